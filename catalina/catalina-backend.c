@@ -0,0 +1,658 @@
+/* catalina-backend.c
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include "catalina-backend.h"
+#include "catalina-storage.h"
+
+/**
+ * SECTION:catalina-backend
+ * @title: CatalinaBackend
+ * @short_description: storage engines
+ *
+ * #CatalinaBackend is the storage engine underneath a #CatalinaStorage.  The storage
+ * is responsible for threading, transforms, formatting and transaction bookkeeping;
+ * the backend only needs to persist buffers by key.
+ *
+ * #CatalinaStorage guarantees that mutating methods (store, remove, transactions,
+ * open, close and compact) are never called concurrently with any other method,
+ * unless the backend accepted catalina_backend_set_concurrent().  The read-only
+ * methods (fetch, parse, next_key and traversal) may be called concurrently from
+ * multiple threads and must be thread safe with respect to each other.
+ *
+ * The default backend is #CatalinaTdbBackend.  #CatalinaMemoryBackend keeps the
+ * records in memory only.
+ *
+ * |[
+ * CatalinaStorage *storage = catalina_storage_new ();
+ * g_object_set (storage, "backend", catalina_memory_backend_new (), NULL);
+ * ]|
+ */
+
+GType
+catalina_backend_get_type (void)
+{
+	static GType backend_type = 0;
+
+	if (G_UNLIKELY (!backend_type)) {
+		const GTypeInfo backend_type_info = {
+			sizeof (CatalinaBackendIface),
+			NULL,
+			NULL,
+			NULL,
+			NULL,
+			NULL,
+			0,
+			0,
+			NULL
+		};
+
+		backend_type = g_type_register_static (G_TYPE_INTERFACE,
+		                                       "CatalinaBackend",
+		                                       &backend_type_info,
+		                                       0);
+		g_type_interface_add_prerequisite (backend_type,
+		                                   G_TYPE_OBJECT);
+	}
+
+	return backend_type;
+}
+
+/**
+ * catalina_backend_open:
+ * @backend: A #CatalinaBackend
+ * @path: the path of the data-store
+ * @error: A location for a #GError or %NULL
+ *
+ * Opens the data-store found at @path, creating it if needed.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_open (CatalinaBackend  *backend,
+                       const gchar      *path,
+                       GError          **error)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->open (backend, path, error);
+}
+
+/**
+ * catalina_backend_close:
+ * @backend: A #CatalinaBackend
+ * @error: A location for a #GError or %NULL
+ *
+ * Closes the data-store.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_close (CatalinaBackend  *backend,
+                        GError          **error)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->close (backend, error);
+}
+
+/**
+ * catalina_backend_fetch:
+ * @backend: A #CatalinaBackend
+ * @key: the key to fetch
+ * @key_length: the length of @key in bytes
+ * @data: A location for a newly allocated copy of the buffer
+ * @data_length: A location for the length of @data
+ *
+ * Retrieves a copy of the buffer stored for @key.  Free @data with g_free().
+ *
+ * Return value: %TRUE if @key was found
+ */
+gboolean
+catalina_backend_fetch (CatalinaBackend  *backend,
+                        const gchar      *key,
+                        gsize             key_length,
+                        gchar           **data,
+                        gsize            *data_length)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->fetch
+		(backend, key, key_length, data, data_length);
+}
+
+/**
+ * catalina_backend_parse:
+ * @backend: A #CatalinaBackend
+ * @key: the key to look up
+ * @key_length: the length of @key in bytes
+ * @func: A #CatalinaBackendFunc to run with the stored buffer
+ * @user_data: data for @func
+ *
+ * Runs @func with the buffer stored for @key without copying it, if the backend can
+ * do so.  The return value of @func is ignored.
+ *
+ * Return value: %TRUE if @key was found
+ */
+gboolean
+catalina_backend_parse (CatalinaBackend      *backend,
+                        const gchar          *key,
+                        gsize                 key_length,
+                        CatalinaBackendFunc   func,
+                        gpointer              user_data)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+	gchar                *data  = NULL;
+	gsize                 data_length = 0;
+
+	if (iface->parse)
+		return iface->parse (backend, key, key_length, func, user_data);
+
+	if (!iface->fetch (backend, key, key_length, &data, &data_length))
+		return FALSE;
+
+	func (key, key_length, data, data_length, user_data);
+	g_free (data);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_backend_size_parser (const gchar *key,
+                              gsize        key_length,
+                              const gchar *data,
+                              gsize        data_length,
+                              gpointer     user_data)
+{
+	*((gsize*)user_data) = data_length;
+	return TRUE;
+}
+
+/**
+ * catalina_backend_size:
+ * @backend: A #CatalinaBackend
+ * @key: the key to look up
+ * @key_length: the length of @key in bytes
+ * @data_length: A location for the length of the stored buffer
+ *
+ * Looks up the length of the buffer stored for @key.  Backends which know it without
+ * reading the record implement this; the others are asked with
+ * catalina_backend_parse().
+ *
+ * Return value: %TRUE if @key was found
+ */
+gboolean
+catalina_backend_size (CatalinaBackend *backend,
+                       const gchar     *key,
+                       gsize            key_length,
+                       gsize           *data_length)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->size)
+		return iface->size (backend, key, key_length, data_length);
+
+	return catalina_backend_parse (backend, key, key_length,
+	                               catalina_backend_size_parser, data_length);
+}
+
+/**
+ * catalina_backend_store:
+ * @backend: A #CatalinaBackend
+ * @key: the key to store
+ * @key_length: the length of @key in bytes
+ * @data: the buffer to store
+ * @data_length: the length of @data in bytes
+ * @error: A location for a #GError or %NULL
+ *
+ * Stores @data for @key, replacing any existing buffer.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_store (CatalinaBackend  *backend,
+                        const gchar      *key,
+                        gsize             key_length,
+                        const gchar      *data,
+                        gsize             data_length,
+                        GError          **error)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->store
+		(backend, key, key_length, data, data_length, error);
+}
+
+/**
+ * catalina_backend_remove:
+ * @backend: A #CatalinaBackend
+ * @key: the key to remove
+ * @key_length: the length of @key in bytes
+ * @error: A location for a #GError or %NULL
+ *
+ * Removes @key from the data-store.  Removing the record currently being visited
+ * during traversal is allowed.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_remove (CatalinaBackend  *backend,
+                         const gchar      *key,
+                         gsize             key_length,
+                         GError          **error)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->remove
+		(backend, key, key_length, error);
+}
+
+/**
+ * catalina_backend_next_key:
+ * @backend: A #CatalinaBackend
+ * @key: the previous key, or %NULL for the first key
+ * @key_length: the length of @key in bytes
+ * @next_key: A location for a newly allocated copy of the next key
+ * @next_key_length: A location for the length of @next_key
+ *
+ * Retrieves the key following @key in the backend's iteration order.  Free
+ * @next_key with g_free().
+ *
+ * Return value: %TRUE if there was another key
+ */
+gboolean
+catalina_backend_next_key (CatalinaBackend  *backend,
+                           const gchar      *key,
+                           gsize             key_length,
+                           gchar           **next_key,
+                           gsize            *next_key_length)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->next_key
+		(backend, key, key_length, next_key, next_key_length);
+}
+
+/**
+ * catalina_backend_traverse:
+ * @backend: A #CatalinaBackend
+ * @func: A #CatalinaBackendFunc
+ * @user_data: data for @func
+ * @error: A location for a #GError or %NULL
+ *
+ * Runs @func for every record in the data-store until it returns %FALSE.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_traverse (CatalinaBackend      *backend,
+                           CatalinaBackendFunc   func,
+                           gpointer              user_data,
+                           GError              **error)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->traverse
+		(backend, func, user_data, error);
+}
+
+/**
+ * catalina_backend_get_n_partitions:
+ * @backend: A #CatalinaBackend
+ *
+ * Retrieves the number of disjoint partitions the records are spread over.  Each
+ * partition can be traversed concurrently with catalina_backend_traverse_partition().
+ *
+ * Return value: the number of partitions, at least 1
+ */
+guint
+catalina_backend_get_n_partitions (CatalinaBackend *backend)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->get_n_partitions && iface->traverse_partition)
+		return MAX (1, iface->get_n_partitions (backend));
+
+	return 1;
+}
+
+/**
+ * catalina_backend_traverse_partition:
+ * @backend: A #CatalinaBackend
+ * @partition: the partition to traverse
+ * @func: A #CatalinaBackendFunc
+ * @user_data: data for @func
+ * @error: A location for a #GError or %NULL
+ *
+ * Runs @func for every record within @partition until it returns %FALSE.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_traverse_partition (CatalinaBackend      *backend,
+                                     guint                 partition,
+                                     CatalinaBackendFunc   func,
+                                     gpointer              user_data,
+                                     GError              **error)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->get_n_partitions && iface->traverse_partition)
+		return iface->traverse_partition (backend, partition, func, user_data, error);
+
+	g_return_val_if_fail (partition == 0, FALSE);
+
+	return iface->traverse (backend, func, user_data, error);
+}
+
+/**
+ * catalina_backend_transaction_begin:
+ * @backend: A #CatalinaBackend
+ * @error: A location for a #GError or %NULL
+ *
+ * Begins a transaction.  Only a single transaction is active at a time.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_transaction_begin (CatalinaBackend  *backend,
+                                    GError          **error)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->transaction_begin (backend, error);
+}
+
+/**
+ * catalina_backend_transaction_commit:
+ * @backend: A #CatalinaBackend
+ * @error: A location for a #GError or %NULL
+ *
+ * Commits the active transaction.  Upon failure, the data-store is left as it was
+ * before the transaction began.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_transaction_commit (CatalinaBackend  *backend,
+                                     GError          **error)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->transaction_commit (backend, error);
+}
+
+/**
+ * catalina_backend_transaction_cancel:
+ * @backend: A #CatalinaBackend
+ * @error: A location for a #GError or %NULL
+ *
+ * Discards the changes made within the active transaction.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_transaction_cancel (CatalinaBackend  *backend,
+                                     GError          **error)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->transaction_cancel (backend, error);
+}
+
+/**
+ * catalina_backend_compact:
+ * @backend: A #CatalinaBackend
+ * @error: A location for a #GError or %NULL
+ *
+ * Returns space used by removed records to the system, if the backend supports it.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_compact (CatalinaBackend  *backend,
+                          GError          **error)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->compact)
+		return iface->compact (backend, error);
+
+	return TRUE;
+}
+
+/**
+ * catalina_backend_is_ordered:
+ * @backend: A #CatalinaBackend
+ *
+ * Checks if the backend keeps its keys ordered and therefore supports
+ * catalina_backend_scan().
+ *
+ * Return value: %TRUE if the backend supports ordered scans
+ */
+gboolean
+catalina_backend_is_ordered (CatalinaBackend *backend)
+{
+	return CATALINA_BACKEND_GET_INTERFACE (backend)->scan != NULL;
+}
+
+/**
+ * catalina_backend_scan:
+ * @backend: A #CatalinaBackend
+ * @start: the first key of the range, or %NULL to start at the first key
+ * @start_length: the length of @start in bytes
+ * @end: the key ending the range, or %NULL to scan to the last key
+ * @end_length: the length of @end in bytes
+ * @func: A #CatalinaBackendFunc
+ * @user_data: data for @func
+ * @error: A location for a #GError or %NULL
+ *
+ * Runs @func in ascending key order for every record whose key is at least @start
+ * and less than @end, until @func returns %FALSE.  Keys are compared bytewise, with a
+ * key ordered before any longer key it is a prefix of.
+ *
+ * Fails with %CATALINA_STORAGE_ERROR_NOT_SUPPORTED if the backend is not ordered.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_scan (CatalinaBackend      *backend,
+                       const gchar          *start,
+                       gsize                 start_length,
+                       const gchar          *end,
+                       gsize                 end_length,
+                       CatalinaBackendFunc   func,
+                       gpointer              user_data,
+                       GError              **error)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (!iface->scan) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NOT_SUPPORTED,
+		             "%s does not support ordered scans",
+		             G_OBJECT_TYPE_NAME (backend));
+		return FALSE;
+	}
+
+	return iface->scan (backend, start, start_length, end, end_length,
+	                    func, user_data, error);
+}
+
+/**
+ * catalina_backend_get_space:
+ * @backend: A #CatalinaBackend
+ * @size: A location for the size of the data-store in bytes
+ * @free_size: A location for the bytes not used by live records
+ *
+ * Retrieves how much of the data-store is taken by free space, such as removed or
+ * replaced records, which a compaction would return to the file-system.  It is called
+ * periodically as records are written, so it should be cheap once measured.
+ * It is only called by the exclusive worker.
+ *
+ * Return value: %TRUE if the backend measures its free space
+ */
+gboolean
+catalina_backend_get_space (CatalinaBackend *backend,
+                            guint64         *size,
+                            guint64         *free_size)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->get_space)
+		return iface->get_space (backend, size, free_size);
+
+	return FALSE;
+}
+
+/**
+ * catalina_backend_compact_step:
+ * @backend: A #CatalinaBackend
+ * @done: A location to store if the compaction has finished
+ * @error: A location for a #GError or %NULL
+ *
+ * Performs a bounded slice of a compaction, starting one if none is running, so that
+ * writers are not held off for the length of a whole compaction.  Call it again until
+ * @done is set.  Backends which cannot compact in slices run catalina_backend_compact()
+ * instead.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_compact_step (CatalinaBackend  *backend,
+                               gboolean         *done,
+                               GError          **error)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->compact_step)
+		return iface->compact_step (backend, done, error);
+
+	*done = TRUE;
+
+	return catalina_backend_compact (backend, error);
+}
+
+/**
+ * catalina_backend_set_sync:
+ * @backend: A #CatalinaBackend
+ * @sync: if commits should reach the disk before they return
+ *
+ * Sets whether catalina_backend_transaction_commit() syncs the data-store to disk
+ * before returning.  Commits which do not sync are made durable by a later call to
+ * catalina_backend_sync().
+ *
+ * Return value: %TRUE if supported; %FALSE if every commit is synced regardless
+ */
+gboolean
+catalina_backend_set_sync (CatalinaBackend *backend,
+                           gboolean         sync)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->set_sync)
+		return iface->set_sync (backend, sync);
+
+	return FALSE;
+}
+
+/**
+ * catalina_backend_sync:
+ * @backend: A #CatalinaBackend
+ * @error: A location for a #GError or %NULL
+ *
+ * Syncs everything committed so far to disk.  Unlike the other methods this may be
+ * called from any thread, including while the exclusive worker is writing, so that
+ * the sync does not hold up writers.  Backends which sync every commit need not
+ * implement it.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_backend_sync (CatalinaBackend  *backend,
+                       GError          **error)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->sync)
+		return iface->sync (backend, error);
+
+	return TRUE;
+}
+
+/**
+ * catalina_backend_is_shared:
+ * @backend: A #CatalinaBackend
+ *
+ * Checks if other processes may write to the data-store while it is open.  The
+ * storage then starts a backend transaction around every write, which excludes the
+ * writers of the other processes, and reloads any state it caches about the
+ * data-store within it.
+ *
+ * Return value: %TRUE if the data-store is shared with other processes
+ */
+gboolean
+catalina_backend_is_shared (CatalinaBackend *backend)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->is_shared)
+		return iface->is_shared (backend);
+
+	return FALSE;
+}
+
+/**
+ * catalina_backend_set_concurrent:
+ * @backend: A #CatalinaBackend
+ * @concurrent: if writes may run alongside other writes and reads
+ *
+ * Sets whether catalina_backend_store() and catalina_backend_remove() may be called
+ * outside of a transaction from several threads at once, alongside the readers.  The
+ * readers may also run alongside transactions and compaction steps.  The other methods
+ * are still called exclusively.  The backend is left to exclude whatever the calls
+ * share; it may apply them one at a time.  Takes effect when the data-store is opened,
+ * or right away when called on an open data-store with no other call in progress.
+ *
+ * Return value: %TRUE if supported; %FALSE if writes must be exclusive
+ */
+gboolean
+catalina_backend_set_concurrent (CatalinaBackend *backend,
+                                 gboolean         concurrent)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->set_concurrent)
+		return iface->set_concurrent (backend, concurrent);
+
+	return FALSE;
+}
+
+/**
+ * catalina_backend_hold_partitions:
+ * @backend: A #CatalinaBackend
+ *
+ * Keeps the partitions from being reorganized until the matching call to
+ * catalina_backend_release_partitions(), so that a traversal spread over several
+ * calls to catalina_backend_traverse_partition() visits every record once even with
+ * writes running alongside.  Holds may be nested and taken from any thread.
+ */
+void
+catalina_backend_hold_partitions (CatalinaBackend *backend)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->hold_partitions)
+		iface->hold_partitions (backend);
+}
+
+/**
+ * catalina_backend_release_partitions:
+ * @backend: A #CatalinaBackend
+ *
+ * Releases a hold taken with catalina_backend_hold_partitions().
+ */
+void
+catalina_backend_release_partitions (CatalinaBackend *backend)
+{
+	CatalinaBackendIface *iface = CATALINA_BACKEND_GET_INTERFACE (backend);
+
+	if (iface->release_partitions)
+		iface->release_partitions (backend);
+}
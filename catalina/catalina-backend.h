@@ -0,0 +1,217 @@
+/* catalina-backend.h
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __CATALINA_BACKEND_H__
+#define __CATALINA_BACKEND_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define CATALINA_TYPE_BACKEND                (catalina_backend_get_type())
+#define CATALINA_BACKEND(obj)                (G_TYPE_CHECK_INSTANCE_CAST ((obj),     CATALINA_TYPE_BACKEND, CatalinaBackend))
+#define CATALINA_IS_BACKEND(obj)             (G_TYPE_CHECK_INSTANCE_TYPE ((obj),     CATALINA_TYPE_BACKEND))
+#define CATALINA_BACKEND_GET_INTERFACE(obj)  (G_TYPE_INSTANCE_GET_INTERFACE ((obj),  CATALINA_TYPE_BACKEND, CatalinaBackendIface))
+
+typedef struct _CatalinaBackend        CatalinaBackend;
+typedef struct _CatalinaBackendIface   CatalinaBackendIface;
+
+/**
+ * CatalinaBackendFunc:
+ * @key: the key of the record
+ * @key_length: the length of @key in bytes
+ * @data: the record's buffer, owned by the backend
+ * @data_length: the length of @data in bytes
+ * @user_data: user data provided with the function
+ *
+ * Callback used to visit records within a #CatalinaBackend.  @key and @data are only
+ * valid for the duration of the call.
+ *
+ * Return value: %TRUE to continue traversal, %FALSE to stop
+ */
+typedef gboolean (*CatalinaBackendFunc) (const gchar *key,
+                                         gsize        key_length,
+                                         const gchar *data,
+                                         gsize        data_length,
+                                         gpointer     user_data);
+
+struct _CatalinaBackendIface
+{
+	GTypeInterface parent;
+
+	gboolean (*open)               (CatalinaBackend      *backend,
+	                                const gchar          *path,
+	                                GError              **error);
+	gboolean (*close)              (CatalinaBackend      *backend,
+	                                GError              **error);
+	gboolean (*fetch)              (CatalinaBackend      *backend,
+	                                const gchar          *key,
+	                                gsize                 key_length,
+	                                gchar               **data,
+	                                gsize                *data_length);
+	gboolean (*parse)              (CatalinaBackend      *backend,
+	                                const gchar          *key,
+	                                gsize                 key_length,
+	                                CatalinaBackendFunc   func,
+	                                gpointer              user_data);
+	gboolean (*store)              (CatalinaBackend      *backend,
+	                                const gchar          *key,
+	                                gsize                 key_length,
+	                                const gchar          *data,
+	                                gsize                 data_length,
+	                                GError              **error);
+	gboolean (*remove)             (CatalinaBackend      *backend,
+	                                const gchar          *key,
+	                                gsize                 key_length,
+	                                GError              **error);
+	gboolean (*next_key)           (CatalinaBackend      *backend,
+	                                const gchar          *key,
+	                                gsize                 key_length,
+	                                gchar               **next_key,
+	                                gsize                *next_key_length);
+	gboolean (*traverse)           (CatalinaBackend      *backend,
+	                                CatalinaBackendFunc   func,
+	                                gpointer              user_data,
+	                                GError              **error);
+	guint    (*get_n_partitions)   (CatalinaBackend      *backend);
+	gboolean (*traverse_partition) (CatalinaBackend      *backend,
+	                                guint                 partition,
+	                                CatalinaBackendFunc   func,
+	                                gpointer              user_data,
+	                                GError              **error);
+	gboolean (*transaction_begin)  (CatalinaBackend      *backend,
+	                                GError              **error);
+	gboolean (*transaction_commit) (CatalinaBackend      *backend,
+	                                GError              **error);
+	gboolean (*transaction_cancel) (CatalinaBackend      *backend,
+	                                GError              **error);
+	gboolean (*compact)            (CatalinaBackend      *backend,
+	                                GError              **error);
+	gboolean (*scan)               (CatalinaBackend      *backend,
+	                                const gchar          *start,
+	                                gsize                 start_length,
+	                                const gchar          *end,
+	                                gsize                 end_length,
+	                                CatalinaBackendFunc   func,
+	                                gpointer              user_data,
+	                                GError              **error);
+	gboolean (*get_space)          (CatalinaBackend      *backend,
+	                                guint64              *size,
+	                                guint64              *free_size);
+	gboolean (*compact_step)       (CatalinaBackend      *backend,
+	                                gboolean             *done,
+	                                GError              **error);
+	gboolean (*set_sync)           (CatalinaBackend      *backend,
+	                                gboolean              sync);
+	gboolean (*sync)               (CatalinaBackend      *backend,
+	                                GError              **error);
+	gboolean (*is_shared)          (CatalinaBackend      *backend);
+	gboolean (*set_concurrent)     (CatalinaBackend      *backend,
+	                                gboolean              concurrent);
+	void     (*hold_partitions)    (CatalinaBackend      *backend);
+	void     (*release_partitions) (CatalinaBackend      *backend);
+	gboolean (*size)               (CatalinaBackend      *backend,
+	                                const gchar          *key,
+	                                gsize                 key_length,
+	                                gsize                *data_length);
+};
+
+GType    catalina_backend_get_type           (void);
+
+gboolean catalina_backend_open               (CatalinaBackend      *backend,
+                                              const gchar          *path,
+                                              GError              **error);
+gboolean catalina_backend_close              (CatalinaBackend      *backend,
+                                              GError              **error);
+gboolean catalina_backend_fetch              (CatalinaBackend      *backend,
+                                              const gchar          *key,
+                                              gsize                 key_length,
+                                              gchar               **data,
+                                              gsize                *data_length);
+gboolean catalina_backend_parse              (CatalinaBackend      *backend,
+                                              const gchar          *key,
+                                              gsize                 key_length,
+                                              CatalinaBackendFunc   func,
+                                              gpointer              user_data);
+gboolean catalina_backend_store              (CatalinaBackend      *backend,
+                                              const gchar          *key,
+                                              gsize                 key_length,
+                                              const gchar          *data,
+                                              gsize                 data_length,
+                                              GError              **error);
+gboolean catalina_backend_remove             (CatalinaBackend      *backend,
+                                              const gchar          *key,
+                                              gsize                 key_length,
+                                              GError              **error);
+gboolean catalina_backend_next_key           (CatalinaBackend      *backend,
+                                              const gchar          *key,
+                                              gsize                 key_length,
+                                              gchar               **next_key,
+                                              gsize                *next_key_length);
+gboolean catalina_backend_traverse           (CatalinaBackend      *backend,
+                                              CatalinaBackendFunc   func,
+                                              gpointer              user_data,
+                                              GError              **error);
+guint    catalina_backend_get_n_partitions   (CatalinaBackend      *backend);
+gboolean catalina_backend_traverse_partition (CatalinaBackend      *backend,
+                                              guint                 partition,
+                                              CatalinaBackendFunc   func,
+                                              gpointer              user_data,
+                                              GError              **error);
+gboolean catalina_backend_transaction_begin  (CatalinaBackend      *backend,
+                                              GError              **error);
+gboolean catalina_backend_transaction_commit (CatalinaBackend      *backend,
+                                              GError              **error);
+gboolean catalina_backend_transaction_cancel (CatalinaBackend      *backend,
+                                              GError              **error);
+gboolean catalina_backend_compact            (CatalinaBackend      *backend,
+                                              GError              **error);
+gboolean catalina_backend_is_ordered         (CatalinaBackend      *backend);
+gboolean catalina_backend_scan               (CatalinaBackend      *backend,
+                                              const gchar          *start,
+                                              gsize                 start_length,
+                                              const gchar          *end,
+                                              gsize                 end_length,
+                                              CatalinaBackendFunc   func,
+                                              gpointer              user_data,
+                                              GError              **error);
+gboolean catalina_backend_get_space          (CatalinaBackend      *backend,
+                                              guint64              *size,
+                                              guint64              *free_size);
+gboolean catalina_backend_compact_step       (CatalinaBackend      *backend,
+                                              gboolean             *done,
+                                              GError              **error);
+gboolean catalina_backend_set_sync           (CatalinaBackend      *backend,
+                                              gboolean              sync);
+gboolean catalina_backend_sync               (CatalinaBackend      *backend,
+                                              GError              **error);
+gboolean catalina_backend_is_shared          (CatalinaBackend      *backend);
+gboolean catalina_backend_set_concurrent     (CatalinaBackend      *backend,
+                                              gboolean              concurrent);
+void     catalina_backend_hold_partitions    (CatalinaBackend      *backend);
+void     catalina_backend_release_partitions (CatalinaBackend      *backend);
+gboolean catalina_backend_size               (CatalinaBackend      *backend,
+                                              const gchar          *key,
+                                              gsize                 key_length,
+                                              gsize                *data_length);
+
+G_END_DECLS
+
+#endif /* __CATALINA_BACKEND_H__ */
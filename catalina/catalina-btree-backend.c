@@ -0,0 +1,1329 @@
+/* catalina-btree-backend.c
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "catalina-btree-backend.h"
+#include "catalina-storage.h"
+
+/**
+ * SECTION:catalina-btree-backend
+ * @title: CatalinaBtreeBackend
+ * @short_description: ordered storage engine using a B+tree
+ *
+ * #CatalinaBtreeBackend keeps its records in a B+tree of fixed-size pages within a
+ * single memory-mapped file.  Records are kept sorted by key, which makes it an
+ * ordered backend: catalina_storage_scan_range_async() and
+ * catalina_storage_scan_prefix_async() walk the linked leaf pages instead of the
+ * whole data-store, and cursors visit keys in ascending order.
+ *
+ * Keys are limited to 512 bytes.  Values too large to share a leaf page with other
+ * records are stored in a chain of overflow pages.  Pages emptied by removals are not
+ * merged with their siblings.
+ *
+ * Modified pages are copied and only written back to the mapping once the operation
+ * or transaction completes.  Transactions, and operations which modify more than one
+ * page, first save the original contents of the pages they replace to a journal next
+ * to the data-store, which is used to roll back a commit interrupted by a crash the
+ * next time the data-store is opened.
+ *
+ * |[
+ * CatalinaStorage *storage = catalina_storage_new ();
+ * g_object_set (storage, "backend", catalina_btree_backend_new (), NULL);
+ * catalina_storage_open (storage, ".", "people.db", NULL);
+ * ]|
+ */
+
+#define BTREE_MAGIC            "CATBTRE1"
+#define BTREE_PAGE_SIZE        4096
+#define BTREE_GROWTH           256            /* pages added when the file grows */
+#define BTREE_MAX_KEY          512
+#define BTREE_MAX_DEPTH        32
+#define BTREE_MAX_CELLS        (BTREE_PAGE_SIZE / 8 + 1)
+#define BTREE_JOURNAL_SUFFIX   "-journal"
+#define BTREE_JOURNAL_MAGIC    0x4341544AU
+#define BTREE_JOURNAL_HEADER   8
+
+/* header page */
+#define HEADER_ROOT            12
+#define HEADER_N_PAGES         16
+#define HEADER_FREE            20
+
+/* node pages: type, pad, n_cells, cell_start, frag, next, then the cell slots.
+ * next is the right sibling of a leaf and the leftmost child of a branch. */
+#define NODE_LEAF              1
+#define NODE_BRANCH            2
+#define NODE_HEADER            12
+#define NODE_TYPE(p)           ((p) [0])
+#define NODE_N_CELLS(p)        get16 ((p) + 2)
+#define NODE_CELL_START(p)     get16 ((p) + 4)
+#define NODE_FRAG(p)           get16 ((p) + 6)
+#define NODE_NEXT(p)           get32 ((p) + 8)
+#define NODE_CELL(p,i)         ((p) + get16 ((p) + NODE_HEADER + 2 * (i)))
+
+/* leaf cells: key_length, value_length, overflow page, key, inline value.
+ * branch cells: key_length, child, key. */
+#define LEAF_CELL_HEADER       10
+#define BRANCH_CELL_HEADER     6
+#define LEAF_CELL_MAX          ((BTREE_PAGE_SIZE - NODE_HEADER) / 4 - 2)
+
+/* overflow pages: next, length, data */
+#define OVERFLOW_HEADER        8
+#define OVERFLOW_CAPACITY      (BTREE_PAGE_SIZE - OVERFLOW_HEADER)
+
+#define PAGE_OFFSET(n)         ((gsize)(n) * BTREE_PAGE_SIZE)
+
+static void catalina_btree_backend_base_init (CatalinaBackendIface *iface);
+
+G_DEFINE_TYPE_EXTENDED (CatalinaBtreeBackend,
+                        catalina_btree_backend,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (CATALINA_TYPE_BACKEND,
+                                               catalina_btree_backend_base_init))
+
+typedef struct
+{
+	guint32 page;
+	guint   position;   /* 0 is the leftmost child, n is the child of cell n - 1 */
+} PathItem;
+
+struct _CatalinaBtreeBackendPrivate
+{
+	gchar      *path;
+	gint        fd;
+	guchar     *map;
+	gsize       map_size;
+
+	GHashTable *dirty;        /* page number -> modified copy of the page */
+	gboolean    in_txn;
+	guint       generation;   /* bumped on every modification */
+};
+
+/***************************************************************************
+ *                               Helpers                                   *
+ ***************************************************************************/
+
+static inline guint16
+get16 (const guchar *p)
+{
+	return (p [0] << 8) | p [1];
+}
+
+static inline void
+put16 (guchar  *p,
+       guint16  v)
+{
+	p [0] = v >> 8;
+	p [1] = v & 0xFF;
+}
+
+static inline guint32
+get32 (const guchar *p)
+{
+	return ((guint32)p [0] << 24) | ((guint32)p [1] << 16) | ((guint32)p [2] << 8) | p [3];
+}
+
+static inline void
+put32 (guchar  *p,
+       guint32  v)
+{
+	p [0] = v >> 24;
+	p [1] = (v >> 16) & 0xFF;
+	p [2] = (v >> 8) & 0xFF;
+	p [3] = v & 0xFF;
+}
+
+static gint
+key_compare (const gchar *a,
+             gsize        a_length,
+             const gchar *b,
+             gsize        b_length)
+{
+	gint cmp;
+
+	if ((cmp = memcmp (a, b, MIN (a_length, b_length))) != 0)
+		return cmp;
+
+	return (a_length > b_length) - (a_length < b_length);
+}
+
+static gboolean
+write_all (gint         fd,
+           const gchar *buffer,
+           gsize        length,
+           guint64      offset)
+{
+	gssize ret;
+
+	while (length > 0) {
+		if ((ret = pwrite (fd, buffer, length, offset)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		buffer += ret;
+		length -= ret;
+		offset += ret;
+	}
+
+	return TRUE;
+}
+
+static void
+set_errno_error (GError      **error,
+                 const gchar  *what,
+                 const gchar  *path)
+{
+	g_set_error (error, CATALINA_STORAGE_ERROR,
+	             CATALINA_STORAGE_ERROR_DB,
+	             "Could not %s \"%s\": %s",
+	             what, path, g_strerror (errno));
+}
+
+/***************************************************************************
+ *                                 Pages                                   *
+ ***************************************************************************/
+
+static const guchar*
+page_read (CatalinaBtreeBackendPrivate *priv,
+           guint32                      page)
+{
+	guchar *copy;
+
+	if ((copy = g_hash_table_lookup (priv->dirty, GUINT_TO_POINTER (page))) != NULL)
+		return copy;
+
+	g_assert (PAGE_OFFSET (page + 1) <= priv->map_size);
+
+	return priv->map + PAGE_OFFSET (page);
+}
+
+/* Returns a private copy of @page that is written back on the next flush. */
+static guchar*
+page_write (CatalinaBtreeBackendPrivate *priv,
+            guint32                      page)
+{
+	guchar *copy;
+
+	if ((copy = g_hash_table_lookup (priv->dirty, GUINT_TO_POINTER (page))) != NULL)
+		return copy;
+
+	copy = g_malloc (BTREE_PAGE_SIZE);
+	if (PAGE_OFFSET (page + 1) <= priv->map_size)
+		memcpy (copy, priv->map + PAGE_OFFSET (page), BTREE_PAGE_SIZE);
+	else
+		memset (copy, 0, BTREE_PAGE_SIZE);
+
+	g_hash_table_insert (priv->dirty, GUINT_TO_POINTER (page), copy);
+
+	return copy;
+}
+
+static guint32
+page_alloc (CatalinaBtreeBackendPrivate *priv)
+{
+	const guchar *header = page_read (priv, 0);
+	guint32       page;
+
+	if ((page = get32 (header + HEADER_FREE)) != 0) {
+		put32 (page_write (priv, 0) + HEADER_FREE, get32 (page_read (priv, page)));
+		return page;
+	}
+
+	page = get32 (header + HEADER_N_PAGES);
+	put32 (page_write (priv, 0) + HEADER_N_PAGES, page + 1);
+
+	return page;
+}
+
+static void
+page_free (CatalinaBtreeBackendPrivate *priv,
+           guint32                      page)
+{
+	guchar *buffer = page_write (priv, page);
+
+	memset (buffer, 0, BTREE_PAGE_SIZE);
+	put32 (buffer, get32 (page_read (priv, 0) + HEADER_FREE));
+	put32 (page_write (priv, 0) + HEADER_FREE, page);
+}
+
+static gchar*
+journal_path (CatalinaBtreeBackendPrivate *priv)
+{
+	return g_strconcat (priv->path, BTREE_JOURNAL_SUFFIX, NULL);
+}
+
+/* Saves the committed contents of every page about to be replaced.  The header is
+ * written last so that a journal interrupted while being written is ignored. */
+static gboolean
+journal_write (CatalinaBtreeBackendPrivate *priv,
+               GError                     **error)
+{
+	GHashTableIter  iter;
+	gpointer        key;
+	gchar          *path;
+	guchar          record [4 + BTREE_PAGE_SIZE],
+	                header [BTREE_JOURNAL_HEADER];
+	guint32         page;
+	guint64         offset = BTREE_JOURNAL_HEADER;
+	gint            fd;
+
+	path = journal_path (priv);
+
+	if ((fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		set_errno_error (error, "create journal", path);
+		g_free (path);
+		return FALSE;
+	}
+
+	g_hash_table_iter_init (&iter, priv->dirty);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		page = GPOINTER_TO_UINT (key);
+		if (PAGE_OFFSET (page + 1) > priv->map_size)
+			continue;
+
+		put32 (record, page);
+		memcpy (record + 4, priv->map + PAGE_OFFSET (page), BTREE_PAGE_SIZE);
+		if (!write_all (fd, (gchar*)record, sizeof (record), offset))
+			goto failure;
+		offset += sizeof (record);
+	}
+
+	put32 (header, BTREE_JOURNAL_MAGIC);
+	put32 (header + 4, priv->map_size / BTREE_PAGE_SIZE);
+
+	if (fsync (fd) != 0 ||
+	    !write_all (fd, (gchar*)header, sizeof (header), 0) ||
+	    fsync (fd) != 0)
+		goto failure;
+
+	close (fd);
+	g_free (path);
+
+	return TRUE;
+
+failure:
+	set_errno_error (error, "write journal", path);
+	close (fd);
+	unlink (path);
+	g_free (path);
+
+	return FALSE;
+}
+
+/* Restores the pages saved by an interrupted commit. */
+static gboolean
+journal_recover (CatalinaBtreeBackendPrivate *priv,
+                 GError                     **error)
+{
+	gchar        *path,
+	             *contents = NULL;
+	const guchar *record;
+	gsize         length = 0,
+	              offset;
+	gboolean      success = TRUE;
+
+	path = journal_path (priv);
+
+	if (!g_file_get_contents (path, &contents, &length, NULL)) {
+		g_free (path);
+		return TRUE;
+	}
+
+	if (length >= BTREE_JOURNAL_HEADER &&
+	    get32 ((guchar*)contents) == BTREE_JOURNAL_MAGIC)
+	{
+		g_warning ("Rolling back an incomplete transaction of \"%s\"", priv->path);
+
+		for (offset = BTREE_JOURNAL_HEADER;
+		     offset + 4 + BTREE_PAGE_SIZE <= length;
+		     offset += 4 + BTREE_PAGE_SIZE)
+		{
+			record = (guchar*)contents + offset;
+			if (!write_all (priv->fd, (gchar*)record + 4, BTREE_PAGE_SIZE,
+			                PAGE_OFFSET (get32 (record))))
+			{
+				success = FALSE;
+				break;
+			}
+		}
+
+		if (success) {
+			record = (guchar*)contents;
+			success = ftruncate (priv->fd, PAGE_OFFSET (get32 (record + 4))) == 0 &&
+			          fsync (priv->fd) == 0;
+		}
+	}
+
+	if (success)
+		unlink (path);
+	else
+		set_errno_error (error, "roll back", priv->path);
+
+	g_free (contents);
+	g_free (path);
+
+	return success;
+}
+
+static gboolean
+map_resize (CatalinaBtreeBackendPrivate *priv,
+            gsize                        size,
+            GError                     **error)
+{
+	gpointer map;
+
+	if (ftruncate (priv->fd, size) != 0) {
+		set_errno_error (error, "grow", priv->path);
+		return FALSE;
+	}
+
+	map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, priv->fd, 0);
+	if (map == MAP_FAILED) {
+		set_errno_error (error, "map", priv->path);
+		return FALSE;
+	}
+
+	if (priv->map)
+		munmap (priv->map, priv->map_size);
+
+	priv->map = map;
+	priv->map_size = size;
+
+	return TRUE;
+}
+
+/* Writes the modified pages back to the mapping.  A durable flush journals the
+ * pages it replaces and syncs the file before returning. */
+static gboolean
+btree_flush (CatalinaBtreeBackendPrivate *priv,
+             gboolean                     durable,
+             GError                     **error)
+{
+	GHashTableIter  iter;
+	gpointer        key,
+	                value;
+	gchar          *path;
+	gsize           size;
+
+	if (g_hash_table_size (priv->dirty) == 0)
+		return TRUE;
+
+	if (durable && !journal_write (priv, error))
+		return FALSE;
+
+	size = PAGE_OFFSET (get32 (page_read (priv, 0) + HEADER_N_PAGES));
+	if (size > priv->map_size) {
+		size = PAGE_OFFSET ((size / BTREE_PAGE_SIZE + BTREE_GROWTH - 1)
+		                    / BTREE_GROWTH * BTREE_GROWTH);
+		if (!map_resize (priv, size, error))
+			return FALSE;
+	}
+
+	g_hash_table_iter_init (&iter, priv->dirty);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		memcpy (priv->map + PAGE_OFFSET (GPOINTER_TO_UINT (key)), value, BTREE_PAGE_SIZE);
+	g_hash_table_remove_all (priv->dirty);
+
+	if (durable) {
+		if (msync (priv->map, priv->map_size, MS_SYNC) != 0) {
+			set_errno_error (error, "sync", priv->path);
+			return FALSE;
+		}
+		path = journal_path (priv);
+		unlink (path);
+		g_free (path);
+	}
+
+	return TRUE;
+}
+
+/***************************************************************************
+ *                                 Nodes                                   *
+ ***************************************************************************/
+
+static void
+node_init (guchar  *node,
+           guint8   type,
+           guint32  next)
+{
+	memset (node, 0, NODE_HEADER);
+	node [0] = type;
+	put16 (node + 4, BTREE_PAGE_SIZE);
+	put32 (node + 8, next);
+}
+
+static void
+cell_key (const guchar  *node,
+          const guchar  *cell,
+          const gchar  **key,
+          gsize         *key_length)
+{
+	*key_length = get16 (cell);
+	*key = (const gchar*)cell + (NODE_TYPE (node) == NODE_LEAF ? LEAF_CELL_HEADER
+	                                                            : BRANCH_CELL_HEADER);
+}
+
+static guint
+cell_size (const guchar *node,
+           const guchar *cell)
+{
+	if (NODE_TYPE (node) == NODE_BRANCH)
+		return BRANCH_CELL_HEADER + get16 (cell);
+
+	return LEAF_CELL_HEADER + get16 (cell) + (get32 (cell + 6) ? 0 : get32 (cell + 2));
+}
+
+/* Returns the index of the first cell whose key is not less than @key. */
+static guint
+node_search (const guchar *node,
+             const gchar  *key,
+             gsize         key_length,
+             gboolean     *found)
+{
+	const gchar *ckey;
+	gsize        ckey_length;
+	guint        lo = 0,
+	             hi = NODE_N_CELLS (node),
+	             mid;
+	gint         cmp;
+
+	*found = FALSE;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		cell_key (node, NODE_CELL (node, mid), &ckey, &ckey_length);
+		cmp = key_compare (ckey, ckey_length, key, key_length);
+		if (cmp < 0)
+			lo = mid + 1;
+		else {
+			if (cmp == 0)
+				*found = TRUE;
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+static guint32
+node_child (const guchar *node,
+            guint         position)
+{
+	if (position == 0)
+		return NODE_NEXT (node);
+
+	return get32 (NODE_CELL (node, position - 1) + 2);
+}
+
+static void
+node_defrag (guchar *node)
+{
+	guchar  copy [BTREE_PAGE_SIZE];
+	guint   n_cells = NODE_N_CELLS (node),
+	        start = BTREE_PAGE_SIZE,
+	        size,
+	        i;
+
+	memcpy (copy, node, BTREE_PAGE_SIZE);
+
+	for (i = 0; i < n_cells; i++) {
+		size = cell_size (copy, NODE_CELL (copy, i));
+		start -= size;
+		memcpy (node + start, NODE_CELL (copy, i), size);
+		put16 (node + NODE_HEADER + 2 * i, start);
+	}
+
+	put16 (node + 4, start);
+	put16 (node + 6, 0);
+}
+
+/* Checks that a cell of @size bytes fits within @node, defragmenting if needed. */
+static gboolean
+node_fits (guchar *node,
+           guint   size)
+{
+	guint used  = NODE_HEADER + 2 * NODE_N_CELLS (node),
+	      avail = NODE_CELL_START (node) - used;
+
+	if (avail >= size + 2)
+		return TRUE;
+
+	if (avail + NODE_FRAG (node) < size + 2)
+		return FALSE;
+
+	node_defrag (node);
+
+	return TRUE;
+}
+
+static void
+node_insert (guchar       *node,
+             guint         index,
+             const guchar *cell,
+             guint         size)
+{
+	guchar *slots   = node + NODE_HEADER;
+	guint   n_cells = NODE_N_CELLS (node),
+	        start   = NODE_CELL_START (node) - size;
+
+	memcpy (node + start, cell, size);
+	put16 (node + 4, start);
+	memmove (slots + 2 * (index + 1), slots + 2 * index, 2 * (n_cells - index));
+	put16 (slots + 2 * index, start);
+	put16 (node + 2, n_cells + 1);
+}
+
+static void
+node_delete (guchar *node,
+             guint   index)
+{
+	guchar *slots   = node + NODE_HEADER;
+	guint   n_cells = NODE_N_CELLS (node);
+
+	put16 (node + 6, NODE_FRAG (node) + cell_size (node, NODE_CELL (node, index)));
+	memmove (slots + 2 * index, slots + 2 * (index + 1), 2 * (n_cells - index - 1));
+	put16 (node + 2, n_cells - 1);
+}
+
+/***************************************************************************
+ *                               Overflow                                  *
+ ***************************************************************************/
+
+static guint32
+overflow_write (CatalinaBtreeBackendPrivate *priv,
+                const gchar                 *data,
+                gsize                        data_length)
+{
+	guchar  *buffer,
+	        *prev = NULL;
+	guint32  page,
+	         first = 0;
+	gsize    length;
+
+	while (data_length > 0) {
+		length = MIN (data_length, OVERFLOW_CAPACITY);
+		page = page_alloc (priv);
+		buffer = page_write (priv, page);
+		put32 (buffer, 0);
+		put32 (buffer + 4, length);
+		memcpy (buffer + OVERFLOW_HEADER, data, length);
+
+		if (prev)
+			put32 (prev, page);
+		else
+			first = page;
+
+		prev = buffer;
+		data += length;
+		data_length -= length;
+	}
+
+	return first;
+}
+
+static gchar*
+overflow_read (CatalinaBtreeBackendPrivate *priv,
+               guint32                      page,
+               gsize                        data_length)
+{
+	const guchar *buffer;
+	gchar        *data;
+	gsize         offset = 0,
+	              length;
+
+	data = g_malloc (data_length);
+
+	while (page && offset < data_length) {
+		buffer = page_read (priv, page);
+		length = MIN (get32 (buffer + 4), data_length - offset);
+		memcpy (data + offset, buffer + OVERFLOW_HEADER, length);
+		offset += length;
+		page = get32 (buffer);
+	}
+
+	return data;
+}
+
+static void
+overflow_free (CatalinaBtreeBackendPrivate *priv,
+               guint32                      page)
+{
+	guint32 next;
+
+	while (page) {
+		next = get32 (page_read (priv, page));
+		page_free (priv, page);
+		page = next;
+	}
+}
+
+/* Retrieves the value of a leaf cell.  @owned is set if @data must be freed. */
+static void
+leaf_value (CatalinaBtreeBackendPrivate  *priv,
+            const guchar                 *cell,
+            const gchar                 **data,
+            gsize                        *data_length,
+            gboolean                     *owned)
+{
+	guint32 overflow = get32 (cell + 6);
+
+	*data_length = get32 (cell + 2);
+
+	if (overflow) {
+		*data = overflow_read (priv, overflow, *data_length);
+		*owned = TRUE;
+	}
+	else {
+		*data = (const gchar*)cell + LEAF_CELL_HEADER + get16 (cell);
+		*owned = FALSE;
+	}
+}
+
+/***************************************************************************
+ *                                 Tree                                    *
+ ***************************************************************************/
+
+/* Descends to the leaf that would hold @key, or the leftmost leaf if @key is %NULL,
+ * recording the branches visited in @path. */
+static guint32
+btree_descend (CatalinaBtreeBackendPrivate *priv,
+               const gchar                 *key,
+               gsize                        key_length,
+               PathItem                    *path,
+               guint                       *depth)
+{
+	const guchar *node;
+	guint32       page;
+	guint         position;
+	gboolean      found;
+
+	page = get32 (page_read (priv, 0) + HEADER_ROOT);
+	*depth = 0;
+
+	while (NODE_TYPE ((node = page_read (priv, page))) == NODE_BRANCH) {
+		position = 0;
+		if (key) {
+			position = node_search (node, key, key_length, &found);
+			if (found)
+				position++;
+		}
+
+		g_assert (*depth < BTREE_MAX_DEPTH);
+		path [*depth].page = page;
+		path [*depth].position = position;
+		(*depth)++;
+
+		page = node_child (node, position);
+	}
+
+	return page;
+}
+
+/* Positions at the first key not less than @key, or greater than @key if
+ * @inclusive is %FALSE.  Returns %FALSE if there is no such key. */
+static gboolean
+btree_seek (CatalinaBtreeBackendPrivate *priv,
+            const gchar                 *key,
+            gsize                        key_length,
+            gboolean                     inclusive,
+            guint32                     *leaf,
+            guint                       *index)
+{
+	PathItem      path [BTREE_MAX_DEPTH];
+	const guchar *node;
+	guint         depth;
+	gboolean      found = FALSE;
+
+	*leaf = btree_descend (priv, key, key_length, path, &depth);
+	node = page_read (priv, *leaf);
+	*index = key ? node_search (node, key, key_length, &found) : 0;
+	if (found && !inclusive)
+		(*index)++;
+
+	while (*index >= NODE_N_CELLS (node)) {
+		if (!(*leaf = NODE_NEXT (node)))
+			return FALSE;
+		node = page_read (priv, *leaf);
+		*index = 0;
+	}
+
+	return TRUE;
+}
+
+/* Inserts @cell at @index of @page, splitting it and its ancestors as needed. */
+static void
+btree_insert (CatalinaBtreeBackendPrivate *priv,
+              PathItem                    *path,
+              guint                        depth,
+              guint32                      page,
+              guint                        index,
+              const guchar                *cell,
+              guint                        size)
+{
+	guchar        copy [BTREE_PAGE_SIZE],
+	              branch_cell [BRANCH_CELL_HEADER + BTREE_MAX_KEY];
+	const guchar *cells [BTREE_MAX_CELLS];
+	guint         sizes [BTREE_MAX_CELLS];
+	guchar       *node,
+	             *right;
+	const gchar  *key;
+	gsize         key_length;
+	guint32       right_page,
+	              root;
+	guint         n_cells,
+	              total = 0,
+	              half,
+	              split,
+	              i;
+
+	node = page_write (priv, page);
+	if (node_fits (node, size)) {
+		node_insert (node, index, cell, size);
+		return;
+	}
+
+	/* gather the cells, including the new one, from a copy of the node */
+	memcpy (copy, node, BTREE_PAGE_SIZE);
+	n_cells = NODE_N_CELLS (copy) + 1;
+	for (i = 0; i < n_cells; i++) {
+		if (i == index) {
+			cells [i] = cell;
+			sizes [i] = size;
+		}
+		else {
+			cells [i] = NODE_CELL (copy, i < index ? i : i - 1);
+			sizes [i] = cell_size (copy, cells [i]);
+		}
+		total += sizes [i] + 2;
+	}
+
+	for (split = 0, half = 0; split < n_cells - 1 && half < total / 2; split++)
+		half += sizes [split] + 2;
+	split = CLAMP (split, 1, n_cells - 1);
+
+	right_page = page_alloc (priv);
+	right = page_write (priv, right_page);
+
+	if (NODE_TYPE (copy) == NODE_LEAF) {
+		node_init (right, NODE_LEAF, NODE_NEXT (copy));
+		node_init (node, NODE_LEAF, right_page);
+		for (i = 0; i < split; i++)
+			node_insert (node, i, cells [i], sizes [i]);
+		for (i = split; i < n_cells; i++)
+			node_insert (right, i - split, cells [i], sizes [i]);
+		cell_key (right, NODE_CELL (right, 0), &key, &key_length);
+	}
+	else {
+		/* the middle cell moves up and its child becomes the leftmost of @right */
+		node_init (right, NODE_BRANCH, get32 (cells [split] + 2));
+		node_init (node, NODE_BRANCH, NODE_NEXT (copy));
+		for (i = 0; i < split; i++)
+			node_insert (node, i, cells [i], sizes [i]);
+		for (i = split + 1; i < n_cells; i++)
+			node_insert (right, i - split - 1, cells [i], sizes [i]);
+		key_length = get16 (cells [split]);
+		key = (const gchar*)cells [split] + BRANCH_CELL_HEADER;
+	}
+
+	put16 (branch_cell, key_length);
+	put32 (branch_cell + 2, right_page);
+	memcpy (branch_cell + BRANCH_CELL_HEADER, key, key_length);
+
+	if (depth == 0) {
+		root = page_alloc (priv);
+		node = page_write (priv, root);
+		node_init (node, NODE_BRANCH, page);
+		node_insert (node, 0, branch_cell, BRANCH_CELL_HEADER + key_length);
+		put32 (page_write (priv, 0) + HEADER_ROOT, root);
+		return;
+	}
+
+	btree_insert (priv, path, depth - 1,
+	              path [depth - 1].page, path [depth - 1].position,
+	              branch_cell, BRANCH_CELL_HEADER + key_length);
+}
+
+static void
+btree_cancel (CatalinaBtreeBackendPrivate *priv)
+{
+	g_hash_table_remove_all (priv->dirty);
+	priv->generation++;
+}
+
+/* Completes a modification made outside of a transaction. */
+static gboolean
+btree_complete (CatalinaBtreeBackendPrivate *priv,
+                GError                     **error)
+{
+	priv->generation++;
+
+	if (priv->in_txn)
+		return TRUE;
+
+	/* a split or an overflow chain is only consistent once all of its pages are
+	 * written, which the journal guarantees across a crash */
+	if (!btree_flush (priv, g_hash_table_size (priv->dirty) > 1, error)) {
+		btree_cancel (priv);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/***************************************************************************
+ *                                 Object                                  *
+ ***************************************************************************/
+
+static void
+catalina_btree_backend_finalize (GObject *object)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (object)->priv;
+
+	if (priv->map)
+		catalina_backend_close (CATALINA_BACKEND (object), NULL);
+
+	g_hash_table_destroy (priv->dirty);
+
+	G_OBJECT_CLASS (catalina_btree_backend_parent_class)->finalize (object);
+}
+
+static void
+catalina_btree_backend_class_init (CatalinaBtreeBackendClass *klass)
+{
+	GObjectClass *object_class;
+
+	g_type_class_add_private (klass, sizeof (CatalinaBtreeBackendPrivate));
+
+	object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = catalina_btree_backend_finalize;
+}
+
+static void
+catalina_btree_backend_init (CatalinaBtreeBackend *backend)
+{
+	backend->priv = G_TYPE_INSTANCE_GET_PRIVATE (backend,
+	                                             CATALINA_TYPE_BTREE_BACKEND,
+	                                             CatalinaBtreeBackendPrivate);
+
+	backend->priv->fd = -1;
+	backend->priv->dirty = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+	                                              NULL, g_free);
+}
+
+/**
+ * catalina_btree_backend_new:
+ *
+ * Creates a new instance of #CatalinaBtreeBackend.
+ *
+ * Return value: the newly created #CatalinaBtreeBackend instance
+ */
+CatalinaBackend*
+catalina_btree_backend_new (void)
+{
+	return g_object_new (CATALINA_TYPE_BTREE_BACKEND, NULL);
+}
+
+/***************************************************************************
+ *                           Backend Interface                             *
+ ***************************************************************************/
+
+static gboolean
+catalina_btree_backend_real_open (CatalinaBackend  *backend,
+                                  const gchar      *path,
+                                  GError          **error)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (backend)->priv;
+	guchar                       init [2 * BTREE_PAGE_SIZE];
+	struct stat                  st;
+
+	if ((priv->fd = open (path, O_RDWR | O_CREAT, 0644)) < 0) {
+		set_errno_error (error, "open", path);
+		return FALSE;
+	}
+
+	priv->path = g_strdup (path);
+
+	if (!journal_recover (priv, error) || fstat (priv->fd, &st) != 0)
+		goto failure;
+
+	/* a new data-store holds the header and an empty root leaf */
+	if (st.st_size == 0) {
+		memset (init, 0, sizeof (init));
+		memcpy (init, BTREE_MAGIC, 8);
+		put32 (init + 8, BTREE_PAGE_SIZE);
+		put32 (init + HEADER_ROOT, 1);
+		put32 (init + HEADER_N_PAGES, 2);
+		node_init (init + BTREE_PAGE_SIZE, NODE_LEAF, 0);
+
+		if (!write_all (priv->fd, (gchar*)init, sizeof (init), 0) || fsync (priv->fd) != 0) {
+			set_errno_error (error, "initialize", path);
+			goto failure;
+		}
+
+		st.st_size = sizeof (init);
+	}
+
+	if (st.st_size < 2 * BTREE_PAGE_SIZE || st.st_size % BTREE_PAGE_SIZE != 0)
+		goto corrupt;
+
+	priv->map = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, priv->fd, 0);
+	if (priv->map == MAP_FAILED) {
+		priv->map = NULL;
+		set_errno_error (error, "map", path);
+		goto failure;
+	}
+	priv->map_size = st.st_size;
+
+	if (memcmp (priv->map, BTREE_MAGIC, 8) != 0 ||
+	    get32 (priv->map + 8) != BTREE_PAGE_SIZE ||
+	    PAGE_OFFSET (get32 (priv->map + HEADER_N_PAGES)) > priv->map_size)
+		goto corrupt;
+
+	return TRUE;
+
+corrupt:
+	g_set_error (error, CATALINA_STORAGE_ERROR,
+	             CATALINA_STORAGE_ERROR_DB,
+	             "\"%s\" is not a valid B+tree data-store", path);
+
+failure:
+	if (priv->map)
+		munmap (priv->map, priv->map_size);
+	priv->map = NULL;
+	priv->map_size = 0;
+	close (priv->fd);
+	priv->fd = -1;
+	g_free (priv->path);
+	priv->path = NULL;
+
+	return FALSE;
+}
+
+static gboolean
+catalina_btree_backend_real_close (CatalinaBackend  *backend,
+                                   GError          **error)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (backend)->priv;
+	gboolean                     success = TRUE;
+
+	/* an uncommitted transaction is discarded */
+	btree_cancel (priv);
+	priv->in_txn = FALSE;
+
+	if (msync (priv->map, priv->map_size, MS_SYNC) != 0) {
+		set_errno_error (error, "sync", priv->path);
+		success = FALSE;
+	}
+
+	munmap (priv->map, priv->map_size);
+	priv->map = NULL;
+	priv->map_size = 0;
+	close (priv->fd);
+	priv->fd = -1;
+	g_free (priv->path);
+	priv->path = NULL;
+
+	return success;
+}
+
+static gboolean
+catalina_btree_backend_real_fetch (CatalinaBackend  *backend,
+                                   const gchar      *key,
+                                   gsize             key_length,
+                                   gchar           **data,
+                                   gsize            *data_length)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (backend)->priv;
+	PathItem                     path [BTREE_MAX_DEPTH];
+	const guchar                *node;
+	const gchar                 *value;
+	guint                        depth,
+	                             index;
+	gboolean                     found,
+	                             owned;
+
+	node = page_read (priv, btree_descend (priv, key, key_length, path, &depth));
+	index = node_search (node, key, key_length, &found);
+	if (!found)
+		return FALSE;
+
+	leaf_value (priv, NODE_CELL (node, index), &value, data_length, &owned);
+	*data = owned ? (gchar*)value : g_memdup (value, *data_length);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_btree_backend_real_store (CatalinaBackend  *backend,
+                                   const gchar      *key,
+                                   gsize             key_length,
+                                   const gchar      *data,
+                                   gsize             data_length,
+                                   GError          **error)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (backend)->priv;
+	PathItem                     path [BTREE_MAX_DEPTH];
+	guchar                       cell [LEAF_CELL_MAX];
+	guchar                      *node;
+	guint32                      leaf,
+	                             overflow = 0;
+	guint                        depth,
+	                             index,
+	                             size;
+	gboolean                     found;
+
+	if (key_length > BTREE_MAX_KEY) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Keys are limited to %d bytes", BTREE_MAX_KEY);
+		return FALSE;
+	}
+
+	if (data_length > G_MAXUINT32) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Values are limited to %u bytes", G_MAXUINT32);
+		return FALSE;
+	}
+
+	size = LEAF_CELL_HEADER + key_length;
+	if (size + data_length > LEAF_CELL_MAX)
+		overflow = overflow_write (priv, data, data_length);
+	else
+		size += data_length;
+
+	put16 (cell, key_length);
+	put32 (cell + 2, data_length);
+	put32 (cell + 6, overflow);
+	memcpy (cell + LEAF_CELL_HEADER, key, key_length);
+	if (!overflow)
+		memcpy (cell + LEAF_CELL_HEADER + key_length, data, data_length);
+
+	leaf = btree_descend (priv, key, key_length, path, &depth);
+	node = page_write (priv, leaf);
+	index = node_search (node, key, key_length, &found);
+
+	if (found) {
+		overflow_free (priv, get32 (NODE_CELL (node, index) + 6));
+		node_delete (node, index);
+	}
+
+	btree_insert (priv, path, depth, leaf, index, cell, size);
+
+	return btree_complete (priv, error);
+}
+
+static gboolean
+catalina_btree_backend_real_remove (CatalinaBackend  *backend,
+                                    const gchar      *key,
+                                    gsize             key_length,
+                                    GError          **error)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (backend)->priv;
+	PathItem                     path [BTREE_MAX_DEPTH];
+	guchar                      *node;
+	guint32                      leaf;
+	guint                        depth,
+	                             index;
+	gboolean                     found;
+
+	leaf = btree_descend (priv, key, key_length, path, &depth);
+	index = node_search (page_read (priv, leaf), key, key_length, &found);
+
+	if (!found) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
+		             "The key does not exist");
+		return FALSE;
+	}
+
+	node = page_write (priv, leaf);
+	overflow_free (priv, get32 (NODE_CELL (node, index) + 6));
+	node_delete (node, index);
+
+	return btree_complete (priv, error);
+}
+
+static gboolean
+catalina_btree_backend_real_next_key (CatalinaBackend  *backend,
+                                      const gchar      *key,
+                                      gsize             key_length,
+                                      gchar           **next_key,
+                                      gsize            *next_key_length)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (backend)->priv;
+	const gchar                 *found_key;
+	guint32                      leaf;
+	guint                        index;
+
+	if (!btree_seek (priv, key, key_length, FALSE, &leaf, &index))
+		return FALSE;
+
+	cell_key (page_read (priv, leaf), NODE_CELL (page_read (priv, leaf), index),
+	          &found_key, next_key_length);
+	*next_key = g_memdup (found_key, *next_key_length);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_btree_backend_real_scan (CatalinaBackend      *backend,
+                                  const gchar          *start,
+                                  gsize                 start_length,
+                                  const gchar          *end,
+                                  gsize                 end_length,
+                                  CatalinaBackendFunc   func,
+                                  gpointer              user_data,
+                                  GError              **error)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (backend)->priv;
+	const guchar                *node,
+	                            *cell;
+	const gchar                 *key,
+	                            *data;
+	gchar                        last [BTREE_MAX_KEY];
+	gsize                        key_length,
+	                             last_length,
+	                             data_length;
+	guint32                      leaf;
+	guint                        index,
+	                             generation;
+	gboolean                     owned,
+	                             more;
+
+	if (!btree_seek (priv, start, start_length, TRUE, &leaf, &index))
+		return TRUE;
+
+	for (;;) {
+		node = page_read (priv, leaf);
+		cell = NODE_CELL (node, index);
+		cell_key (node, cell, &key, &key_length);
+
+		if (end && key_compare (key, key_length, end, end_length) >= 0)
+			break;
+
+		memcpy (last, key, key_length);
+		last_length = key_length;
+		generation = priv->generation;
+
+		leaf_value (priv, cell, &data, &data_length, &owned);
+		more = func (last, last_length, data, data_length, user_data);
+		if (owned)
+			g_free ((gchar*)data);
+
+		if (!more)
+			break;
+
+		/* the callback changed the tree, find our place again */
+		if (generation != priv->generation) {
+			if (!btree_seek (priv, last, last_length, FALSE, &leaf, &index))
+				break;
+			continue;
+		}
+
+		for (index++; index >= NODE_N_CELLS (node); index = 0) {
+			if (!(leaf = NODE_NEXT (node)))
+				return TRUE;
+			node = page_read (priv, leaf);
+		}
+	}
+
+	return TRUE;
+}
+
+static gboolean
+catalina_btree_backend_real_traverse (CatalinaBackend      *backend,
+                                      CatalinaBackendFunc   func,
+                                      gpointer              user_data,
+                                      GError              **error)
+{
+	return catalina_btree_backend_real_scan (backend, NULL, 0, NULL, 0,
+	                                         func, user_data, error);
+}
+
+static gboolean
+catalina_btree_backend_real_transaction_begin (CatalinaBackend  *backend,
+                                               GError          **error)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (backend)->priv;
+
+	if (priv->in_txn) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "A transaction is already active");
+		return FALSE;
+	}
+
+	priv->in_txn = TRUE;
+
+	return TRUE;
+}
+
+static gboolean
+catalina_btree_backend_real_transaction_commit (CatalinaBackend  *backend,
+                                                GError          **error)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (backend)->priv;
+
+	priv->in_txn = FALSE;
+
+	if (!btree_flush (priv, TRUE, error)) {
+		btree_cancel (priv);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+catalina_btree_backend_real_transaction_cancel (CatalinaBackend  *backend,
+                                                GError          **error)
+{
+	CatalinaBtreeBackendPrivate *priv = CATALINA_BTREE_BACKEND (backend)->priv;
+
+	priv->in_txn = FALSE;
+	btree_cancel (priv);
+
+	return TRUE;
+}
+
+static void
+catalina_btree_backend_base_init (CatalinaBackendIface *iface)
+{
+	iface->open               = catalina_btree_backend_real_open;
+	iface->close              = catalina_btree_backend_real_close;
+	iface->fetch              = catalina_btree_backend_real_fetch;
+	iface->store              = catalina_btree_backend_real_store;
+	iface->remove             = catalina_btree_backend_real_remove;
+	iface->next_key           = catalina_btree_backend_real_next_key;
+	iface->traverse           = catalina_btree_backend_real_traverse;
+	iface->scan               = catalina_btree_backend_real_scan;
+	iface->transaction_begin  = catalina_btree_backend_real_transaction_begin;
+	iface->transaction_commit = catalina_btree_backend_real_transaction_commit;
+	iface->transaction_cancel = catalina_btree_backend_real_transaction_cancel;
+}
@@ -0,0 +1,1785 @@
+/* catalina-log-backend.c
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "catalina-log-backend.h"
+#include "catalina-storage.h"
+
+/**
+ * SECTION:catalina-log-backend
+ * @title: CatalinaLogBackend
+ * @short_description: log-structured storage engine
+ *
+ * #CatalinaLogBackend never updates records in place.  Every write is appended to
+ * the active segment file and an in-memory hash index maps each key to the location
+ * of its latest value.  This turns overwrite-heavy workloads into sequential writes.
+ *
+ * The data-store is a directory of segment files.  Once a segment reaches the
+ * "segment-size" property it becomes immutable and a new segment is started.  A
+ * background thread writes a hint file for each immutable segment, which holds the
+ * keys and value locations without the values, so that the index can be rebuilt
+ * quickly when the data-store is opened.  The same thread merges the immutable
+ * segments into new ones containing only live records once enough of their space
+ * belongs to overwritten or removed records.
+ *
+ * Transactions are buffered in memory and appended as a single write upon commit.
+ * The records of a commit are framed by a header holding their number and length
+ * and followed by a checksum of the frame, so that a commit torn by a crash is
+ * discarded as a whole when the segment is replayed.
+ *
+ * |[
+ * CatalinaStorage *storage = catalina_storage_new ();
+ * g_object_set (storage, "backend", catalina_log_backend_new (), NULL);
+ * catalina_storage_open (storage, ".", "people.log", NULL);
+ * ]|
+ */
+
+#define LOG_HEADER_SIZE          12
+#define LOG_HINT_SIZE            16
+#define LOG_TOMBSTONE            G_MAXUINT32
+#define LOG_FRAME                G_MAXUINT32 /* key length of a commit frame header */
+#define LOG_FRAME_TRAILER_SIZE   4
+#define LOG_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+#define LOG_MERGE_RATIO          0.5         /* dead fraction that triggers a merge */
+#define LOG_MERGE_MIN            (1 << 20)   /* dead bytes required before merging */
+#define LOG_SEGMENT_FORMAT       "%016" G_GINT64_MODIFIER "x"
+#define LOG_DATA_SUFFIX          ".data"
+#define LOG_HINT_SUFFIX          ".hint"
+
+/* segment ids sort in write order.  the low 16 bits number the outputs of a
+ * merge so they sort right after the segments they replace. */
+#define SEGMENT_SUB(id)          ((id) & 0xFFFF)
+#define SEGMENT_NEXT(id)         ((((id) >> 16) + 1) << 16)
+
+#define RECORD_SIZE(kl,l)        (LOG_HEADER_SIZE + (kl) + ((l) == LOG_TOMBSTONE ? 0 : (l)))
+
+static void catalina_log_backend_base_init (CatalinaBackendIface *iface);
+
+G_DEFINE_TYPE_EXTENDED (CatalinaLogBackend,
+                        catalina_log_backend,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (CATALINA_TYPE_BACKEND,
+                                               catalina_log_backend_base_init))
+
+enum
+{
+	PROP_0,
+	PROP_SEGMENT_SIZE,
+};
+
+typedef struct
+{
+	guint64  id;
+	gint     fd;
+	guint64  size;
+	guint64  dead;     /* bytes belonging to replaced records */
+	gboolean hinted;   /* hint file is up to date */
+} Segment;
+
+/* Entry and Pending begin with the same members as LogKey so they can share the
+ * hash and equality functions. */
+typedef struct
+{
+	gchar *key;
+	gsize  key_length;
+} LogKey;
+
+typedef struct
+{
+	gchar   *key;
+	gsize    key_length;
+	Segment *segment;
+	guint64  offset;   /* offset of the value within the segment */
+	guint32  length;
+	GList   *link;
+} Entry;
+
+typedef struct
+{
+	gchar    *key;
+	gsize     key_length;
+	gchar    *data;
+	gsize     data_length;
+	gboolean  removed;
+} Pending;
+
+typedef struct
+{
+	gchar   *key;
+	gsize    key_length;
+	Segment *segment;
+	guint64  offset;
+	guint32  length;
+	Segment *new_segment;
+	guint64  new_offset;
+} MergeItem;
+
+typedef gboolean (*SegmentScanFunc) (Segment     *segment,
+                                     const gchar *key,
+                                     gsize        key_length,
+                                     guint64      offset,
+                                     guint32      length,
+                                     gpointer     user_data);
+
+struct _CatalinaLogBackendPrivate
+{
+	gchar         *path;           /* directory holding the segments */
+	guint          segment_size;   /* size at which segments are rolled */
+
+	GStaticRWLock  lock;           /* protects index, order and segments */
+	GHashTable    *index;          /* Entry -> Entry */
+	GQueue        *order;          /* Entries in insertion order */
+	GList         *segments;       /* Segments sorted by id */
+	Segment       *active;         /* segment receiving appends */
+
+	gboolean       in_txn;
+	gboolean       no_sync;        /* commits are not synced to disk */
+	GHashTable    *pending;        /* Pending -> Pending */
+	GQueue        *pending_order;
+
+	GThread       *merger;         /* writes hints and merges segments */
+	GMutex        *merger_mutex;
+	GCond         *merger_cond;
+	gboolean       merger_wake;
+	gboolean       merger_force;
+	gboolean       merger_stop;
+};
+
+/***************************************************************************
+ *                               Helpers                                   *
+ ***************************************************************************/
+
+static guint
+log_key_hash (gconstpointer v)
+{
+	const LogKey *key = v;
+	const guchar *p   = (const guchar*)key->key;
+	guint         h   = 5381;
+	gsize         i;
+
+	for (i = 0; i < key->key_length; i++)
+		h = (h << 5) + h + p[i];
+
+	return h;
+}
+
+static gboolean
+log_key_equal (gconstpointer a,
+               gconstpointer b)
+{
+	const LogKey *ka = a,
+	             *kb = b;
+
+	return ka->key_length == kb->key_length &&
+	       memcmp (ka->key, kb->key, ka->key_length) == 0;
+}
+
+static void
+entry_free (gpointer data)
+{
+	Entry *entry = data;
+
+	g_free (entry->key);
+	g_slice_free (Entry, entry);
+}
+
+static void
+pending_free (gpointer data)
+{
+	Pending *pending = data;
+
+	g_free (pending->key);
+	g_free (pending->data);
+	g_slice_free (Pending, pending);
+}
+
+/* FNV-1a over the key and value, used to detect torn writes */
+static guint32
+log_checksum (const gchar *key,
+              gsize        key_length,
+              const gchar *data,
+              gsize        data_length)
+{
+	guint32 h = 2166136261U;
+	gsize   i;
+
+	for (i = 0; i < key_length; i++)
+		h = (h ^ (guchar)key [i]) * 16777619U;
+	for (i = 0; i < data_length; i++)
+		h = (h ^ (guchar)data [i]) * 16777619U;
+
+	return h;
+}
+
+static gboolean
+write_all (gint         fd,
+           const gchar *buffer,
+           gsize        length,
+           guint64      offset)
+{
+	gssize ret;
+
+	while (length > 0) {
+		if ((ret = pwrite (fd, buffer, length, offset)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		buffer += ret;
+		length -= ret;
+		offset += ret;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+read_all (gint     fd,
+          gchar   *buffer,
+          gsize    length,
+          guint64  offset)
+{
+	gssize ret;
+
+	while (length > 0) {
+		if ((ret = pread (fd, buffer, length, offset)) <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		buffer += ret;
+		length -= ret;
+		offset += ret;
+	}
+
+	return TRUE;
+}
+
+/* Appends a record to @buffer.  A %NULL @data with @removed set is a tombstone. */
+static void
+record_append (GByteArray  *buffer,
+               const gchar *key,
+               gsize        key_length,
+               const gchar *data,
+               gsize        data_length,
+               gboolean     removed)
+{
+	guint32 header [3];
+
+	header [0] = GUINT32_TO_BE ((guint32)key_length);
+	header [1] = GUINT32_TO_BE (removed ? LOG_TOMBSTONE : (guint32)data_length);
+	header [2] = GUINT32_TO_BE (log_checksum (key, key_length,
+	                                          data, removed ? 0 : data_length));
+
+	g_byte_array_append (buffer, (guint8*)header, LOG_HEADER_SIZE);
+	g_byte_array_append (buffer, (guint8*)key, key_length);
+	if (!removed)
+		g_byte_array_append (buffer, (guint8*)data, data_length);
+}
+
+/***************************************************************************
+ *                               Segments                                  *
+ ***************************************************************************/
+
+static gchar*
+segment_path (CatalinaLogBackendPrivate *priv,
+              guint64                    id,
+              const gchar               *suffix)
+{
+	return g_strdup_printf ("%s" G_DIR_SEPARATOR_S LOG_SEGMENT_FORMAT "%s",
+	                        priv->path, id, suffix);
+}
+
+static Segment*
+segment_open (CatalinaLogBackendPrivate  *priv,
+              guint64                     id,
+              gboolean                    create,
+              GError                    **error)
+{
+	Segment *segment;
+	gchar   *path;
+	gint     fd;
+	off_t    size;
+
+	path = segment_path (priv, id, LOG_DATA_SUFFIX);
+	fd = open (path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+
+	if (fd < 0 || (size = lseek (fd, 0, SEEK_END)) < 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not open segment \"%s\": %s",
+		             path, g_strerror (errno));
+		if (fd >= 0)
+			close (fd);
+		g_free (path);
+		return NULL;
+	}
+
+	g_free (path);
+
+	segment = g_slice_new0 (Segment);
+	segment->id = id;
+	segment->fd = fd;
+	segment->size = size;
+
+	return segment;
+}
+
+static void
+segment_free (Segment *segment)
+{
+	close (segment->fd);
+	g_slice_free (Segment, segment);
+}
+
+static void
+segment_unlink (CatalinaLogBackendPrivate *priv,
+                Segment                   *segment)
+{
+	gchar *path;
+
+	path = segment_path (priv, segment->id, LOG_DATA_SUFFIX);
+	unlink (path);
+	g_free (path);
+
+	path = segment_path (priv, segment->id, LOG_HINT_SUFFIX);
+	unlink (path);
+	g_free (path);
+}
+
+static gint
+segment_compare (gconstpointer a,
+                 gconstpointer b)
+{
+	const Segment *sa = a,
+	              *sb = b;
+
+	return (sa->id > sb->id) - (sa->id < sb->id);
+}
+
+/* Parses the record at @p within the @length bytes of @buffer, verifying its
+ * checksum.  Returns the size of the record, or 0 if it is incomplete or corrupt. */
+static gsize
+record_parse (const gchar  *buffer,
+              gsize         length,
+              gsize         p,
+              const gchar **key,
+              guint32      *key_length,
+              guint32      *data_length)
+{
+	guint32 header [3];
+	gsize   body_length;
+
+	if (p + LOG_HEADER_SIZE > length)
+		return 0;
+
+	memcpy (header, buffer + p, LOG_HEADER_SIZE);
+	*key_length = GUINT32_FROM_BE (header [0]);
+	*data_length = GUINT32_FROM_BE (header [1]);
+	body_length = (gsize)*key_length + (*data_length == LOG_TOMBSTONE ? 0 : *data_length);
+
+	if (*key_length == LOG_FRAME || p + LOG_HEADER_SIZE + body_length > length)
+		return 0;
+
+	*key = buffer + p + LOG_HEADER_SIZE;
+	if (log_checksum (*key, *key_length, *key + *key_length,
+	                  body_length - *key_length) != GUINT32_FROM_BE (header [2]))
+		return 0;
+
+	return LOG_HEADER_SIZE + body_length;
+}
+
+/*
+ * Visits the records of the commit frame at @offset, which holds @n_records
+ * records in @length bytes.  Nothing is visited unless the whole frame is present
+ * and valid.  Returns the size of the frame, or 0 if it is incomplete or corrupt.
+ */
+static guint64
+segment_scan_frame (Segment         *segment,
+                    guint64          offset,
+                    guint32          n_records,
+                    guint32          length,
+                    SegmentScanFunc  func,
+                    gpointer         user_data,
+                    gboolean        *proceed)
+{
+	const gchar *key;
+	gchar       *body;
+	guint32      key_length,
+	             data_length,
+	             trailer,
+	             count = 0;
+	gsize        p,
+	             size = 0;
+	guint64      frame_length;
+
+	frame_length = LOG_HEADER_SIZE + (guint64)length + LOG_FRAME_TRAILER_SIZE;
+	if (offset + frame_length > segment->size)
+		return 0;
+
+	body = g_malloc (length + LOG_FRAME_TRAILER_SIZE);
+
+	if (!read_all (segment->fd, body, length + LOG_FRAME_TRAILER_SIZE,
+	               offset + LOG_HEADER_SIZE))
+		goto invalid;
+
+	memcpy (&trailer, body + length, LOG_FRAME_TRAILER_SIZE);
+	if (log_checksum (body, length, NULL, 0) != GUINT32_FROM_BE (trailer))
+		goto invalid;
+
+	/* validate every record before applying any of them */
+	for (p = 0; p < length; p += size, count++)
+		if (!(size = record_parse (body, length, p, &key, &key_length, &data_length)))
+			goto invalid;
+
+	if (count != n_records)
+		goto invalid;
+
+	for (p = 0; p < length && *proceed; p += size) {
+		size = record_parse (body, length, p, &key, &key_length, &data_length);
+		*proceed = func (segment, key, key_length,
+		                 offset + LOG_HEADER_SIZE + p + LOG_HEADER_SIZE + key_length,
+		                 data_length, user_data);
+	}
+
+	g_free (body);
+
+	return frame_length;
+
+invalid:
+	g_free (body);
+	return 0;
+}
+
+/*
+ * Visits every valid record of @segment in write order.  Scanning stops at the
+ * first truncated or corrupt record or commit frame and the offset following the
+ * last valid one is returned.
+ */
+static guint64
+segment_scan (Segment         *segment,
+              SegmentScanFunc  func,
+              gpointer         user_data)
+{
+	guint64  offset = 0,
+	         frame_length;
+	guint32  header [3],
+	         key_length,
+	         length;
+	gsize    body_length;
+	gchar   *body = NULL;
+	gsize    body_alloc = 0;
+	gboolean proceed = TRUE;
+
+	while (offset + LOG_HEADER_SIZE <= segment->size) {
+		if (!read_all (segment->fd, (gchar*)header, LOG_HEADER_SIZE, offset))
+			break;
+
+		key_length = GUINT32_FROM_BE (header [0]);
+		length = GUINT32_FROM_BE (header [1]);
+
+		if (key_length == LOG_FRAME) {
+			frame_length = segment_scan_frame (segment, offset, length,
+			                                   GUINT32_FROM_BE (header [2]),
+			                                   func, user_data, &proceed);
+			if (!frame_length || !proceed)
+				break;
+			offset += frame_length;
+			continue;
+		}
+		body_length = key_length + (length == LOG_TOMBSTONE ? 0 : length);
+
+		if (offset + LOG_HEADER_SIZE + body_length > segment->size)
+			break;
+
+		if (body_length > body_alloc) {
+			body_alloc = body_length;
+			body = g_realloc (body, body_alloc);
+		}
+
+		if (!read_all (segment->fd, body, body_length, offset + LOG_HEADER_SIZE))
+			break;
+
+		if (log_checksum (body, key_length, body + key_length,
+		                  body_length - key_length) != GUINT32_FROM_BE (header [2]))
+			break;
+
+		if (!func (segment, body, key_length,
+		           offset + LOG_HEADER_SIZE + key_length, length,
+		           user_data))
+			break;
+
+		offset += LOG_HEADER_SIZE + body_length;
+	}
+
+	g_free (body);
+
+	return offset;
+}
+
+static gboolean
+segment_write_hint_cb (Segment     *segment,
+                       const gchar *key,
+                       gsize        key_length,
+                       guint64      offset,
+                       guint32      length,
+                       gpointer     user_data)
+{
+	GByteArray *hint = user_data;
+	guint32     header [2];
+	guint64     value_offset;
+
+	header [0] = GUINT32_TO_BE ((guint32)key_length);
+	header [1] = GUINT32_TO_BE (length);
+	value_offset = GUINT64_TO_BE (offset);
+
+	g_byte_array_append (hint, (guint8*)header, sizeof (header));
+	g_byte_array_append (hint, (guint8*)&value_offset, sizeof (value_offset));
+	g_byte_array_append (hint, (guint8*)key, key_length);
+
+	return TRUE;
+}
+
+/* Writes the hint file of an immutable segment.  Hints hold every record of the
+ * segment, including tombstones, without the values. */
+static gboolean
+segment_write_hint (CatalinaLogBackendPrivate  *priv,
+                    Segment                    *segment,
+                    GError                    **error)
+{
+	GByteArray *hint;
+	gchar      *path;
+	gboolean    success;
+
+	hint = g_byte_array_new ();
+	segment_scan (segment, segment_write_hint_cb, hint);
+
+	path = segment_path (priv, segment->id, LOG_HINT_SUFFIX);
+	success = g_file_set_contents (path, (gchar*)hint->data, hint->len, error);
+	g_free (path);
+	g_byte_array_free (hint, TRUE);
+
+	if (success)
+		segment->hinted = TRUE;
+
+	return success;
+}
+
+/* Replays the hint file of @segment.  Returns %FALSE if there is no usable hint,
+ * in which case the segment must be scanned. */
+static gboolean
+segment_read_hint (CatalinaLogBackendPrivate *priv,
+                   Segment                   *segment,
+                   SegmentScanFunc            func,
+                   gpointer                   user_data)
+{
+	gchar   *path,
+	        *contents = NULL,
+	        *p,
+	        *end;
+	gsize    length = 0;
+	guint32  header [2],
+	         key_length;
+	guint64  offset;
+
+	path = segment_path (priv, segment->id, LOG_HINT_SUFFIX);
+
+	if (!g_file_get_contents (path, &contents, &length, NULL)) {
+		g_free (path);
+		return FALSE;
+	}
+
+	g_free (path);
+
+	/* validate the entire hint before applying any of it */
+	for (p = contents, end = contents + length; p < end; p += LOG_HINT_SIZE + key_length) {
+		if (p + LOG_HINT_SIZE > end)
+			goto invalid;
+		memcpy (header, p, sizeof (header));
+		memcpy (&offset, p + sizeof (header), sizeof (offset));
+		key_length = GUINT32_FROM_BE (header [0]);
+		if (p + LOG_HINT_SIZE + key_length > end ||
+		    GUINT64_FROM_BE (offset) > segment->size)
+			goto invalid;
+	}
+
+	for (p = contents; p < end; p += LOG_HINT_SIZE + key_length) {
+		memcpy (header, p, sizeof (header));
+		memcpy (&offset, p + sizeof (header), sizeof (offset));
+		key_length = GUINT32_FROM_BE (header [0]);
+		func (segment, p + LOG_HINT_SIZE, key_length,
+		      GUINT64_FROM_BE (offset), GUINT32_FROM_BE (header [1]),
+		      user_data);
+	}
+
+	g_free (contents);
+	segment->hinted = TRUE;
+
+	return TRUE;
+
+invalid:
+	g_warning ("Ignoring corrupt hint file for segment " LOG_SEGMENT_FORMAT,
+	           segment->id);
+	g_free (contents);
+	return FALSE;
+}
+
+/***************************************************************************
+ *                                 Index                                   *
+ ***************************************************************************/
+
+/*
+ * Points @key at the record found at @offset within @segment.  The space of the
+ * record it replaces is accounted as dead.  Tombstones are dead as soon as they
+ * are applied since they only exist to hide older records.  The caller must hold
+ * the writer lock when the backend is open.
+ */
+static gboolean
+index_apply (Segment     *segment,
+             const gchar *key,
+             gsize        key_length,
+             guint64      offset,
+             guint32      length,
+             gpointer     user_data)
+{
+	CatalinaLogBackendPrivate *priv   = user_data;
+	LogKey                     lookup = { (gchar*)key, key_length };
+	Entry                     *entry;
+
+	if ((entry = g_hash_table_lookup (priv->index, &lookup)) != NULL)
+		entry->segment->dead += RECORD_SIZE (entry->key_length, entry->length);
+
+	if (length == LOG_TOMBSTONE) {
+		segment->dead += RECORD_SIZE (key_length, length);
+		if (entry) {
+			g_queue_delete_link (priv->order, entry->link);
+			g_hash_table_remove (priv->index, entry);
+		}
+		return TRUE;
+	}
+
+	if (!entry) {
+		entry = g_slice_new0 (Entry);
+		entry->key = g_memdup (key, key_length);
+		entry->key_length = key_length;
+		g_queue_push_tail (priv->order, entry);
+		entry->link = priv->order->tail;
+		g_hash_table_insert (priv->index, entry, entry);
+	}
+
+	entry->segment = segment;
+	entry->offset = offset;
+	entry->length = length;
+
+	return TRUE;
+}
+
+static Entry*
+index_lookup (CatalinaLogBackendPrivate *priv,
+              const gchar               *key,
+              gsize                      key_length)
+{
+	LogKey lookup = { (gchar*)key, key_length };
+
+	return g_hash_table_lookup (priv->index, &lookup);
+}
+
+static Pending*
+pending_lookup (CatalinaLogBackendPrivate *priv,
+                const gchar               *key,
+                gsize                      key_length)
+{
+	LogKey lookup = { (gchar*)key, key_length };
+
+	if (!priv->in_txn)
+		return NULL;
+
+	return g_hash_table_lookup (priv->pending, &lookup);
+}
+
+static void
+pending_clear (CatalinaLogBackendPrivate *priv)
+{
+	g_queue_clear (priv->pending_order);
+	g_hash_table_remove_all (priv->pending);
+	priv->in_txn = FALSE;
+}
+
+/***************************************************************************
+ *                                Merging                                  *
+ ***************************************************************************/
+
+static void
+merger_wake (CatalinaLogBackendPrivate *priv,
+             gboolean                   force)
+{
+	g_mutex_lock (priv->merger_mutex);
+	priv->merger_wake = TRUE;
+	priv->merger_force |= force;
+	g_cond_signal (priv->merger_cond);
+	g_mutex_unlock (priv->merger_mutex);
+}
+
+static void
+merger_write_hints (CatalinaLogBackendPrivate *priv)
+{
+	GList   *unhinted = NULL,
+	        *iter;
+	Segment *segment;
+	GError  *error = NULL;
+
+	g_static_rw_lock_reader_lock (&priv->lock);
+	for (iter = priv->segments; iter; iter = iter->next) {
+		segment = iter->data;
+		if (segment != priv->active && !segment->hinted)
+			unhinted = g_list_prepend (unhinted, segment);
+	}
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	/* only this thread removes immutable segments, so they stay valid */
+	for (iter = unhinted; iter; iter = iter->next) {
+		if (!segment_write_hint (priv, iter->data, &error)) {
+			g_warning ("%s", error->message);
+			g_clear_error (&error);
+		}
+	}
+
+	g_list_free (unhinted);
+}
+
+static void
+merge_items_free (GArray *items)
+{
+	guint i;
+
+	for (i = 0; i < items->len; i++)
+		g_free (g_array_index (items, MergeItem, i).key);
+	g_array_free (items, TRUE);
+}
+
+/*
+ * Rewrites the live records of every immutable segment into new segments and
+ * removes the old ones.  The new segments are numbered after the newest merged
+ * segment, so they still sort before any segment written during the merge.
+ */
+static void
+merger_merge (CatalinaLogBackendPrivate *priv,
+              gboolean                   force)
+{
+	GList      *merged  = NULL,
+	           *outputs = NULL,
+	           *iter;
+	GArray     *items;
+	GByteArray *buffer;
+	MergeItem   item,
+	           *pitem;
+	Segment    *segment,
+	           *output = NULL;
+	Entry      *entry;
+	GError     *error = NULL;
+	gchar      *value = NULL;
+	guint64     total = 0,
+	            dead = 0,
+	            max_id = 0,
+	            next_id;
+	guint       i;
+
+	g_static_rw_lock_reader_lock (&priv->lock);
+
+	for (iter = priv->segments; iter; iter = iter->next) {
+		segment = iter->data;
+		if (segment == priv->active)
+			continue;
+		total += segment->size;
+		dead += segment->dead;
+		max_id = MAX (max_id, segment->id);
+		merged = g_list_prepend (merged, segment);
+	}
+
+	if (!merged || dead == 0 ||
+	    (!force && (dead < LOG_MERGE_MIN || dead < total * LOG_MERGE_RATIO)))
+	{
+		g_static_rw_lock_reader_unlock (&priv->lock);
+		g_list_free (merged);
+		return;
+	}
+
+	/* snapshot the live records of the merged segments */
+	items = g_array_new (FALSE, TRUE, sizeof (MergeItem));
+	for (iter = priv->order->head; iter; iter = iter->next) {
+		entry = iter->data;
+		if (entry->segment == priv->active || entry->segment->id > max_id)
+			continue;
+		memset (&item, 0, sizeof (item));
+		item.key = g_memdup (entry->key, entry->key_length);
+		item.key_length = entry->key_length;
+		item.segment = entry->segment;
+		item.offset = entry->offset;
+		item.length = entry->length;
+		g_array_append_val (items, item);
+	}
+
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	/* copy the records without holding the lock */
+	buffer = g_byte_array_new ();
+	next_id = max_id;
+
+	for (i = 0; i < items->len; i++) {
+		pitem = &g_array_index (items, MergeItem, i);
+
+		if (!output || output->size >= priv->segment_size) {
+			if (SEGMENT_SUB (next_id) == 0xFFFF) {
+				g_set_error (&error, CATALINA_STORAGE_ERROR,
+				             CATALINA_STORAGE_ERROR_DB,
+				             "Too many merges of segment " LOG_SEGMENT_FORMAT,
+				             max_id);
+				goto failure;
+			}
+			if (!(output = segment_open (priv, ++next_id, TRUE, &error)))
+				goto failure;
+			outputs = g_list_append (outputs, output);
+		}
+
+		value = g_realloc (value, MAX (1, pitem->length));
+		if (!read_all (pitem->segment->fd, value, pitem->length, pitem->offset)) {
+			g_set_error (&error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_DB,
+			             "Could not read segment " LOG_SEGMENT_FORMAT ": %s",
+			             pitem->segment->id, g_strerror (errno));
+			goto failure;
+		}
+
+		g_byte_array_set_size (buffer, 0);
+		record_append (buffer, pitem->key, pitem->key_length,
+		               value, pitem->length, FALSE);
+
+		if (!write_all (output->fd, (gchar*)buffer->data, buffer->len, output->size)) {
+			g_set_error (&error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_DB,
+			             "Could not write segment " LOG_SEGMENT_FORMAT ": %s",
+			             output->id, g_strerror (errno));
+			goto failure;
+		}
+
+		pitem->new_segment = output;
+		pitem->new_offset = output->size + LOG_HEADER_SIZE + pitem->key_length;
+		output->size += buffer->len;
+	}
+
+	/* the outputs must be durable before the merged segments go away */
+	for (iter = outputs; iter; iter = iter->next) {
+		output = iter->data;
+		if (fsync (output->fd) != 0) {
+			g_set_error (&error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_DB,
+			             "Could not sync segment " LOG_SEGMENT_FORMAT ": %s",
+			             output->id, g_strerror (errno));
+			goto failure;
+		}
+		if (!segment_write_hint (priv, output, &error))
+			goto failure;
+	}
+
+	g_static_rw_lock_writer_lock (&priv->lock);
+
+	/* records changed during the merge keep their newer location */
+	for (i = 0; i < items->len; i++) {
+		pitem = &g_array_index (items, MergeItem, i);
+		entry = index_lookup (priv, pitem->key, pitem->key_length);
+
+		if (entry && entry->segment == pitem->segment && entry->offset == pitem->offset) {
+			entry->segment = pitem->new_segment;
+			entry->offset = pitem->new_offset;
+		}
+		else
+			pitem->new_segment->dead += RECORD_SIZE (pitem->key_length, pitem->length);
+	}
+
+	for (iter = merged; iter; iter = iter->next)
+		priv->segments = g_list_remove (priv->segments, iter->data);
+	for (iter = outputs; iter; iter = iter->next)
+		priv->segments = g_list_insert_sorted (priv->segments, iter->data, segment_compare);
+
+	g_static_rw_lock_writer_unlock (&priv->lock);
+
+	for (iter = merged; iter; iter = iter->next) {
+		segment_unlink (priv, iter->data);
+		segment_free (iter->data);
+	}
+
+	g_list_free (merged);
+	g_list_free (outputs);
+	g_byte_array_free (buffer, TRUE);
+	merge_items_free (items);
+	g_free (value);
+
+	return;
+
+failure:
+	g_warning ("Could not merge segments: %s", error->message);
+	g_error_free (error);
+
+	for (iter = outputs; iter; iter = iter->next) {
+		segment_unlink (priv, iter->data);
+		segment_free (iter->data);
+	}
+
+	g_list_free (merged);
+	g_list_free (outputs);
+	g_byte_array_free (buffer, TRUE);
+	merge_items_free (items);
+	g_free (value);
+}
+
+static gpointer
+merger_thread (gpointer data)
+{
+	CatalinaLogBackendPrivate *priv = data;
+	gboolean                   force;
+
+	g_mutex_lock (priv->merger_mutex);
+
+	while (!priv->merger_stop) {
+		if (!priv->merger_wake) {
+			g_cond_wait (priv->merger_cond, priv->merger_mutex);
+			continue;
+		}
+
+		force = priv->merger_force;
+		priv->merger_wake = FALSE;
+		priv->merger_force = FALSE;
+		g_mutex_unlock (priv->merger_mutex);
+
+		merger_write_hints (priv);
+		merger_merge (priv, force);
+
+		g_mutex_lock (priv->merger_mutex);
+	}
+
+	g_mutex_unlock (priv->merger_mutex);
+
+	return NULL;
+}
+
+/***************************************************************************
+ *                                Appends                                  *
+ ***************************************************************************/
+
+/* Appends @buffer to the active segment.  On failure the segment is truncated
+ * back to its previous size so no partial record remains. */
+static gboolean
+log_append (CatalinaLogBackendPrivate  *priv,
+            GByteArray                 *buffer,
+            gboolean                    sync,
+            GError                    **error)
+{
+	Segment *active = priv->active;
+
+	if (!write_all (active->fd, (gchar*)buffer->data, buffer->len, active->size) ||
+	    (sync && fsync (active->fd) != 0))
+	{
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not append to segment " LOG_SEGMENT_FORMAT ": %s",
+		             active->id, g_strerror (errno));
+		if (ftruncate (active->fd, active->size) != 0)
+			g_warning ("Could not truncate segment " LOG_SEGMENT_FORMAT,
+			           active->id);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Starts a new active segment once the current one is full. */
+static void
+log_roll (CatalinaLogBackendPrivate *priv)
+{
+	Segment *segment;
+	GError  *error = NULL;
+
+	if (priv->active->size < priv->segment_size)
+		return;
+
+	/* catalina_backend_sync() only covers the active segment */
+	if (priv->no_sync && fsync (priv->active->fd) != 0)
+		g_warning ("Could not sync segment " LOG_SEGMENT_FORMAT ": %s",
+		           priv->active->id, g_strerror (errno));
+
+	if (!(segment = segment_open (priv, SEGMENT_NEXT (priv->active->id), TRUE, &error))) {
+		g_warning ("%s", error->message);
+		g_error_free (error);
+		return;
+	}
+
+	g_static_rw_lock_writer_lock (&priv->lock);
+	priv->segments = g_list_append (priv->segments, segment);
+	priv->active = segment;
+	g_static_rw_lock_writer_unlock (&priv->lock);
+
+	merger_wake (priv, FALSE);
+}
+
+/***************************************************************************
+ *                                 Object                                  *
+ ***************************************************************************/
+
+static void
+catalina_log_backend_get_property (GObject    *object,
+                                   guint       property_id,
+                                   GValue     *value,
+                                   GParamSpec *pspec)
+{
+	switch (property_id) {
+	case PROP_SEGMENT_SIZE:
+		g_value_set_uint (value, catalina_log_backend_get_segment_size ((gpointer)object));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+	}
+}
+
+static void
+catalina_log_backend_set_property (GObject      *object,
+                                   guint         property_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+	switch (property_id) {
+	case PROP_SEGMENT_SIZE:
+		catalina_log_backend_set_segment_size ((gpointer)object, g_value_get_uint (value));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+	}
+}
+
+static void
+catalina_log_backend_finalize (GObject *object)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (object)->priv;
+
+	if (priv->active)
+		catalina_backend_close (CATALINA_BACKEND (object), NULL);
+
+	g_hash_table_destroy (priv->pending);
+	g_queue_free (priv->pending_order);
+	g_queue_free (priv->order);
+	g_hash_table_destroy (priv->index);
+	g_static_rw_lock_free (&priv->lock);
+	g_mutex_free (priv->merger_mutex);
+	g_cond_free (priv->merger_cond);
+
+	G_OBJECT_CLASS (catalina_log_backend_parent_class)->finalize (object);
+}
+
+static void
+catalina_log_backend_class_init (CatalinaLogBackendClass *klass)
+{
+	GObjectClass *object_class;
+
+	g_type_class_add_private (klass, sizeof (CatalinaLogBackendPrivate));
+
+	object_class = G_OBJECT_CLASS (klass);
+	object_class->set_property = catalina_log_backend_set_property;
+	object_class->get_property = catalina_log_backend_get_property;
+	object_class->finalize     = catalina_log_backend_finalize;
+
+	/**
+	 * CatalinaLogBackend:segment-size:
+	 *
+	 * The "segment-size" property.  Once the active segment grows beyond this many
+	 * bytes it becomes immutable and a new segment is started.  Immutable segments
+	 * are the unit of merging.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_SEGMENT_SIZE,
+	                                 g_param_spec_uint ("segment-size",
+	                                                    "SegmentSize",
+	                                                    "Size at which a new segment "
+	                                                    "is started.",
+	                                                    4096,
+	                                                    G_MAXUINT,
+	                                                    LOG_DEFAULT_SEGMENT_SIZE,
+	                                                    G_PARAM_READWRITE));
+}
+
+static void
+catalina_log_backend_init (CatalinaLogBackend *backend)
+{
+	CatalinaLogBackendPrivate *priv;
+
+	backend->priv = G_TYPE_INSTANCE_GET_PRIVATE (backend,
+	                                             CATALINA_TYPE_LOG_BACKEND,
+	                                             CatalinaLogBackendPrivate);
+	priv = backend->priv;
+
+	priv->segment_size = LOG_DEFAULT_SEGMENT_SIZE;
+	g_static_rw_lock_init (&priv->lock);
+	priv->index = g_hash_table_new_full (log_key_hash, log_key_equal, NULL, entry_free);
+	priv->order = g_queue_new ();
+	priv->pending = g_hash_table_new_full (log_key_hash, log_key_equal, NULL, pending_free);
+	priv->pending_order = g_queue_new ();
+	priv->merger_mutex = g_mutex_new ();
+	priv->merger_cond = g_cond_new ();
+}
+
+/**
+ * catalina_log_backend_new:
+ *
+ * Creates a new instance of #CatalinaLogBackend.
+ *
+ * Return value: the newly created #CatalinaLogBackend instance
+ */
+CatalinaBackend*
+catalina_log_backend_new (void)
+{
+	return g_object_new (CATALINA_TYPE_LOG_BACKEND, NULL);
+}
+
+/**
+ * catalina_log_backend_get_segment_size:
+ * @backend: A #CatalinaLogBackend
+ *
+ * Retrieves the "segment-size" property.
+ *
+ * Return value: the size in bytes at which segments are rolled
+ */
+guint
+catalina_log_backend_get_segment_size (CatalinaLogBackend *backend)
+{
+	g_return_val_if_fail (CATALINA_IS_LOG_BACKEND (backend), 0);
+	return backend->priv->segment_size;
+}
+
+/**
+ * catalina_log_backend_set_segment_size:
+ * @backend: A #CatalinaLogBackend
+ * @segment_size: the size in bytes at which segments are rolled
+ *
+ * Sets the "segment-size" property.
+ *
+ * This method is not thread-safe.
+ */
+void
+catalina_log_backend_set_segment_size (CatalinaLogBackend *backend,
+                                       guint               segment_size)
+{
+	g_return_if_fail (CATALINA_IS_LOG_BACKEND (backend));
+	backend->priv->segment_size = segment_size;
+	g_object_notify (G_OBJECT (backend), "segment-size");
+}
+
+/***************************************************************************
+ *                           Backend Interface                             *
+ ***************************************************************************/
+
+static gint
+guint64_compare (gconstpointer a,
+                 gconstpointer b)
+{
+	guint64 ia = *(const guint64*)a,
+	        ib = *(const guint64*)b;
+
+	return (ia > ib) - (ia < ib);
+}
+
+static gboolean
+catalina_log_backend_real_close (CatalinaBackend  *backend,
+                                 GError          **error);
+
+static gboolean
+catalina_log_backend_real_open (CatalinaBackend  *backend,
+                                const gchar      *path,
+                                GError          **error)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	GDir                      *dir;
+	GArray                    *ids;
+	Segment                   *segment;
+	const gchar               *name;
+	gchar                     *end;
+	guint64                    id,
+	                           valid;
+	guint                      i;
+
+	if (!g_file_test (path, G_FILE_TEST_IS_DIR))
+		g_mkdir_with_parents (path, 0755);
+
+	if (!(dir = g_dir_open (path, 0, error)))
+		return FALSE;
+
+	priv->path = g_strdup (path);
+
+	/* replay the segments in the order they were written */
+	ids = g_array_new (FALSE, FALSE, sizeof (guint64));
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		id = g_ascii_strtoull (name, &end, 16);
+		if (end != name && g_str_equal (end, LOG_DATA_SUFFIX))
+			g_array_append_val (ids, id);
+	}
+	g_dir_close (dir);
+	g_array_sort (ids, guint64_compare);
+
+	for (i = 0; i < ids->len; i++) {
+		if (!(segment = segment_open (priv, g_array_index (ids, guint64, i), FALSE, error)))
+			goto failure;
+
+		priv->segments = g_list_append (priv->segments, segment);
+
+		if (segment_read_hint (priv, segment, index_apply, priv))
+			continue;
+
+		/* no hint, the segment was active when the data-store was last closed */
+		valid = segment_scan (segment, index_apply, priv);
+		if (valid < segment->size) {
+			g_warning ("Discarding %" G_GUINT64_FORMAT " bytes of incomplete "
+			           "records from segment " LOG_SEGMENT_FORMAT,
+			           segment->size - valid, segment->id);
+			if (ftruncate (segment->fd, valid) == 0)
+				segment->size = valid;
+		}
+	}
+
+	/* appends always go to a fresh segment */
+	id = ids->len ? SEGMENT_NEXT (g_array_index (ids, guint64, ids->len - 1)) : 0;
+	if (!(priv->active = segment_open (priv, id, TRUE, error)))
+		goto failure;
+	priv->segments = g_list_append (priv->segments, priv->active);
+
+	g_array_free (ids, TRUE);
+
+	priv->merger_stop = FALSE;
+	priv->merger_wake = TRUE;
+	priv->merger_force = FALSE;
+
+	if (!(priv->merger = g_thread_create (merger_thread, priv, TRUE, error))) {
+		catalina_log_backend_real_close (backend, NULL);
+		return FALSE;
+	}
+
+	return TRUE;
+
+failure:
+	g_array_free (ids, TRUE);
+	g_list_foreach (priv->segments, (GFunc)segment_free, NULL);
+	g_list_free (priv->segments);
+	priv->segments = NULL;
+	g_queue_clear (priv->order);
+	g_hash_table_remove_all (priv->index);
+	g_free (priv->path);
+	priv->path = NULL;
+
+	return FALSE;
+}
+
+static gboolean
+catalina_log_backend_real_close (CatalinaBackend  *backend,
+                                 GError          **error)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	GList                     *iter;
+	Segment                   *segment;
+	GError                    *hint_error = NULL;
+
+	if (priv->merger) {
+		g_mutex_lock (priv->merger_mutex);
+		priv->merger_stop = TRUE;
+		g_cond_signal (priv->merger_cond);
+		g_mutex_unlock (priv->merger_mutex);
+		g_thread_join (priv->merger);
+		priv->merger = NULL;
+	}
+
+	pending_clear (priv);
+
+	/* leave hints behind so the next open does not need to scan */
+	for (iter = priv->segments; iter; iter = iter->next) {
+		segment = iter->data;
+		if (segment == priv->active && segment->size == 0)
+			segment_unlink (priv, segment);
+		else if (!segment->hinted && !segment_write_hint (priv, segment, &hint_error)) {
+			g_warning ("%s", hint_error->message);
+			g_clear_error (&hint_error);
+		}
+		segment_free (segment);
+	}
+
+	g_list_free (priv->segments);
+	priv->segments = NULL;
+	priv->active = NULL;
+	g_queue_clear (priv->order);
+	g_hash_table_remove_all (priv->index);
+	g_free (priv->path);
+	priv->path = NULL;
+
+	return TRUE;
+}
+
+static gboolean
+catalina_log_backend_real_fetch (CatalinaBackend  *backend,
+                                 const gchar      *key,
+                                 gsize             key_length,
+                                 gchar           **data,
+                                 gsize            *data_length)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	Pending                   *pending;
+	Entry                     *entry;
+	gchar                     *buffer;
+	gboolean                   success;
+
+	/* uncommitted changes of the active transaction win */
+	if ((pending = pending_lookup (priv, key, key_length)) != NULL) {
+		if (pending->removed)
+			return FALSE;
+		*data = g_memdup (pending->data, MAX (1, pending->data_length));
+		*data_length = pending->data_length;
+		return TRUE;
+	}
+
+	g_static_rw_lock_reader_lock (&priv->lock);
+
+	if (!(entry = index_lookup (priv, key, key_length))) {
+		g_static_rw_lock_reader_unlock (&priv->lock);
+		return FALSE;
+	}
+
+	buffer = g_malloc (MAX (1, entry->length));
+	success = read_all (entry->segment->fd, buffer, entry->length, entry->offset);
+	*data_length = entry->length;
+
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	if (!success) {
+		g_warning ("Could not read record: %s", g_strerror (errno));
+		g_free (buffer);
+		return FALSE;
+	}
+
+	*data = buffer;
+
+	return TRUE;
+}
+
+static gboolean
+catalina_log_backend_real_size (CatalinaBackend *backend,
+                                const gchar     *key,
+                                gsize            key_length,
+                                gsize           *data_length)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	Pending                   *pending;
+	Entry                     *entry;
+
+	/* answered from the index so that writes do not read the value they replace */
+	if ((pending = pending_lookup (priv, key, key_length)) != NULL) {
+		if (pending->removed)
+			return FALSE;
+		*data_length = pending->data_length;
+		return TRUE;
+	}
+
+	g_static_rw_lock_reader_lock (&priv->lock);
+	if ((entry = index_lookup (priv, key, key_length)) != NULL)
+		*data_length = entry->length;
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	return entry != NULL;
+}
+
+static gboolean
+catalina_log_backend_real_store (CatalinaBackend  *backend,
+                                 const gchar      *key,
+                                 gsize             key_length,
+                                 const gchar      *data,
+                                 gsize             data_length,
+                                 GError          **error)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	Pending                   *pending;
+	GByteArray                *buffer;
+	guint64                    offset;
+
+	if (priv->in_txn) {
+		if (!(pending = pending_lookup (priv, key, key_length))) {
+			pending = g_slice_new0 (Pending);
+			pending->key = g_memdup (key, key_length);
+			pending->key_length = key_length;
+			g_hash_table_insert (priv->pending, pending, pending);
+			g_queue_push_tail (priv->pending_order, pending);
+		}
+		g_free (pending->data);
+		pending->data = g_memdup (data, data_length);
+		pending->data_length = data_length;
+		pending->removed = FALSE;
+		return TRUE;
+	}
+
+	buffer = g_byte_array_sized_new (LOG_HEADER_SIZE + key_length + data_length);
+	record_append (buffer, key, key_length, data, data_length, FALSE);
+
+	if (!log_append (priv, buffer, FALSE, error)) {
+		g_byte_array_free (buffer, TRUE);
+		return FALSE;
+	}
+
+	g_static_rw_lock_writer_lock (&priv->lock);
+	offset = priv->active->size + LOG_HEADER_SIZE + key_length;
+	priv->active->size += buffer->len;
+	index_apply (priv->active, key, key_length, offset, data_length, priv);
+	g_static_rw_lock_writer_unlock (&priv->lock);
+
+	g_byte_array_free (buffer, TRUE);
+	log_roll (priv);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_log_backend_real_remove (CatalinaBackend  *backend,
+                                  const gchar      *key,
+                                  gsize             key_length,
+                                  GError          **error)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	Pending                   *pending;
+	GByteArray                *buffer;
+	gboolean                   exists;
+
+	pending = pending_lookup (priv, key, key_length);
+
+	g_static_rw_lock_reader_lock (&priv->lock);
+	exists = pending ? !pending->removed : (index_lookup (priv, key, key_length) != NULL);
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	if (!exists) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
+		             "The key does not exist");
+		return FALSE;
+	}
+
+	if (priv->in_txn) {
+		if (!pending) {
+			pending = g_slice_new0 (Pending);
+			pending->key = g_memdup (key, key_length);
+			pending->key_length = key_length;
+			g_hash_table_insert (priv->pending, pending, pending);
+			g_queue_push_tail (priv->pending_order, pending);
+		}
+		g_free (pending->data);
+		pending->data = NULL;
+		pending->data_length = 0;
+		pending->removed = TRUE;
+		return TRUE;
+	}
+
+	buffer = g_byte_array_sized_new (LOG_HEADER_SIZE + key_length);
+	record_append (buffer, key, key_length, NULL, 0, TRUE);
+
+	if (!log_append (priv, buffer, FALSE, error)) {
+		g_byte_array_free (buffer, TRUE);
+		return FALSE;
+	}
+
+	g_static_rw_lock_writer_lock (&priv->lock);
+	priv->active->size += buffer->len;
+	index_apply (priv->active, key, key_length, 0, LOG_TOMBSTONE, priv);
+	g_static_rw_lock_writer_unlock (&priv->lock);
+
+	g_byte_array_free (buffer, TRUE);
+	log_roll (priv);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_log_backend_real_next_key (CatalinaBackend  *backend,
+                                    const gchar      *key,
+                                    gsize             key_length,
+                                    gchar           **next_key,
+                                    gsize            *next_key_length)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	Entry                     *entry;
+	GList                     *link = NULL;
+
+	g_static_rw_lock_reader_lock (&priv->lock);
+
+	if (!key)
+		link = priv->order->head;
+	else if ((entry = index_lookup (priv, key, key_length)) != NULL)
+		link = entry->link->next;
+
+	if (link) {
+		entry = link->data;
+		*next_key = g_memdup (entry->key, entry->key_length);
+		*next_key_length = entry->key_length;
+	}
+
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	return (link != NULL);
+}
+
+static gboolean
+catalina_log_backend_real_traverse (CatalinaBackend      *backend,
+                                    CatalinaBackendFunc   func,
+                                    gpointer              user_data,
+                                    GError              **error)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	Entry                     *entry;
+	GList                     *link,
+	                          *next;
+	gchar                     *key,
+	                          *value;
+	gsize                      key_length,
+	                           value_length;
+	gboolean                   success;
+
+	g_static_rw_lock_reader_lock (&priv->lock);
+
+	for (link = priv->order->head; link; link = next) {
+		entry = link->data;
+		key = g_memdup (entry->key, entry->key_length);
+		key_length = entry->key_length;
+		value_length = entry->length;
+		value = g_malloc (MAX (1, value_length));
+		success = read_all (entry->segment->fd, value, value_length, entry->offset);
+
+		/* fetch the next link first so the current record may be removed */
+		next = link->next;
+
+		/* the lock is released so @func may change the data-store */
+		g_static_rw_lock_reader_unlock (&priv->lock);
+
+		if (!success) {
+			g_set_error (error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_DB,
+			             "Could not read record: %s",
+			             g_strerror (errno));
+			g_free (key);
+			g_free (value);
+			return FALSE;
+		}
+
+		success = func (key, key_length, value, value_length, user_data);
+		g_free (key);
+		g_free (value);
+
+		if (!success)
+			return TRUE;
+
+		g_static_rw_lock_reader_lock (&priv->lock);
+	}
+
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_log_backend_real_transaction_begin (CatalinaBackend  *backend,
+                                             GError          **error)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+
+	if (priv->in_txn) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "A transaction is already active");
+		return FALSE;
+	}
+
+	priv->in_txn = TRUE;
+
+	return TRUE;
+}
+
+static gboolean
+catalina_log_backend_real_transaction_commit (CatalinaBackend  *backend,
+                                              GError          **error)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	GByteArray                *buffer;
+	GList                     *iter;
+	Pending                   *pending;
+	guint64                    offset;
+	guint32                    header [3],
+	                           trailer;
+	gboolean                   success = TRUE;
+
+	/* the whole transaction is appended and synced as a single write, framed so
+	 * that it is replayed as a whole or not at all */
+	buffer = g_byte_array_new ();
+	g_byte_array_set_size (buffer, LOG_HEADER_SIZE);
+	for (iter = priv->pending_order->head; iter; iter = iter->next) {
+		pending = iter->data;
+		record_append (buffer, pending->key, pending->key_length,
+		               pending->data, pending->data_length,
+		               pending->removed);
+	}
+
+	header [0] = GUINT32_TO_BE (LOG_FRAME);
+	header [1] = GUINT32_TO_BE (priv->pending_order->length);
+	header [2] = GUINT32_TO_BE (buffer->len - LOG_HEADER_SIZE);
+	memcpy (buffer->data, header, LOG_HEADER_SIZE);
+	trailer = GUINT32_TO_BE (log_checksum ((gchar*)buffer->data + LOG_HEADER_SIZE,
+	                                       buffer->len - LOG_HEADER_SIZE, NULL, 0));
+	g_byte_array_append (buffer, (guint8*)&trailer, LOG_FRAME_TRAILER_SIZE);
+
+	if (priv->pending_order->length > 0) {
+		if (!(success = log_append (priv, buffer, !priv->no_sync, error)))
+			goto cleanup;
+
+		g_static_rw_lock_writer_lock (&priv->lock);
+
+		offset = priv->active->size + LOG_HEADER_SIZE;
+		for (iter = priv->pending_order->head; iter; iter = iter->next) {
+			pending = iter->data;
+			index_apply (priv->active, pending->key, pending->key_length,
+			             offset + LOG_HEADER_SIZE + pending->key_length,
+			             pending->removed ? LOG_TOMBSTONE : pending->data_length,
+			             priv);
+			offset += RECORD_SIZE (pending->key_length,
+			                       pending->removed ? LOG_TOMBSTONE : pending->data_length);
+		}
+		priv->active->size += buffer->len;
+
+		g_static_rw_lock_writer_unlock (&priv->lock);
+	}
+
+cleanup:
+	g_byte_array_free (buffer, TRUE);
+	pending_clear (priv);
+
+	if (success)
+		log_roll (priv);
+
+	return success;
+}
+
+static gboolean
+catalina_log_backend_real_transaction_cancel (CatalinaBackend  *backend,
+                                              GError          **error)
+{
+	pending_clear (CATALINA_LOG_BACKEND (backend)->priv);
+	return TRUE;
+}
+
+static gboolean
+catalina_log_backend_real_compact (CatalinaBackend  *backend,
+                                   GError          **error)
+{
+	/* merging happens in the background, just make sure it runs soon */
+	merger_wake (CATALINA_LOG_BACKEND (backend)->priv, TRUE);
+	return TRUE;
+}
+
+static gboolean
+catalina_log_backend_real_get_space (CatalinaBackend *backend,
+                                     guint64         *size,
+                                     guint64         *free_size)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	Segment                   *segment;
+	GList                     *iter;
+
+	*size = 0;
+	*free_size = 0;
+
+	g_static_rw_lock_reader_lock (&priv->lock);
+	for (iter = priv->segments; iter; iter = iter->next) {
+		segment = iter->data;
+		*size += segment->size;
+		*free_size += segment->dead;
+	}
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_log_backend_real_set_sync (CatalinaBackend *backend,
+                                    gboolean         sync)
+{
+	CATALINA_LOG_BACKEND (backend)->priv->no_sync = !sync;
+	return TRUE;
+}
+
+static gboolean
+catalina_log_backend_real_sync (CatalinaBackend  *backend,
+                                GError          **error)
+{
+	CatalinaLogBackendPrivate *priv = CATALINA_LOG_BACKEND (backend)->priv;
+	gint                       fd = -1,
+	                           ret;
+
+	/* a duplicate stays valid if the segment is rolled or merged meanwhile */
+	g_static_rw_lock_reader_lock (&priv->lock);
+	if (priv->active)
+		fd = dup (priv->active->fd);
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	if (fd < 0)
+		return TRUE;
+
+	ret = fsync (fd);
+	close (fd);
+
+	if (ret != 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not sync the active segment: %s",
+		             g_strerror (errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+catalina_log_backend_base_init (CatalinaBackendIface *iface)
+{
+	iface->open               = catalina_log_backend_real_open;
+	iface->close              = catalina_log_backend_real_close;
+	iface->fetch              = catalina_log_backend_real_fetch;
+	iface->size               = catalina_log_backend_real_size;
+	iface->store              = catalina_log_backend_real_store;
+	iface->remove             = catalina_log_backend_real_remove;
+	iface->next_key           = catalina_log_backend_real_next_key;
+	iface->traverse           = catalina_log_backend_real_traverse;
+	iface->transaction_begin  = catalina_log_backend_real_transaction_begin;
+	iface->transaction_commit = catalina_log_backend_real_transaction_commit;
+	iface->transaction_cancel = catalina_log_backend_real_transaction_cancel;
+	iface->compact            = catalina_log_backend_real_compact;
+	iface->get_space          = catalina_log_backend_real_get_space;
+	iface->set_sync           = catalina_log_backend_real_set_sync;
+	iface->sync               = catalina_log_backend_real_sync;
+}
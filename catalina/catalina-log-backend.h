@@ -0,0 +1,62 @@
+/* catalina-log-backend.h
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __CATALINA_LOG_BACKEND_H__
+#define __CATALINA_LOG_BACKEND_H__
+
+#include <glib-object.h>
+
+#include "catalina-backend.h"
+
+G_BEGIN_DECLS
+
+#define CATALINA_TYPE_LOG_BACKEND            (catalina_log_backend_get_type())
+#define CATALINA_LOG_BACKEND(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj),  CATALINA_TYPE_LOG_BACKEND, CatalinaLogBackend))
+#define CATALINA_LOG_BACKEND_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),   CATALINA_TYPE_LOG_BACKEND, CatalinaLogBackendClass))
+#define CATALINA_IS_LOG_BACKEND(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj),  CATALINA_TYPE_LOG_BACKEND))
+#define CATALINA_IS_LOG_BACKEND_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),   CATALINA_TYPE_LOG_BACKEND))
+#define CATALINA_LOG_BACKEND_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),   CATALINA_TYPE_LOG_BACKEND, CatalinaLogBackendClass))
+
+typedef struct _CatalinaLogBackend        CatalinaLogBackend;
+typedef struct _CatalinaLogBackendClass   CatalinaLogBackendClass;
+typedef struct _CatalinaLogBackendPrivate CatalinaLogBackendPrivate;
+
+struct _CatalinaLogBackend
+{
+	GObject parent;
+
+	/*< private >*/
+	CatalinaLogBackendPrivate *priv;
+};
+
+struct _CatalinaLogBackendClass
+{
+	GObjectClass parent_class;
+};
+
+GType            catalina_log_backend_get_type         (void);
+CatalinaBackend* catalina_log_backend_new              (void);
+guint            catalina_log_backend_get_segment_size (CatalinaLogBackend *backend);
+void             catalina_log_backend_set_segment_size (CatalinaLogBackend *backend,
+                                                        guint               segment_size);
+
+G_END_DECLS
+
+#endif /* __CATALINA_LOG_BACKEND_H__ */
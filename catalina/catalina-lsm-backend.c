@@ -0,0 +1,2646 @@
+/* catalina-lsm-backend.c
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "catalina-lsm-backend.h"
+#include "catalina-storage.h"
+
+/**
+ * SECTION:catalina-lsm-backend
+ * @title: CatalinaLsmBackend
+ * @short_description: log-structured merge-tree storage engine
+ *
+ * #CatalinaLsmBackend is built for write-heavy workloads.  Writes go to a sorted
+ * in-memory table, the memtable, and are appended to a write-ahead log so they
+ * survive a crash.  Once the memtable reaches the "memtable-size" property it is
+ * frozen and a background thread writes it out as an immutable sorted run file,
+ * while a new memtable keeps absorbing writes.  Writes therefore never update the
+ * data-store in place and disk writes stay sequential.
+ *
+ * Runs are organized in levels.  Runs flushed from memtables enter level 0 and
+ * may overlap.  The background thread merges them into level 1, and each level
+ * beyond that holds non-overlapping runs and is ten times larger than the one
+ * above it.  When a level outgrows its budget one of its runs is merged into the
+ * next level, discarding overwritten values and, at the bottom, removed records.
+ *
+ * Each run carries a sparse block index and a bloom filter, so a lookup reads at
+ * most one block from each level it cannot rule out.  Keys are kept in order,
+ * which makes this an ordered backend supporting catalina_storage_scan_range_async().
+ *
+ * The data-store is a directory holding the runs, the write-ahead logs and a
+ * MANIFEST file listing the runs of each level.  The records of a transaction are
+ * framed in the write-ahead log by a header holding their number and length and
+ * followed by a checksum of the frame, so that a commit torn by a crash is
+ * discarded as a whole when the log is replayed.
+ *
+ * |[
+ * CatalinaStorage *storage = catalina_storage_new ();
+ * g_object_set (storage, "backend", catalina_lsm_backend_new (), NULL);
+ * catalina_storage_open (storage, ".", "events.lsm", NULL);
+ * ]|
+ */
+
+#define LSM_DEFAULT_MEMTABLE_SIZE (4 * 1024 * 1024)
+#define LSM_MAX_HEIGHT            12
+#define LSM_TOMBSTONE             G_MAXUINT32
+#define LSM_RECORD_HEADER         8
+#define LSM_WAL_HEADER            12
+#define LSM_WAL_FRAME             G_MAXUINT32        /* key length of a commit frame header */
+#define LSM_WAL_TRAILER           4
+#define LSM_BLOCK_SIZE            4096
+#define LSM_FOOTER_SIZE           36
+#define LSM_RUN_MAGIC             0x434C534DU
+#define LSM_RUN_SIZE              (2 * 1024 * 1024)  /* compaction output size */
+#define LSM_MAX_LEVELS            7
+#define LSM_L0_TRIGGER            4                  /* level 0 runs that trigger a merge */
+#define LSM_LEVEL_BASE            (8 * 1024 * 1024)  /* budget of level 1 */
+#define LSM_LEVEL_RATIO           10
+#define LSM_BLOOM_BITS            10                 /* bits per record */
+#define LSM_BLOOM_HASHES          7
+#define LSM_SCAN_BATCH            256
+#define LSM_ID_FORMAT             "%016" G_GINT64_MODIFIER "x"
+#define LSM_RUN_SUFFIX            ".run"
+#define LSM_WAL_SUFFIX            ".wal"
+#define LSM_MANIFEST              "MANIFEST"
+
+#define NODE_SIZE(kl,l)           (sizeof (SkipNode) + (kl) + (l))
+
+static void catalina_lsm_backend_base_init (CatalinaBackendIface *iface);
+
+G_DEFINE_TYPE_EXTENDED (CatalinaLsmBackend,
+                        catalina_lsm_backend,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (CATALINA_TYPE_BACKEND,
+                                               catalina_lsm_backend_base_init))
+
+enum
+{
+	PROP_0,
+	PROP_MEMTABLE_SIZE,
+};
+
+typedef struct _SkipNode SkipNode;
+
+struct _SkipNode
+{
+	gchar     *key;
+	gsize      key_length;
+	gchar     *data;
+	gsize      data_length;
+	gboolean   removed;
+	SkipNode  *next [1];   /* one link per level of the node */
+};
+
+/* Records are never unlinked from a memtable; removals insert a tombstone. */
+typedef struct
+{
+	SkipNode  *head;
+	guint      height;
+	guint32    seed;
+	gsize      size;       /* approximate memory used by the records */
+	guint      n_records;
+	GSList    *wals;       /* write-ahead logs holding the records */
+} Memtable;
+
+typedef struct
+{
+	gchar   *key;          /* first key of the block */
+	gsize    key_length;
+	guint64  offset;
+	guint32  length;
+} Block;
+
+typedef struct
+{
+	guint64   id;
+	gint      fd;
+	guint64   size;
+	guint32   n_records;
+	guint     n_blocks;
+	Block    *blocks;
+	gchar    *last_key;
+	gsize     last_key_length;
+	guchar   *bloom;
+	guint32   bloom_bits;
+	guint32   bloom_hashes;
+} Run;
+
+/* A cursor walks a memtable or a sorted array of non-overlapping runs. */
+typedef struct
+{
+	Memtable    *memtable;
+	SkipNode    *node;
+
+	Run        **runs;
+	guint        n_runs;
+	guint        run;
+	guint        block;
+	gchar       *buffer;
+	gsize        buffer_length;
+	gsize        offset;
+
+	gboolean     valid;
+	const gchar *key;
+	gsize        key_length;
+	const gchar *data;
+	gsize        data_length;
+	gboolean     removed;
+} Cursor;
+
+typedef struct
+{
+	CatalinaLsmBackendPrivate *priv;
+	Run                       *run;
+	gchar                     *path;
+	GByteArray                *block;
+	GArray                    *blocks;
+	GArray                    *hashes;
+	gchar                     *last_key;
+	gsize                      last_key_length;
+	gboolean                   failed;
+} RunBuilder;
+
+struct _CatalinaLsmBackendPrivate
+{
+	gchar         *path;              /* directory holding the data-store */
+	guint          memtable_size;     /* size at which the memtable is frozen */
+	guint64        next_id;           /* next run or log id, protected by mutex */
+
+	GStaticRWLock  lock;              /* protects memtable, immutable and levels */
+	Memtable      *memtable;
+	Memtable      *immutable;         /* frozen memtable being flushed */
+	GPtrArray     *levels [LSM_MAX_LEVELS]; /* level 0 newest last, others by key */
+	gchar         *compact_pointer [LSM_MAX_LEVELS];
+	gsize          compact_pointer_length [LSM_MAX_LEVELS];
+
+	gint           wal_fd;            /* log of the active memtable */
+	guint64        wal_size;
+
+	gboolean       in_txn;
+	Memtable      *pending;           /* changes of the active transaction */
+
+	GThread       *worker;            /* flushes memtables and merges runs */
+	GMutex        *mutex;
+	GCond         *worker_cond;
+	GCond         *flushed_cond;      /* signalled once the immutable memtable is gone */
+	gboolean       worker_wake;
+	gboolean       worker_force;
+	gboolean       worker_stop;
+	gboolean       worker_stalled;    /* a flush failed, writes can not rotate */
+};
+
+/***************************************************************************
+ *                               Helpers                                   *
+ ***************************************************************************/
+
+static inline guint32
+read32 (const gchar *p)
+{
+	guint32 v;
+	memcpy (&v, p, sizeof (v));
+	return GUINT32_FROM_BE (v);
+}
+
+static inline guint64
+read64 (const gchar *p)
+{
+	guint64 v;
+	memcpy (&v, p, sizeof (v));
+	return GUINT64_FROM_BE (v);
+}
+
+static inline void
+append32 (GByteArray *buffer,
+          guint32     v)
+{
+	v = GUINT32_TO_BE (v);
+	g_byte_array_append (buffer, (guint8*)&v, sizeof (v));
+}
+
+static inline void
+append64 (GByteArray *buffer,
+          guint64     v)
+{
+	v = GUINT64_TO_BE (v);
+	g_byte_array_append (buffer, (guint8*)&v, sizeof (v));
+}
+
+static gint
+key_compare (const gchar *a,
+             gsize        a_length,
+             const gchar *b,
+             gsize        b_length)
+{
+	gint cmp;
+
+	if ((cmp = memcmp (a, b, MIN (a_length, b_length))) != 0)
+		return cmp;
+
+	return (a_length > b_length) - (a_length < b_length);
+}
+
+/* FNV-1a, also the first bloom filter hash */
+static guint32
+lsm_hash (const gchar *key,
+          gsize        key_length,
+          const gchar *data,
+          gsize        data_length)
+{
+	guint32 h = 2166136261U;
+	gsize   i;
+
+	for (i = 0; i < key_length; i++)
+		h = (h ^ (guchar)key [i]) * 16777619U;
+	for (i = 0; i < data_length; i++)
+		h = (h ^ (guchar)data [i]) * 16777619U;
+
+	return h;
+}
+
+static guint32
+lsm_hash2 (const gchar *key,
+           gsize        key_length)
+{
+	guint32 h = 5381;
+	gsize   i;
+
+	for (i = 0; i < key_length; i++)
+		h = (h << 5) + h + (guchar)key [i];
+
+	return h | 1;
+}
+
+static gboolean
+write_all (gint         fd,
+           const gchar *buffer,
+           gsize        length,
+           guint64      offset)
+{
+	gssize ret;
+
+	while (length > 0) {
+		if ((ret = pwrite (fd, buffer, length, offset)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		buffer += ret;
+		length -= ret;
+		offset += ret;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+read_all (gint     fd,
+          gchar   *buffer,
+          gsize    length,
+          guint64  offset)
+{
+	gssize ret;
+
+	while (length > 0) {
+		if ((ret = pread (fd, buffer, length, offset)) <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		buffer += ret;
+		length -= ret;
+		offset += ret;
+	}
+
+	return TRUE;
+}
+
+static gchar*
+lsm_path (CatalinaLsmBackendPrivate *priv,
+          guint64                    id,
+          const gchar               *suffix)
+{
+	return g_strdup_printf ("%s" G_DIR_SEPARATOR_S LSM_ID_FORMAT "%s",
+	                        priv->path, id, suffix);
+}
+
+static guint64
+lsm_next_id (CatalinaLsmBackendPrivate *priv)
+{
+	guint64 id;
+
+	g_mutex_lock (priv->mutex);
+	id = priv->next_id++;
+	g_mutex_unlock (priv->mutex);
+
+	return id;
+}
+
+/***************************************************************************
+ *                               Memtables                                 *
+ ***************************************************************************/
+
+static SkipNode*
+skip_node_new (guint height)
+{
+	return g_malloc0 (sizeof (SkipNode) + (height - 1) * sizeof (SkipNode*));
+}
+
+static Memtable*
+memtable_new (void)
+{
+	Memtable *memtable;
+
+	memtable = g_slice_new0 (Memtable);
+	memtable->head = skip_node_new (LSM_MAX_HEIGHT);
+	memtable->height = 1;
+	memtable->seed = 0x9E3779B9U;
+
+	return memtable;
+}
+
+static void
+memtable_free (Memtable *memtable)
+{
+	SkipNode *node,
+	         *next;
+
+	for (node = memtable->head; node; node = next) {
+		next = node->next [0];
+		g_free (node->key);
+		g_free (node->data);
+		g_free (node);
+	}
+
+	g_slist_foreach (memtable->wals, (GFunc)g_free, NULL);
+	g_slist_free (memtable->wals);
+	g_slice_free (Memtable, memtable);
+}
+
+/* Finds the first node whose key is not less than @key, filling @update with the
+ * last node before it on each level when requested. */
+static SkipNode*
+memtable_seek (Memtable     *memtable,
+               const gchar  *key,
+               gsize         key_length,
+               SkipNode    **update)
+{
+	SkipNode *node = memtable->head;
+	gint      level;
+
+	if (!key)
+		return node->next [0];
+
+	for (level = memtable->height - 1; level >= 0; level--) {
+		while (node->next [level] &&
+		       key_compare (node->next [level]->key, node->next [level]->key_length,
+		                    key, key_length) < 0)
+			node = node->next [level];
+		if (update)
+			update [level] = node;
+	}
+
+	return node->next [0];
+}
+
+static SkipNode*
+memtable_lookup (Memtable    *memtable,
+                 const gchar *key,
+                 gsize        key_length)
+{
+	SkipNode *node = memtable_seek (memtable, key, key_length, NULL);
+
+	if (node && key_compare (node->key, node->key_length, key, key_length) == 0)
+		return node;
+
+	return NULL;
+}
+
+/* Stores a copy of the record, replacing any previous one.  A %NULL @data with
+ * @removed set is a tombstone. */
+static void
+memtable_put (Memtable    *memtable,
+              const gchar *key,
+              gsize        key_length,
+              const gchar *data,
+              gsize        data_length,
+              gboolean     removed)
+{
+	SkipNode *update [LSM_MAX_HEIGHT],
+	         *node;
+	guint     height = 1,
+	          level;
+
+	if (removed)
+		data_length = 0;
+
+	node = memtable_seek (memtable, key, key_length, update);
+
+	if (node && key_compare (node->key, node->key_length, key, key_length) == 0) {
+		memtable->size += data_length - node->data_length;
+		g_free (node->data);
+		node->data = g_memdup (data, data_length);
+		node->data_length = data_length;
+		node->removed = removed;
+		return;
+	}
+
+	/* xorshift, each level is a quarter as likely as the one below */
+	for (;;) {
+		memtable->seed ^= memtable->seed << 13;
+		memtable->seed ^= memtable->seed >> 17;
+		memtable->seed ^= memtable->seed << 5;
+		if (height == LSM_MAX_HEIGHT || (memtable->seed & 3) != 0)
+			break;
+		height++;
+	}
+
+	for (level = memtable->height; level < height; level++)
+		update [level] = memtable->head;
+	memtable->height = MAX (memtable->height, height);
+
+	node = skip_node_new (height);
+	node->key = g_memdup (key, key_length);
+	node->key_length = key_length;
+	node->data = g_memdup (data, data_length);
+	node->data_length = data_length;
+	node->removed = removed;
+
+	for (level = 0; level < height; level++) {
+		node->next [level] = update [level]->next [level];
+		update [level]->next [level] = node;
+	}
+
+	memtable->size += NODE_SIZE (key_length, data_length) + height * sizeof (SkipNode*);
+	memtable->n_records++;
+}
+
+/***************************************************************************
+ *                                 Runs                                    *
+ ***************************************************************************/
+
+/* Run files hold data blocks of sorted records, followed by the block index, the
+ * last key, the bloom filter and a fixed size footer. */
+
+static void
+run_free (Run *run)
+{
+	guint i;
+
+	for (i = 0; i < run->n_blocks; i++)
+		g_free (run->blocks [i].key);
+
+	if (run->fd >= 0)
+		close (run->fd);
+
+	g_free (run->blocks);
+	g_free (run->last_key);
+	g_free (run->bloom);
+	g_slice_free (Run, run);
+}
+
+static void
+run_unlink (CatalinaLsmBackendPrivate *priv,
+            Run                       *run)
+{
+	gchar *path;
+
+	path = lsm_path (priv, run->id, LSM_RUN_SUFFIX);
+	unlink (path);
+	g_free (path);
+}
+
+static Run*
+run_open (CatalinaLsmBackendPrivate  *priv,
+          guint64                     id,
+          GError                    **error)
+{
+	Run         *run;
+	gchar       *path,
+	             footer [LSM_FOOTER_SIZE],
+	            *meta = NULL;
+	const gchar *p,
+	            *end;
+	guint64      index_offset,
+	             bloom_offset;
+	off_t        size;
+	guint        i;
+
+	run = g_slice_new0 (Run);
+	run->id = id;
+
+	path = lsm_path (priv, id, LSM_RUN_SUFFIX);
+
+	if ((run->fd = open (path, O_RDONLY)) < 0 ||
+	    (size = lseek (run->fd, 0, SEEK_END)) < LSM_FOOTER_SIZE ||
+	    !read_all (run->fd, footer, LSM_FOOTER_SIZE, size - LSM_FOOTER_SIZE))
+	{
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not read run \"%s\": %s",
+		             path, g_strerror (errno));
+		goto failure;
+	}
+
+	run->size = size;
+	run->n_records = read32 (footer + 4);
+	run->n_blocks = read32 (footer + 8);
+	index_offset = read64 (footer + 12);
+	bloom_offset = read64 (footer + 20);
+	run->bloom_bits = read32 (footer + 28);
+	run->bloom_hashes = read32 (footer + 32);
+
+	if (read32 (footer) != LSM_RUN_MAGIC ||
+	    index_offset > bloom_offset ||
+	    bloom_offset + run->bloom_bits / 8 + LSM_FOOTER_SIZE != run->size)
+		goto corrupt;
+
+	meta = g_malloc (run->size - LSM_FOOTER_SIZE - index_offset);
+	if (!read_all (run->fd, meta, run->size - LSM_FOOTER_SIZE - index_offset, index_offset))
+		goto corrupt;
+
+	p = meta;
+	end = meta + (bloom_offset - index_offset);
+	run->blocks = g_new0 (Block, run->n_blocks);
+
+	for (i = 0; i < run->n_blocks; i++) {
+		if (p + 16 > end || p + 16 + read32 (p) > end)
+			goto corrupt;
+		run->blocks [i].key_length = read32 (p);
+		run->blocks [i].offset = read64 (p + 4);
+		run->blocks [i].length = read32 (p + 12);
+		run->blocks [i].key = g_memdup (p + 16, run->blocks [i].key_length);
+		p += 16 + run->blocks [i].key_length;
+	}
+
+	if (p + 4 > end || p + 4 + read32 (p) != end)
+		goto corrupt;
+	run->last_key_length = read32 (p);
+	run->last_key = g_memdup (p + 4, run->last_key_length);
+
+	run->bloom = g_memdup (end, run->bloom_bits / 8);
+
+	g_free (meta);
+	g_free (path);
+
+	return run;
+
+corrupt:
+	g_set_error (error, CATALINA_STORAGE_ERROR,
+	             CATALINA_STORAGE_ERROR_DB,
+	             "Run \"%s\" is corrupt", path);
+
+failure:
+	g_free (meta);
+	g_free (path);
+	run_free (run);
+
+	return NULL;
+}
+
+static gboolean
+run_may_contain (Run         *run,
+                 const gchar *key,
+                 gsize        key_length)
+{
+	guint32 h1,
+	        h2,
+	        bit;
+	guint   i;
+
+	if (run->n_blocks == 0 ||
+	    key_compare (key, key_length, run->blocks [0].key, run->blocks [0].key_length) < 0 ||
+	    key_compare (key, key_length, run->last_key, run->last_key_length) > 0)
+		return FALSE;
+
+	h1 = lsm_hash (key, key_length, NULL, 0);
+	h2 = lsm_hash2 (key, key_length);
+
+	for (i = 0; i < run->bloom_hashes; i++) {
+		bit = (h1 + i * h2) % run->bloom_bits;
+		if (!(run->bloom [bit / 8] & (1 << (bit % 8))))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Returns the last block whose first key is not greater than @key. */
+static guint
+run_find_block (Run         *run,
+                const gchar *key,
+                gsize        key_length)
+{
+	guint lo = 0,
+	      hi = run->n_blocks,
+	      mid;
+
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (key_compare (run->blocks [mid].key, run->blocks [mid].key_length,
+		                 key, key_length) <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static gchar*
+run_read_block (Run   *run,
+                guint  block)
+{
+	gchar *buffer;
+
+	buffer = g_malloc (run->blocks [block].length);
+
+	if (!read_all (run->fd, buffer, run->blocks [block].length, run->blocks [block].offset)) {
+		g_warning ("Could not read block %u of run " LSM_ID_FORMAT ": %s",
+		           block, run->id, g_strerror (errno));
+		g_free (buffer);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/* Looks up @key within @run.  A tombstone is found with @removed set. */
+static gboolean
+run_get (Run          *run,
+         const gchar  *key,
+         gsize         key_length,
+         gchar       **data,
+         gsize        *data_length,
+         gboolean     *removed)
+{
+	gchar    *buffer;
+	gsize     offset = 0,
+	          length;
+	guint32   record_key_length,
+	          record_length;
+	guint     block;
+	gboolean  found = FALSE;
+	gint      cmp;
+
+	if (!run_may_contain (run, key, key_length))
+		return FALSE;
+
+	block = run_find_block (run, key, key_length);
+	if (!(buffer = run_read_block (run, block)))
+		return FALSE;
+
+	length = run->blocks [block].length;
+
+	while (offset + LSM_RECORD_HEADER <= length) {
+		record_key_length = read32 (buffer + offset);
+		record_length = read32 (buffer + offset + 4);
+		cmp = key_compare (buffer + offset + LSM_RECORD_HEADER, record_key_length,
+		                   key, key_length);
+
+		if (cmp == 0) {
+			found = TRUE;
+			*removed = record_length == LSM_TOMBSTONE;
+			if (!*removed && data) {
+				*data = g_memdup (buffer + offset + LSM_RECORD_HEADER + record_key_length,
+				                  record_length);
+				*data_length = record_length;
+			}
+			break;
+		}
+		else if (cmp > 0)
+			break;
+
+		offset += LSM_RECORD_HEADER + record_key_length +
+		          (record_length == LSM_TOMBSTONE ? 0 : record_length);
+	}
+
+	g_free (buffer);
+
+	return found;
+}
+
+static gint
+run_compare (gconstpointer a,
+             gconstpointer b)
+{
+	const Run *ra = *(Run**)a,
+	          *rb = *(Run**)b;
+
+	return key_compare (ra->blocks [0].key, ra->blocks [0].key_length,
+	                    rb->blocks [0].key, rb->blocks [0].key_length);
+}
+
+static guint64
+level_size (GPtrArray *level)
+{
+	guint64 size = 0;
+	guint   i;
+
+	for (i = 0; i < level->len; i++)
+		size += ((Run*)g_ptr_array_index (level, i))->size;
+
+	return size;
+}
+
+/***************************************************************************
+ *                              Run Builder                                *
+ ***************************************************************************/
+
+static RunBuilder*
+run_builder_new (CatalinaLsmBackendPrivate *priv)
+{
+	RunBuilder *builder;
+
+	builder = g_slice_new0 (RunBuilder);
+	builder->priv = priv;
+	builder->run = g_slice_new0 (Run);
+	builder->run->id = lsm_next_id (priv);
+	builder->path = lsm_path (priv, builder->run->id, LSM_RUN_SUFFIX);
+	builder->block = g_byte_array_new ();
+	builder->blocks = g_array_new (FALSE, FALSE, sizeof (Block));
+	builder->hashes = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+	if ((builder->run->fd = open (builder->path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+		builder->failed = TRUE;
+
+	return builder;
+}
+
+static void
+run_builder_flush_block (RunBuilder *builder)
+{
+	Block *block;
+
+	if (builder->block->len == 0)
+		return;
+
+	block = &g_array_index (builder->blocks, Block, builder->blocks->len - 1);
+	block->length = builder->block->len;
+
+	if (!builder->failed &&
+	    !write_all (builder->run->fd, (gchar*)builder->block->data,
+	                builder->block->len, block->offset))
+		builder->failed = TRUE;
+
+	builder->run->size += builder->block->len;
+	g_byte_array_set_size (builder->block, 0);
+}
+
+static void
+run_builder_add (RunBuilder  *builder,
+                 const gchar *key,
+                 gsize        key_length,
+                 const gchar *data,
+                 gsize        data_length,
+                 gboolean     removed)
+{
+	Block   block;
+	guint32 hashes [2];
+
+	if (builder->block->len == 0) {
+		block.key = g_memdup (key, key_length);
+		block.key_length = key_length;
+		block.offset = builder->run->size;
+		block.length = 0;
+		g_array_append_val (builder->blocks, block);
+	}
+
+	append32 (builder->block, key_length);
+	append32 (builder->block, removed ? LSM_TOMBSTONE : data_length);
+	g_byte_array_append (builder->block, (guint8*)key, key_length);
+	if (!removed)
+		g_byte_array_append (builder->block, (guint8*)data, data_length);
+
+	hashes [0] = lsm_hash (key, key_length, NULL, 0);
+	hashes [1] = lsm_hash2 (key, key_length);
+	g_array_append_vals (builder->hashes, hashes, 2);
+
+	g_free (builder->last_key);
+	builder->last_key = g_memdup (key, key_length);
+	builder->last_key_length = key_length;
+	builder->run->n_records++;
+
+	if (builder->block->len >= LSM_BLOCK_SIZE)
+		run_builder_flush_block (builder);
+}
+
+static guint64
+run_builder_size (RunBuilder *builder)
+{
+	return builder->run->size + builder->block->len;
+}
+
+static void
+run_builder_free (RunBuilder *builder)
+{
+	if (builder->run)
+		run_free (builder->run);
+	g_free (builder->path);
+	g_free (builder->last_key);
+	g_byte_array_free (builder->block, TRUE);
+	g_array_free (builder->blocks, TRUE);
+	g_array_free (builder->hashes, TRUE);
+	g_slice_free (RunBuilder, builder);
+}
+
+/* Writes the index, bloom filter and footer.  Returns the completed run, or %NULL
+ * if it is empty or could not be written, in which case the file is removed. */
+static Run*
+run_builder_finish (RunBuilder  *builder,
+                    GError     **error)
+{
+	Run        *run = builder->run;
+	GByteArray *meta;
+	Block      *block;
+	guint64     index_offset,
+	            bloom_offset;
+	guint32     h1,
+	            h2,
+	            bit;
+	guint       i,
+	            j;
+
+	run_builder_flush_block (builder);
+
+	run->n_blocks = builder->blocks->len;
+	run->blocks = (Block*)g_array_free (builder->blocks, FALSE);
+	builder->blocks = g_array_new (FALSE, FALSE, sizeof (Block));
+	run->last_key = builder->last_key;
+	run->last_key_length = builder->last_key_length;
+	builder->last_key = NULL;
+
+	if (run->n_records == 0) {
+		unlink (builder->path);
+		run_builder_free (builder);
+		return NULL;
+	}
+
+	if (builder->failed)
+		goto failure;
+
+	run->bloom_hashes = LSM_BLOOM_HASHES;
+	run->bloom_bits = (MAX (run->n_records * LSM_BLOOM_BITS, 64) + 7) & ~7;
+	run->bloom = g_malloc0 (run->bloom_bits / 8);
+	for (i = 0; i < builder->hashes->len; i += 2) {
+		h1 = g_array_index (builder->hashes, guint32, i);
+		h2 = g_array_index (builder->hashes, guint32, i + 1);
+		for (j = 0; j < run->bloom_hashes; j++) {
+			bit = (h1 + j * h2) % run->bloom_bits;
+			run->bloom [bit / 8] |= 1 << (bit % 8);
+		}
+	}
+
+	meta = g_byte_array_new ();
+	index_offset = run->size;
+	for (i = 0; i < run->n_blocks; i++) {
+		block = &run->blocks [i];
+		append32 (meta, block->key_length);
+		append64 (meta, block->offset);
+		append32 (meta, block->length);
+		g_byte_array_append (meta, (guint8*)block->key, block->key_length);
+	}
+	append32 (meta, run->last_key_length);
+	g_byte_array_append (meta, (guint8*)run->last_key, run->last_key_length);
+	bloom_offset = index_offset + meta->len;
+	g_byte_array_append (meta, run->bloom, run->bloom_bits / 8);
+
+	append32 (meta, LSM_RUN_MAGIC);
+	append32 (meta, run->n_records);
+	append32 (meta, run->n_blocks);
+	append64 (meta, index_offset);
+	append64 (meta, bloom_offset);
+	append32 (meta, run->bloom_bits);
+	append32 (meta, run->bloom_hashes);
+
+	if (!write_all (run->fd, (gchar*)meta->data, meta->len, index_offset) ||
+	    fsync (run->fd) != 0)
+	{
+		g_byte_array_free (meta, TRUE);
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not write run \"%s\": %s",
+		             builder->path, g_strerror (errno));
+		goto failure;
+	}
+
+	run->size += meta->len;
+	g_byte_array_free (meta, TRUE);
+	builder->run = NULL;
+	run_builder_free (builder);
+
+	return run;
+
+failure:
+	if (builder->failed)
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not write run \"%s\": %s",
+		             builder->path, g_strerror (errno));
+	unlink (builder->path);
+	run_builder_free (builder);
+
+	return NULL;
+}
+
+/***************************************************************************
+ *                                Cursors                                  *
+ ***************************************************************************/
+
+static void
+cursor_read_node (Cursor *cursor)
+{
+	if (!(cursor->valid = cursor->node != NULL))
+		return;
+
+	cursor->key = cursor->node->key;
+	cursor->key_length = cursor->node->key_length;
+	cursor->data = cursor->node->data;
+	cursor->data_length = cursor->node->data_length;
+	cursor->removed = cursor->node->removed;
+}
+
+/* Parses the record at the cursor's offset, moving on to the following blocks and
+ * runs once the current block is exhausted. */
+static void
+cursor_read_record (Cursor *cursor)
+{
+	guint32 length;
+
+	while (cursor->offset + LSM_RECORD_HEADER > cursor->buffer_length) {
+		g_free (cursor->buffer);
+		cursor->buffer = NULL;
+		cursor->buffer_length = 0;
+		cursor->offset = 0;
+
+		if (++cursor->block >= cursor->runs [cursor->run]->n_blocks) {
+			cursor->run++;
+			cursor->block = 0;
+		}
+
+		if (cursor->run >= cursor->n_runs ||
+		    !(cursor->buffer = run_read_block (cursor->runs [cursor->run], cursor->block)))
+		{
+			cursor->valid = FALSE;
+			return;
+		}
+
+		cursor->buffer_length = cursor->runs [cursor->run]->blocks [cursor->block].length;
+	}
+
+	cursor->valid = TRUE;
+	cursor->key_length = read32 (cursor->buffer + cursor->offset);
+	length = read32 (cursor->buffer + cursor->offset + 4);
+	cursor->key = cursor->buffer + cursor->offset + LSM_RECORD_HEADER;
+	cursor->removed = length == LSM_TOMBSTONE;
+	cursor->data = cursor->key + cursor->key_length;
+	cursor->data_length = cursor->removed ? 0 : length;
+}
+
+static void
+cursor_init_memtable (Cursor   *cursor,
+                      Memtable *memtable)
+{
+	memset (cursor, 0, sizeof (Cursor));
+	cursor->memtable = memtable;
+}
+
+static void
+cursor_init_runs (Cursor  *cursor,
+                  Run    **runs,
+                  guint    n_runs)
+{
+	memset (cursor, 0, sizeof (Cursor));
+	cursor->runs = runs;
+	cursor->n_runs = n_runs;
+}
+
+static void
+cursor_clear (Cursor *cursor)
+{
+	g_free (cursor->buffer);
+	cursor->buffer = NULL;
+}
+
+/* Positions the cursor at the first record whose key is not less than @key, or
+ * the first record if @key is %NULL. */
+static void
+cursor_seek (Cursor      *cursor,
+             const gchar *key,
+             gsize        key_length)
+{
+	Run *run;
+
+	if (cursor->memtable) {
+		cursor->node = memtable_seek (cursor->memtable, key, key_length, NULL);
+		cursor_read_node (cursor);
+		return;
+	}
+
+	cursor->run = 0;
+	cursor->block = 0;
+
+	if (key) {
+		while (cursor->run < cursor->n_runs) {
+			run = cursor->runs [cursor->run];
+			if (key_compare (run->last_key, run->last_key_length, key, key_length) >= 0)
+				break;
+			cursor->run++;
+		}
+		if (cursor->run < cursor->n_runs)
+			cursor->block = run_find_block (cursor->runs [cursor->run], key, key_length);
+	}
+
+	g_free (cursor->buffer);
+	cursor->buffer = NULL;
+	cursor->buffer_length = 0;
+	cursor->offset = 0;
+	cursor->valid = FALSE;
+
+	if (cursor->run >= cursor->n_runs)
+		return;
+
+	if (!(cursor->buffer = run_read_block (cursor->runs [cursor->run], cursor->block)))
+		return;
+	cursor->buffer_length = cursor->runs [cursor->run]->blocks [cursor->block].length;
+
+	for (cursor_read_record (cursor);
+	     cursor->valid && key &&
+	     key_compare (cursor->key, cursor->key_length, key, key_length) < 0;)
+	{
+		cursor->offset += LSM_RECORD_HEADER + cursor->key_length + cursor->data_length;
+		cursor_read_record (cursor);
+	}
+}
+
+static void
+cursor_next (Cursor *cursor)
+{
+	if (cursor->memtable) {
+		cursor->node = cursor->node->next [0];
+		cursor_read_node (cursor);
+		return;
+	}
+
+	cursor->offset += LSM_RECORD_HEADER + cursor->key_length + cursor->data_length;
+	cursor_read_record (cursor);
+}
+
+/* Returns the cursor holding the smallest key.  Cursors are ordered from the newest
+ * source to the oldest, so the first one wins a tie. */
+static Cursor*
+cursors_pick (Cursor *cursors,
+              guint   n_cursors)
+{
+	Cursor *best = NULL;
+	guint   i;
+
+	for (i = 0; i < n_cursors; i++) {
+		if (cursors [i].valid &&
+		    (!best || key_compare (cursors [i].key, cursors [i].key_length,
+		                           best->key, best->key_length) < 0))
+			best = &cursors [i];
+	}
+
+	return best;
+}
+
+/* Moves every cursor positioned at @key past it. */
+static void
+cursors_skip (Cursor      *cursors,
+              guint        n_cursors,
+              const gchar *key,
+              gsize        key_length)
+{
+	guint i;
+
+	for (i = 0; i < n_cursors; i++) {
+		if (cursors [i].valid &&
+		    key_compare (cursors [i].key, cursors [i].key_length, key, key_length) == 0)
+			cursor_next (&cursors [i]);
+	}
+}
+
+/***************************************************************************
+ *                           Write-Ahead Logs                              *
+ ***************************************************************************/
+
+static void
+wal_record (GByteArray  *buffer,
+            const gchar *key,
+            gsize        key_length,
+            const gchar *data,
+            gsize        data_length,
+            gboolean     removed)
+{
+	append32 (buffer, key_length);
+	append32 (buffer, removed ? LSM_TOMBSTONE : data_length);
+	append32 (buffer, lsm_hash (key, key_length, data, removed ? 0 : data_length));
+	g_byte_array_append (buffer, (guint8*)key, key_length);
+	if (!removed)
+		g_byte_array_append (buffer, (guint8*)data, data_length);
+}
+
+/* Starts a new log for @memtable and makes it the target of appends. */
+static gboolean
+wal_open (CatalinaLsmBackendPrivate  *priv,
+          Memtable                   *memtable,
+          GError                    **error)
+{
+	gchar *path;
+	gint   fd;
+
+	path = lsm_path (priv, lsm_next_id (priv), LSM_WAL_SUFFIX);
+
+	if ((fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not create log \"%s\": %s",
+		             path, g_strerror (errno));
+		g_free (path);
+		return FALSE;
+	}
+
+	if (priv->wal_fd >= 0)
+		close (priv->wal_fd);
+
+	priv->wal_fd = fd;
+	priv->wal_size = 0;
+	memtable->wals = g_slist_append (memtable->wals, path);
+
+	return TRUE;
+}
+
+static gboolean
+wal_append (CatalinaLsmBackendPrivate  *priv,
+            GByteArray                 *buffer,
+            gboolean                    sync,
+            GError                    **error)
+{
+	if (!write_all (priv->wal_fd, (gchar*)buffer->data, buffer->len, priv->wal_size) ||
+	    (sync && fsync (priv->wal_fd) != 0))
+	{
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not append to log: %s",
+		             g_strerror (errno));
+		if (ftruncate (priv->wal_fd, priv->wal_size) != 0)
+			g_warning ("Could not truncate log");
+		return FALSE;
+	}
+
+	priv->wal_size += buffer->len;
+
+	return TRUE;
+}
+
+/* Frames the records of @buffer, whose first LSM_WAL_HEADER bytes must have
+ * been reserved for the frame header. */
+static void
+wal_frame (GByteArray *buffer,
+           guint32     n_records)
+{
+	guint32 header [3],
+	        length = buffer->len - LSM_WAL_HEADER;
+
+	header [0] = GUINT32_TO_BE (LSM_WAL_FRAME);
+	header [1] = GUINT32_TO_BE (n_records);
+	header [2] = GUINT32_TO_BE (length);
+	memcpy (buffer->data, header, LSM_WAL_HEADER);
+	append32 (buffer, lsm_hash ((gchar*)buffer->data + LSM_WAL_HEADER,
+	                            length, NULL, 0));
+}
+
+/* Verifies the record at @offset within the @length bytes of @contents and
+ * returns its size, or 0 if it is incomplete or corrupt. */
+static gsize
+wal_parse (const gchar *contents,
+           gsize        length,
+           gsize        offset)
+{
+	guint32 key_length,
+	        data_length;
+	gsize   body_length;
+
+	if (offset + LSM_WAL_HEADER > length)
+		return 0;
+
+	key_length = read32 (contents + offset);
+	data_length = read32 (contents + offset + 4);
+	body_length = (gsize)key_length + (data_length == LSM_TOMBSTONE ? 0 : data_length);
+
+	if (key_length == LSM_WAL_FRAME ||
+	    body_length > length - offset - LSM_WAL_HEADER ||
+	    lsm_hash (contents + offset + LSM_WAL_HEADER, key_length,
+	              contents + offset + LSM_WAL_HEADER + key_length,
+	              body_length - key_length) != read32 (contents + offset + 8))
+		return 0;
+
+	return LSM_WAL_HEADER + body_length;
+}
+
+/* Verifies the commit frame at @offset and returns its size, or 0 if it or any of
+ * its records is incomplete or corrupt. */
+static gsize
+wal_parse_frame (const gchar *contents,
+                 gsize        length,
+                 gsize        offset)
+{
+	guint32 n_records,
+	        body_length,
+	        count = 0;
+	gsize   p,
+	        end,
+	        size;
+
+	if (offset + LSM_WAL_HEADER > length)
+		return 0;
+
+	n_records = read32 (contents + offset + 4);
+	body_length = read32 (contents + offset + 8);
+
+	if ((gsize)body_length + LSM_WAL_TRAILER > length - offset - LSM_WAL_HEADER)
+		return 0;
+
+	p = offset + LSM_WAL_HEADER;
+	end = p + body_length;
+	if (lsm_hash (contents + p, body_length, NULL, 0) != read32 (contents + end))
+		return 0;
+
+	for (; p < end; p += size, count++)
+		if (!(size = wal_parse (contents, end, p)))
+			return 0;
+
+	return count == n_records ? LSM_WAL_HEADER + body_length + LSM_WAL_TRAILER : 0;
+}
+
+static void
+wal_apply (const gchar *contents,
+           gsize        offset,
+           Memtable    *memtable)
+{
+	guint32  key_length = read32 (contents + offset),
+	         data_length = read32 (contents + offset + 4);
+	gboolean removed = data_length == LSM_TOMBSTONE;
+
+	memtable_put (memtable,
+	              contents + offset + LSM_WAL_HEADER, key_length,
+	              contents + offset + LSM_WAL_HEADER + key_length,
+	              removed ? 0 : data_length, removed);
+}
+
+/*
+ * Replays the records of a log into @memtable, stopping at the first torn record
+ * or commit frame.  The records of a frame are applied only once the whole frame
+ * has been verified.
+ */
+static void
+wal_replay (const gchar *path,
+            Memtable    *memtable)
+{
+	gchar *contents = NULL;
+	gsize  length = 0,
+	       offset = 0,
+	       size,
+	       p;
+
+	if (!g_file_get_contents (path, &contents, &length, NULL))
+		return;
+
+	while (offset + LSM_WAL_HEADER <= length) {
+		if (read32 (contents + offset) == LSM_WAL_FRAME) {
+			if (!(size = wal_parse_frame (contents, length, offset)))
+				break;
+			for (p = offset + LSM_WAL_HEADER;
+			     p < offset + size - LSM_WAL_TRAILER;
+			     p += wal_parse (contents, length, p))
+				wal_apply (contents, p, memtable);
+		}
+		else {
+			if (!(size = wal_parse (contents, length, offset)))
+				break;
+			wal_apply (contents, offset, memtable);
+		}
+		offset += size;
+	}
+
+	if (offset < length)
+		g_warning ("Discarding %" G_GSIZE_FORMAT " bytes of incomplete "
+		           "records from log \"%s\"", length - offset, path);
+
+	g_free (contents);
+}
+
+/***************************************************************************
+ *                                Manifest                                 *
+ ***************************************************************************/
+
+/* The manifest lists the runs of each level, level 0 from oldest to newest. */
+static gboolean
+manifest_write (CatalinaLsmBackendPrivate  *priv,
+                GPtrArray                 **levels,
+                GError                    **error)
+{
+	GString  *manifest;
+	gchar    *path;
+	gboolean  success;
+	guint     level,
+	          i;
+
+	manifest = g_string_new (NULL);
+	for (level = 0; level < LSM_MAX_LEVELS; level++)
+		for (i = 0; i < levels [level]->len; i++)
+			g_string_append_printf (manifest, "%u " LSM_ID_FORMAT "\n", level,
+			                        ((Run*)g_ptr_array_index (levels [level], i))->id);
+
+	path = g_build_filename (priv->path, LSM_MANIFEST, NULL);
+	success = g_file_set_contents (path, manifest->str, manifest->len, error);
+	g_free (path);
+	g_string_free (manifest, TRUE);
+
+	return success;
+}
+
+static gboolean
+manifest_read (CatalinaLsmBackendPrivate  *priv,
+               GError                    **error)
+{
+	gchar  *path,
+	       *contents = NULL,
+	      **lines,
+	       *end;
+	Run    *run;
+	guint64 level,
+	        id;
+	guint   i;
+
+	path = g_build_filename (priv->path, LSM_MANIFEST, NULL);
+	if (!g_file_test (path, G_FILE_TEST_EXISTS)) {
+		g_free (path);
+		return TRUE;
+	}
+
+	if (!g_file_get_contents (path, &contents, NULL, error)) {
+		g_free (path);
+		return FALSE;
+	}
+	g_free (path);
+
+	lines = g_strsplit (contents, "\n", 0);
+	g_free (contents);
+
+	for (i = 0; lines [i]; i++) {
+		if (!*lines [i])
+			continue;
+
+		level = g_ascii_strtoull (lines [i], &end, 10);
+		id = g_ascii_strtoull (end, NULL, 16);
+
+		if (level >= LSM_MAX_LEVELS) {
+			g_set_error (error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_DB,
+			             "Invalid manifest entry \"%s\"", lines [i]);
+			g_strfreev (lines);
+			return FALSE;
+		}
+
+		if (!(run = run_open (priv, id, error))) {
+			g_strfreev (lines);
+			return FALSE;
+		}
+
+		g_ptr_array_add (priv->levels [level], run);
+	}
+
+	g_strfreev (lines);
+
+	for (level = 1; level < LSM_MAX_LEVELS; level++)
+		g_ptr_array_sort (priv->levels [level], run_compare);
+
+	return TRUE;
+}
+
+/***************************************************************************
+ *                             Background Work                             *
+ ***************************************************************************/
+
+static GPtrArray*
+level_copy (GPtrArray  *level,
+            GPtrArray  *exclude)
+{
+	GPtrArray *copy;
+	gpointer   run;
+	guint      i,
+	           j;
+
+	copy = g_ptr_array_sized_new (level->len + 1);
+
+	for (i = 0; i < level->len; i++) {
+		run = g_ptr_array_index (level, i);
+		for (j = 0; exclude && j < exclude->len; j++)
+			if (g_ptr_array_index (exclude, j) == run)
+				break;
+		if (!exclude || j == exclude->len)
+			g_ptr_array_add (copy, run);
+	}
+
+	return copy;
+}
+
+/* Writes the immutable memtable out as a new level 0 run. */
+static gboolean
+worker_flush (CatalinaLsmBackendPrivate  *priv,
+              Memtable                   *memtable,
+              GError                    **error)
+{
+	RunBuilder *builder;
+	SkipNode   *node;
+	Run        *run;
+	GPtrArray  *levels [LSM_MAX_LEVELS],
+	           *old;
+	GSList     *iter;
+
+	builder = run_builder_new (priv);
+	for (node = memtable->head->next [0]; node; node = node->next [0])
+		run_builder_add (builder, node->key, node->key_length,
+		                 node->data, node->data_length, node->removed);
+
+	if (!(run = run_builder_finish (builder, error)) && memtable->n_records > 0)
+		return FALSE;
+
+	memcpy (levels, priv->levels, sizeof (levels));
+	levels [0] = level_copy (priv->levels [0], NULL);
+	if (run)
+		g_ptr_array_add (levels [0], run);
+
+	/* the logs are only removed once the manifest holds the run */
+	if (!manifest_write (priv, levels, error)) {
+		g_ptr_array_free (levels [0], TRUE);
+		if (run) {
+			run_unlink (priv, run);
+			run_free (run);
+		}
+		return FALSE;
+	}
+
+	g_static_rw_lock_writer_lock (&priv->lock);
+	old = priv->levels [0];
+	priv->levels [0] = levels [0];
+	priv->immutable = NULL;
+	g_static_rw_lock_writer_unlock (&priv->lock);
+
+	g_ptr_array_free (old, TRUE);
+
+	for (iter = memtable->wals; iter; iter = iter->next)
+		unlink (iter->data);
+	memtable_free (memtable);
+
+	return TRUE;
+}
+
+static guint64
+level_budget (guint level)
+{
+	guint64 budget = LSM_LEVEL_BASE;
+
+	while (--level > 0)
+		budget *= LSM_LEVEL_RATIO;
+
+	return budget;
+}
+
+/* Adds the runs of @level overlapping [@first, @last] to @overlap. */
+static void
+level_overlap (GPtrArray   *level,
+               const gchar *first,
+               gsize        first_length,
+               const gchar *last,
+               gsize        last_length,
+               GPtrArray   *overlap)
+{
+	Run   *run;
+	guint  i;
+
+	for (i = 0; i < level->len; i++) {
+		run = g_ptr_array_index (level, i);
+		if (key_compare (run->last_key, run->last_key_length, first, first_length) >= 0 &&
+		    key_compare (run->blocks [0].key, run->blocks [0].key_length, last, last_length) <= 0)
+			g_ptr_array_add (overlap, run);
+	}
+}
+
+/* Selects the runs to merge next.  @upper holds the runs of @input_level, newest
+ * first, and @lower the overlapping runs of the level below, ordered by key.
+ * Returns the level receiving the merged runs, or 0 if no merge is needed. */
+static guint
+worker_pick (CatalinaLsmBackendPrivate *priv,
+             gboolean                   force,
+             GPtrArray                 *upper,
+             GPtrArray                 *lower)
+{
+	GPtrArray *level0 = priv->levels [0];
+	Run       *run,
+	          *first = NULL,
+	          *last = NULL;
+	guint      level,
+	           i;
+
+	if (level0->len >= LSM_L0_TRIGGER || (force && level0->len > 0)) {
+		for (i = level0->len; i-- > 0;) {
+			run = g_ptr_array_index (level0, i);
+			g_ptr_array_add (upper, run);
+			if (!first || run_compare (&run, &first) < 0)
+				first = run;
+			if (!last || key_compare (run->last_key, run->last_key_length,
+			                          last->last_key, last->last_key_length) > 0)
+				last = run;
+		}
+		level_overlap (priv->levels [1], first->blocks [0].key, first->blocks [0].key_length,
+		               last->last_key, last->last_key_length, lower);
+		return 1;
+	}
+
+	for (level = 1; level < LSM_MAX_LEVELS - 1; level++) {
+		if (level_size (priv->levels [level]) <= level_budget (level))
+			continue;
+
+		/* take turns over the key space of the level */
+		run = g_ptr_array_index (priv->levels [level], 0);
+		for (i = 0; priv->compact_pointer [level] && i < priv->levels [level]->len; i++) {
+			last = g_ptr_array_index (priv->levels [level], i);
+			if (key_compare (last->blocks [0].key, last->blocks [0].key_length,
+			                 priv->compact_pointer [level],
+			                 priv->compact_pointer_length [level]) > 0)
+			{
+				run = last;
+				break;
+			}
+		}
+
+		g_free (priv->compact_pointer [level]);
+		priv->compact_pointer [level] = g_memdup (run->last_key, run->last_key_length);
+		priv->compact_pointer_length [level] = run->last_key_length;
+
+		g_ptr_array_add (upper, run);
+		level_overlap (priv->levels [level + 1], run->blocks [0].key, run->blocks [0].key_length,
+		               run->last_key, run->last_key_length, lower);
+		return level + 1;
+	}
+
+	return 0;
+}
+
+/* Merges runs into the next level.  Returns %FALSE when there is nothing to do or
+ * the merge failed. */
+static gboolean
+worker_compact (CatalinaLsmBackendPrivate *priv,
+                gboolean                   force)
+{
+	GPtrArray  *upper,
+	           *lower,
+	           *outputs,
+	           *levels [LSM_MAX_LEVELS],
+	           *old_upper,
+	           *old_lower;
+	Cursor     *cursors,
+	           *cursor;
+	RunBuilder *builder = NULL;
+	Run        *run;
+	GError     *error = NULL;
+	gchar      *key;
+	gsize       key_length;
+	gboolean    drop_removed = TRUE;
+	guint       output_level,
+	            input_level,
+	            n_cursors,
+	            i;
+
+	upper = g_ptr_array_new ();
+	lower = g_ptr_array_new ();
+	outputs = g_ptr_array_new ();
+
+	if (!(output_level = worker_pick (priv, force, upper, lower))) {
+		g_ptr_array_free (upper, TRUE);
+		g_ptr_array_free (lower, TRUE);
+		g_ptr_array_free (outputs, TRUE);
+		return FALSE;
+	}
+
+	input_level = output_level - 1;
+
+	/* removed records must shadow older values unless nothing lies below */
+	for (i = output_level + 1; i < LSM_MAX_LEVELS; i++)
+		if (priv->levels [i]->len > 0)
+			drop_removed = FALSE;
+
+	n_cursors = upper->len + 1;
+	cursors = g_new (Cursor, n_cursors);
+	for (i = 0; i < upper->len; i++) {
+		cursor_init_runs (&cursors [i], (Run**)&g_ptr_array_index (upper, i), 1);
+		cursor_seek (&cursors [i], NULL, 0);
+	}
+	cursor_init_runs (&cursors [upper->len], (Run**)lower->pdata, lower->len);
+	cursor_seek (&cursors [upper->len], NULL, 0);
+
+	while ((cursor = cursors_pick (cursors, n_cursors)) != NULL) {
+		key = g_memdup (cursor->key, cursor->key_length);
+		key_length = cursor->key_length;
+
+		if (!cursor->removed || !drop_removed) {
+			if (!builder)
+				builder = run_builder_new (priv);
+			run_builder_add (builder, key, key_length,
+			                 cursor->data, cursor->data_length, cursor->removed);
+			if (run_builder_size (builder) >= LSM_RUN_SIZE) {
+				if (!(run = run_builder_finish (builder, &error)))
+					break;
+				g_ptr_array_add (outputs, run);
+				builder = NULL;
+			}
+		}
+
+		cursors_skip (cursors, n_cursors, key, key_length);
+		g_free (key);
+	}
+
+	if (!error && builder) {
+		if ((run = run_builder_finish (builder, &error)) != NULL)
+			g_ptr_array_add (outputs, run);
+	}
+
+	for (i = 0; i < n_cursors; i++)
+		cursor_clear (&cursors [i]);
+	g_free (cursors);
+
+	if (!error) {
+		memcpy (levels, priv->levels, sizeof (levels));
+		levels [input_level] = level_copy (priv->levels [input_level], upper);
+		levels [output_level] = level_copy (priv->levels [output_level], lower);
+		for (i = 0; i < outputs->len; i++)
+			g_ptr_array_add (levels [output_level], g_ptr_array_index (outputs, i));
+		g_ptr_array_sort (levels [output_level], run_compare);
+
+		if (!manifest_write (priv, levels, &error)) {
+			g_ptr_array_free (levels [input_level], TRUE);
+			g_ptr_array_free (levels [output_level], TRUE);
+		}
+	}
+
+	if (error) {
+		g_warning ("Could not merge runs of level %u: %s", input_level, error->message);
+		g_error_free (error);
+		for (i = 0; i < outputs->len; i++) {
+			run_unlink (priv, g_ptr_array_index (outputs, i));
+			run_free (g_ptr_array_index (outputs, i));
+		}
+		g_ptr_array_free (upper, TRUE);
+		g_ptr_array_free (lower, TRUE);
+		g_ptr_array_free (outputs, TRUE);
+		return FALSE;
+	}
+
+	g_static_rw_lock_writer_lock (&priv->lock);
+	old_upper = priv->levels [input_level];
+	old_lower = priv->levels [output_level];
+	priv->levels [input_level] = levels [input_level];
+	priv->levels [output_level] = levels [output_level];
+	g_static_rw_lock_writer_unlock (&priv->lock);
+
+	g_ptr_array_free (old_upper, TRUE);
+	g_ptr_array_free (old_lower, TRUE);
+
+	/* readers only touch runs while holding the lock, so the inputs are unused */
+	for (i = 0; i < upper->len; i++) {
+		run_unlink (priv, g_ptr_array_index (upper, i));
+		run_free (g_ptr_array_index (upper, i));
+	}
+	for (i = 0; i < lower->len; i++) {
+		run_unlink (priv, g_ptr_array_index (lower, i));
+		run_free (g_ptr_array_index (lower, i));
+	}
+
+	g_ptr_array_free (upper, TRUE);
+	g_ptr_array_free (lower, TRUE);
+	g_ptr_array_free (outputs, TRUE);
+
+	return TRUE;
+}
+
+static gpointer
+worker_thread (gpointer data)
+{
+	CatalinaLsmBackendPrivate *priv = data;
+	Memtable                  *memtable;
+	GError                    *error = NULL;
+	gboolean                   force;
+
+	g_mutex_lock (priv->mutex);
+
+	while (!priv->worker_stop) {
+		if (!priv->worker_wake) {
+			g_cond_wait (priv->worker_cond, priv->mutex);
+			continue;
+		}
+
+		force = priv->worker_force;
+		priv->worker_wake = FALSE;
+		priv->worker_force = FALSE;
+		memtable = priv->immutable;
+		g_mutex_unlock (priv->mutex);
+
+		if (memtable && !worker_flush (priv, memtable, &error)) {
+			g_warning ("Could not flush memtable: %s", error->message);
+			g_clear_error (&error);
+			g_mutex_lock (priv->mutex);
+			priv->worker_stalled = TRUE;
+			g_cond_broadcast (priv->flushed_cond);
+			continue;
+		}
+
+		g_mutex_lock (priv->mutex);
+		priv->worker_stalled = FALSE;
+		g_cond_broadcast (priv->flushed_cond);
+		g_mutex_unlock (priv->mutex);
+
+		while (!priv->worker_stop && worker_compact (priv, force))
+			force = FALSE;
+
+		g_mutex_lock (priv->mutex);
+	}
+
+	g_mutex_unlock (priv->mutex);
+
+	return NULL;
+}
+
+static void
+worker_wake (CatalinaLsmBackendPrivate *priv,
+             gboolean                   force)
+{
+	g_mutex_lock (priv->mutex);
+	priv->worker_wake = TRUE;
+	priv->worker_force |= force;
+	g_cond_signal (priv->worker_cond);
+	g_mutex_unlock (priv->mutex);
+}
+
+/* Freezes the memtable so the worker flushes it, waiting for the previous flush
+ * to complete first. */
+static gboolean
+lsm_rotate (CatalinaLsmBackendPrivate  *priv,
+            GError                    **error)
+{
+	Memtable *memtable;
+
+	g_mutex_lock (priv->mutex);
+	while (priv->immutable && !priv->worker_stalled)
+		g_cond_wait (priv->flushed_cond, priv->mutex);
+	if (priv->immutable) {
+		priv->worker_wake = TRUE;
+		g_cond_signal (priv->worker_cond);
+		g_mutex_unlock (priv->mutex);
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "The memtable could not be flushed");
+		return FALSE;
+	}
+	g_mutex_unlock (priv->mutex);
+
+	memtable = memtable_new ();
+	if (!wal_open (priv, memtable, error)) {
+		memtable_free (memtable);
+		return FALSE;
+	}
+
+	g_mutex_lock (priv->mutex);
+	g_static_rw_lock_writer_lock (&priv->lock);
+	priv->immutable = priv->memtable;
+	priv->memtable = memtable;
+	g_static_rw_lock_writer_unlock (&priv->lock);
+	priv->worker_wake = TRUE;
+	g_cond_signal (priv->worker_cond);
+	g_mutex_unlock (priv->mutex);
+
+	return TRUE;
+}
+
+/***************************************************************************
+ *                                 Reads                                   *
+ ***************************************************************************/
+
+static gboolean
+memtable_get (Memtable     *memtable,
+              const gchar  *key,
+              gsize         key_length,
+              gchar       **data,
+              gsize        *data_length,
+              gboolean     *removed)
+{
+	SkipNode *node;
+
+	if (!memtable || !(node = memtable_lookup (memtable, key, key_length)))
+		return FALSE;
+
+	*removed = node->removed;
+	if (!node->removed && data) {
+		*data = g_memdup (node->data, node->data_length);
+		*data_length = node->data_length;
+	}
+
+	return TRUE;
+}
+
+/* Looks up @key from the newest source to the oldest.  The first source knowing
+ * about the key decides, a tombstone meaning the key was removed. */
+static gboolean
+lsm_get (CatalinaLsmBackendPrivate  *priv,
+         const gchar                *key,
+         gsize                       key_length,
+         gchar                     **data,
+         gsize                      *data_length)
+{
+	GPtrArray *level;
+	Run       *run;
+	gboolean   found = FALSE,
+	           removed = FALSE;
+	guint      lo,
+	           hi,
+	           mid,
+	           i;
+
+	if (priv->in_txn &&
+	    memtable_get (priv->pending, key, key_length, data, data_length, &removed))
+		return !removed;
+
+	g_static_rw_lock_reader_lock (&priv->lock);
+
+	found = memtable_get (priv->memtable, key, key_length, data, data_length, &removed) ||
+	        memtable_get (priv->immutable, key, key_length, data, data_length, &removed);
+
+	for (i = priv->levels [0]->len; !found && i-- > 0;)
+		found = run_get (g_ptr_array_index (priv->levels [0], i),
+		                 key, key_length, data, data_length, &removed);
+
+	for (i = 1; !found && i < LSM_MAX_LEVELS; i++) {
+		level = priv->levels [i];
+
+		/* the first run whose last key is not less than @key */
+		for (lo = 0, hi = level->len; lo < hi;) {
+			mid = (lo + hi) / 2;
+			run = g_ptr_array_index (level, mid);
+			if (key_compare (run->last_key, run->last_key_length, key, key_length) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (lo < level->len)
+			found = run_get (g_ptr_array_index (level, lo),
+			                 key, key_length, data, data_length, &removed);
+	}
+
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	return found && !removed;
+}
+
+typedef struct
+{
+	gchar *key;
+	gsize  key_length;
+	gchar *data;
+	gsize  data_length;
+} ScanItem;
+
+/* Collects up to LSM_SCAN_BATCH live records following @position into @items.
+ * Returns %FALSE once the range is exhausted. */
+static gboolean
+lsm_scan_batch (CatalinaLsmBackendPrivate  *priv,
+                const gchar                *position,
+                gsize                       position_length,
+                gboolean                    exclusive,
+                const gchar                *end,
+                gsize                       end_length,
+                GArray                     *items,
+                gchar                     **last,
+                gsize                      *last_length)
+{
+	Cursor   *cursors,
+	         *cursor;
+	ScanItem  item;
+	gboolean  more = TRUE;
+	guint     n_cursors = 0,
+	          i;
+
+	g_static_rw_lock_reader_lock (&priv->lock);
+
+	cursors = g_new (Cursor, 3 + priv->levels [0]->len + LSM_MAX_LEVELS);
+
+	if (priv->in_txn)
+		cursor_init_memtable (&cursors [n_cursors++], priv->pending);
+	cursor_init_memtable (&cursors [n_cursors++], priv->memtable);
+	if (priv->immutable)
+		cursor_init_memtable (&cursors [n_cursors++], priv->immutable);
+	for (i = priv->levels [0]->len; i-- > 0;)
+		cursor_init_runs (&cursors [n_cursors++],
+		                  (Run**)&g_ptr_array_index (priv->levels [0], i), 1);
+	for (i = 1; i < LSM_MAX_LEVELS; i++)
+		if (priv->levels [i]->len > 0)
+			cursor_init_runs (&cursors [n_cursors++],
+			                  (Run**)priv->levels [i]->pdata, priv->levels [i]->len);
+
+	for (i = 0; i < n_cursors; i++) {
+		cursor_seek (&cursors [i], position, position_length);
+		if (exclusive && cursors [i].valid &&
+		    key_compare (cursors [i].key, cursors [i].key_length,
+		                 position, position_length) == 0)
+			cursor_next (&cursors [i]);
+	}
+
+	while (items->len < LSM_SCAN_BATCH) {
+		if (!(cursor = cursors_pick (cursors, n_cursors)) ||
+		    (end && key_compare (cursor->key, cursor->key_length, end, end_length) >= 0))
+		{
+			more = FALSE;
+			break;
+		}
+
+		g_free (*last);
+		*last = g_memdup (cursor->key, cursor->key_length);
+		*last_length = cursor->key_length;
+
+		if (!cursor->removed) {
+			item.key = g_memdup (cursor->key, cursor->key_length);
+			item.key_length = cursor->key_length;
+			item.data = g_memdup (cursor->data, cursor->data_length);
+			item.data_length = cursor->data_length;
+			g_array_append_val (items, item);
+		}
+
+		cursors_skip (cursors, n_cursors, *last, *last_length);
+	}
+
+	for (i = 0; i < n_cursors; i++)
+		cursor_clear (&cursors [i]);
+	g_free (cursors);
+
+	g_static_rw_lock_reader_unlock (&priv->lock);
+
+	return more;
+}
+
+/* Visits the records of [@start, @end) in key order.  Records are gathered in
+ * batches so @func runs without the lock held and may modify the data-store. */
+static void
+lsm_scan (CatalinaLsmBackendPrivate *priv,
+          const gchar               *start,
+          gsize                      start_length,
+          gboolean                   exclusive,
+          const gchar               *end,
+          gsize                      end_length,
+          CatalinaBackendFunc        func,
+          gpointer                   user_data)
+{
+	GArray   *items;
+	ScanItem *item;
+	gchar    *last = NULL;
+	gsize     last_length = 0;
+	gboolean  more = TRUE,
+	          stop = FALSE;
+	guint     i;
+
+	items = g_array_new (FALSE, FALSE, sizeof (ScanItem));
+
+	if (start)
+		last = g_memdup (start, start_length);
+	last_length = start_length;
+
+	while (more && !stop) {
+		more = lsm_scan_batch (priv, last, last_length, exclusive,
+		                       end, end_length, items, &last, &last_length);
+		exclusive = TRUE;
+
+		for (i = 0; i < items->len; i++) {
+			item = &g_array_index (items, ScanItem, i);
+			if (!stop)
+				stop = !func (item->key, item->key_length,
+				              item->data, item->data_length, user_data);
+			g_free (item->key);
+			g_free (item->data);
+		}
+		g_array_set_size (items, 0);
+
+		/* nothing was visited, the range is empty */
+		if (!last)
+			break;
+	}
+
+	g_free (last);
+	g_array_free (items, TRUE);
+}
+
+/***************************************************************************
+ *                                 Object                                  *
+ ***************************************************************************/
+
+static void
+catalina_lsm_backend_get_property (GObject    *object,
+                                   guint       property_id,
+                                   GValue     *value,
+                                   GParamSpec *pspec)
+{
+	switch (property_id) {
+	case PROP_MEMTABLE_SIZE:
+		g_value_set_uint (value, catalina_lsm_backend_get_memtable_size ((gpointer)object));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+	}
+}
+
+static void
+catalina_lsm_backend_set_property (GObject      *object,
+                                   guint         property_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+	switch (property_id) {
+	case PROP_MEMTABLE_SIZE:
+		catalina_lsm_backend_set_memtable_size ((gpointer)object, g_value_get_uint (value));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+	}
+}
+
+static void
+catalina_lsm_backend_finalize (GObject *object)
+{
+	CatalinaLsmBackendPrivate *priv = CATALINA_LSM_BACKEND (object)->priv;
+	guint                      i;
+
+	if (priv->memtable)
+		catalina_backend_close (CATALINA_BACKEND (object), NULL);
+
+	for (i = 0; i < LSM_MAX_LEVELS; i++) {
+		g_ptr_array_free (priv->levels [i], TRUE);
+		g_free (priv->compact_pointer [i]);
+	}
+
+	g_static_rw_lock_free (&priv->lock);
+	g_mutex_free (priv->mutex);
+	g_cond_free (priv->worker_cond);
+	g_cond_free (priv->flushed_cond);
+
+	G_OBJECT_CLASS (catalina_lsm_backend_parent_class)->finalize (object);
+}
+
+static void
+catalina_lsm_backend_class_init (CatalinaLsmBackendClass *klass)
+{
+	GObjectClass *object_class;
+
+	g_type_class_add_private (klass, sizeof (CatalinaLsmBackendPrivate));
+
+	object_class = G_OBJECT_CLASS (klass);
+	object_class->set_property = catalina_lsm_backend_set_property;
+	object_class->get_property = catalina_lsm_backend_get_property;
+	object_class->finalize     = catalina_lsm_backend_finalize;
+
+	/**
+	 * CatalinaLsmBackend:memtable-size:
+	 *
+	 * The "memtable-size" property.  Once the records held in memory use this many
+	 * bytes the memtable is frozen and flushed to a new run in the background.
+	 * Larger memtables produce fewer runs at the cost of memory and recovery time.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_MEMTABLE_SIZE,
+	                                 g_param_spec_uint ("memtable-size",
+	                                                    "MemtableSize",
+	                                                    "Size at which the memtable "
+	                                                    "is flushed.",
+	                                                    4096,
+	                                                    G_MAXUINT,
+	                                                    LSM_DEFAULT_MEMTABLE_SIZE,
+	                                                    G_PARAM_READWRITE));
+}
+
+static void
+catalina_lsm_backend_init (CatalinaLsmBackend *backend)
+{
+	CatalinaLsmBackendPrivate *priv;
+	guint                      i;
+
+	backend->priv = G_TYPE_INSTANCE_GET_PRIVATE (backend,
+	                                             CATALINA_TYPE_LSM_BACKEND,
+	                                             CatalinaLsmBackendPrivate);
+	priv = backend->priv;
+
+	priv->memtable_size = LSM_DEFAULT_MEMTABLE_SIZE;
+	priv->wal_fd = -1;
+	g_static_rw_lock_init (&priv->lock);
+	priv->mutex = g_mutex_new ();
+	priv->worker_cond = g_cond_new ();
+	priv->flushed_cond = g_cond_new ();
+
+	for (i = 0; i < LSM_MAX_LEVELS; i++)
+		priv->levels [i] = g_ptr_array_new ();
+}
+
+/**
+ * catalina_lsm_backend_new:
+ *
+ * Creates a new instance of #CatalinaLsmBackend.
+ *
+ * Return value: the newly created #CatalinaLsmBackend instance
+ */
+CatalinaBackend*
+catalina_lsm_backend_new (void)
+{
+	return g_object_new (CATALINA_TYPE_LSM_BACKEND, NULL);
+}
+
+/**
+ * catalina_lsm_backend_get_memtable_size:
+ * @backend: A #CatalinaLsmBackend
+ *
+ * Retrieves the "memtable-size" property.
+ *
+ * Return value: the size in bytes at which memtables are flushed
+ */
+guint
+catalina_lsm_backend_get_memtable_size (CatalinaLsmBackend *backend)
+{
+	g_return_val_if_fail (CATALINA_IS_LSM_BACKEND (backend), 0);
+	return backend->priv->memtable_size;
+}
+
+/**
+ * catalina_lsm_backend_set_memtable_size:
+ * @backend: A #CatalinaLsmBackend
+ * @memtable_size: the size in bytes at which memtables are flushed
+ *
+ * Sets the "memtable-size" property.
+ *
+ * This method is not thread-safe.
+ */
+void
+catalina_lsm_backend_set_memtable_size (CatalinaLsmBackend *backend,
+                                        guint               memtable_size)
+{
+	g_return_if_fail (CATALINA_IS_LSM_BACKEND (backend));
+	backend->priv->memtable_size = memtable_size;
+	g_object_notify (G_OBJECT (backend), "memtable-size");
+}
+
+/***************************************************************************
+ *                           Backend Interface                             *
+ ***************************************************************************/
+
+static gint
+guint64_compare (gconstpointer a,
+                 gconstpointer b)
+{
+	guint64 ia = *(const guint64*)a,
+	        ib = *(const guint64*)b;
+
+	return (ia > ib) - (ia < ib);
+}
+
+static gboolean
+catalina_lsm_backend_real_close (CatalinaBackend  *backend,
+                                 GError          **error);
+
+static gboolean
+catalina_lsm_backend_real_open (CatalinaBackend  *backend,
+                                const gchar      *path,
+                                GError          **error)
+{
+	CatalinaLsmBackendPrivate *priv = CATALINA_LSM_BACKEND (backend)->priv;
+	GDir                      *dir;
+	GArray                    *wals,
+	                          *runs;
+	const gchar               *name;
+	gchar                     *end,
+	                          *file;
+	guint64                    id;
+	guint                      level,
+	                           i,
+	                           j;
+
+	if (!g_file_test (path, G_FILE_TEST_IS_DIR))
+		g_mkdir_with_parents (path, 0755);
+
+	if (!(dir = g_dir_open (path, 0, error)))
+		return FALSE;
+
+	priv->path = g_strdup (path);
+	priv->next_id = 0;
+
+	wals = g_array_new (FALSE, FALSE, sizeof (guint64));
+	runs = g_array_new (FALSE, FALSE, sizeof (guint64));
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		id = g_ascii_strtoull (name, &end, 16);
+		if (end == name)
+			continue;
+		if (g_str_equal (end, LSM_WAL_SUFFIX))
+			g_array_append_val (wals, id);
+		else if (g_str_equal (end, LSM_RUN_SUFFIX))
+			g_array_append_val (runs, id);
+		else
+			continue;
+		priv->next_id = MAX (priv->next_id, id + 1);
+	}
+	g_dir_close (dir);
+
+	priv->memtable = memtable_new ();
+
+	if (!manifest_read (priv, error))
+		goto failure;
+
+	/* runs missing from the manifest are left over from an interrupted merge */
+	for (i = 0; i < runs->len; i++) {
+		id = g_array_index (runs, guint64, i);
+		for (level = 0; level < LSM_MAX_LEVELS; level++)
+			for (j = 0; j < priv->levels [level]->len; j++)
+				if (((Run*)g_ptr_array_index (priv->levels [level], j))->id == id)
+					goto listed;
+		file = lsm_path (priv, id, LSM_RUN_SUFFIX);
+		unlink (file);
+		g_free (file);
+	listed:
+		;
+	}
+
+	/* the logs hold everything newer than the runs */
+	g_array_sort (wals, guint64_compare);
+	for (i = 0; i < wals->len; i++) {
+		file = lsm_path (priv, g_array_index (wals, guint64, i), LSM_WAL_SUFFIX);
+		wal_replay (file, priv->memtable);
+		priv->memtable->wals = g_slist_append (priv->memtable->wals, file);
+	}
+
+	if (!wal_open (priv, priv->memtable, error))
+		goto failure;
+
+	g_array_free (wals, TRUE);
+	g_array_free (runs, TRUE);
+
+	priv->worker_stop = FALSE;
+	priv->worker_wake = TRUE;
+	priv->worker_force = FALSE;
+	priv->worker_stalled = FALSE;
+
+	if (!(priv->worker = g_thread_create (worker_thread, priv, TRUE, error))) {
+		catalina_lsm_backend_real_close (backend, NULL);
+		return FALSE;
+	}
+
+	return TRUE;
+
+failure:
+	g_array_free (wals, TRUE);
+	g_array_free (runs, TRUE);
+	catalina_lsm_backend_real_close (backend, NULL);
+
+	return FALSE;
+}
+
+static gboolean
+catalina_lsm_backend_real_close (CatalinaBackend  *backend,
+                                 GError          **error)
+{
+	CatalinaLsmBackendPrivate *priv = CATALINA_LSM_BACKEND (backend)->priv;
+	guint                      level,
+	                           i;
+
+	if (priv->worker) {
+		g_mutex_lock (priv->mutex);
+		priv->worker_stop = TRUE;
+		g_cond_signal (priv->worker_cond);
+		g_mutex_unlock (priv->mutex);
+		g_thread_join (priv->worker);
+		priv->worker = NULL;
+	}
+
+	if (priv->wal_fd >= 0) {
+		close (priv->wal_fd);
+		priv->wal_fd = -1;
+	}
+
+	/* unflushed memtables are rebuilt from their logs on the next open */
+	if (priv->pending) {
+		memtable_free (priv->pending);
+		priv->pending = NULL;
+	}
+	if (priv->immutable) {
+		memtable_free (priv->immutable);
+		priv->immutable = NULL;
+	}
+	if (priv->memtable) {
+		memtable_free (priv->memtable);
+		priv->memtable = NULL;
+	}
+	priv->in_txn = FALSE;
+
+	for (level = 0; level < LSM_MAX_LEVELS; level++) {
+		for (i = 0; i < priv->levels [level]->len; i++)
+			run_free (g_ptr_array_index (priv->levels [level], i));
+		g_ptr_array_set_size (priv->levels [level], 0);
+		g_free (priv->compact_pointer [level]);
+		priv->compact_pointer [level] = NULL;
+	}
+
+	g_free (priv->path);
+	priv->path = NULL;
+
+	return TRUE;
+}
+
+static gboolean
+catalina_lsm_backend_real_fetch (CatalinaBackend  *backend,
+                                 const gchar      *key,
+                                 gsize             key_length,
+                                 gchar           **data,
+                                 gsize            *data_length)
+{
+	return lsm_get (CATALINA_LSM_BACKEND (backend)->priv, key, key_length,
+	                data, data_length);
+}
+
+/* Applies a change outside of a transaction: logged first, then visible. */
+static gboolean
+lsm_write (CatalinaLsmBackendPrivate  *priv,
+           const gchar                *key,
+           gsize                       key_length,
+           const gchar                *data,
+           gsize                       data_length,
+           gboolean                    removed,
+           GError                    **error)
+{
+	GByteArray *buffer;
+	gboolean    success;
+
+	if (priv->in_txn) {
+		memtable_put (priv->pending, key, key_length, data, data_length, removed);
+		return TRUE;
+	}
+
+	if (priv->memtable->size >= priv->memtable_size && !lsm_rotate (priv, error))
+		return FALSE;
+
+	buffer = g_byte_array_new ();
+	wal_record (buffer, key, key_length, data, data_length, removed);
+	success = wal_append (priv, buffer, FALSE, error);
+	g_byte_array_free (buffer, TRUE);
+
+	if (!success)
+		return FALSE;
+
+	g_static_rw_lock_writer_lock (&priv->lock);
+	memtable_put (priv->memtable, key, key_length, data, data_length, removed);
+	g_static_rw_lock_writer_unlock (&priv->lock);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_lsm_backend_real_store (CatalinaBackend  *backend,
+                                 const gchar      *key,
+                                 gsize             key_length,
+                                 const gchar      *data,
+                                 gsize             data_length,
+                                 GError          **error)
+{
+	CatalinaLsmBackendPrivate *priv = CATALINA_LSM_BACKEND (backend)->priv;
+
+	if (key_length >= G_MAXUINT32 || data_length >= LSM_TOMBSTONE) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Record is too large");
+		return FALSE;
+	}
+
+	return lsm_write (priv, key, key_length, data, data_length, FALSE, error);
+}
+
+static gboolean
+catalina_lsm_backend_real_remove (CatalinaBackend  *backend,
+                                  const gchar      *key,
+                                  gsize             key_length,
+                                  GError          **error)
+{
+	CatalinaLsmBackendPrivate *priv = CATALINA_LSM_BACKEND (backend)->priv;
+
+	if (!lsm_get (priv, key, key_length, NULL, NULL)) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
+		             "The key does not exist");
+		return FALSE;
+	}
+
+	return lsm_write (priv, key, key_length, NULL, 0, TRUE, error);
+}
+
+static gboolean
+lsm_next_key_func (const gchar *key,
+                   gsize        key_length,
+                   const gchar *data,
+                   gsize        data_length,
+                   gpointer     user_data)
+{
+	ScanItem *item = user_data;
+
+	item->key = g_memdup (key, key_length);
+	item->key_length = key_length;
+
+	return FALSE;
+}
+
+static gboolean
+catalina_lsm_backend_real_next_key (CatalinaBackend  *backend,
+                                    const gchar      *key,
+                                    gsize             key_length,
+                                    gchar           **next_key,
+                                    gsize            *next_key_length)
+{
+	CatalinaLsmBackendPrivate *priv = CATALINA_LSM_BACKEND (backend)->priv;
+	ScanItem                   item = { NULL, 0, NULL, 0 };
+
+	lsm_scan (priv, key, key_length, key != NULL, NULL, 0, lsm_next_key_func, &item);
+
+	if (!item.key)
+		return FALSE;
+
+	*next_key = item.key;
+	*next_key_length = item.key_length;
+
+	return TRUE;
+}
+
+static gboolean
+catalina_lsm_backend_real_scan (CatalinaBackend      *backend,
+                                const gchar          *start,
+                                gsize                 start_length,
+                                const gchar          *end,
+                                gsize                 end_length,
+                                CatalinaBackendFunc   func,
+                                gpointer              user_data,
+                                GError              **error)
+{
+	lsm_scan (CATALINA_LSM_BACKEND (backend)->priv, start, start_length, FALSE,
+	          end, end_length, func, user_data);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_lsm_backend_real_traverse (CatalinaBackend      *backend,
+                                    CatalinaBackendFunc   func,
+                                    gpointer              user_data,
+                                    GError              **error)
+{
+	lsm_scan (CATALINA_LSM_BACKEND (backend)->priv, NULL, 0, FALSE,
+	          NULL, 0, func, user_data);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_lsm_backend_real_transaction_begin (CatalinaBackend  *backend,
+                                             GError          **error)
+{
+	CatalinaLsmBackendPrivate *priv = CATALINA_LSM_BACKEND (backend)->priv;
+
+	if (priv->in_txn) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "A transaction is already active");
+		return FALSE;
+	}
+
+	priv->pending = memtable_new ();
+	priv->in_txn = TRUE;
+
+	return TRUE;
+}
+
+/* The changes of a transaction are logged as one synchronous append. */
+static gboolean
+catalina_lsm_backend_real_transaction_commit (CatalinaBackend  *backend,
+                                              GError          **error)
+{
+	CatalinaLsmBackendPrivate *priv = CATALINA_LSM_BACKEND (backend)->priv;
+	GByteArray                *buffer;
+	Memtable                  *pending = priv->pending;
+	SkipNode                  *node;
+	gboolean                   success = TRUE;
+
+	priv->in_txn = FALSE;
+	priv->pending = NULL;
+
+	if (pending->n_records == 0)
+		goto finish;
+
+	if (priv->memtable->n_records > 0 &&
+	    priv->memtable->size + pending->size >= priv->memtable_size &&
+	    !lsm_rotate (priv, error))
+	{
+		success = FALSE;
+		goto finish;
+	}
+
+	/* the transaction is framed so that it is replayed as a whole or not at all */
+	buffer = g_byte_array_new ();
+	g_byte_array_set_size (buffer, LSM_WAL_HEADER);
+	for (node = pending->head->next [0]; node; node = node->next [0])
+		wal_record (buffer, node->key, node->key_length,
+		            node->data, node->data_length, node->removed);
+	wal_frame (buffer, pending->n_records);
+	success = wal_append (priv, buffer, TRUE, error);
+	g_byte_array_free (buffer, TRUE);
+
+	if (!success)
+		goto finish;
+
+	g_static_rw_lock_writer_lock (&priv->lock);
+	for (node = pending->head->next [0]; node; node = node->next [0])
+		memtable_put (priv->memtable, node->key, node->key_length,
+		              node->data, node->data_length, node->removed);
+	g_static_rw_lock_writer_unlock (&priv->lock);
+
+finish:
+	memtable_free (pending);
+
+	return success;
+}
+
+static gboolean
+catalina_lsm_backend_real_transaction_cancel (CatalinaBackend  *backend,
+                                              GError          **error)
+{
+	CatalinaLsmBackendPrivate *priv = CATALINA_LSM_BACKEND (backend)->priv;
+
+	if (priv->pending) {
+		memtable_free (priv->pending);
+		priv->pending = NULL;
+	}
+	priv->in_txn = FALSE;
+
+	return TRUE;
+}
+
+/* Flushes the memtable and merges level 0 regardless of its size. */
+static gboolean
+catalina_lsm_backend_real_compact (CatalinaBackend  *backend,
+                                   GError          **error)
+{
+	CatalinaLsmBackendPrivate *priv = CATALINA_LSM_BACKEND (backend)->priv;
+
+	if (priv->memtable->n_records > 0 && !lsm_rotate (priv, error))
+		return FALSE;
+
+	worker_wake (priv, TRUE);
+
+	return TRUE;
+}
+
+static void
+catalina_lsm_backend_base_init (CatalinaBackendIface *iface)
+{
+	iface->open               = catalina_lsm_backend_real_open;
+	iface->close              = catalina_lsm_backend_real_close;
+	iface->fetch              = catalina_lsm_backend_real_fetch;
+	iface->store              = catalina_lsm_backend_real_store;
+	iface->remove             = catalina_lsm_backend_real_remove;
+	iface->next_key           = catalina_lsm_backend_real_next_key;
+	iface->traverse           = catalina_lsm_backend_real_traverse;
+	iface->scan               = catalina_lsm_backend_real_scan;
+	iface->transaction_begin  = catalina_lsm_backend_real_transaction_begin;
+	iface->transaction_commit = catalina_lsm_backend_real_transaction_commit;
+	iface->transaction_cancel = catalina_lsm_backend_real_transaction_cancel;
+	iface->compact            = catalina_lsm_backend_real_compact;
+}
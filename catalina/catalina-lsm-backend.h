@@ -0,0 +1,62 @@
+/* catalina-lsm-backend.h
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __CATALINA_LSM_BACKEND_H__
+#define __CATALINA_LSM_BACKEND_H__
+
+#include <glib-object.h>
+
+#include "catalina-backend.h"
+
+G_BEGIN_DECLS
+
+#define CATALINA_TYPE_LSM_BACKEND            (catalina_lsm_backend_get_type())
+#define CATALINA_LSM_BACKEND(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj),  CATALINA_TYPE_LSM_BACKEND, CatalinaLsmBackend))
+#define CATALINA_LSM_BACKEND_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),   CATALINA_TYPE_LSM_BACKEND, CatalinaLsmBackendClass))
+#define CATALINA_IS_LSM_BACKEND(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj),  CATALINA_TYPE_LSM_BACKEND))
+#define CATALINA_IS_LSM_BACKEND_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),   CATALINA_TYPE_LSM_BACKEND))
+#define CATALINA_LSM_BACKEND_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),   CATALINA_TYPE_LSM_BACKEND, CatalinaLsmBackendClass))
+
+typedef struct _CatalinaLsmBackend        CatalinaLsmBackend;
+typedef struct _CatalinaLsmBackendClass   CatalinaLsmBackendClass;
+typedef struct _CatalinaLsmBackendPrivate CatalinaLsmBackendPrivate;
+
+struct _CatalinaLsmBackend
+{
+	GObject parent;
+
+	/*< private >*/
+	CatalinaLsmBackendPrivate *priv;
+};
+
+struct _CatalinaLsmBackendClass
+{
+	GObjectClass parent_class;
+};
+
+GType            catalina_lsm_backend_get_type          (void);
+CatalinaBackend* catalina_lsm_backend_new               (void);
+guint            catalina_lsm_backend_get_memtable_size (CatalinaLsmBackend *backend);
+void             catalina_lsm_backend_set_memtable_size (CatalinaLsmBackend *backend,
+                                                         guint               memtable_size);
+
+G_END_DECLS
+
+#endif /* __CATALINA_LSM_BACKEND_H__ */
@@ -0,0 +1,445 @@
+/* catalina-memory-backend.c
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "catalina-memory-backend.h"
+#include "catalina-storage.h"
+
+/**
+ * SECTION:catalina-memory-backend
+ * @title: CatalinaMemoryBackend
+ * @short_description: in-memory storage engine
+ *
+ * #CatalinaMemoryBackend keeps its records in memory.  Nothing is persisted, so
+ * the contents are discarded when the storage is closed.  It is useful as a cache
+ * and for testing code built upon #CatalinaStorage.
+ *
+ * Records are visited in the order they were first stored.
+ */
+
+static void catalina_memory_backend_base_init (CatalinaBackendIface *iface);
+
+G_DEFINE_TYPE_EXTENDED (CatalinaMemoryBackend,
+                        catalina_memory_backend,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (CATALINA_TYPE_BACKEND,
+                                               catalina_memory_backend_base_init))
+
+struct _CatalinaMemoryBackendPrivate
+{
+	GHashTable *records;  /* Record -> Record */
+	GQueue     *order;    /* Records in insertion order */
+	GHashTable *undo;     /* Record -> Record with the value before the txn */
+	gboolean    in_txn;
+};
+
+typedef struct
+{
+	gchar *key;
+	gsize  key_length;
+	gchar    *data;
+	gsize     data_length;
+	GList    *link;
+	gboolean  existed;   /* within the undo log, if the key existed before the txn */
+} Record;
+
+static guint
+record_hash (gconstpointer v)
+{
+	const Record *record = v;
+	const guchar *p      = (const guchar*)record->key;
+	guint         h      = 5381;
+	gsize         i;
+
+	for (i = 0; i < record->key_length; i++)
+		h = (h << 5) + h + p[i];
+
+	return h;
+}
+
+static gboolean
+record_equal (gconstpointer a,
+              gconstpointer b)
+{
+	const Record *ra = a,
+	             *rb = b;
+
+	return ra->key_length == rb->key_length &&
+	       memcmp (ra->key, rb->key, ra->key_length) == 0;
+}
+
+static Record*
+record_new (const gchar *key,
+            gsize        key_length,
+            const gchar *data,
+            gsize        data_length)
+{
+	Record *record = g_slice_new0 (Record);
+
+	record->key = g_memdup (key, key_length);
+	record->key_length = key_length;
+	record->data = data ? g_memdup (data, data_length) : NULL;
+	record->data_length = data_length;
+
+	return record;
+}
+
+static void
+record_free (gpointer data)
+{
+	Record *record = data;
+
+	g_free (record->key);
+	g_free (record->data);
+	g_slice_free (Record, record);
+}
+
+static Record*
+record_lookup (CatalinaMemoryBackendPrivate *priv,
+               const gchar                  *key,
+               gsize                         key_length)
+{
+	Record lookup = { (gchar*)key, key_length, NULL, 0, NULL };
+
+	return g_hash_table_lookup (priv->records, &lookup);
+}
+
+static void
+catalina_memory_backend_clear (CatalinaMemoryBackendPrivate *priv)
+{
+	g_hash_table_remove_all (priv->undo);
+	g_queue_clear (priv->order);
+	g_hash_table_remove_all (priv->records);
+	priv->in_txn = FALSE;
+}
+
+/*
+ * Records the value of a key before it is first changed within a transaction
+ * so that it may be restored if the transaction is cancelled.
+ */
+static void
+catalina_memory_backend_log_undo (CatalinaMemoryBackendPrivate *priv,
+                                  const gchar                  *key,
+                                  gsize                         key_length)
+{
+	Record  lookup = { (gchar*)key, key_length, NULL, 0, NULL };
+	Record *record,
+	       *undo;
+
+	if (!priv->in_txn || g_hash_table_lookup (priv->undo, &lookup))
+		return;
+
+	if ((record = record_lookup (priv, key, key_length)) != NULL) {
+		undo = record_new (key, key_length, record->data, record->data_length);
+		undo->existed = TRUE;
+	}
+	else
+		undo = record_new (key, key_length, NULL, 0);
+
+	g_hash_table_insert (priv->undo, undo, undo);
+}
+
+static void
+catalina_memory_backend_finalize (GObject *object)
+{
+	CatalinaMemoryBackendPrivate *priv = CATALINA_MEMORY_BACKEND (object)->priv;
+
+	g_hash_table_destroy (priv->undo);
+	g_queue_free (priv->order);
+	g_hash_table_destroy (priv->records);
+
+	G_OBJECT_CLASS (catalina_memory_backend_parent_class)->finalize (object);
+}
+
+static void
+catalina_memory_backend_class_init (CatalinaMemoryBackendClass *klass)
+{
+	GObjectClass *object_class;
+
+	g_type_class_add_private (klass, sizeof (CatalinaMemoryBackendPrivate));
+
+	object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = catalina_memory_backend_finalize;
+}
+
+static void
+catalina_memory_backend_init (CatalinaMemoryBackend *backend)
+{
+	CatalinaMemoryBackendPrivate *priv;
+
+	backend->priv = G_TYPE_INSTANCE_GET_PRIVATE (backend,
+	                                             CATALINA_TYPE_MEMORY_BACKEND,
+	                                             CatalinaMemoryBackendPrivate);
+	priv = backend->priv;
+
+	priv->records = g_hash_table_new_full (record_hash, record_equal, NULL, record_free);
+	priv->undo = g_hash_table_new_full (record_hash, record_equal, NULL, record_free);
+	priv->order = g_queue_new ();
+}
+
+/**
+ * catalina_memory_backend_new:
+ *
+ * Creates a new instance of #CatalinaMemoryBackend.
+ *
+ * Return value: the newly created #CatalinaMemoryBackend instance
+ */
+CatalinaBackend*
+catalina_memory_backend_new (void)
+{
+	return g_object_new (CATALINA_TYPE_MEMORY_BACKEND, NULL);
+}
+
+static gboolean
+catalina_memory_backend_real_open (CatalinaBackend  *backend,
+                                   const gchar      *path,
+                                   GError          **error)
+{
+	catalina_memory_backend_clear (CATALINA_MEMORY_BACKEND (backend)->priv);
+	return TRUE;
+}
+
+static gboolean
+catalina_memory_backend_real_close (CatalinaBackend  *backend,
+                                    GError          **error)
+{
+	catalina_memory_backend_clear (CATALINA_MEMORY_BACKEND (backend)->priv);
+	return TRUE;
+}
+
+static gboolean
+catalina_memory_backend_real_fetch (CatalinaBackend  *backend,
+                                    const gchar      *key,
+                                    gsize             key_length,
+                                    gchar           **data,
+                                    gsize            *data_length)
+{
+	Record *record;
+
+	if (!(record = record_lookup (CATALINA_MEMORY_BACKEND (backend)->priv, key, key_length)))
+		return FALSE;
+
+	*data = g_memdup (record->data, record->data_length);
+	*data_length = record->data_length;
+
+	return TRUE;
+}
+
+static gboolean
+catalina_memory_backend_real_parse (CatalinaBackend     *backend,
+                                    const gchar         *key,
+                                    gsize                key_length,
+                                    CatalinaBackendFunc  func,
+                                    gpointer             user_data)
+{
+	Record *record;
+
+	if (!(record = record_lookup (CATALINA_MEMORY_BACKEND (backend)->priv, key, key_length)))
+		return FALSE;
+
+	func (record->key, record->key_length, record->data, record->data_length, user_data);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_memory_backend_real_store (CatalinaBackend  *backend,
+                                    const gchar      *key,
+                                    gsize             key_length,
+                                    const gchar      *data,
+                                    gsize             data_length,
+                                    GError          **error)
+{
+	CatalinaMemoryBackendPrivate *priv = CATALINA_MEMORY_BACKEND (backend)->priv;
+	Record                       *record;
+
+	catalina_memory_backend_log_undo (priv, key, key_length);
+
+	if ((record = record_lookup (priv, key, key_length)) != NULL) {
+		g_free (record->data);
+		record->data = g_memdup (data, data_length);
+		record->data_length = data_length;
+		return TRUE;
+	}
+
+	record = record_new (key, key_length, data, data_length);
+	g_queue_push_tail (priv->order, record);
+	record->link = priv->order->tail;
+	g_hash_table_insert (priv->records, record, record);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_memory_backend_real_remove (CatalinaBackend  *backend,
+                                     const gchar      *key,
+                                     gsize             key_length,
+                                     GError          **error)
+{
+	CatalinaMemoryBackendPrivate *priv = CATALINA_MEMORY_BACKEND (backend)->priv;
+	Record                       *record;
+
+	if (!(record = record_lookup (priv, key, key_length))) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
+		             "The key does not exist");
+		return FALSE;
+	}
+
+	catalina_memory_backend_log_undo (priv, key, key_length);
+
+	g_queue_delete_link (priv->order, record->link);
+	g_hash_table_remove (priv->records, record);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_memory_backend_real_next_key (CatalinaBackend  *backend,
+                                       const gchar      *key,
+                                       gsize             key_length,
+                                       gchar           **next_key,
+                                       gsize            *next_key_length)
+{
+	CatalinaMemoryBackendPrivate *priv = CATALINA_MEMORY_BACKEND (backend)->priv;
+	Record                       *record;
+	GList                        *link;
+
+	if (key) {
+		if (!(record = record_lookup (priv, key, key_length)))
+			return FALSE;
+		link = record->link->next;
+	}
+	else
+		link = priv->order->head;
+
+	if (!link)
+		return FALSE;
+
+	record = link->data;
+	*next_key = g_memdup (record->key, record->key_length);
+	*next_key_length = record->key_length;
+
+	return TRUE;
+}
+
+static gboolean
+catalina_memory_backend_real_traverse (CatalinaBackend      *backend,
+                                       CatalinaBackendFunc   func,
+                                       gpointer              user_data,
+                                       GError              **error)
+{
+	CatalinaMemoryBackendPrivate *priv = CATALINA_MEMORY_BACKEND (backend)->priv;
+	GList                        *iter,
+	                             *next;
+	Record                       *record;
+
+	/* fetch the next link first so the current record may be removed */
+	for (iter = priv->order->head; iter; iter = next) {
+		next = iter->next;
+		record = iter->data;
+		if (!func (record->key, record->key_length,
+		           record->data, record->data_length,
+		           user_data))
+			break;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+catalina_memory_backend_real_transaction_begin (CatalinaBackend  *backend,
+                                                GError          **error)
+{
+	CatalinaMemoryBackendPrivate *priv = CATALINA_MEMORY_BACKEND (backend)->priv;
+
+	if (priv->in_txn) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "A transaction is already active");
+		return FALSE;
+	}
+
+	priv->in_txn = TRUE;
+
+	return TRUE;
+}
+
+static gboolean
+catalina_memory_backend_real_transaction_commit (CatalinaBackend  *backend,
+                                                 GError          **error)
+{
+	CatalinaMemoryBackendPrivate *priv = CATALINA_MEMORY_BACKEND (backend)->priv;
+
+	g_hash_table_remove_all (priv->undo);
+	priv->in_txn = FALSE;
+
+	return TRUE;
+}
+
+static void
+catalina_memory_backend_restore (gpointer key,
+                                 gpointer value,
+                                 gpointer user_data)
+{
+	CatalinaMemoryBackend *backend = user_data;
+	Record                *undo    = value;
+
+	if (undo->existed)
+		catalina_memory_backend_real_store (CATALINA_BACKEND (backend),
+		                                    undo->key, undo->key_length,
+		                                    undo->data, undo->data_length,
+		                                    NULL);
+	else if (record_lookup (backend->priv, undo->key, undo->key_length))
+		catalina_memory_backend_real_remove (CATALINA_BACKEND (backend),
+		                                     undo->key, undo->key_length,
+		                                     NULL);
+}
+
+static gboolean
+catalina_memory_backend_real_transaction_cancel (CatalinaBackend  *backend,
+                                                 GError          **error)
+{
+	CatalinaMemoryBackendPrivate *priv = CATALINA_MEMORY_BACKEND (backend)->priv;
+
+	priv->in_txn = FALSE;
+	g_hash_table_foreach (priv->undo, catalina_memory_backend_restore, backend);
+	g_hash_table_remove_all (priv->undo);
+
+	return TRUE;
+}
+
+static void
+catalina_memory_backend_base_init (CatalinaBackendIface *iface)
+{
+	iface->open               = catalina_memory_backend_real_open;
+	iface->close              = catalina_memory_backend_real_close;
+	iface->fetch              = catalina_memory_backend_real_fetch;
+	iface->parse              = catalina_memory_backend_real_parse;
+	iface->store              = catalina_memory_backend_real_store;
+	iface->remove             = catalina_memory_backend_real_remove;
+	iface->next_key           = catalina_memory_backend_real_next_key;
+	iface->traverse           = catalina_memory_backend_real_traverse;
+	iface->transaction_begin  = catalina_memory_backend_real_transaction_begin;
+	iface->transaction_commit = catalina_memory_backend_real_transaction_commit;
+	iface->transaction_cancel = catalina_memory_backend_real_transaction_cancel;
+}
@@ -0,0 +1,59 @@
+/* catalina-memory-backend.h
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __CATALINA_MEMORY_BACKEND_H__
+#define __CATALINA_MEMORY_BACKEND_H__
+
+#include <glib-object.h>
+
+#include "catalina-backend.h"
+
+G_BEGIN_DECLS
+
+#define CATALINA_TYPE_MEMORY_BACKEND            (catalina_memory_backend_get_type())
+#define CATALINA_MEMORY_BACKEND(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj),  CATALINA_TYPE_MEMORY_BACKEND, CatalinaMemoryBackend))
+#define CATALINA_MEMORY_BACKEND_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),   CATALINA_TYPE_MEMORY_BACKEND, CatalinaMemoryBackendClass))
+#define CATALINA_IS_MEMORY_BACKEND(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj),  CATALINA_TYPE_MEMORY_BACKEND))
+#define CATALINA_IS_MEMORY_BACKEND_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),   CATALINA_TYPE_MEMORY_BACKEND))
+#define CATALINA_MEMORY_BACKEND_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),   CATALINA_TYPE_MEMORY_BACKEND, CatalinaMemoryBackendClass))
+
+typedef struct _CatalinaMemoryBackend        CatalinaMemoryBackend;
+typedef struct _CatalinaMemoryBackendClass   CatalinaMemoryBackendClass;
+typedef struct _CatalinaMemoryBackendPrivate CatalinaMemoryBackendPrivate;
+
+struct _CatalinaMemoryBackend
+{
+	GObject parent;
+
+	/*< private >*/
+	CatalinaMemoryBackendPrivate *priv;
+};
+
+struct _CatalinaMemoryBackendClass
+{
+	GObjectClass parent_class;
+};
+
+GType            catalina_memory_backend_get_type (void);
+CatalinaBackend* catalina_memory_backend_new      (void);
+
+G_END_DECLS
+
+#endif /* __CATALINA_MEMORY_BACKEND_H__ */
@@ -0,0 +1,1148 @@
+/* catalina-sharded-storage.c
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "catalina-sharded-storage.h"
+
+/**
+ * SECTION:catalina-sharded-storage
+ * @title: CatalinaShardedStorage
+ * @short_description: data-store partitioned across multiple #CatalinaStorage
+ *
+ * #CatalinaShardedStorage hashes keys across a fixed number of #CatalinaStorage
+ * instances, each with its own data-store file and its own exclusive receiver.  Since
+ * writes to different shards do not contend with each other, write throughput scales
+ * with the number of shards.
+ *
+ * The number of shards is fixed for the lifetime of the data-store; opening it with a
+ * different "n-shards" will route keys to the wrong files.
+ *
+ * Transactions are bound to a single shard.  The shard is chosen from the key given to
+ * catalina_sharded_storage_transaction_begin_async() and every key written within the
+ * transaction must hash to the same shard.  Within that shard, transactions are atomic.
+ */
+
+G_DEFINE_TYPE (CatalinaShardedStorage, catalina_sharded_storage, G_TYPE_OBJECT)
+
+enum
+{
+	PROP_0,
+	PROP_N_SHARDS,
+	PROP_USE_IDLE,
+	PROP_FORMATTER,
+	PROP_TRANSFORM,
+};
+
+struct _CatalinaShardedStoragePrivate
+{
+	guint             n_shards;
+	CatalinaStorage **shards;
+};
+
+typedef struct
+{
+	GSimpleAsyncResult *result;
+	guint               shard;
+	gchar              *data;
+	gsize               data_length;
+	GValue              value;
+	gulong              txn_id;
+} ShardOp;
+
+/* transaction ids from each shard are interleaved so the shard can be recovered
+ * from the id alone. */
+#define TXN_ENCODE(p,s,t) ((((t) - 1) * (p)->n_shards) + (s) + 1)
+#define TXN_SHARD(p,id)   (((id) - 1) % (p)->n_shards)
+#define TXN_LOCAL(p,id)   ((((id) - 1) / (p)->n_shards) + 1)
+
+static guint
+shard_for_key (CatalinaShardedStoragePrivate *priv,
+               const gchar                   *key,
+               gssize                         key_length)
+{
+	const guchar *p;
+	guint32       hash = 2166136261U;
+	gsize         i, length;
+
+	/* FNV-1a over the key as it will be stored */
+	length = (key_length == -1) ? strlen (key) + 1 : (gsize)key_length;
+	for (i = 0, p = (const guchar*)key; i < length; i++) {
+		hash ^= p [i];
+		hash *= 16777619U;
+	}
+
+	return hash % priv->n_shards;
+}
+
+static gboolean
+shard_check_txn (CatalinaShardedStoragePrivate  *priv,
+                 gulong                          txn_id,
+                 guint                           shard,
+                 GError                        **error)
+{
+	if (txn_id != 0 && TXN_SHARD (priv, txn_id) != shard) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NO_SUCH_TXN,
+		             "Transaction \"%lu\" belongs to another shard", txn_id);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+shard_op_free (ShardOp *op)
+{
+	g_free (op->data);
+	if (G_VALUE_TYPE (&op->value))
+		g_value_unset (&op->value);
+	g_slice_free (ShardOp, op);
+}
+
+static ShardOp*
+shard_op_new (CatalinaShardedStorage *storage,
+              guint                   shard,
+              GAsyncReadyCallback     callback,
+              gpointer                user_data,
+              gpointer                source_tag)
+{
+	ShardOp *op;
+
+	op = g_slice_new0 (ShardOp);
+	op->shard = shard;
+	op->result = g_simple_async_result_new (G_OBJECT (storage), callback,
+	                                        user_data, source_tag);
+	g_simple_async_result_set_op_res_gpointer (op->result, op,
+	                                           (GDestroyNotify)shard_op_free);
+
+	return op;
+}
+
+/* Completes @op, failing it with @error if set.  Takes ownership of @error. */
+static void
+shard_op_complete (ShardOp *op,
+                   GError  *error)
+{
+	GSimpleAsyncResult *result = op->result;
+
+	if (error) {
+		g_simple_async_result_set_from_error (result, error);
+		g_error_free (error);
+	}
+
+	g_simple_async_result_complete (result);
+	g_object_unref (result);
+}
+
+static void
+shard_op_complete_in_idle (ShardOp *op,
+                           GError  *error)
+{
+	GSimpleAsyncResult *result = op->result;
+
+	g_simple_async_result_set_from_error (result, error);
+	g_error_free (error);
+	g_simple_async_result_complete_in_idle (result);
+	g_object_unref (result);
+}
+
+static ShardOp*
+shard_op_finish (CatalinaShardedStorage  *storage,
+                 GAsyncResult            *result,
+                 gpointer                 source_tag,
+                 GError                 **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), NULL);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      source_tag),
+	                      NULL);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+
+	return g_simple_async_result_get_op_res_gpointer (simple);
+}
+
+static void
+catalina_sharded_storage_get_property (GObject    *object,
+                                       guint       property_id,
+                                       GValue     *value,
+                                       GParamSpec *pspec)
+{
+	CatalinaShardedStoragePrivate *priv = CATALINA_SHARDED_STORAGE (object)->priv;
+
+	switch (property_id) {
+	case PROP_N_SHARDS:
+		g_value_set_uint (value, priv->n_shards);
+		break;
+	case PROP_USE_IDLE:
+	case PROP_FORMATTER:
+	case PROP_TRANSFORM:
+		/* all shards are configured identically */
+		g_object_get_property (G_OBJECT (priv->shards [0]), pspec->name, value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+	}
+}
+
+static void
+catalina_sharded_storage_set_property (GObject      *object,
+                                       guint         property_id,
+                                       const GValue *value,
+                                       GParamSpec   *pspec)
+{
+	CatalinaShardedStoragePrivate *priv = CATALINA_SHARDED_STORAGE (object)->priv;
+	guint                          i;
+
+	switch (property_id) {
+	case PROP_N_SHARDS:
+		priv->n_shards = g_value_get_uint (value);
+		priv->shards = g_new0 (CatalinaStorage*, priv->n_shards);
+		for (i = 0; i < priv->n_shards; i++)
+			priv->shards [i] = catalina_storage_new ();
+		break;
+	case PROP_USE_IDLE:
+	case PROP_FORMATTER:
+	case PROP_TRANSFORM:
+		for (i = 0; i < priv->n_shards; i++)
+			g_object_set_property (G_OBJECT (priv->shards [i]), pspec->name, value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+	}
+}
+
+static void
+catalina_sharded_storage_finalize (GObject *object)
+{
+	CatalinaShardedStoragePrivate *priv = CATALINA_SHARDED_STORAGE (object)->priv;
+
+	g_free (priv->shards);
+
+	G_OBJECT_CLASS (catalina_sharded_storage_parent_class)->finalize (object);
+}
+
+static void
+catalina_sharded_storage_dispose (GObject *object)
+{
+	CatalinaShardedStoragePrivate *priv = CATALINA_SHARDED_STORAGE (object)->priv;
+	guint                          i;
+
+	for (i = 0; i < priv->n_shards; i++) {
+		if (priv->shards [i]) {
+			g_object_unref (priv->shards [i]);
+			priv->shards [i] = NULL;
+		}
+	}
+}
+
+static void
+catalina_sharded_storage_class_init (CatalinaShardedStorageClass *klass)
+{
+	GObjectClass *object_class;
+
+	g_type_class_add_private (klass, sizeof (CatalinaShardedStoragePrivate));
+
+	object_class = G_OBJECT_CLASS (klass);
+	object_class->set_property = catalina_sharded_storage_set_property;
+	object_class->get_property = catalina_sharded_storage_get_property;
+	object_class->finalize     = catalina_sharded_storage_finalize;
+	object_class->dispose      = catalina_sharded_storage_dispose;
+
+	/**
+	 * CatalinaShardedStorage:n-shards:
+	 *
+	 * The number of #CatalinaStorage shards keys are distributed across.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_N_SHARDS,
+	                                 g_param_spec_uint ("n-shards",
+	                                                    "NShards",
+	                                                    "Number of shards",
+	                                                    1,
+	                                                    G_MAXUINT16,
+	                                                    1,
+	                                                    G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
+
+	/**
+	 * CatalinaShardedStorage:use-idle:
+	 *
+	 * The "use-idle" property of each shard.  See #CatalinaStorage:use-idle.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_USE_IDLE,
+	                                 g_param_spec_boolean ("use-idle",
+	                                                       "UseIdle",
+	                                                       "If callbacks should occur in "
+	                                                       "an idle-timeout of the main-"
+	                                                       "loop.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaShardedStorage:transform:
+	 *
+	 * The "transform" of each shard.  See #CatalinaStorage:transform.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_TRANSFORM,
+	                                 g_param_spec_object ("transform",
+	                                                      "Transform",
+	                                                      "Storage transform",
+	                                                      CATALINA_TYPE_TRANSFORM,
+	                                                      G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaShardedStorage:formatter:
+	 *
+	 * The "formatter" of each shard.  See #CatalinaStorage:formatter.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_FORMATTER,
+	                                 g_param_spec_object ("formatter",
+	                                                      "Formatter",
+	                                                      "Storage formatter",
+	                                                      CATALINA_TYPE_FORMATTER,
+	                                                      G_PARAM_READWRITE));
+}
+
+static void
+catalina_sharded_storage_init (CatalinaShardedStorage *storage)
+{
+	storage->priv = G_TYPE_INSTANCE_GET_PRIVATE (storage,
+	                                             CATALINA_TYPE_SHARDED_STORAGE,
+	                                             CatalinaShardedStoragePrivate);
+}
+
+/**
+ * catalina_sharded_storage_new:
+ * @n_shards: the number of shards
+ *
+ * Creates a new instance of #CatalinaShardedStorage that distributes keys across
+ * @n_shards data-stores.
+ *
+ * Return value: the newly created #CatalinaShardedStorage instance
+ */
+CatalinaShardedStorage*
+catalina_sharded_storage_new (guint n_shards)
+{
+	g_return_val_if_fail (n_shards > 0, NULL);
+
+	return g_object_new (CATALINA_TYPE_SHARDED_STORAGE, "n-shards", n_shards, NULL);
+}
+
+/**
+ * catalina_sharded_storage_get_n_shards:
+ * @storage: A #CatalinaShardedStorage
+ *
+ * Retrieves the number of shards in @storage.
+ *
+ * Return value: the number of shards
+ */
+guint
+catalina_sharded_storage_get_n_shards (CatalinaShardedStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), 0);
+	return storage->priv->n_shards;
+}
+
+/**
+ * catalina_sharded_storage_get_shard:
+ * @storage: A #CatalinaShardedStorage
+ * @index: the index of the shard
+ *
+ * Retrieves the #CatalinaStorage for shard @index.  This can be used for operations
+ * that are not routed by key, such as traversal with a #CatalinaCursor.
+ *
+ * Return value: the #CatalinaStorage owned by @storage
+ */
+CatalinaStorage*
+catalina_sharded_storage_get_shard (CatalinaShardedStorage *storage,
+                                    guint                   index)
+{
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), NULL);
+	g_return_val_if_fail (index < storage->priv->n_shards, NULL);
+
+	return storage->priv->shards [index];
+}
+
+/**
+ * catalina_sharded_storage_get_shard_for_key:
+ * @storage: A #CatalinaShardedStorage
+ * @key: the key
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ *
+ * Retrieves the #CatalinaStorage that @key is stored within.
+ *
+ * Return value: the #CatalinaStorage owned by @storage
+ */
+CatalinaStorage*
+catalina_sharded_storage_get_shard_for_key (CatalinaShardedStorage *storage,
+                                            const gchar            *key,
+                                            gssize                  key_length)
+{
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), NULL);
+	g_return_val_if_fail (key != NULL, NULL);
+
+	return storage->priv->shards [shard_for_key (storage->priv, key, key_length)];
+}
+
+/**
+ * catalina_sharded_storage_open:
+ * @storage: A #CatalinaShardedStorage
+ * @env_dir: the directory containing the data-stores
+ * @name: the base name of the data-stores
+ * @error: A location for a #GError or %NULL
+ *
+ * Opens each shard of @storage.  Shard N is stored in a file named "@name.N" within
+ * @env_dir.  If any shard fails to open, the shards already opened are closed again.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_open (CatalinaShardedStorage  *storage,
+                               const gchar             *env_dir,
+                               const gchar             *name,
+                               GError                 **error)
+{
+	CatalinaShardedStoragePrivate *priv;
+	gchar                         *shard_name;
+	gboolean                       success = TRUE;
+	guint                          i;
+
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), FALSE);
+	g_return_val_if_fail (name != NULL, FALSE);
+
+	priv = storage->priv;
+
+	for (i = 0; success && i < priv->n_shards; i++) {
+		shard_name = g_strdup_printf ("%s.%u", name, i);
+		success = catalina_storage_open (priv->shards [i], env_dir, shard_name, error);
+		g_free (shard_name);
+	}
+
+	if (!success) {
+		/* i is one past the shard that failed */
+		for (i = i - 1; i > 0; i--)
+			catalina_storage_close (priv->shards [i - 1], NULL);
+	}
+
+	return success;
+}
+
+/**
+ * catalina_sharded_storage_close:
+ * @storage: A #CatalinaShardedStorage
+ * @error: A location for a #GError or %NULL
+ *
+ * Closes each shard of @storage.  All shards are closed even if one of them fails,
+ * in which case @error is set to the first failure.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_close (CatalinaShardedStorage  *storage,
+                                GError                 **error)
+{
+	CatalinaShardedStoragePrivate *priv;
+	GError                        *shard_error = NULL;
+	gboolean                       success = TRUE;
+	guint                          i;
+
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), FALSE);
+
+	priv = storage->priv;
+
+	for (i = 0; i < priv->n_shards; i++) {
+		if (!catalina_storage_close (priv->shards [i], &shard_error)) {
+			if (success)
+				g_propagate_error (error, shard_error);
+			else
+				g_error_free (shard_error);
+			shard_error = NULL;
+			success = FALSE;
+		}
+	}
+
+	return success;
+}
+
+static void
+shard_get_cb (GObject      *object,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+	ShardOp *op    = user_data;
+	GError  *error = NULL;
+
+	catalina_storage_get_finish (CATALINA_STORAGE (object), result,
+	                             &op->data, &op->data_length, &error);
+	shard_op_complete (op, error);
+}
+
+/**
+ * catalina_sharded_storage_get_async:
+ * @storage: A #CatalinaShardedStorage
+ * @key: the key to retrieve
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously retrieves @key from the shard it is stored within.
+ *
+ * See catalina_storage_get_async().
+ */
+void
+catalina_sharded_storage_get_async (CatalinaShardedStorage *storage,
+                                    const gchar            *key,
+                                    gssize                  key_length,
+                                    GAsyncReadyCallback     callback,
+                                    gpointer                user_data)
+{
+	ShardOp *op;
+
+	g_return_if_fail (CATALINA_IS_SHARDED_STORAGE (storage));
+	g_return_if_fail (key != NULL);
+
+	op = shard_op_new (storage, shard_for_key (storage->priv, key, key_length),
+	                   callback, user_data, catalina_sharded_storage_get_async);
+	catalina_storage_get_async (storage->priv->shards [op->shard], key, key_length,
+	                            shard_get_cb, op);
+}
+
+/**
+ * catalina_sharded_storage_get_finish:
+ * @storage: A #CatalinaShardedStorage
+ * @result: A #GAsyncResult
+ * @value: A location for the buffer
+ * @value_length: A location for the length of the buffer, or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_sharded_storage_get_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_get_finish (CatalinaShardedStorage  *storage,
+                                     GAsyncResult            *result,
+                                     gchar                  **value,
+                                     gsize                   *value_length,
+                                     GError                 **error)
+{
+	ShardOp *op;
+
+	g_return_val_if_fail (value != NULL, FALSE);
+
+	if (!(op = shard_op_finish (storage, result,
+	                            catalina_sharded_storage_get_async, error)))
+		return FALSE;
+
+	*value = op->data;
+	if (value_length)
+		*value_length = op->data_length;
+	op->data = NULL;
+
+	return TRUE;
+}
+
+/**
+ * catalina_sharded_storage_get:
+ * @storage: A #CatalinaShardedStorage
+ * @key: the key to retrieve
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @value: A location for the buffer
+ * @value_length: A location for the length of the buffer, or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously retrieves @key from the shard it is stored within.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_get (CatalinaShardedStorage  *storage,
+                              const gchar             *key,
+                              gssize                   key_length,
+                              gchar                  **value,
+                              gsize                   *value_length,
+                              GError                 **error)
+{
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+
+	return catalina_storage_get (catalina_sharded_storage_get_shard_for_key (storage, key, key_length),
+	                             key, key_length, value, value_length, error);
+}
+
+static void
+shard_set_cb (GObject      *object,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+	ShardOp *op    = user_data;
+	GError  *error = NULL;
+
+	catalina_storage_set_finish (CATALINA_STORAGE (object), result, &error);
+	shard_op_complete (op, error);
+}
+
+/**
+ * catalina_sharded_storage_set_async:
+ * @storage: A #CatalinaShardedStorage
+ * @txn_id: A transaction id from catalina_sharded_storage_transaction_begin_async() or 0
+ * @key: the key of which to assign @value
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @value: the content to store
+ * @value_length: the length of @value in bytes or -1 if @value is %NULL terminated
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously stores @value in the shard for @key.  If @txn_id is set, @key must
+ * belong to the same shard as the transaction.
+ *
+ * See catalina_storage_set_async().
+ */
+void
+catalina_sharded_storage_set_async (CatalinaShardedStorage *storage,
+                                    gulong                  txn_id,
+                                    const gchar            *key,
+                                    gssize                  key_length,
+                                    const gchar            *value,
+                                    gssize                  value_length,
+                                    GAsyncReadyCallback     callback,
+                                    gpointer                user_data)
+{
+	CatalinaShardedStoragePrivate *priv;
+	ShardOp                       *op;
+	GError                        *error = NULL;
+
+	g_return_if_fail (CATALINA_IS_SHARDED_STORAGE (storage));
+	g_return_if_fail (key != NULL);
+
+	priv = storage->priv;
+	op = shard_op_new (storage, shard_for_key (priv, key, key_length),
+	                   callback, user_data, catalina_sharded_storage_set_async);
+
+	if (!shard_check_txn (priv, txn_id, op->shard, &error)) {
+		shard_op_complete_in_idle (op, error);
+		return;
+	}
+
+	catalina_storage_set_async (priv->shards [op->shard],
+	                            txn_id ? TXN_LOCAL (priv, txn_id) : 0,
+	                            key, key_length, value, value_length,
+	                            shard_set_cb, op);
+}
+
+/**
+ * catalina_sharded_storage_set_finish:
+ * @storage: A #CatalinaShardedStorage
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_sharded_storage_set_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_set_finish (CatalinaShardedStorage  *storage,
+                                     GAsyncResult            *result,
+                                     GError                 **error)
+{
+	return shard_op_finish (storage, result,
+	                        catalina_sharded_storage_set_async, error) != NULL;
+}
+
+/**
+ * catalina_sharded_storage_set:
+ * @storage: A #CatalinaShardedStorage
+ * @txn_id: A transaction id from catalina_sharded_storage_transaction_begin_async() or 0
+ * @key: the key of which to assign @value
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @value: the content to store
+ * @value_length: the length of @value in bytes or -1 if @value is %NULL terminated
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously stores @value in the shard for @key.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_set (CatalinaShardedStorage  *storage,
+                              gulong                   txn_id,
+                              const gchar             *key,
+                              gssize                   key_length,
+                              const gchar             *value,
+                              gssize                   value_length,
+                              GError                 **error)
+{
+	CatalinaShardedStoragePrivate *priv;
+	guint                          shard;
+
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+
+	priv = storage->priv;
+	shard = shard_for_key (priv, key, key_length);
+
+	if (!shard_check_txn (priv, txn_id, shard, error))
+		return FALSE;
+
+	return catalina_storage_set (priv->shards [shard],
+	                             txn_id ? TXN_LOCAL (priv, txn_id) : 0,
+	                             key, key_length, value, value_length, error);
+}
+
+static void
+shard_get_value_cb (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+	ShardOp *op    = user_data;
+	GError  *error = NULL;
+
+	catalina_storage_get_value_finish (CATALINA_STORAGE (object), result,
+	                                   &op->value, &error);
+	shard_op_complete (op, error);
+}
+
+/**
+ * catalina_sharded_storage_get_value_async:
+ * @storage: A #CatalinaShardedStorage
+ * @key: the key to retrieve
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously retrieves and deserializes @key from the shard it is stored within.
+ *
+ * See catalina_storage_get_value_async().
+ */
+void
+catalina_sharded_storage_get_value_async (CatalinaShardedStorage *storage,
+                                          const gchar            *key,
+                                          gssize                  key_length,
+                                          GAsyncReadyCallback     callback,
+                                          gpointer                user_data)
+{
+	ShardOp *op;
+
+	g_return_if_fail (CATALINA_IS_SHARDED_STORAGE (storage));
+	g_return_if_fail (key != NULL);
+
+	op = shard_op_new (storage, shard_for_key (storage->priv, key, key_length),
+	                   callback, user_data, catalina_sharded_storage_get_value_async);
+	catalina_storage_get_value_async (storage->priv->shards [op->shard], key, key_length,
+	                                  shard_get_value_cb, op);
+}
+
+/**
+ * catalina_sharded_storage_get_value_finish:
+ * @storage: A #CatalinaShardedStorage
+ * @result: A #GAsyncResult
+ * @value: A #GValue to store the result
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_sharded_storage_get_value_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_get_value_finish (CatalinaShardedStorage  *storage,
+                                           GAsyncResult            *result,
+                                           GValue                  *value,
+                                           GError                 **error)
+{
+	ShardOp *op;
+
+	g_return_val_if_fail (value != NULL, FALSE);
+
+	if (!(op = shard_op_finish (storage, result,
+	                            catalina_sharded_storage_get_value_async, error)))
+		return FALSE;
+
+	if (!G_VALUE_TYPE (value))
+		g_value_init (value, G_VALUE_TYPE (&op->value));
+	g_value_copy (&op->value, value);
+
+	return TRUE;
+}
+
+/**
+ * catalina_sharded_storage_get_value:
+ * @storage: A #CatalinaShardedStorage
+ * @key: the key to retrieve
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @value: A #GValue to store the result
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously retrieves and deserializes @key from the shard it is stored within.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_get_value (CatalinaShardedStorage  *storage,
+                                    const gchar             *key,
+                                    gssize                   key_length,
+                                    GValue                  *value,
+                                    GError                 **error)
+{
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+
+	return catalina_storage_get_value (catalina_sharded_storage_get_shard_for_key (storage, key, key_length),
+	                                   key, key_length, value, error);
+}
+
+static void
+shard_set_value_cb (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+	ShardOp *op    = user_data;
+	GError  *error = NULL;
+
+	catalina_storage_set_value_finish (CATALINA_STORAGE (object), result, &error);
+	shard_op_complete (op, error);
+}
+
+/**
+ * catalina_sharded_storage_set_value_async:
+ * @storage: A #CatalinaShardedStorage
+ * @txn_id: A transaction id from catalina_sharded_storage_transaction_begin_async() or 0
+ * @key: the key of which to assign @value
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @value: A #GValue to serialize and store
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously serializes and stores @value in the shard for @key.  If @txn_id is
+ * set, @key must belong to the same shard as the transaction.
+ *
+ * See catalina_storage_set_value_async().
+ */
+void
+catalina_sharded_storage_set_value_async (CatalinaShardedStorage *storage,
+                                          gulong                  txn_id,
+                                          const gchar            *key,
+                                          gssize                  key_length,
+                                          const GValue           *value,
+                                          GAsyncReadyCallback     callback,
+                                          gpointer                user_data)
+{
+	CatalinaShardedStoragePrivate *priv;
+	ShardOp                       *op;
+	GError                        *error = NULL;
+
+	g_return_if_fail (CATALINA_IS_SHARDED_STORAGE (storage));
+	g_return_if_fail (key != NULL);
+	g_return_if_fail (value != NULL);
+
+	priv = storage->priv;
+	op = shard_op_new (storage, shard_for_key (priv, key, key_length),
+	                   callback, user_data, catalina_sharded_storage_set_value_async);
+
+	if (!shard_check_txn (priv, txn_id, op->shard, &error)) {
+		shard_op_complete_in_idle (op, error);
+		return;
+	}
+
+	catalina_storage_set_value_async (priv->shards [op->shard],
+	                                  txn_id ? TXN_LOCAL (priv, txn_id) : 0,
+	                                  key, key_length, value,
+	                                  shard_set_value_cb, op);
+}
+
+/**
+ * catalina_sharded_storage_set_value_finish:
+ * @storage: A #CatalinaShardedStorage
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_sharded_storage_set_value_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_set_value_finish (CatalinaShardedStorage  *storage,
+                                           GAsyncResult            *result,
+                                           GError                 **error)
+{
+	return shard_op_finish (storage, result,
+	                        catalina_sharded_storage_set_value_async, error) != NULL;
+}
+
+/**
+ * catalina_sharded_storage_set_value:
+ * @storage: A #CatalinaShardedStorage
+ * @txn_id: A transaction id from catalina_sharded_storage_transaction_begin_async() or 0
+ * @key: the key of which to assign @value
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @value: A #GValue to serialize and store
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously serializes and stores @value in the shard for @key.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_set_value (CatalinaShardedStorage  *storage,
+                                    gulong                   txn_id,
+                                    const gchar             *key,
+                                    gssize                   key_length,
+                                    const GValue            *value,
+                                    GError                 **error)
+{
+	CatalinaShardedStoragePrivate *priv;
+	guint                          shard;
+
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+
+	priv = storage->priv;
+	shard = shard_for_key (priv, key, key_length);
+
+	if (!shard_check_txn (priv, txn_id, shard, error))
+		return FALSE;
+
+	return catalina_storage_set_value (priv->shards [shard],
+	                                   txn_id ? TXN_LOCAL (priv, txn_id) : 0,
+	                                   key, key_length, value, error);
+}
+
+/**
+ * catalina_sharded_storage_count_keys:
+ * @storage: A #CatalinaShardedStorage
+ *
+ * Counts the number of keys across all shards.
+ *
+ * Return value: the current number of keys
+ */
+gulong
+catalina_sharded_storage_count_keys (CatalinaShardedStorage *storage)
+{
+	CatalinaShardedStoragePrivate *priv;
+	gulong                         count = 0;
+	guint                          i;
+
+	g_return_val_if_fail (CATALINA_IS_SHARDED_STORAGE (storage), 0);
+
+	priv = storage->priv;
+
+	for (i = 0; i < priv->n_shards; i++)
+		count += catalina_storage_count_keys (priv->shards [i]);
+
+	return count;
+}
+
+static void
+shard_txn_begin_cb (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+	ShardOp *op = user_data;
+	gulong   txn_id;
+
+	txn_id = catalina_storage_transaction_begin_finish (CATALINA_STORAGE (object), result);
+	if (txn_id != 0) {
+		CatalinaShardedStorage *storage;
+
+		storage = CATALINA_SHARDED_STORAGE (g_async_result_get_source_object (G_ASYNC_RESULT (op->result)));
+		op->txn_id = TXN_ENCODE (storage->priv, op->shard, txn_id);
+		g_object_unref (storage);
+	}
+
+	shard_op_complete (op, NULL);
+}
+
+/**
+ * catalina_sharded_storage_transaction_begin_async:
+ * @storage: A #CatalinaShardedStorage
+ * @key: A key within the shard to begin the transaction on
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @callback: a callback to execute when the transaction begins
+ * @user_data: data for @callback
+ *
+ * Begins a new transaction on the shard that @key belongs to.  Every key written using
+ * the resulting transaction id must belong to the same shard.
+ *
+ * See catalina_storage_transaction_begin_async().
+ */
+void
+catalina_sharded_storage_transaction_begin_async (CatalinaShardedStorage *storage,
+                                                  const gchar            *key,
+                                                  gssize                  key_length,
+                                                  GAsyncReadyCallback     callback,
+                                                  gpointer                user_data)
+{
+	ShardOp *op;
+
+	g_return_if_fail (CATALINA_IS_SHARDED_STORAGE (storage));
+	g_return_if_fail (key != NULL);
+
+	op = shard_op_new (storage, shard_for_key (storage->priv, key, key_length),
+	                   callback, user_data, catalina_sharded_storage_transaction_begin_async);
+	catalina_storage_transaction_begin_async (storage->priv->shards [op->shard],
+	                                          shard_txn_begin_cb, op);
+}
+
+/**
+ * catalina_sharded_storage_transaction_begin_finish:
+ * @storage: A #CatalinaShardedStorage
+ * @result: A #GAsyncResult
+ *
+ * Completes an asynchronous request to begin a transaction.
+ *
+ * Return value: the transaction id, or 0 on failure
+ */
+gulong
+catalina_sharded_storage_transaction_begin_finish (CatalinaShardedStorage *storage,
+                                                   GAsyncResult           *result)
+{
+	ShardOp *op;
+
+	if (!(op = shard_op_finish (storage, result,
+	                            catalina_sharded_storage_transaction_begin_async, NULL)))
+		return 0;
+
+	return op->txn_id;
+}
+
+static void
+shard_txn_commit_cb (GObject      *object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+	ShardOp *op    = user_data;
+	GError  *error = NULL;
+
+	catalina_storage_transaction_commit_finish (CATALINA_STORAGE (object), result, &error);
+	shard_op_complete (op, error);
+}
+
+/**
+ * catalina_sharded_storage_transaction_commit_async:
+ * @storage: A #CatalinaShardedStorage
+ * @txn_id: the transaction id from catalina_sharded_storage_transaction_begin_async()
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously commits the transaction on the shard it belongs to.
+ *
+ * See catalina_storage_transaction_commit_async().
+ */
+void
+catalina_sharded_storage_transaction_commit_async (CatalinaShardedStorage *storage,
+                                                   gulong                  txn_id,
+                                                   GAsyncReadyCallback     callback,
+                                                   gpointer                user_data)
+{
+	CatalinaShardedStoragePrivate *priv;
+	ShardOp                       *op;
+
+	g_return_if_fail (CATALINA_IS_SHARDED_STORAGE (storage));
+	g_return_if_fail (txn_id != 0);
+
+	priv = storage->priv;
+	op = shard_op_new (storage, TXN_SHARD (priv, txn_id), callback, user_data,
+	                   catalina_sharded_storage_transaction_commit_async);
+	catalina_storage_transaction_commit_async (priv->shards [op->shard],
+	                                           TXN_LOCAL (priv, txn_id),
+	                                           shard_txn_commit_cb, op);
+}
+
+/**
+ * catalina_sharded_storage_transaction_commit_finish:
+ * @storage: A #CatalinaShardedStorage
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to commit a transaction.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_sharded_storage_transaction_commit_finish (CatalinaShardedStorage  *storage,
+                                                    GAsyncResult            *result,
+                                                    GError                 **error)
+{
+	return shard_op_finish (storage, result,
+	                        catalina_sharded_storage_transaction_commit_async,
+	                        error) != NULL;
+}
+
+static void
+shard_txn_cancel_cb (GObject      *object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+	catalina_storage_transaction_cancel_finish (CATALINA_STORAGE (object), result);
+	shard_op_complete (user_data, NULL);
+}
+
+/**
+ * catalina_sharded_storage_transaction_cancel_async:
+ * @storage: A #CatalinaShardedStorage
+ * @txn_id: the transaction id from catalina_sharded_storage_transaction_begin_async()
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously cancels the transaction on the shard it belongs to.
+ *
+ * See catalina_storage_transaction_cancel_async().
+ */
+void
+catalina_sharded_storage_transaction_cancel_async (CatalinaShardedStorage *storage,
+                                                   gulong                  txn_id,
+                                                   GAsyncReadyCallback     callback,
+                                                   gpointer                user_data)
+{
+	CatalinaShardedStoragePrivate *priv;
+	ShardOp                       *op;
+
+	g_return_if_fail (CATALINA_IS_SHARDED_STORAGE (storage));
+	g_return_if_fail (txn_id != 0);
+
+	priv = storage->priv;
+	op = shard_op_new (storage, TXN_SHARD (priv, txn_id), callback, user_data,
+	                   catalina_sharded_storage_transaction_cancel_async);
+	catalina_storage_transaction_cancel_async (priv->shards [op->shard],
+	                                           TXN_LOCAL (priv, txn_id),
+	                                           shard_txn_cancel_cb, op);
+}
+
+/**
+ * catalina_sharded_storage_transaction_cancel_finish:
+ * @storage: A #CatalinaShardedStorage
+ * @result: A #GAsyncResult
+ *
+ * Completes an asynchronous request to cancel a transaction.
+ */
+void
+catalina_sharded_storage_transaction_cancel_finish (CatalinaShardedStorage *storage,
+                                                    GAsyncResult           *result)
+{
+	shard_op_finish (storage, result,
+	                 catalina_sharded_storage_transaction_cancel_async, NULL);
+}
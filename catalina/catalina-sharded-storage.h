@@ -0,0 +1,158 @@
+/* catalina-sharded-storage.h
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __CATALINA_SHARDED_STORAGE_H__
+#define __CATALINA_SHARDED_STORAGE_H__
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "catalina-storage.h"
+
+G_BEGIN_DECLS
+
+#define CATALINA_TYPE_SHARDED_STORAGE            (catalina_sharded_storage_get_type())
+#define CATALINA_SHARDED_STORAGE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj),  CATALINA_TYPE_SHARDED_STORAGE, CatalinaShardedStorage))
+#define CATALINA_SHARDED_STORAGE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),   CATALINA_TYPE_SHARDED_STORAGE, CatalinaShardedStorageClass))
+#define CATALINA_IS_SHARDED_STORAGE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj),  CATALINA_TYPE_SHARDED_STORAGE))
+#define CATALINA_IS_SHARDED_STORAGE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),   CATALINA_TYPE_SHARDED_STORAGE))
+#define CATALINA_SHARDED_STORAGE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),   CATALINA_TYPE_SHARDED_STORAGE, CatalinaShardedStorageClass))
+
+typedef struct _CatalinaShardedStorage        CatalinaShardedStorage;
+typedef struct _CatalinaShardedStorageClass   CatalinaShardedStorageClass;
+typedef struct _CatalinaShardedStoragePrivate CatalinaShardedStoragePrivate;
+
+struct _CatalinaShardedStorage
+{
+	GObject parent;
+
+	/*< private >*/
+	CatalinaShardedStoragePrivate *priv;
+};
+
+struct _CatalinaShardedStorageClass
+{
+	GObjectClass parent_class;
+};
+
+GType                   catalina_sharded_storage_get_type          (void);
+CatalinaShardedStorage* catalina_sharded_storage_new               (guint                    n_shards);
+guint                   catalina_sharded_storage_get_n_shards      (CatalinaShardedStorage  *storage);
+CatalinaStorage*        catalina_sharded_storage_get_shard         (CatalinaShardedStorage  *storage,
+                                                                    guint                    index);
+CatalinaStorage*        catalina_sharded_storage_get_shard_for_key (CatalinaShardedStorage  *storage,
+                                                                    const gchar             *key,
+                                                                    gssize                   key_length);
+gboolean                catalina_sharded_storage_open              (CatalinaShardedStorage  *storage,
+                                                                    const gchar             *env_dir,
+                                                                    const gchar             *name,
+                                                                    GError                 **error);
+gboolean                catalina_sharded_storage_close             (CatalinaShardedStorage  *storage,
+                                                                    GError                 **error);
+void                    catalina_sharded_storage_get_async         (CatalinaShardedStorage  *storage,
+                                                                    const gchar             *key,
+                                                                    gssize                   key_length,
+                                                                    GAsyncReadyCallback      callback,
+                                                                    gpointer                 user_data);
+gboolean                catalina_sharded_storage_get_finish        (CatalinaShardedStorage  *storage,
+                                                                    GAsyncResult            *result,
+                                                                    gchar                  **value,
+                                                                    gsize                   *value_length,
+                                                                    GError                 **error);
+gboolean                catalina_sharded_storage_get               (CatalinaShardedStorage  *storage,
+                                                                    const gchar             *key,
+                                                                    gssize                   key_length,
+                                                                    gchar                  **value,
+                                                                    gsize                   *value_length,
+                                                                    GError                 **error);
+void                    catalina_sharded_storage_set_async         (CatalinaShardedStorage  *storage,
+                                                                    gulong                   txn_id,
+                                                                    const gchar             *key,
+                                                                    gssize                   key_length,
+                                                                    const gchar             *value,
+                                                                    gssize                   value_length,
+                                                                    GAsyncReadyCallback      callback,
+                                                                    gpointer                 user_data);
+gboolean                catalina_sharded_storage_set_finish        (CatalinaShardedStorage  *storage,
+                                                                    GAsyncResult            *result,
+                                                                    GError                 **error);
+gboolean                catalina_sharded_storage_set               (CatalinaShardedStorage  *storage,
+                                                                    gulong                   txn_id,
+                                                                    const gchar             *key,
+                                                                    gssize                   key_length,
+                                                                    const gchar             *value,
+                                                                    gssize                   value_length,
+                                                                    GError                 **error);
+void                    catalina_sharded_storage_get_value_async   (CatalinaShardedStorage  *storage,
+                                                                    const gchar             *key,
+                                                                    gssize                   key_length,
+                                                                    GAsyncReadyCallback      callback,
+                                                                    gpointer                 user_data);
+gboolean                catalina_sharded_storage_get_value_finish  (CatalinaShardedStorage  *storage,
+                                                                    GAsyncResult            *result,
+                                                                    GValue                  *value,
+                                                                    GError                 **error);
+gboolean                catalina_sharded_storage_get_value         (CatalinaShardedStorage  *storage,
+                                                                    const gchar             *key,
+                                                                    gssize                   key_length,
+                                                                    GValue                  *value,
+                                                                    GError                 **error);
+void                    catalina_sharded_storage_set_value_async   (CatalinaShardedStorage  *storage,
+                                                                    gulong                   txn_id,
+                                                                    const gchar             *key,
+                                                                    gssize                   key_length,
+                                                                    const GValue            *value,
+                                                                    GAsyncReadyCallback      callback,
+                                                                    gpointer                 user_data);
+gboolean                catalina_sharded_storage_set_value_finish  (CatalinaShardedStorage  *storage,
+                                                                    GAsyncResult            *result,
+                                                                    GError                 **error);
+gboolean                catalina_sharded_storage_set_value         (CatalinaShardedStorage  *storage,
+                                                                    gulong                   txn_id,
+                                                                    const gchar             *key,
+                                                                    gssize                   key_length,
+                                                                    const GValue            *value,
+                                                                    GError                 **error);
+gulong                  catalina_sharded_storage_count_keys        (CatalinaShardedStorage  *storage);
+
+void                    catalina_sharded_storage_transaction_begin_async   (CatalinaShardedStorage *storage,
+                                                                            const gchar            *key,
+                                                                            gssize                  key_length,
+                                                                            GAsyncReadyCallback     callback,
+                                                                            gpointer                user_data);
+gulong                  catalina_sharded_storage_transaction_begin_finish  (CatalinaShardedStorage *storage,
+                                                                            GAsyncResult           *result);
+void                    catalina_sharded_storage_transaction_commit_async  (CatalinaShardedStorage *storage,
+                                                                            gulong                  txn_id,
+                                                                            GAsyncReadyCallback     callback,
+                                                                            gpointer                user_data);
+gboolean                catalina_sharded_storage_transaction_commit_finish (CatalinaShardedStorage *storage,
+                                                                            GAsyncResult           *result,
+                                                                            GError                **error);
+void                    catalina_sharded_storage_transaction_cancel_async  (CatalinaShardedStorage *storage,
+                                                                            gulong                  txn_id,
+                                                                            GAsyncReadyCallback     callback,
+                                                                            gpointer                user_data);
+void                    catalina_sharded_storage_transaction_cancel_finish (CatalinaShardedStorage *storage,
+                                                                            GAsyncResult           *result);
+
+G_END_DECLS
+
+#endif /* __CATALINA_SHARDED_STORAGE_H__ */
@@ -22,7 +22,6 @@
 #define __CATALINA_STORAGE_PRIVATE_H__
 
 #include <sys/types.h>
-#include <tdb.h>
 #include <glib-object.h>
 #include <iris/iris.h>
 
@@ -32,12 +31,59 @@
 
 G_BEGIN_DECLS
 
+#define STORAGE_WRITE_LANES 64
+
 typedef struct _StorageTask StorageTask;
 typedef struct _TxnState    TxnState;
+typedef struct _ForeachJob  ForeachJob;
+typedef struct _ForeachPart ForeachPart;
+typedef struct _StorageIndex StorageIndex;
+typedef struct _IndexDatum  IndexDatum;
+typedef struct _IndexUpdate IndexUpdate;
+typedef struct _IndexBuild  IndexBuild;
+typedef struct _StorageQueue StorageQueue;
+typedef struct _QueueCompletion QueueCompletion;
+
+struct _CatalinaCursor
+{
+	CatalinaStorage     *storage;
+	CatalinaCursorFlags  flags;
+	gchar               *position;  /* last key delivered */
+	gsize                position_length;
+	gboolean             started;
+	gboolean             done;
+	CatalinaBackend     *backend;   /* holding its partitions until done */
+};
+
+struct _CatalinaSnapshot
+{
+	CatalinaStorage     *storage;
+	GHashTable          *versions;  /* IndexDatum key -> IndexDatum record as of the
+	                                 * snapshot, or %NULL if it did not exist.  %NULL
+	                                 * once the storage is closed. */
+};
+
+struct _StorageQueue
+{
+	guint    length;     /* asynchronous requests outstanding */
+	guint64  bytes;      /* bytes of their keys and values */
+	guint    idle;       /* of those, done with the callback waiting in the main loop */
+	guint64  idle_bytes;
+};
+
+struct _QueueCompletion
+{
+	CatalinaStorage    *storage;
+	GSimpleAsyncResult *result;
+	StorageQueue       *queue;
+	gsize               bytes;
+};
 
 struct _CatalinaStoragePrivate
 {
-	TDB_CONTEXT       *db_ctx;        /* TDB handle */
+	CatalinaBackend   *backend;       /* storage engine */
+	gboolean           opened;        /* backend holds an open data-store */
+	gboolean           shared;        /* other processes write to the data-store */
 	gboolean           use_idle;      /* dispatch callbacks in main thread */
 	guint              flags;         /* state flags */
 
@@ -49,10 +95,72 @@ struct _CatalinaStoragePrivate
 	GList             *txn_commits;   /* pending commit queue */
 	GHashTable        *txn_state;     /* transaction state */
 
+	guint              txn_group_size;    /* max commits per backend transaction */
+	GList             *txn_group;         /* commits awaiting a group flush */
+	guint              txn_group_length;  /* length of txn_group */
+	gboolean           txn_flush_pending; /* MESSAGE_TXN_FLUSH is queued */
+	gulong             txn_group_count;   /* number of group flushes */
+	gulong             txn_group_commits; /* commits processed by group flushes */
+	guint              txn_group_largest; /* largest group flushed */
+	gboolean           txn_replay;        /* a group is being replayed */
+	GList             *txn_replayed;      /* tasks completed during the replay */
+
+	gulong             meta_keys;     /* number of records, excluding metadata */
+	guint64            meta_bytes;    /* bytes stored for record values */
+	gboolean           meta_dirty;    /* counters are stored apart from the records */
+
+	GList             *indexes;       /* StorageIndex, changed by exclusive handlers */
+	GMutex            *index_mutex;   /* protects indexes for callers extracting values */
+
+	gdouble            compact_threshold; /* free fraction starting a compaction, or 0 */
+	gboolean           compact_running;   /* MESSAGE_COMPACT_STEP is queued */
+	GList             *compact_waiters;   /* StorageTask awaiting the compaction */
+	volatile gint      compact_writes;    /* writes since the threshold was checked */
+
+	CatalinaDurability durability;        /* default durability of commits */
+	guint              sync_interval;     /* ms between periodic syncs */
+	guint64            sync_bytes;        /* bytes written forcing a periodic sync */
+	guint64            sync_written;      /* bytes written, for sync_bytes */
+	GThread           *sync_thread;       /* syncs commits made with PERIODIC */
+	GMutex            *sync_mutex;        /* protects the fields below */
+	GCond             *sync_cond;
+	GList             *sync_waiters;      /* StorageTask awaiting the next sync */
+	guint64            sync_pending;      /* bytes written by the waiters */
+	gboolean           sync_wake;         /* sync without waiting for the interval */
+	gboolean           sync_stop;
+
+	GMutex            *stage_mutex;       /* protects stage_queue and the lanes */
+	GQueue            *stage_queue;       /* exclusive messages held behind the
+	                                       * transform stage, in submission order */
+
+	gboolean           concurrent_writes; /* run writes on the concurrent workers */
+	gboolean           concurrent;        /* concurrent_writes is in effect */
+	GQueue             write_lanes [STORAGE_WRITE_LANES]; /* writes by key hash, the
+	                                                       * head is running */
+	guint              writes_inflight;   /* messages within the lanes */
+	GMutex            *write_mutex;       /* protects the counters and indexes from
+	                                       * concurrent writers */
+
+	GList             *snapshots;         /* CatalinaSnapshot, see snapshot_lock */
+	GStaticRWLock      snapshot_lock;     /* readers of the snapshots against the
+	                                       * writers keeping versions for them */
+	gboolean           snapshot_reads;    /* snapshots are read on sn_port */
+
+	guint              queue_limit;       /* requests outstanding per port, or 0 */
+	guint64            queue_limit_bytes; /* bytes outstanding per port, or 0 */
+	CatalinaQueuePolicy queue_policy;
+	GMutex            *queue_mutex;       /* protects the fields below */
+	GCond             *queue_cond;        /* signaled as requests complete */
+	StorageQueue       ex_queue,          /* requests through storage_ex_post() */
+	                   cn_queue;          /* requests through storage_cn_post() */
+	GList             *queue_waiters;     /* GSimpleAsyncResult awaiting ex_queue */
+
 	IrisPort          *ex_port,       /* exclusive operations, open/close/write/etc */
-	                  *cn_port;       /* concurrent operations, get/etc */
+	                  *cn_port,       /* concurrent operations, get/etc */
+	                  *sn_port;       /* snapshot reads, outside of the arbiter */
 	IrisReceiver      *ex_receiver,
-	                  *cn_receiver;
+	                  *cn_receiver,
+	                  *sn_receiver;
 	IrisArbiter       *arbiter;
 };
 
@@ -74,17 +182,96 @@ struct _StorageTask
 	gchar                *data;
 	gsize                 data_length;
 	GValue                value;
+	GArray               *entries;
+	CatalinaRecordFunc    record_func;
+	CatalinaPredicateFunc predicate;
+	gpointer              record_data;
+	CatalinaCursor       *cursor;
+	CatalinaSnapshot     *snapshot;
+	StorageQueue         *queue;         /* counted in the queue until it completes */
+	gsize                 queue_bytes;
+	guint                 max_items;
+	ForeachJob           *foreach;
+	gpointer              reduced;
+	guint64               size;
+	GSList               *index_values;  /* IndexUpdate extracted by set_value */
+	CatalinaDurability    durability;
+	gboolean              transformed;   /* @data went through the transform already */
+	gboolean              staging;       /* in the transform stage, see stage_queue */
 
 	/* task failure propagation */
 	GError               *error;
 };
 
-struct _TxnState
+struct _ForeachJob
+{
+	StorageTask        *task;
+	CatalinaMapFunc     map_func;
+	CatalinaReduceFunc  reduce_func;
+	gpointer            func_data;
+
+	guint               n_parts;
+	ForeachPart        *parts;
+	volatile gint       pending;   /* partitions still running */
+
+	GMutex             *mutex;     /* protects error */
+	GError             *error;
+};
+
+struct _ForeachPart
+{
+	ForeachJob *job;
+	guint       first;
+	guint       last;         /* exclusive */
+	gpointer    partial;
+};
+
+struct _StorageIndex
+{
+	volatile gint      ref_count;
+	gchar             *name;
+	gchar             *property;     /* indexed property, or %NULL to use func */
+	CatalinaIndexFunc  func;
+	gpointer           func_data;
+	GDestroyNotify     func_notify;
+
+	GHashTable        *entries;      /* IndexDatum value -> set of IndexDatum keys */
+	GHashTable        *reverse;      /* IndexDatum key -> IndexDatum value */
+	gboolean           ready;        /* every record has been indexed */
+	gboolean           removed;      /* dropped from the storage */
+	guint              generation;   /* bumped to abandon a running build */
+	guint              partition;    /* next partition to build */
+};
+
+struct _IndexDatum
+{
+	gchar *data;
+	gsize  length;
+};
+
+struct _IndexUpdate
+{
+	StorageIndex *index;
+	IndexDatum   *value;         /* serialized index value or %NULL */
+};
+
+struct _IndexBuild
 {
-	gulong           txn_id;
 	CatalinaStorage *storage;
-	GList           *msgs;
-	GError          *error;
+	StorageIndex    *index;
+	guint            generation;  /* abandoned once it differs from the index */
+	guint            n_records;   /* records visited by the current batch */
+	guint            n_partitions;
+};
+
+struct _TxnState
+{
+	gulong              txn_id;
+	CatalinaStorage    *storage;
+	GList              *msgs;
+	gboolean            ordered;   /* msgs were reversed into commit order */
+	GError             *error;
+	CatalinaDurability  durability;
 };
 
 enum
@@ -94,12 +281,33 @@ enum
 	MESSAGE_CLOSE,
 	MESSAGE_GET,
 	MESSAGE_GET_VALUE,
+	MESSAGE_GET_MANY,
+	MESSAGE_GET_WITH_FUNC,
+	MESSAGE_CURSOR_NEXT,
+	MESSAGE_SCAN,
+	MESSAGE_FOREACH,
+	MESSAGE_FOREACH_PART,
 	MESSAGE_SET,
 	MESSAGE_SET_VALUE,
+	MESSAGE_REMOVE,
+	MESSAGE_REMOVE_MANY,
+	MESSAGE_REMOVE_WHERE,
 	MESSAGE_COUNT_KEYS,
 	MESSAGE_TXN_BEGIN,
 	MESSAGE_TXN_COMMIT,
 	MESSAGE_TXN_CANCEL,
+	MESSAGE_TXN_FLUSH,
+	MESSAGE_INDEX_ADD,
+	MESSAGE_INDEX_REMOVE,
+	MESSAGE_INDEX_BUILD,
+	MESSAGE_INDEX_LOOKUP,
+	MESSAGE_COMPACT,
+	MESSAGE_COMPACT_STEP,
+	MESSAGE_GET_SPACE,
+	MESSAGE_COMPACT_CHECK,
+	MESSAGE_SNAPSHOT,
+	MESSAGE_SNAPSHOT_GET,
+	MESSAGE_SNAPSHOT_GET_VALUE,
 };
 
 enum
@@ -108,6 +316,16 @@ enum
 	PROP_USE_IDLE,
 	PROP_FORMATTER,
 	PROP_TRANSFORM,
+	PROP_GROUP_COMMIT_SIZE,
+	PROP_BACKEND,
+	PROP_COMPACT_THRESHOLD,
+	PROP_DURABILITY,
+	PROP_SYNC_INTERVAL,
+	PROP_SYNC_BYTES,
+	PROP_CONCURRENT_WRITES,
+	PROP_QUEUE_LIMIT,
+	PROP_QUEUE_LIMIT_BYTES,
+	PROP_QUEUE_POLICY,
 };
 
 enum
@@ -117,10 +335,99 @@ enum
 
 static void         catalina_storage_ex_handle_message (IrisMessage     *message, CatalinaStorage  *storage);
 static void         catalina_storage_cn_handle_message (IrisMessage     *message, CatalinaStorage  *storage);
+static void         catalina_storage_sn_handle_message (IrisMessage     *message, CatalinaStorage  *storage);
 
 static TxnState*    txn_state_new         (CatalinaStorage *storage, gulong            txn_id);
 static gboolean     txn_state_run         (TxnState        *state,   GError          **error);
 static void         txn_state_free        (TxnState        *state);
+static void         foreach_job_free      (ForeachJob      *job);
+static gboolean     meta_load             (CatalinaStorage *storage,
+                                           GError         **error);
+static gboolean     meta_store            (CatalinaStorage *storage,
+                                           GError         **error);
+static gboolean     meta_fetch            (CatalinaStorage *storage,
+                                           gulong          *n_keys,
+                                           guint64         *n_bytes);
+static gboolean     storage_write_begin   (CatalinaStorage *storage,
+                                           GError         **error);
+static gboolean     storage_untransform   (CatalinaStorage *storage,
+                                           gchar           *value,
+                                           gsize            value_length,
+                                           gchar          **data,
+                                           gsize           *data_length,
+                                           GError         **error);
+static gboolean     meta_record_size      (CatalinaStorage *storage,
+                                           const gchar     *key,
+                                           gsize            key_length,
+                                           gsize           *size);
+static StorageIndex* storage_index_new    (const gchar       *name,
+                                           const gchar       *property,
+                                           CatalinaIndexFunc  func,
+                                           gpointer           func_data,
+                                           GDestroyNotify     func_notify);
+static void         storage_index_unref   (StorageIndex    *index);
+static StorageIndex* storage_index_find   (CatalinaStorage *storage,
+                                           const gchar     *name);
+static IndexDatum*  storage_index_extract (CatalinaStorage *storage,
+                                           StorageIndex    *index,
+                                           const GValue    *value);
+static void         storage_index_put     (StorageIndex    *index,
+                                           const gchar     *key,
+                                           gsize            key_length,
+                                           IndexDatum      *value);
+static gboolean     storage_index_read    (CatalinaStorage *storage,
+                                           const gchar     *data,
+                                           gsize            data_length,
+                                           GValue          *value);
+static void         storage_index_build   (CatalinaStorage *storage,
+                                           StorageIndex    *index);
+static gboolean     index_datum_equal     (gconstpointer    a,
+                                           gconstpointer    b);
+static IndexDatum*  index_datum_new       (gchar           *data,
+                                           gsize            length);
+static void         index_datum_free      (IndexDatum      *datum);
+static GSList*      storage_indexes_extract (CatalinaStorage *storage,
+                                             const GValue    *value);
+static void         storage_indexes_update  (CatalinaStorage *storage,
+                                             StorageTask     *task);
+static void         storage_indexes_remove  (CatalinaStorage *storage,
+                                             const gchar     *key,
+                                             gsize            key_length);
+static void         storage_indexes_reset   (CatalinaStorage *storage);
+static void         storage_indexes_clear   (CatalinaStorage *storage);
+static void         storage_index_updates_free (GSList       *updates);
+static void         storage_compact_start (CatalinaStorage *storage);
+static void         storage_compact_check (CatalinaStorage *storage);
+static void         storage_compact_measure (CatalinaStorage *storage);
+static void         storage_compact_step  (CatalinaStorage *storage);
+static CatalinaDurability
+                    storage_durability    (CatalinaStorage *storage, CatalinaDurability durability);
+static CatalinaDurability
+                    storage_sync_prepare  (CatalinaStorage *storage, CatalinaDurability durability);
+static void         storage_sync_succeed  (CatalinaStorage *storage, StorageTask *task, CatalinaDurability durability);
+static void         storage_sync_stop     (CatalinaStorage *storage);
+static void         storage_ex_post       (CatalinaStorage *storage, IrisMessage     *message);
+static void         storage_cn_post       (CatalinaStorage *storage, IrisMessage     *message);
+static gboolean     storage_queue_admit   (CatalinaStorage *storage, IrisMessage     *message, StorageQueue *queue);
+static void         storage_queue_release (CatalinaStorage *storage, StorageQueue    *queue, gsize bytes, gboolean idle);
+static void         storage_queue_complete (CatalinaStorage *storage, StorageTask    *task);
+static void         storage_queue_resize  (CatalinaStorage *storage, StorageTask     *task);
+static gboolean     storage_queue_has_room (CatalinaStoragePrivate *priv, StorageQueue *queue, gsize bytes, gboolean blocking);
+static void         storage_stage_set     (CatalinaStorage *storage, IrisMessage     *message);
+static void         storage_stage_done    (CatalinaStorage *storage, StorageTask     *task);
+static guint        storage_lane_of       (StorageTask     *task);
+static void         storage_lane_post     (CatalinaStorage *storage, IrisMessage     *message);
+static void         storage_lane_done     (CatalinaStorage *storage, guint            lane);
+static CatalinaSnapshot*
+                    storage_snapshot_new  (CatalinaStorage *storage);
+static void         storage_snapshots_preserve (CatalinaStorage *storage,
+                                                const gchar     *key,
+                                                gsize            key_length);
+static void         storage_snapshots_release  (CatalinaStorage *storage);
+static void         txn_group_queue       (CatalinaStorage *storage, IrisMessage     *message);
+static void         txn_group_flush       (CatalinaStorage *storage);
+static void         txn_group_commit      (CatalinaStorage *storage, GList           *messages);
+static void         txn_group_complete_replayed (CatalinaStorage *storage, gulong txn_id);
 static StorageTask* storage_task_new      (CatalinaStorage *storage, gboolean          is_async, GAsyncReadyCallback  callback, gpointer user_data, gpointer source_tag);
 static void         storage_task_free     (StorageTask     *task,    gboolean          free_key, gboolean             free_data);
 static gboolean     storage_task_wait     (StorageTask     *task,    GError          **error);
@@ -18,18 +18,30 @@
  * 02110-1301 USA
  */
 
-#include <fcntl.h>
 #include <string.h>
 #include <sys/types.h>
-#include <tdb.h>
 
 #include <iris/iris.h>
 
 #include "catalina-formatter.h"
 #include "catalina-storage.h"
 #include "catalina-storage-private.h"
+#include "catalina-tdb-backend.h"
 #include "catalina-transform.h"
 
+#define FOREACH_DEFAULT_PARTITIONS 16
+#define STORAGE_INDEX_BATCH        256
+#define STORAGE_SYNC_INTERVAL      100
+
+/* reserved record holding the key count and value size.  the leading nul
+ * keeps it out of reach of string keys, and requests naming it are refused. */
+#define META_KEY         "\0catalina-meta"
+#define META_KEY_LENGTH  (sizeof (META_KEY) - 1)
+#define META_VERSION     2
+#define META_DIRTY       1  /* flag of a data-store not closed cleanly yet */
+#define IS_META_KEY(k,l) ((l) == META_KEY_LENGTH && \
+                          memcmp ((k), META_KEY, META_KEY_LENGTH) == 0)
+
 #define CLEAR_DBT(dbt)   (memset(&(dbt), 0, sizeof(dbt)))
 #define FREE_DBT(dbt)    if ((dbt.flags & (DB_DBT_MALLOC|DB_DBT_REALLOC)) && \
 			      dbt.data != NULL) { g_free(dbt.data); dbt.data = NULL; }
@@ -140,6 +152,36 @@ catalina_storage_get_property (GObject    *object,
 	case PROP_TRANSFORM:
 		g_value_set_object (value, catalina_storage_get_transform ((gpointer)object));
 		break;
+	case PROP_GROUP_COMMIT_SIZE:
+		g_value_set_uint (value, catalina_storage_get_group_commit_size ((gpointer)object));
+		break;
+	case PROP_BACKEND:
+		g_value_set_object (value, catalina_storage_get_backend ((gpointer)object));
+		break;
+	case PROP_COMPACT_THRESHOLD:
+		g_value_set_double (value, catalina_storage_get_compact_threshold ((gpointer)object));
+		break;
+	case PROP_DURABILITY:
+		g_value_set_uint (value, catalina_storage_get_durability ((gpointer)object));
+		break;
+	case PROP_SYNC_INTERVAL:
+		g_value_set_uint (value, catalina_storage_get_sync_interval ((gpointer)object));
+		break;
+	case PROP_SYNC_BYTES:
+		g_value_set_uint64 (value, catalina_storage_get_sync_bytes ((gpointer)object));
+		break;
+	case PROP_CONCURRENT_WRITES:
+		g_value_set_boolean (value, catalina_storage_get_concurrent_writes ((gpointer)object));
+		break;
+	case PROP_QUEUE_LIMIT:
+		g_value_set_uint (value, catalina_storage_get_queue_limit ((gpointer)object));
+		break;
+	case PROP_QUEUE_LIMIT_BYTES:
+		g_value_set_uint64 (value, catalina_storage_get_queue_limit_bytes ((gpointer)object));
+		break;
+	case PROP_QUEUE_POLICY:
+		g_value_set_uint (value, catalina_storage_get_queue_policy ((gpointer)object));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -161,6 +203,36 @@ catalina_storage_set_property (GObject      *object,
 	case PROP_TRANSFORM:
 		catalina_storage_set_transform ((gpointer)object, g_value_get_object (value));
 		break;
+	case PROP_GROUP_COMMIT_SIZE:
+		catalina_storage_set_group_commit_size ((gpointer)object, g_value_get_uint (value));
+		break;
+	case PROP_BACKEND:
+		catalina_storage_set_backend ((gpointer)object, g_value_get_object (value));
+		break;
+	case PROP_COMPACT_THRESHOLD:
+		catalina_storage_set_compact_threshold ((gpointer)object, g_value_get_double (value));
+		break;
+	case PROP_DURABILITY:
+		catalina_storage_set_durability ((gpointer)object, g_value_get_uint (value));
+		break;
+	case PROP_SYNC_INTERVAL:
+		catalina_storage_set_sync_interval ((gpointer)object, g_value_get_uint (value));
+		break;
+	case PROP_SYNC_BYTES:
+		catalina_storage_set_sync_bytes ((gpointer)object, g_value_get_uint64 (value));
+		break;
+	case PROP_CONCURRENT_WRITES:
+		catalina_storage_set_concurrent_writes ((gpointer)object, g_value_get_boolean (value));
+		break;
+	case PROP_QUEUE_LIMIT:
+		catalina_storage_set_queue_limit ((gpointer)object, g_value_get_uint (value));
+		break;
+	case PROP_QUEUE_LIMIT_BYTES:
+		catalina_storage_set_queue_limit_bytes ((gpointer)object, g_value_get_uint64 (value));
+		break;
+	case PROP_QUEUE_POLICY:
+		catalina_storage_set_queue_policy ((gpointer)object, g_value_get_uint (value));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -169,6 +241,28 @@ catalina_storage_set_property (GObject      *object,
 static void
 catalina_storage_finalize (GObject *object)
 {
+	CatalinaStoragePrivate *priv;
+
+	priv = CATALINA_STORAGE (object)->priv;
+
+	g_list_foreach (priv->indexes, (GFunc)storage_index_unref, NULL);
+	g_list_free (priv->indexes);
+	g_mutex_free (priv->index_mutex);
+
+	g_mutex_free (priv->sync_mutex);
+	g_cond_free (priv->sync_cond);
+
+	g_mutex_free (priv->stage_mutex);
+	g_queue_free (priv->stage_queue);
+	g_mutex_free (priv->write_mutex);
+
+	g_static_rw_lock_free (&priv->snapshot_lock);
+
+	g_list_foreach (priv->queue_waiters, (GFunc)g_object_unref, NULL);
+	g_list_free (priv->queue_waiters);
+	g_mutex_free (priv->queue_mutex);
+	g_cond_free (priv->queue_cond);
+
 	G_OBJECT_CLASS (catalina_storage_parent_class)->finalize (object);
 }
 
@@ -179,6 +273,9 @@ catalina_storage_dispose (GObject *object)
 
 	priv = CATALINA_STORAGE (object)->priv;
 
+	/* the sync thread uses the backend */
+	storage_sync_stop (CATALINA_STORAGE (object));
+
 	if (priv->transform) {
 		g_object_unref (priv->transform);
 		priv->transform = NULL;
@@ -188,6 +285,11 @@ catalina_storage_dispose (GObject *object)
 		g_object_unref (priv->formatter);
 		priv->formatter = NULL;
 	}
+
+	if (priv->backend) {
+		g_object_unref (priv->backend);
+		priv->backend = NULL;
+	}
 }
 
 static void
@@ -228,6 +330,10 @@ catalina_storage_class_init (CatalinaStorageClass *klass)
 	 * on the way to and from the data-store.  This can be used to add features such as
 	 * encryption or compression.
 	 *
+	 * Values written asynchronously are transformed by the concurrent workers before
+	 * the write takes the exclusive section, and synchronous writes transform within
+	 * the calling thread, so writers do not hold up readers while compressing.
+	 *
 	 * See catalina_transform_read() and catalina_transform_write().
 	 */
 	g_object_class_install_property (object_class,
@@ -254,11 +360,222 @@ catalina_storage_class_init (CatalinaStorageClass *klass)
 	                                                      "Storage formatter",
 	                                                      CATALINA_TYPE_FORMATTER,
 	                                                      G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaStorage:group-commit-size:
+	 *
+	 * The "group-commit-size" property.  When larger than 1, transaction commits that
+	 * arrive close together are coalesced into a single backend transaction of up to
+	 * "group-commit-size" commits.  This amortizes the cost of the transaction and its
+	 * sync to disk across all of the commits in the group.
+	 *
+	 * A transaction of the group which fails to apply fails on its own commit and the
+	 * group is applied again without it.  Only a failure of the backend commit itself
+	 * rolls back the entire group and fails every commit in it.
+	 *
+	 * See catalina_storage_get_group_commit_stats().
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_GROUP_COMMIT_SIZE,
+	                                 g_param_spec_uint ("group-commit-size",
+	                                                    "GroupCommitSize",
+	                                                    "Maximum number of commits "
+	                                                    "coalesced into a single "
+	                                                    "transaction.",
+	                                                    1,
+	                                                    G_MAXUINT,
+	                                                    1,
+	                                                    G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaStorage:backend:
+	 *
+	 * The "backend" property.  The backend is the storage engine that persists the
+	 * buffers.  It defaults to a #CatalinaTdbBackend and may only be changed while the
+	 * storage is closed.
+	 *
+	 * See #CatalinaBackend.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_BACKEND,
+	                                 g_param_spec_object ("backend",
+	                                                      "Backend",
+	                                                      "Storage engine",
+	                                                      CATALINA_TYPE_BACKEND,
+	                                                      G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaStorage:compact-threshold:
+	 *
+	 * The "compact-threshold" property.  When larger than 0, a compaction is started in
+	 * the background once this fraction of the data-store is free space left behind by
+	 * overwritten and removed records.  Small data-stores are not compacted
+	 * automatically.  The free space is measured every few writes, and right after
+	 * catalina_storage_remove_many() and catalina_storage_remove_where() remove any
+	 * record, so that a bulk removal does not wait for later writes to be reclaimed.
+	 *
+	 * See catalina_storage_get_space() and catalina_storage_compact_async().
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_COMPACT_THRESHOLD,
+	                                 g_param_spec_double ("compact-threshold",
+	                                                      "CompactThreshold",
+	                                                      "Fraction of free space "
+	                                                      "starting a compaction.",
+	                                                      0.0,
+	                                                      1.0,
+	                                                      0.0,
+	                                                      G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaStorage:durability:
+	 *
+	 * The "durability" property.  A #CatalinaDurability describing how far transaction
+	 * commits are persisted before they complete, unless the transaction was begun with
+	 * catalina_storage_transaction_begin_full_async().  Writes made outside of a
+	 * transaction are never synced on their own.
+	 *
+	 * Backends which sync every commit regardless, such as #CatalinaBtreeBackend,
+	 * always provide %CATALINA_DURABILITY_COMMIT.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_DURABILITY,
+	                                 g_param_spec_uint ("durability",
+	                                                    "Durability",
+	                                                    "Default durability of "
+	                                                    "transaction commits.",
+	                                                    CATALINA_DURABILITY_NONE,
+	                                                    CATALINA_DURABILITY_COMMIT,
+	                                                    CATALINA_DURABILITY_COMMIT,
+	                                                    G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaStorage:sync-interval:
+	 *
+	 * The "sync-interval" property.  The longest time in milliseconds a commit made with
+	 * %CATALINA_DURABILITY_PERIODIC waits for the background sync.  Commits arriving
+	 * within the interval are made durable by a single sync.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_SYNC_INTERVAL,
+	                                 g_param_spec_uint ("sync-interval",
+	                                                    "SyncInterval",
+	                                                    "Milliseconds between "
+	                                                    "periodic syncs.",
+	                                                    1,
+	                                                    G_MAXUINT,
+	                                                    STORAGE_SYNC_INTERVAL,
+	                                                    G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaStorage:sync-bytes:
+	 *
+	 * The "sync-bytes" property.  When larger than 0, the background sync starts before
+	 * "sync-interval" has passed once this many bytes were written by the commits
+	 * waiting on it, which bounds the data at risk under heavy writes.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_SYNC_BYTES,
+	                                 g_param_spec_uint64 ("sync-bytes",
+	                                                      "SyncBytes",
+	                                                      "Bytes written starting "
+	                                                      "a periodic sync.",
+	                                                      0,
+	                                                      G_MAXUINT64,
+	                                                      0,
+	                                                      G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaStorage:concurrent-writes:
+	 *
+	 * The "concurrent-writes" property.  When %TRUE, sets and removes made outside of a
+	 * transaction no longer hold the exclusive worker.  They run on the concurrent
+	 * workers, where their transforms, index updates and metadata bookkeeping run
+	 * alongside each other and the reads, while the writes to a single key are still
+	 * applied in the order they were made.  Transactions and the other exclusive
+	 * requests wait for the running writes.
+	 *
+	 * The backend may still apply the stores themselves one at a time.
+	 * #CatalinaTdbBackend does, and excludes the readers for the duration of each
+	 * store, since all of its hash chains share the free list and the file mapping.
+	 *
+	 * Takes effect when the storage is opened, and only if the backend supports it;
+	 * shared data-stores always write exclusively.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_CONCURRENT_WRITES,
+	                                 g_param_spec_boolean ("concurrent-writes",
+	                                                       "ConcurrentWrites",
+	                                                       "Run writes on the "
+	                                                       "concurrent workers.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaStorage:queue-limit:
+	 *
+	 * The "queue-limit" property.  When larger than 0, the most asynchronous requests
+	 * which may be outstanding on each of the exclusive and concurrent ports.  Requests
+	 * beyond it are handled according to "queue-policy".  Requests made within a
+	 * transaction only complete with its commit and are not counted.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_QUEUE_LIMIT,
+	                                 g_param_spec_uint ("queue-limit",
+	                                                    "QueueLimit",
+	                                                    "Asynchronous requests "
+	                                                    "outstanding per port.",
+	                                                    0,
+	                                                    G_MAXUINT,
+	                                                    0,
+	                                                    G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaStorage:queue-limit-bytes:
+	 *
+	 * The "queue-limit-bytes" property.  When larger than 0, the most bytes of keys and
+	 * values the outstanding asynchronous requests of each port may hold.  A single
+	 * request larger than the limit is still let through once its port is empty.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_QUEUE_LIMIT_BYTES,
+	                                 g_param_spec_uint64 ("queue-limit-bytes",
+	                                                      "QueueLimitBytes",
+	                                                      "Bytes of asynchronous "
+	                                                      "requests outstanding per "
+	                                                      "port.",
+	                                                      0,
+	                                                      G_MAXUINT64,
+	                                                      0,
+	                                                      G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaStorage:queue-policy:
+	 *
+	 * The "queue-policy" property.  A #CatalinaQueuePolicy describing what happens to
+	 * asynchronous requests made beyond "queue-limit" or "queue-limit-bytes".
+	 *
+	 * %CATALINA_QUEUE_BLOCK must not be used from callbacks invoked on the workers, which
+	 * happens when "use-idle" is %FALSE, since the requests they wait for may be held up
+	 * behind the blocked worker.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_QUEUE_POLICY,
+	                                 g_param_spec_uint ("queue-policy",
+	                                                    "QueuePolicy",
+	                                                    "What happens to requests "
+	                                                    "beyond the queue limits.",
+	                                                    CATALINA_QUEUE_FAIL,
+	                                                    CATALINA_QUEUE_BLOCK,
+	                                                    CATALINA_QUEUE_FAIL,
+	                                                    G_PARAM_READWRITE));
 }
 
 static void
 catalina_storage_init (CatalinaStorage *storage)
 {
+	guint i;
+
 	storage->priv = G_TYPE_INSTANCE_GET_PRIVATE (storage,
 	                                             CATALINA_TYPE_STORAGE,
 	                                             CatalinaStoragePrivate);
@@ -266,15 +583,45 @@ catalina_storage_init (CatalinaStorage *storage)
 	/* perform callbacks in main by default */
 	storage->priv->use_idle = TRUE;
 
+	/* tdb is the default storage engine */
+	storage->priv->backend = catalina_tdb_backend_new ();
+
 	/* transaction state */
 	storage->priv->txn = 0;
 	storage->priv->txn_commits = NULL;
 	storage->priv->txn_state = g_hash_table_new_full (g_int_hash, g_int_equal, NULL,
 	                                                  (GDestroyNotify)txn_state_free);
+	storage->priv->txn_group_size = 1;
+
+	/* secondary indexes */
+	storage->priv->index_mutex = g_mutex_new ();
+
+	/* durability */
+	storage->priv->durability = CATALINA_DURABILITY_COMMIT;
+	storage->priv->sync_interval = STORAGE_SYNC_INTERVAL;
+	storage->priv->sync_mutex = g_mutex_new ();
+	storage->priv->sync_cond = g_cond_new ();
+
+	/* transform stage */
+	storage->priv->stage_mutex = g_mutex_new ();
+	storage->priv->stage_queue = g_queue_new ();
+
+	/* write lanes */
+	for (i = 0; i < STORAGE_WRITE_LANES; i++)
+		g_queue_init (&storage->priv->write_lanes [i]);
+	storage->priv->write_mutex = g_mutex_new ();
+
+	/* snapshots */
+	g_static_rw_lock_init (&storage->priv->snapshot_lock);
+
+	/* submission queues */
+	storage->priv->queue_mutex = g_mutex_new ();
+	storage->priv->queue_cond = g_cond_new ();
 
 	/* message ports */
 	storage->priv->ex_port = iris_port_new ();
 	storage->priv->cn_port = iris_port_new ();
+	storage->priv->sn_port = iris_port_new ();
 
 	/* message receivers */
 	storage->priv->ex_receiver = iris_arbiter_receive (
@@ -286,6 +633,12 @@ catalina_storage_init (CatalinaStorage *storage)
 		(IrisMessageHandler)catalina_storage_cn_handle_message,
 		storage, NULL);
 
+	/* snapshot reads do not wait for the exclusive receiver */
+	storage->priv->sn_receiver = iris_arbiter_receive (
+		NULL, storage->priv->sn_port,
+		(IrisMessageHandler)catalina_storage_sn_handle_message,
+		storage, NULL);
+
 	/* arbiter to handle concurrency management */
 	storage->priv->arbiter = iris_arbiter_coordinate (
 		storage->priv->ex_receiver,
@@ -356,16 +709,13 @@ catalina_storage_open_async (CatalinaStorage     *storage,
                              GAsyncReadyCallback  callback,
                              gpointer             user_data)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gchar                  *real_env_dir;
-	IrisMessage            *message;
+	StorageTask *task;
+	gchar       *real_env_dir;
+	IrisMessage *message;
 
 	g_return_if_fail (CATALINA_IS_STORAGE (storage));
 	g_return_if_fail (name != NULL);
 
-	priv = storage->priv;
-
 	real_env_dir = g_strdup (env_dir != NULL ? env_dir : ".");
 	task = storage_task_new (storage, TRUE, callback, user_data,
 	                         catalina_storage_open_async);
@@ -373,7 +723,7 @@ catalina_storage_open_async (CatalinaStorage     *storage,
 	g_free (real_env_dir);
 
 	message = iris_message_new_data (MESSAGE_OPEN, G_TYPE_POINTER, task);
-	iris_port_post (priv->ex_port, message);
+	storage_ex_post (storage, message);
 	iris_message_unref (message);
 }
 
@@ -445,24 +795,21 @@ catalina_storage_open (CatalinaStorage  *storage,
                        const            gchar *name,
                        GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gchar                  *real_env_dir;
-	IrisMessage            *message;
-	gboolean                success;
+	StorageTask *task;
+	gchar       *real_env_dir;
+	IrisMessage *message;
+	gboolean     success;
 
 	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
 	g_return_val_if_fail (name != NULL, FALSE);
 
-	priv = storage->priv;
-
 	real_env_dir = g_strdup (env_dir != NULL ? env_dir : ".");
 	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
 	task->key = g_build_filename (real_env_dir, name, NULL);
 	g_free (real_env_dir);
 
 	message = iris_message_new_data (MESSAGE_OPEN, G_TYPE_POINTER, task);
-	iris_port_post (priv->ex_port, message);
+	storage_ex_post (storage, message);
 	iris_message_unref (message);
 
 	success = storage_task_wait (task, error);
@@ -485,17 +832,15 @@ catalina_storage_close_async (CatalinaStorage     *storage,
                               GAsyncReadyCallback  callback,
                               gpointer             user_data)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	IrisMessage            *message;
+	StorageTask *task;
+	IrisMessage *message;
 
 	g_return_if_fail (CATALINA_IS_STORAGE (storage));
 
-	priv = storage->priv;
 	task = storage_task_new (storage, TRUE, callback, user_data,
 	                         catalina_storage_close_async);
 	message = iris_message_new_data (MESSAGE_CLOSE, G_TYPE_POINTER, task);
-	iris_port_post (priv->ex_port, message);
+	storage_ex_post (storage, message);
 	iris_message_unref (message);
 }
 
@@ -563,17 +908,15 @@ gboolean
 catalina_storage_close (CatalinaStorage  *storage,
                         GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	IrisMessage            *message;
-	gboolean                success;
+	StorageTask *task;
+	IrisMessage *message;
+	gboolean     success;
 
 	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
 
-	priv = storage->priv;
 	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
 	message = iris_message_new_data (MESSAGE_CLOSE, G_TYPE_POINTER, task);
-	iris_port_post (priv->ex_port, message);
+	storage_ex_post (storage, message);
 	success = storage_task_wait (task, error);
 	iris_message_unref (message);
 	storage_task_free (task, FALSE, FALSE);
@@ -593,6 +936,7 @@ catalina_storage_close (CatalinaStorage  *storage,
  *
  * The result will be completed asynchronously and provided to @callback which
  * should in turn call catalina_storage_get_finish() to complete the request.
+ * The buffer read from storage is handed to the caller without being copied.
  */
 void
 catalina_storage_get_async (CatalinaStorage     *storage,
@@ -601,18 +945,15 @@ catalina_storage_get_async (CatalinaStorage     *storage,
                             GAsyncReadyCallback  callback,
                             gpointer             user_data)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	IrisMessage            *message;
-	gchar                  *dup_key;
-	gsize                   dup_len;
+	StorageTask *task;
+	IrisMessage *message;
+	gchar       *dup_key;
+	gsize        dup_len;
 
 	g_return_if_fail (CATALINA_IS_STORAGE (storage));
 	g_return_if_fail (key != NULL);
 	g_return_if_fail (key_length == -1 || key_length > 0);
 
-	priv = storage->priv;
-
 	task = storage_task_new (storage, TRUE, callback, user_data,
 	                         catalina_storage_get_async);
 
@@ -630,7 +971,7 @@ catalina_storage_get_async (CatalinaStorage     *storage,
 	task->key_length = dup_len;
 
 	message = iris_message_new_data (MESSAGE_GET, G_TYPE_POINTER, task);
-	iris_port_post (priv->cn_port, message);
+	storage_cn_post (storage, message);
 	iris_message_unref (message);
 }
 
@@ -657,9 +998,8 @@ catalina_storage_get_finish (CatalinaStorage  *storage,
                              gsize            *value_length,
                              GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gboolean                success;
+	StorageTask *task;
+	gboolean     success;
 
 	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
 	g_return_val_if_fail (value != NULL, FALSE);
@@ -667,8 +1007,6 @@ catalina_storage_get_finish (CatalinaStorage  *storage,
 	                                                      catalina_storage_get_async),
 	                      FALSE);
 
-	priv = storage->priv;
-
 	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
 		g_critical ("GSimpleAsyncResult does not have a StorageTask");
 		return FALSE;
@@ -721,18 +1059,16 @@ catalina_storage_get (CatalinaStorage  *storage,
                       gsize            *value_length,
                       GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	IrisMessage            *message;
-	gchar                  *dup_key;
-	gsize                   dup_len;
-	gboolean                success;
+	StorageTask *task;
+	IrisMessage *message;
+	gchar       *dup_key;
+	gsize        dup_len;
+	gboolean     success;
 
 	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
 	g_return_val_if_fail (key != NULL, FALSE);
 	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
 
-	priv = storage->priv;
 	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
 
 	if (key_length == -1) {
@@ -749,7 +1085,7 @@ catalina_storage_get (CatalinaStorage  *storage,
 	task->key_length = dup_len;
 
 	message = iris_message_new_data (MESSAGE_GET, G_TYPE_POINTER, task);
-	iris_port_post (priv->cn_port, message);
+	storage_cn_post (storage, message);
 	iris_message_unref (message);
 
 	if ((success = storage_task_wait (task, error)) == TRUE) {
@@ -763,1480 +1099,7389 @@ catalina_storage_get (CatalinaStorage  *storage,
 	return success;
 }
 
+static GArray*
+storage_entries_new (const gchar  **keys,
+                     const gssize  *key_lengths,
+                     guint          n_keys)
+{
+	CatalinaStorageEntry *entry;
+	GArray               *entries;
+	guint                 i;
+
+	entries = g_array_sized_new (FALSE, TRUE, sizeof (CatalinaStorageEntry), n_keys);
+	g_array_set_size (entries, n_keys);
+
+	for (i = 0; i < n_keys; i++) {
+		entry = &g_array_index (entries, CatalinaStorageEntry, i);
+
+		if (key_lengths == NULL || key_lengths [i] == -1) {
+			entry->key = g_strdup (keys [i]);
+			entry->key_length = strlen (keys [i]) + 1;
+		}
+		else {
+			entry->key = g_memdup (keys [i], key_lengths [i]);
+			entry->key_length = key_lengths [i];
+		}
+	}
+
+	return entries;
+}
+
 /**
- * catalina_storage_set_async:
+ * catalina_storage_get_many_async:
  * @storage: A #CatalinaStorage
- * @txn_id: A transaction id or 0
- * @key: the key of which to assign @value
- * @key_length: the length of @key in bytes
- * @value: the content to store
- * @value_length: the length of @value in bytes
+ * @keys: an array of keys to lookup
+ * @key_lengths: an array of lengths for @keys in bytes, or %NULL if all of the keys
+ *   are %NULL terminated.  An individual length of -1 also denotes a %NULL terminated key.
+ * @n_keys: the number of keys in @keys
  * @callback: A #GAsyncReadyCallback
  * @user_data: data for @callback
  *
- * Asynchronously stores @value to the underlying data-store with @key.  Call
- * catalina_storage_set_finish() from within @callback.
+ * Asynchronously requests the retrieval of the data associated with each of @keys.  All of
+ * the keys are fetched within a single request to the data-store, which is much cheaper than
+ * calling catalina_storage_get_async() for each key.
+ *
+ * Call catalina_storage_get_many_finish() from within @callback to retrieve the entries.
  */
 void
-catalina_storage_set_async (CatalinaStorage     *storage,
-                            gulong               txn_id,
-                            const gchar         *key,
-                            gssize               key_length,
-                            const gchar         *value,
-                            gssize               value_length,
-                            GAsyncReadyCallback  callback,
-                            gpointer             user_data)
+catalina_storage_get_many_async (CatalinaStorage      *storage,
+                                 const gchar         **keys,
+                                 const gssize         *key_lengths,
+                                 guint                 n_keys,
+                                 GAsyncReadyCallback   callback,
+                                 gpointer              user_data)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	IrisMessage            *message;
-	gchar                  *dup_key,
-	                       *dup_value;
-	gsize                   dup_key_length,
-	                        dup_value_length;
+	StorageTask *task;
+	IrisMessage *message;
 
 	g_return_if_fail (CATALINA_IS_STORAGE (storage));
-	g_return_if_fail (key != NULL);
-	g_return_if_fail (key_length == -1 || key_length > 0);
-	g_return_if_fail (value != NULL);
-	g_return_if_fail (value_length == -1 || value_length > 0);
+	g_return_if_fail (keys != NULL || n_keys == 0);
 
-	priv = storage->priv;
 	task = storage_task_new (storage, TRUE, callback, user_data,
-	                         catalina_storage_set_async);
-
-	if (key_length == -1) {
-		dup_key = g_strdup (key);
-		dup_key_length = strlen (dup_key) + 1;
-	}
-	else {
-		dup_key = g_malloc (key_length);
-		memcpy (dup_key, key, key_length);
-		dup_key_length = key_length;
-	}
-
-	if (value_length == -1) {
-		dup_value = g_strdup (value);
-		dup_value_length = strlen (dup_value) + 1;
-	}
-	else {
-		dup_value = g_malloc (value_length);
-		memcpy (dup_value, value, value_length);
-		dup_value_length = value_length;
-	}
-
-	task->txn_id = txn_id;
-	task->key = dup_key;
-	task->key_length = dup_key_length;
-	task->data = dup_value;
-	task->data_length = dup_value_length;
+	                         catalina_storage_get_many_async);
+	task->entries = storage_entries_new (keys, key_lengths, n_keys);
 
-	message = iris_message_new_data (MESSAGE_SET, G_TYPE_POINTER, task);
-	iris_port_post (priv->ex_port, message);
+	message = iris_message_new_data (MESSAGE_GET_MANY, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
 	iris_message_unref (message);
 }
 
 /**
- * catalina_storage_set_finish:
+ * catalina_storage_get_many_finish:
  * @storage: A #CatalinaStorage
  * @result: A #GAsyncResult
- * @error: A location for #GError or %NULL
+ * @entries: A location for a #GArray of #CatalinaStorageEntry
+ * @error: A location for a #GError or %NULL
  *
- * Completes an asynchronous set request.  Upon failure, %FALSE is returned and @error is set.
+ * Completes an asynchronous request to catalina_storage_get_many_async().
  *
- * See catalina_storage_set_async().
+ * @entries contains a #CatalinaStorageEntry for each requested key in the order they
+ * were requested.  Keys that could not be found have their "found" member set to %FALSE;
+ * missing keys are not considered an error.  Free @entries with
+ * catalina_storage_entries_free().
+ *
+ * Upon failure, %FALSE is returned and @error is set.
  *
  * Return value: %TRUE on success
  */
 gboolean
-catalina_storage_set_finish (CatalinaStorage  *storage,
-                             GAsyncResult     *result,
-                             GError          **error)
+catalina_storage_get_many_finish (CatalinaStorage  *storage,
+                                  GAsyncResult     *result,
+                                  GArray          **entries,
+                                  GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gboolean                success;
+	StorageTask *task;
+	gboolean     success;
 
 	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (entries != NULL, FALSE);
 	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
-	                                                      catalina_storage_set_async),
+	                                                      catalina_storage_get_many_async),
 	                      FALSE);
 
-	priv = storage->priv;
-
 	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
 		g_critical ("GSimpleAsyncResult does not have a StorageTask");
 		return FALSE;
 	}
 
-	if (task->error) {
-		if (error && *error == NULL)
-			*error = g_error_copy (task->error);
+	if ((success = task->success) == TRUE) {
+		*entries = task->entries;
+		task->entries = NULL;
 	}
+	else if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
 
-	success = task->success;
-	storage_task_free (task, TRUE, TRUE);
+	storage_task_free (task, FALSE, FALSE);
 
 	return success;
 }
 
 /**
- * catalina_storage_set:
+ * catalina_storage_get_many:
  * @storage: A #CatalinaStorage
- * @txn_id: the transaction id or 0
- * @key: the key of which to store @value
- * @key_length: the length of @key in bytes or -1 if the @key is %NULL terminated
- * @value: the data to store
- * @value_length: the length of @data in bytes
+ * @keys: an array of keys to lookup
+ * @key_lengths: an array of lengths for @keys in bytes, or %NULL if all of the keys
+ *   are %NULL terminated
+ * @n_keys: the number of keys in @keys
+ * @entries: A location for a #GArray of #CatalinaStorageEntry
  * @error: A location for a #GError or %NULL
  *
- * Synchronously performs a set request.
+ * Synchronously retrieves the data for each of @keys.
  *
  * Upon failure, %FALSE is returned and @error is set.
  *
- * See catalina_storage_set_async().
+ * See catalina_storage_get_many_async().
  *
  * Return value: %TRUE on success
  */
 gboolean
-catalina_storage_set (CatalinaStorage  *storage,
-                      gulong            txn_id,
-                      const gchar      *key,
-                      gssize            key_length,
-                      const gchar      *value,
-                      gssize            value_length,
-                      GError          **error)
+catalina_storage_get_many (CatalinaStorage  *storage,
+                           const gchar     **keys,
+                           const gssize     *key_lengths,
+                           guint             n_keys,
+                           GArray          **entries,
+                           GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	IrisMessage            *message;
-	gboolean                success;
+	StorageTask *task;
+	IrisMessage *message;
+	gboolean     success;
 
 	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
-	g_return_val_if_fail (key != NULL, FALSE);
-	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
+	g_return_val_if_fail (keys != NULL || n_keys == 0, FALSE);
+	g_return_val_if_fail (entries != NULL, FALSE);
 
-	priv = storage->priv;
 	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
+	task->entries = storage_entries_new (keys, key_lengths, n_keys);
 
-	task->txn_id = txn_id;
-	task->key = (gchar*)key;
-	task->key_length = (key_length == -1) ? strlen (key) + 1 : key_length;
-	task->data = (gchar*)value;
-	task->data_length = (value_length == -1) ? strlen (value) + 1 : value_length;
-
-	message = iris_message_new_data (MESSAGE_SET, G_TYPE_POINTER, task);
-	iris_port_post (priv->ex_port, message);
+	message = iris_message_new_data (MESSAGE_GET_MANY, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
 	iris_message_unref (message);
 
-	success = storage_task_wait (task, error);
+	if ((success = storage_task_wait (task, error)) == TRUE) {
+		*entries = task->entries;
+		task->entries = NULL;
+	}
+
 	storage_task_free (task, FALSE, FALSE);
 
 	return success;
 }
 
-static void
-catalina_storage_get_value_async_cb (CatalinaStorage *storage,
-                                     GAsyncResult    *result,
-                                     StorageTask     *task)
+/**
+ * catalina_storage_entries_free:
+ * @entries: A #GArray of #CatalinaStorageEntry
+ *
+ * Frees a #GArray of entries as returned from catalina_storage_get_many_finish(),
+ * including the keys and buffers of each entry.
+ */
+void
+catalina_storage_entries_free (GArray *entries)
 {
-	CatalinaStoragePrivate *priv;;
-	gchar                  *buffer        = NULL;
-	gsize                   buffer_length = 0;
+	CatalinaStorageEntry *entry;
+	guint                 i;
 
-	g_return_if_fail (storage != NULL);
-	g_return_if_fail (result != NULL);
-	g_return_if_fail (task != NULL);
+	if (!entries)
+		return;
 
-	priv = storage->priv;
+	for (i = 0; i < entries->len; i++) {
+		entry = &g_array_index (entries, CatalinaStorageEntry, i);
+		g_free (entry->key);
+		g_free (entry->data);
+		if (G_VALUE_TYPE (&entry->value))
+			g_value_unset (&entry->value);
+	}
 
-	if (!catalina_storage_get_finish (storage, result,
-	                                  &buffer, &buffer_length,
-	                                  &task->error))
-		goto failure;
+	g_array_free (entries, TRUE);
+}
 
-	if (!priv->formatter) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "CatalinaStorage is missing a formatter for deserialization");
-		goto failure;
+static StorageTask*
+storage_scan_task_new (CatalinaStorage     *storage,
+                       gboolean             is_async,
+                       const gchar         *start,
+                       gssize               start_length,
+                       const gchar         *end,
+                       gssize               end_length,
+                       guint                limit,
+                       GAsyncReadyCallback  callback,
+                       gpointer             user_data)
+{
+	StorageTask *task;
+
+	task = storage_task_new (storage, is_async, callback, user_data,
+	                         catalina_storage_scan_range_async);
+	task->max_items = limit;
+
+	/* the bounds of the range travel in key and data */
+	if (start) {
+		task->key_length = start_length < 0 ? strlen (start) : start_length;
+		task->key = g_memdup (start, task->key_length);
 	}
 
-	if (!catalina_formatter_deserialize (priv->formatter, &task->value,
-	                                     buffer, buffer_length,
-	                                     &task->error))
-		goto failure;
+	if (end) {
+		task->data_length = end_length < 0 ? strlen (end) : end_length;
+		task->data = g_memdup (end, task->data_length);
+	}
 
-	g_free (buffer);
-	storage_task_succeed (task);
-	return;
+	return task;
+}
 
-failure:
-	g_free (buffer);
-	storage_task_fail (task);
-	return;
+/* Computes the smallest key that is greater than every key beginning with @prefix.
+ * Returns %FALSE if there is no such key, meaning the range is unbounded.
+ */
+static gboolean
+storage_prefix_end (const gchar  *prefix,
+                    gsize         prefix_length,
+                    gchar       **end,
+                    gsize        *end_length)
+{
+	while (prefix_length > 0 && (guchar)prefix [prefix_length - 1] == 0xFF)
+		prefix_length--;
+
+	if (prefix_length == 0)
+		return FALSE;
+
+	*end = g_memdup (prefix, prefix_length);
+	*end_length = prefix_length;
+	(*end) [prefix_length - 1]++;
+
+	return TRUE;
+}
+
+static StorageTask*
+storage_scan_prefix_task_new (CatalinaStorage     *storage,
+                              gboolean             is_async,
+                              const gchar         *prefix,
+                              gssize               prefix_length,
+                              guint                limit,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+	StorageTask *task;
+	gchar       *end        = NULL;
+	gsize        end_length = 0;
+
+	if (prefix_length < 0)
+		prefix_length = strlen (prefix);
+
+	if (!storage_prefix_end (prefix, prefix_length, &end, &end_length)) {
+		end = NULL;
+		end_length = 0;
+	}
+
+	task = storage_scan_task_new (storage, is_async, prefix, prefix_length,
+	                              NULL, 0, limit, callback, user_data);
+	task->data = end;
+	task->data_length = end_length;
+
+	return task;
+}
+
+static gboolean
+storage_scan_finish (CatalinaStorage  *storage,
+                     GAsyncResult     *result,
+                     GArray          **entries,
+                     GError          **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (entries != NULL, FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_scan_range_async),
+	                      FALSE);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return FALSE;
+	}
+
+	if ((success = task->success) == TRUE) {
+		*entries = task->entries;
+		task->entries = NULL;
+	}
+	else if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+
+	storage_task_free (task, TRUE, TRUE);
+
+	return success;
+}
+
+static gboolean
+storage_scan_run (StorageTask  *task,
+                  GArray      **entries,
+                  GError      **error)
+{
+	IrisMessage *message;
+	gboolean     success;
+
+	message = iris_message_new_data (MESSAGE_SCAN, G_TYPE_POINTER, task);
+	storage_cn_post (task->storage, message);
+	iris_message_unref (message);
+
+	if ((success = storage_task_wait (task, error)) == TRUE) {
+		*entries = task->entries;
+		task->entries = NULL;
+	}
+
+	storage_task_free (task, TRUE, TRUE);
+
+	return success;
 }
 
 /**
- * catalina_storage_get_value_async:
+ * catalina_storage_scan_range_async:
  * @storage: A #CatalinaStorage
- * @key: the key to lookup
- * @key_length: the length of @key in bytes
+ * @start: the first key of the range, or %NULL to start with the first key
+ * @start_length: the length of @start in bytes, or -1 if it is %NULL terminated.  The
+ *   terminator is not considered part of the bound.
+ * @end: the key ending the range, or %NULL to continue through the last key
+ * @end_length: the length of @end in bytes, or -1 if it is %NULL terminated
+ * @limit: the maximum number of entries to retrieve, or 0 for no limit
  * @callback: A #GAsyncReadyCallback
  * @user_data: data for @callback
  *
- * Asynchronously requests the content for @key.  In the process, the data is retrieved from
- * storage and deserialized by the #CatalinaStorage instance's "formatter" property.
+ * Asynchronously retrieves the records whose keys are at least @start and less than
+ * @end, in ascending key order.  Keys are compared bytewise, so a key sorts before any
+ * longer key it is a prefix of.
+ *
+ * Range scans require an ordered backend such as #CatalinaBtreeBackend, or the key
+ * index kept by #CatalinaTdbBackend; other backends fail with
+ * %CATALINA_STORAGE_ERROR_NOT_SUPPORTED.
+ *
+ * Call catalina_storage_scan_range_finish() from within @callback to retrieve the entries.
  */
 void
-catalina_storage_get_value_async (CatalinaStorage     *storage,
-                                  const gchar         *key,
-                                  gssize               key_length,
-                                  GAsyncReadyCallback  callback,
-                                  gpointer             user_data)
+catalina_storage_scan_range_async (CatalinaStorage     *storage,
+                                   const gchar         *start,
+                                   gssize               start_length,
+                                   const gchar         *end,
+                                   gssize               end_length,
+                                   guint                limit,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
+	StorageTask *task;
+	IrisMessage *message;
 
 	g_return_if_fail (CATALINA_IS_STORAGE (storage));
 
-	priv = storage->priv;
-
-	if (!priv->formatter)
-		g_critical ("%s called without a formatter", __func__);
+	task = storage_scan_task_new (storage, TRUE, start, start_length,
+	                              end, end_length, limit, callback, user_data);
 
-	task = storage_task_new (storage, TRUE, callback, user_data,
-	                         catalina_storage_get_value_async);
-	catalina_storage_get_async (storage, key, key_length,
-	                            (GAsyncReadyCallback)catalina_storage_get_value_async_cb,
-	                            task);
+	message = iris_message_new_data (MESSAGE_SCAN, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
+	iris_message_unref (message);
 }
 
 /**
- * catalina_storage_get_value_finish:
+ * catalina_storage_scan_range_finish:
  * @storage: A #CatalinaStorage
  * @result: A #GAsyncResult
- * @value: A #GValue
+ * @entries: A location for a #GArray of #CatalinaStorageEntry
  * @error: A location for a #GError or %NULL
  *
- * Completes an asynchronous request to retreive the content from storage and deserialize
- * using the instance's "formatter" property.
+ * Completes an asynchronous request to catalina_storage_scan_range_async().
+ *
+ * @entries contains a #CatalinaStorageEntry for each record within the range, in key
+ * order.  Free @entries with catalina_storage_entries_free().
  *
  * Upon failure, %FALSE is returned and @error is set.
  *
  * Return value: %TRUE on success
  */
 gboolean
-catalina_storage_get_value_finish (CatalinaStorage  *storage,
-                                   GAsyncResult     *result,
-                                   GValue           *value,
-                                   GError          **error)
+catalina_storage_scan_range_finish (CatalinaStorage  *storage,
+                                    GAsyncResult     *result,
+                                    GArray          **entries,
+                                    GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gboolean                success;
-
-	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
-	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
-	                                                      catalina_storage_get_value_async),
-	                      FALSE);
-
-	priv = storage->priv;
-	task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result));
-	success = task->success;
-
-	if (task->error) {
-		if (error && *error == NULL)
-			*error = g_error_copy (task->error);
-	}
-
-	if (success) {
-		if (!G_VALUE_TYPE (value))
-			g_value_init (value, G_VALUE_TYPE (&task->value));
-		g_value_copy (&task->value, value);
-	}
-
-	storage_task_free (task, FALSE, TRUE);
-	return success;
+	return storage_scan_finish (storage, result, entries, error);
 }
 
 /**
- * catalina_storage_get_value:
+ * catalina_storage_scan_range:
  * @storage: A #CatalinaStorage
- * @key: A #const
- * @key_length: the length in bytes of @key or -1 if @key is %NULL terminated
- * @value: A #GValue to store the resulting value
+ * @start: the first key of the range, or %NULL to start with the first key
+ * @start_length: the length of @start in bytes, or -1 if it is %NULL terminated
+ * @end: the key ending the range, or %NULL to continue through the last key
+ * @end_length: the length of @end in bytes, or -1 if it is %NULL terminated
+ * @limit: the maximum number of entries to retrieve, or 0 for no limit
+ * @entries: A location for a #GArray of #CatalinaStorageEntry
  * @error: A location for a #GError or %NULL
  *
- * Synchronously requests the content for @key and deserializes using the instances
- * "formatter" property.
+ * Synchronously retrieves the records whose keys are at least @start and less than
+ * @end, in ascending key order.
  *
- * Upon failure, %FALSE is returned and @error is set.
+ * See catalina_storage_scan_range_async().
  *
  * Return value: %TRUE on success
  */
 gboolean
-catalina_storage_get_value (CatalinaStorage  *storage,
-                            const gchar      *key,
-                            gssize            key_length,
-                            GValue           *value,
-                            GError          **error)
+catalina_storage_scan_range (CatalinaStorage  *storage,
+                             const gchar      *start,
+                             gssize            start_length,
+                             const gchar      *end,
+                             gssize            end_length,
+                             guint             limit,
+                             GArray          **entries,
+                             GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	gchar                  *buffer        = NULL;
-	gsize                   buffer_length = 0;
-	gboolean                success;
-
 	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
-	g_return_val_if_fail (key != NULL, FALSE);
-	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
-	g_return_val_if_fail (value != NULL, FALSE);
-
-	priv = storage->priv;
-
-	if (!priv->formatter) {
-		g_set_error (error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "CatalinaStorage is missing a formatter for deserialization");
-		return FALSE;
-	}
-
-	if (!catalina_storage_get (storage, key, key_length,
-	                           &buffer, &buffer_length, error))
-		return FALSE;
-
-	success = catalina_formatter_deserialize (priv->formatter, value,
-	                                          buffer, buffer_length,
-	                                          error);
-	g_free (buffer);
-	return success;
-}
+	g_return_val_if_fail (entries != NULL, FALSE);
 
-static void
-catalina_storage_set_value_async_cb (CatalinaStorage *storage,
-                                     GAsyncResult    *result,
-                                     StorageTask     *task)
-{
-	if (!catalina_storage_set_finish (storage, result, &task->error))
-		storage_task_fail (task);
-	else
-		storage_task_succeed (task);
+	return storage_scan_run (storage_scan_task_new (storage, FALSE,
+	                                                start, start_length,
+	                                                end, end_length,
+	                                                limit, NULL, NULL),
+	                         entries, error);
 }
 
 /**
- * catalina_storage_set_value_async:
+ * catalina_storage_scan_prefix_async:
  * @storage: A #CatalinaStorage
- * @txn_id: a transaction id or 0
- * @key: A buffer containing the key
- * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
- * @value: A #GValue to serialize and store
+ * @prefix: the prefix shared by the requested keys
+ * @prefix_length: the length of @prefix in bytes, or -1 if it is %NULL terminated.  The
+ *   terminator is not considered part of the prefix.
+ * @limit: the maximum number of entries to retrieve, or 0 for no limit
  * @callback: A #GAsyncReadyCallback
- * @user_data: A #gpointer
- *
- * Asynchronously requests the serialization of @value and storage to the underlying
- * data-store.
+ * @user_data: data for @callback
  *
- * @value is serialized using the instances "formatter" property.
+ * Asynchronously retrieves the records whose keys begin with @prefix, in ascending key
+ * order.  This is a range scan from @prefix up to the first key that does not share it.
  *
- * Call catalina_storage_set_value_finish() from within @callback.
+ * Call catalina_storage_scan_prefix_finish() from within @callback to retrieve the entries.
  */
 void
-catalina_storage_set_value_async (CatalinaStorage     *storage,
-                                  gulong               txn_id,
-                                  const gchar         *key,
-                                  gssize               key_length,
-                                  const GValue        *value,
-                                  GAsyncReadyCallback  callback,
-                                  gpointer             user_data)
+catalina_storage_scan_prefix_async (CatalinaStorage     *storage,
+                                    const gchar         *prefix,
+                                    gssize               prefix_length,
+                                    guint                limit,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gchar                  *buffer        = NULL;
-	gsize                   buffer_length = 0;
+	StorageTask *task;
+	IrisMessage *message;
 
 	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (prefix != NULL);
 
-	priv = storage->priv;
-	task = storage_task_new (storage, TRUE, callback, user_data,
-	                         catalina_storage_set_value_async);
-
-	if (!priv->formatter) {
-		g_critical ("%s: Storage instance missing a CatalinaFormatter", __func__);
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "Storage instance missing a CatalinaFormatter");
-		storage_task_fail (task);
-		storage_task_free (task, FALSE, FALSE);
-		return;
-	}
-
-	if (!catalina_formatter_serialize (priv->formatter, value,
-	                                   &buffer, &buffer_length,
-	                                   &task->error))
-	{
-		storage_task_fail (task);
-		storage_task_free (task, FALSE, FALSE);
-		return;
-	}
-
-	catalina_storage_set_async (storage, txn_id, key, key_length,
-	                            buffer, buffer_length,
-	                            (GAsyncReadyCallback)catalina_storage_set_value_async_cb,
-	                            task);
+	task = storage_scan_prefix_task_new (storage, TRUE, prefix, prefix_length,
+	                                     limit, callback, user_data);
 
-	g_free (buffer);
+	message = iris_message_new_data (MESSAGE_SCAN, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
+	iris_message_unref (message);
 }
 
 /**
- * catalina_storage_set_value_finish:
+ * catalina_storage_scan_prefix_finish:
  * @storage: A #CatalinaStorage
  * @result: A #GAsyncResult
+ * @entries: A location for a #GArray of #CatalinaStorageEntry
  * @error: A location for a #GError or %NULL
  *
- * Completes and asynchronous request to catalina_storage_set_value_async().
- *
- * Upon failure, %FALSE is returned and @error is set.
+ * Completes an asynchronous request to catalina_storage_scan_prefix_async().  Free
+ * @entries with catalina_storage_entries_free().
  *
  * Return value: %TRUE on success
  */
 gboolean
-catalina_storage_set_value_finish (CatalinaStorage  *storage,
-                                   GAsyncResult     *result,
-                                   GError          **error)
+catalina_storage_scan_prefix_finish (CatalinaStorage  *storage,
+                                     GAsyncResult     *result,
+                                     GArray          **entries,
+                                     GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gboolean                success;
-
-	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
-
-	priv = storage->priv;
-	task = g_simple_async_result_get_op_res_gpointer ((gpointer)result);
-
-	success = task->success;
-	if (task->error && error && *error == NULL) {
-		*error = task->error;
-		task->error = NULL;
-	}
-
-	storage_task_free (task, TRUE, TRUE);
-
-	return success;
+	return storage_scan_finish (storage, result, entries, error);
 }
 
 /**
- * catalina_storage_set_value:
+ * catalina_storage_scan_prefix:
  * @storage: A #CatalinaStorage
- * @txn_id: a transaction id or 0
- * @key: A buffer containing the key
- * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
- * @value: A #GValue to serialize and store
+ * @prefix: the prefix shared by the requested keys
+ * @prefix_length: the length of @prefix in bytes, or -1 if it is %NULL terminated
+ * @limit: the maximum number of entries to retrieve, or 0 for no limit
+ * @entries: A location for a #GArray of #CatalinaStorageEntry
  * @error: A location for a #GError or %NULL
  *
- * Synchronously requests the serialization of @value and storage to the underlying data-store.
- *
- * Upon error, %FALSE is returned and @error is set.
+ * Synchronously retrieves the records whose keys begin with @prefix.
  *
- * See catalina_storage_set_value_async().
+ * See catalina_storage_scan_prefix_async().
  *
  * Return value: %TRUE on success
  */
 gboolean
-catalina_storage_set_value (CatalinaStorage  *storage,
-                            gulong            txn_id,
-                            const gchar      *key,
-                            gssize            key_length,
-                            const GValue     *value,
-                            GError          **error)
+catalina_storage_scan_prefix (CatalinaStorage  *storage,
+                              const gchar      *prefix,
+                              gssize            prefix_length,
+                              guint             limit,
+                              GArray          **entries,
+                              GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	gchar                  *buffer        = NULL;
-	gsize                   buffer_length = 0;
-	gboolean                success;
-
 	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
-	g_return_val_if_fail (key != NULL, FALSE);
-	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
-	g_return_val_if_fail (value != NULL, FALSE);
-
-	priv = storage->priv;
-
-	if (!priv->formatter) {
-		g_set_error (error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "Instance missing formatter for deserialization");
-		return FALSE;
-	}
-
-	if (!catalina_formatter_serialize (priv->formatter, value,
-	                                   &buffer, &buffer_length,
-	                                   error))
-		return FALSE;
+	g_return_val_if_fail (prefix != NULL, FALSE);
+	g_return_val_if_fail (entries != NULL, FALSE);
 
-	success = catalina_storage_set (storage, txn_id, key, key_length,
-	                                buffer, buffer_length, error);
-	g_free (buffer);
-
-	return success;
+	return storage_scan_run (storage_scan_prefix_task_new (storage, FALSE,
+	                                                       prefix, prefix_length,
+	                                                       limit, NULL, NULL),
+	                         entries, error);
 }
 
 /**
- * catalina_storage_get_transform:
+ * catalina_storage_get_with_func_async:
  * @storage: A #CatalinaStorage
+ * @key: the key to lookup
+ * @key_length: the length of @key in bytes or -1 if it is %NULL terminated
+ * @func: A #CatalinaRecordFunc to inspect the record
+ * @func_data: data for @func
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
  *
- * This method is not thread-safe.
- *
- * Return value: the #CatalinaTransform for the @storage instance.
- */
-CatalinaTransform*
-catalina_storage_get_transform (CatalinaStorage *storage)
-{
-	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), NULL);
-	return CATALINA_STORAGE (storage)->priv->transform;
-}
-
-/**
- * catalina_storage_set_transform:
- * @storage: A #CatalinaStorage
- * @transform: A #CatalinaTransform
+ * Asynchronously looks up @key and calls @func with the record while it is still
+ * owned by the data-store.  No copy of the record is made unless the storage has a
+ * "transform", in which case @func is given the transformed buffer.
  *
- * Sets the #CatalinaTransform for the storage.  This is the "transform" property.
+ * @func is called from a worker thread and must not call back into @storage.  This is
+ * useful when only a few fields of a record need decoding and the buffer would be
+ * thrown away afterwards.
  *
- * This method is not thread-safe.
+ * Call catalina_storage_get_with_func_finish() from within @callback.
  */
 void
-catalina_storage_set_transform (CatalinaStorage   *storage,
-                                CatalinaTransform *transform)
+catalina_storage_get_with_func_async (CatalinaStorage     *storage,
+                                      const gchar         *key,
+                                      gssize               key_length,
+                                      CatalinaRecordFunc   func,
+                                      gpointer             func_data,
+                                      GAsyncReadyCallback  callback,
+                                      gpointer             user_data)
 {
+	StorageTask *task;
+	IrisMessage *message;
+
 	g_return_if_fail (CATALINA_IS_STORAGE (storage));
-	if (CATALINA_STORAGE (storage)->priv->transform)
-		g_object_unref (CATALINA_STORAGE (storage)->priv->transform);
-	CATALINA_STORAGE (storage)->priv->transform = g_object_ref (transform);
-	g_object_notify (G_OBJECT (storage), "transform");
+	g_return_if_fail (key != NULL);
+	g_return_if_fail (key_length == -1 || key_length > 0);
+	g_return_if_fail (func != NULL);
+
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_get_with_func_async);
+
+	if (key_length == -1) {
+		task->key = g_strdup (key);
+		task->key_length = strlen (key) + 1;
+	}
+	else {
+		task->key = g_memdup (key, key_length);
+		task->key_length = key_length;
+	}
+
+	task->record_func = func;
+	task->record_data = func_data;
+
+	message = iris_message_new_data (MESSAGE_GET_WITH_FUNC, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
+	iris_message_unref (message);
 }
 
 /**
- * catalina_storage_get_formatter:
+ * catalina_storage_get_with_func_finish:
  * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
  *
- * This method is not thread-safe.
+ * Completes an asynchronous request to catalina_storage_get_with_func_async().  By the
+ * time this is called the record function has already been run.
  *
- * Return value: The #CatalinaFormatter property
+ * Upon failure, %FALSE is returned and @error is set.
+ *
+ * Return value: %TRUE if the record was found and inspected
  */
-CatalinaFormatter*
-catalina_storage_get_formatter (CatalinaStorage *storage)
+gboolean
+catalina_storage_get_with_func_finish (CatalinaStorage  *storage,
+                                       GAsyncResult     *result,
+                                       GError          **error)
 {
-	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), NULL);
-	return CATALINA_STORAGE (storage)->priv->formatter;
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_get_with_func_async),
+	                      FALSE);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return FALSE;
+	}
+
+	success = task->success;
+	if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+
+	storage_task_free (task, TRUE, FALSE);
+
+	return success;
 }
 
 /**
- * catalina_storage_set_formatter:
+ * catalina_storage_get_with_func:
  * @storage: A #CatalinaStorage
- * @formatter: A #CatalinaFormatter
+ * @key: the key to lookup
+ * @key_length: the length of @key in bytes or -1 if it is %NULL terminated
+ * @func: A #CatalinaRecordFunc to inspect the record
+ * @func_data: data for @func
+ * @error: A location for a #GError or %NULL
  *
- * Sets the "formatter" property.
+ * Synchronously looks up @key and calls @func with the record in place.
  *
- * This method is not thread-safe.
- */
-void
-catalina_storage_set_formatter (CatalinaStorage   *storage,
-                                CatalinaFormatter *formatter)
-{
-	g_return_if_fail (CATALINA_IS_STORAGE (storage));
-	if (CATALINA_STORAGE (storage)->priv->formatter)
-		g_object_unref (CATALINA_STORAGE (storage)->priv->formatter);
-	CATALINA_STORAGE (storage)->priv->formatter = g_object_ref (formatter);
-	g_object_notify (G_OBJECT (storage), "formatter");
-}
-
-/**
- * catalina_storage_count_keys:
- * @storage: A #CatalinaStorage
+ * Upon failure, %FALSE is returned and @error is set.
  *
- * Counts the number of keys that are currently in the database.
+ * See catalina_storage_get_with_func_async().
  *
- * Return value: the current number of keys
+ * Return value: %TRUE if the record was found and inspected
  */
-gulong
-catalina_storage_count_keys (CatalinaStorage *storage)
+gboolean
+catalina_storage_get_with_func (CatalinaStorage     *storage,
+                                const gchar         *key,
+                                gssize               key_length,
+                                CatalinaRecordFunc   func,
+                                gpointer             func_data,
+                                GError             **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	IrisMessage            *message;
-	gulong                  count = 0;
+	StorageTask *task;
+	IrisMessage *message;
+	gboolean     success;
 
-	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 0);
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
+	g_return_val_if_fail (func != NULL, FALSE);
 
-	priv = storage->priv;
 	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
 
-	message = iris_message_new_data (MESSAGE_COUNT_KEYS, G_TYPE_POINTER, task);
-	iris_port_post (priv->cn_port, message);
-	iris_message_unref (message);
+	/* the caller is blocked until completion, so the key can be borrowed */
+	task->key = (gchar*)key;
+	task->key_length = (key_length == -1) ? strlen (key) + 1 : key_length;
+	task->record_func = func;
+	task->record_data = func_data;
 
-	if (storage_task_wait (task, NULL))
-		count = g_value_get_ulong (&task->value);
+	message = iris_message_new_data (MESSAGE_GET_WITH_FUNC, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
+	iris_message_unref (message);
 
+	success = storage_task_wait (task, error);
 	storage_task_free (task, FALSE, FALSE);
 
-	return count;
+	return success;
+}
+
+static void
+storage_set_take_async (CatalinaStorage     *storage,
+                        gulong               txn_id,
+                        const gchar         *key,
+                        gssize               key_length,
+                        gchar               *value,
+                        gsize                value_length,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_set_async);
+
+	if (key_length == -1) {
+		task->key = g_strdup (key);
+		task->key_length = strlen (key) + 1;
+	}
+	else {
+		task->key = g_memdup (key, key_length);
+		task->key_length = key_length;
+	}
+
+	task->txn_id = txn_id;
+	task->data = value;
+	task->data_length = value_length;
+
+	/* transform on the concurrent workers rather than within the exclusive section */
+	message = iris_message_new_data (MESSAGE_SET, G_TYPE_POINTER, task);
+	if (storage->priv->transform)
+		storage_stage_set (storage, message);
+	else
+		storage_ex_post (storage, message);
+	iris_message_unref (message);
 }
 
 /**
- * catalina_storage_transaction_begin_async:
+ * catalina_storage_set_async:
  * @storage: A #CatalinaStorage
- * @callback: a callback to execute when the transaction begins
+ * @txn_id: A transaction id or 0
+ * @key: the key of which to assign @value
+ * @key_length: the length of @key in bytes
+ * @value: the content to store
+ * @value_length: the length of @value in bytes
+ * @callback: A #GAsyncReadyCallback
  * @user_data: data for @callback
  *
- * Begins a new transaction.  Catalina does not support recursive transactions currently, but it
- * does support concurrent transactions using the resulting transaction id.  Consumers can implement
- * recursive transactions by cancelling a secondary transaction if the child transaction fails.
+ * Asynchronously stores @value to the underlying data-store with @key.  Call
+ * catalina_storage_set_finish() from within @callback.
+ *
+ * A copy of @value is made.  If the buffer is not needed after the call, use
+ * catalina_storage_set_take_async() to avoid the copy.
  */
 void
-catalina_storage_transaction_begin_async (CatalinaStorage     *storage,
-                                          GAsyncReadyCallback  callback,
-                                          gpointer             user_data)
+catalina_storage_set_async (CatalinaStorage     *storage,
+                            gulong               txn_id,
+                            const gchar         *key,
+                            gssize               key_length,
+                            const gchar         *value,
+                            gssize               value_length,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	IrisMessage            *message;
+	gchar *dup_value;
+	gsize  dup_value_length;
 
 	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (key != NULL);
+	g_return_if_fail (key_length == -1 || key_length > 0);
+	g_return_if_fail (value != NULL);
+	g_return_if_fail (value_length == -1 || value_length > 0);
 
-	priv = storage->priv;
-	task = storage_task_new (storage, TRUE, callback, user_data,
-	                         catalina_storage_transaction_begin_async);
+	if (value_length == -1) {
+		dup_value = g_strdup (value);
+		dup_value_length = strlen (dup_value) + 1;
+	}
+	else {
+		dup_value = g_malloc (value_length);
+		memcpy (dup_value, value, value_length);
+		dup_value_length = value_length;
+	}
 
-	message = iris_message_new_data (MESSAGE_TXN_BEGIN, G_TYPE_POINTER, task);
-	iris_port_post (priv->ex_port, message);
-	iris_message_unref (message);
+	storage_set_take_async (storage, txn_id, key, key_length,
+	                        dup_value, dup_value_length,
+	                        callback, user_data);
 }
 
 /**
- * catalina_storage_transaction_begin_finish:
+ * catalina_storage_set_take_async:
  * @storage: A #CatalinaStorage
- * @result: A #GAsyncResult
+ * @txn_id: A transaction id or 0
+ * @key: the key of which to assign @value
+ * @key_length: the length of @key in bytes or -1 if it is %NULL terminated
+ * @value: the content to store, allocated with g_malloc()
+ * @value_length: the length of @value in bytes
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
  *
- * Completes an asynchronous request to create a new transaction.
+ * Asynchronously stores @value to the underlying data-store with @key, taking
+ * ownership of @value.  The buffer is handed to the storage thread as is and freed
+ * with g_free() once the request completes, avoiding the copy made by
+ * catalina_storage_set_async().  @value must not be used after calling this function.
  *
- * Return value: the transaction id
+ * Buffers returned from catalina_storage_get_finish() and
+ * catalina_formatter_serialize() may be passed directly.
+ *
+ * Call catalina_storage_set_finish() from within @callback.
  */
-gulong
-catalina_storage_transaction_begin_finish (CatalinaStorage *storage,
-                                           GAsyncResult    *result)
+void
+catalina_storage_set_take_async (CatalinaStorage     *storage,
+                                 gulong               txn_id,
+                                 const gchar         *key,
+                                 gssize               key_length,
+                                 gchar               *value,
+                                 gsize                value_length,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gulong                  txn_id;
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (key != NULL);
+	g_return_if_fail (key_length == -1 || key_length > 0);
+	g_return_if_fail (value != NULL);
+	g_return_if_fail (value_length > 0);
 
-	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 0);
+	storage_set_take_async (storage, txn_id, key, key_length,
+	                        value, value_length,
+	                        callback, user_data);
+}
+
+/**
+ * catalina_storage_set_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @error: A location for #GError or %NULL
+ *
+ * Completes an asynchronous set request.  Upon failure, %FALSE is returned and @error is set.
+ *
+ * See catalina_storage_set_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_set_finish (CatalinaStorage  *storage,
+                             GAsyncResult     *result,
+                             GError          **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
 	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
-	                                                      catalina_storage_transaction_begin_async),
-	                      0);
+	                                                      catalina_storage_set_async),
+	                      FALSE);
 
-	priv = storage->priv;
-	task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result));
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return FALSE;
+	}
 
-	txn_id = task->txn_id;
+	if (task->error) {
+		if (error && *error == NULL)
+			*error = g_error_copy (task->error);
+	}
+
+	success = task->success;
+	storage_task_free (task, TRUE, TRUE);
+
+	return success;
+}
+
+static gboolean
+storage_set (CatalinaStorage  *storage,
+             gulong            txn_id,
+             const gchar      *key,
+             gssize            key_length,
+             const gchar      *value,
+             gssize            value_length,
+             GSList           *index_values,
+             GError          **error)
+{
+	CatalinaTransform *transform;
+	StorageTask       *task;
+	IrisMessage       *message;
+	gchar             *buffer        = NULL;
+	gsize              buffer_length = 0;
+	gboolean           success;
+
+	if (value_length == -1)
+		value_length = strlen (value) + 1;
+
+	/* the caller waits anyway, so it transforms the value instead of a worker */
+	if ((transform = storage->priv->transform) != NULL) {
+		if (!catalina_transform_write (transform, value, value_length,
+		                               &buffer, &buffer_length, error)) {
+			storage_index_updates_free (index_values);
+			return FALSE;
+		}
+	}
+
+	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
+
+	task->txn_id = txn_id;
+	task->key = (gchar*)key;
+	task->key_length = (key_length == -1) ? strlen (key) + 1 : key_length;
+	task->data = buffer != NULL ? buffer : (gchar*)value;
+	task->data_length = buffer != NULL ? buffer_length : value_length;
+	task->transformed = (transform != NULL);
+	task->index_values = index_values;
+
+	message = iris_message_new_data (MESSAGE_SET, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+
+	success = storage_task_wait (task, error);
 	storage_task_free (task, FALSE, FALSE);
+	g_free (buffer);
 
-	return txn_id;
+	return success;
 }
 
 /**
- * catalina_storage_transaction_commit_async:
+ * catalina_storage_set:
  * @storage: A #CatalinaStorage
- * @txn_id: the transaction id from a call to catalina_storage_transaction_begin_async()
- * @callback: A #GAsyncReadyCallback to call when the transaction is ready
- * @user_data: data for @callback
+ * @txn_id: the transaction id or 0
+ * @key: the key of which to store @value
+ * @key_length: the length of @key in bytes or -1 if the @key is %NULL terminated
+ * @value: the data to store
+ * @value_length: the length of @data in bytes
+ * @error: A location for a #GError or %NULL
  *
- * Asynchronously beings the process of committing a transaction.
+ * Synchronously performs a set request.
  *
- * Upon failure, %FALSE is returned and @error is set.  If you want to bring the storage back to a
- * consistent state, call catalina_storage_transaction_rollback().
+ * Upon failure, %FALSE is returned and @error is set.
+ *
+ * See catalina_storage_set_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_set (CatalinaStorage  *storage,
+                      gulong            txn_id,
+                      const gchar      *key,
+                      gssize            key_length,
+                      const gchar      *value,
+                      gssize            value_length,
+                      GError          **error)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
+
+	return storage_set (storage, txn_id, key, key_length,
+	                    value, value_length, NULL, error);
+}
+
+/**
+ * catalina_storage_get_value_async:
+ * @storage: A #CatalinaStorage
+ * @key: the key to lookup
+ * @key_length: the length of @key in bytes
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously requests the content for @key.  In the process, the data is retrieved from
+ * storage and deserialized by the #CatalinaStorage instance's "formatter" property.  Both
+ * happen on a worker thread, so @callback only needs to collect the value with
+ * catalina_storage_get_value_finish().
  */
 void
-catalina_storage_transaction_commit_async (CatalinaStorage     *storage,
-                                           gulong               txn_id,
-                                           GAsyncReadyCallback  callback,
-                                           gpointer             user_data)
+catalina_storage_get_value_async (CatalinaStorage     *storage,
+                                  const gchar         *key,
+                                  gssize               key_length,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
 {
 	CatalinaStoragePrivate *priv;
 	StorageTask            *task;
 	IrisMessage            *message;
 
 	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (key != NULL);
+	g_return_if_fail (key_length == -1 || key_length > 0);
 
 	priv = storage->priv;
+
+	if (!priv->formatter)
+		g_critical ("%s called without a formatter", __func__);
+
 	task = storage_task_new (storage, TRUE, callback, user_data,
-	                         catalina_storage_transaction_commit_async);
-	task->txn_id = txn_id;
+	                         catalina_storage_get_value_async);
 
-	message = iris_message_new_data (MESSAGE_TXN_COMMIT, G_TYPE_POINTER, task);
-	iris_port_post (priv->ex_port, message);
+	if (key_length == -1) {
+		task->key = g_strdup (key);
+		task->key_length = strlen (key) + 1;
+	}
+	else {
+		task->key = g_memdup (key, key_length);
+		task->key_length = key_length;
+	}
+
+	/* fetched and deserialized by the worker, completing once */
+	message = iris_message_new_data (MESSAGE_GET_VALUE, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
 	iris_message_unref (message);
 }
 
 /**
- * catalina_storage_transaction_commit_finish:
+ * catalina_storage_get_value_finish:
  * @storage: A #CatalinaStorage
  * @result: A #GAsyncResult
+ * @value: A #GValue
  * @error: A location for a #GError or %NULL
  *
- * Completes and asynchronous request to commit a transaction.
+ * Completes an asynchronous request to retreive the content from storage and deserialize
+ * using the instance's "formatter" property.
  *
- * Upon failure, %FALSE is returned and @error is set.  If the commit failed, the state is
- * automatically rolled back.
+ * Upon failure, %FALSE is returned and @error is set.
  *
  * Return value: %TRUE on success
  */
 gboolean
-catalina_storage_transaction_commit_finish (CatalinaStorage  *storage,
-                                            GAsyncResult     *result,
-                                            GError          **error)
+catalina_storage_get_value_finish (CatalinaStorage  *storage,
+                                   GAsyncResult     *result,
+                                   GValue           *value,
+                                   GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gboolean                success = FALSE;
+	StorageTask *task;
+	gboolean     success;
 
 	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
 	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
-	                                                      catalina_storage_transaction_commit_async),
+	                                                      catalina_storage_get_value_async),
 	                      FALSE);
 
-	priv = storage->priv;
 	task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result));
-
 	success = task->success;
-	if (task->error && error && *error == NULL) {
-		*error = task->error;
-		task->error = NULL;
+
+	if (task->error) {
+		if (error && *error == NULL)
+			*error = g_error_copy (task->error);
 	}
 
-	storage_task_free (task, FALSE, FALSE);
+	if (success) {
+		if (!G_VALUE_TYPE (value))
+			g_value_init (value, G_VALUE_TYPE (&task->value));
+		g_value_copy (&task->value, value);
+	}
 
+	storage_task_free (task, TRUE, TRUE);
 	return success;
 }
 
 /**
- * catalina_storage_transaction_cancel_async:
+ * catalina_storage_get_value:
  * @storage: A #CatalinaStorage
- * @txn_id: A transaction id retrieved from catalina_storage_transaction_begin_async()
- * @callback: a callback to execute when the transaction is cancelled
- * @user_data: data for @callback
+ * @key: A #const
+ * @key_length: the length in bytes of @key or -1 if @key is %NULL terminated
+ * @value: A #GValue to store the resulting value
+ * @error: A location for a #GError or %NULL
  *
- * Asynchronously cancels transaction @txn_id.  There is no need to call
- * catalina_storage_transaction_rollback_async() as the state will be rolled back automatically.
+ * Synchronously requests the content for @key and deserializes using the instances
+ * "formatter" property.
+ *
+ * Upon failure, %FALSE is returned and @error is set.
+ *
+ * Return value: %TRUE on success
  */
-void
-catalina_storage_transaction_cancel_async (CatalinaStorage     *storage,
-                                           gulong               txn_id,
-                                           GAsyncReadyCallback  callback,
-                                           gpointer             user_data)
+gboolean
+catalina_storage_get_value (CatalinaStorage  *storage,
+                            const gchar      *key,
+                            gssize            key_length,
+                            GValue           *value,
+                            GError          **error)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	IrisMessage            *message;
+	StorageTask *task;
+	IrisMessage *message;
+	gboolean     success;
 
-	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
+	g_return_val_if_fail (value != NULL, FALSE);
 
-	priv = storage->priv;
-	task = storage_task_new (storage, TRUE, callback, user_data,
-	                         catalina_storage_transaction_cancel_async);
-	task->txn_id = txn_id;
+	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
 
-	message = iris_message_new_data (MESSAGE_TXN_CANCEL, G_TYPE_POINTER, task);
-	iris_port_post (priv->ex_port, message);
+	/* the caller is blocked until completion, so the key can be borrowed */
+	task->key = (gchar*)key;
+	task->key_length = (key_length == -1) ? strlen (key) + 1 : key_length;
+
+	message = iris_message_new_data (MESSAGE_GET_VALUE, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
 	iris_message_unref (message);
+
+	if ((success = storage_task_wait (task, error))) {
+		if (!G_VALUE_TYPE (value))
+			g_value_init (value, G_VALUE_TYPE (&task->value));
+		g_value_copy (&task->value, value);
+	}
+
+	storage_task_free (task, FALSE, TRUE);
+
+	return success;
 }
 
 /**
- * catalina_storage_transaction_cancel_finish:
+ * catalina_storage_set_value_async:
  * @storage: A #CatalinaStorage
- * @result: a #GAsyncResult
+ * @txn_id: a transaction id or 0
+ * @key: A buffer containing the key
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @value: A #GValue to serialize and store
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: A #gpointer
  *
- * Completes and asynchronous request to cancel the current transaction.
+ * Asynchronously requests the serialization of @value and storage to the underlying
+ * data-store.
  *
- * The state is automatically rolled back to that of before the transaction.
+ * @value is serialized using the instances "formatter" property.  A copy of @value is
+ * serialized by the concurrent workers, so many values can be encoded at once, while
+ * the writes are still applied in the order they were requested.  An object held by
+ * @value should therefore not be changed until @callback is called.
+ *
+ * Call catalina_storage_set_value_finish() from within @callback.
  */
 void
-catalina_storage_transaction_cancel_finish (CatalinaStorage *storage,
-                                            GAsyncResult    *result)
-{
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
+catalina_storage_set_value_async (CatalinaStorage     *storage,
+                                  gulong               txn_id,
+                                  const gchar         *key,
+                                  gssize               key_length,
+                                  const GValue        *value,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	IrisMessage            *message;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (key != NULL);
+	g_return_if_fail (key_length == -1 || key_length > 0);
+	g_return_if_fail (value != NULL);
+
+	priv = storage->priv;
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_set_value_async);
+
+	if (!priv->formatter) {
+		g_critical ("%s: Storage instance missing a CatalinaFormatter", __func__);
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage instance missing a CatalinaFormatter");
+		storage_task_fail (task);
+		storage_task_free (task, FALSE, FALSE);
+		return;
+	}
+
+	if (key_length == -1) {
+		task->key = g_strdup (key);
+		task->key_length = strlen (key) + 1;
+	}
+	else {
+		task->key = g_memdup (key, key_length);
+		task->key_length = key_length;
+	}
+
+	task->txn_id = txn_id;
+	g_value_init (&task->value, G_VALUE_TYPE (value));
+	g_value_copy (value, &task->value);
+
+	/* serialized in the transform stage, see handle_set_stage() */
+	message = iris_message_new_data (MESSAGE_SET, G_TYPE_POINTER, task);
+	storage_stage_set (storage, message);
+	iris_message_unref (message);
+}
+
+/**
+ * catalina_storage_set_value_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes and asynchronous request to catalina_storage_set_value_async().
+ *
+ * Upon failure, %FALSE is returned and @error is set.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_set_value_finish (CatalinaStorage  *storage,
+                                   GAsyncResult     *result,
+                                   GError          **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+
+	task = g_simple_async_result_get_op_res_gpointer ((gpointer)result);
+
+	success = task->success;
+	if (task->error && error && *error == NULL) {
+		*error = task->error;
+		task->error = NULL;
+	}
+
+	storage_task_free (task, TRUE, TRUE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_set_value:
+ * @storage: A #CatalinaStorage
+ * @txn_id: a transaction id or 0
+ * @key: A buffer containing the key
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @value: A #GValue to serialize and store
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously requests the serialization of @value and storage to the underlying data-store.
+ *
+ * Upon error, %FALSE is returned and @error is set.
+ *
+ * See catalina_storage_set_value_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_set_value (CatalinaStorage  *storage,
+                            gulong            txn_id,
+                            const gchar      *key,
+                            gssize            key_length,
+                            const GValue     *value,
+                            GError          **error)
+{
+	CatalinaStoragePrivate *priv;
+	gchar                  *buffer        = NULL;
+	gsize                   buffer_length = 0;
+	gboolean                success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
+	g_return_val_if_fail (value != NULL, FALSE);
+
+	priv = storage->priv;
+
+	if (!priv->formatter) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Instance missing formatter for deserialization");
+		return FALSE;
+	}
+
+	if (!catalina_formatter_serialize (priv->formatter, value,
+	                                   &buffer, &buffer_length,
+	                                   error))
+		return FALSE;
+
+	success = storage_set (storage, txn_id, key, key_length,
+	                       buffer, buffer_length,
+	                       storage_indexes_extract (storage, value),
+	                       error);
+	g_free (buffer);
+
+	return success;
+}
+
+/**
+ * catalina_storage_get_transform:
+ * @storage: A #CatalinaStorage
+ *
+ * This method is not thread-safe.
+ *
+ * Return value: the #CatalinaTransform for the @storage instance.
+ */
+CatalinaTransform*
+catalina_storage_get_transform (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), NULL);
+	return CATALINA_STORAGE (storage)->priv->transform;
+}
+
+/**
+ * catalina_storage_set_transform:
+ * @storage: A #CatalinaStorage
+ * @transform: A #CatalinaTransform
+ *
+ * Sets the #CatalinaTransform for the storage.  This is the "transform" property.
+ *
+ * This method is not thread-safe.
+ */
+void
+catalina_storage_set_transform (CatalinaStorage   *storage,
+                                CatalinaTransform *transform)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	if (CATALINA_STORAGE (storage)->priv->transform)
+		g_object_unref (CATALINA_STORAGE (storage)->priv->transform);
+	CATALINA_STORAGE (storage)->priv->transform = g_object_ref (transform);
+	g_object_notify (G_OBJECT (storage), "transform");
+}
+
+/**
+ * catalina_storage_get_formatter:
+ * @storage: A #CatalinaStorage
+ *
+ * This method is not thread-safe.
+ *
+ * Return value: The #CatalinaFormatter property
+ */
+CatalinaFormatter*
+catalina_storage_get_formatter (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), NULL);
+	return CATALINA_STORAGE (storage)->priv->formatter;
+}
+
+/**
+ * catalina_storage_set_formatter:
+ * @storage: A #CatalinaStorage
+ * @formatter: A #CatalinaFormatter
+ *
+ * Sets the "formatter" property.
+ *
+ * This method is not thread-safe.
+ */
+void
+catalina_storage_set_formatter (CatalinaStorage   *storage,
+                                CatalinaFormatter *formatter)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	if (CATALINA_STORAGE (storage)->priv->formatter)
+		g_object_unref (CATALINA_STORAGE (storage)->priv->formatter);
+	CATALINA_STORAGE (storage)->priv->formatter = g_object_ref (formatter);
+	g_object_notify (G_OBJECT (storage), "formatter");
+}
+
+/**
+ * catalina_storage_get_backend:
+ * @storage: A #CatalinaStorage
+ *
+ * Retrieves the "backend" property.
+ *
+ * Return value: The #CatalinaBackend storing the records
+ */
+CatalinaBackend*
+catalina_storage_get_backend (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), NULL);
+	return storage->priv->backend;
+}
+
+/**
+ * catalina_storage_set_backend:
+ * @storage: A #CatalinaStorage
+ * @backend: A #CatalinaBackend
+ *
+ * Sets the "backend" property.  The backend can only be changed while the storage
+ * is closed.
+ *
+ * This method is not thread-safe.
+ */
+void
+catalina_storage_set_backend (CatalinaStorage *storage,
+                              CatalinaBackend *backend)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (CATALINA_IS_BACKEND (backend));
+	g_return_if_fail (!storage->priv->opened);
+	g_object_ref (backend);
+	if (storage->priv->backend)
+		g_object_unref (storage->priv->backend);
+	storage->priv->backend = backend;
+	g_object_notify (G_OBJECT (storage), "backend");
+}
+
+/**
+ * catalina_storage_get_group_commit_size:
+ * @storage: A #CatalinaStorage
+ *
+ * Retrieves the "group-commit-size" property.
+ *
+ * Return value: the maximum number of commits per group
+ */
+guint
+catalina_storage_get_group_commit_size (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 1);
+	return storage->priv->txn_group_size;
+}
+
+/**
+ * catalina_storage_set_group_commit_size:
+ * @storage: A #CatalinaStorage
+ * @group_commit_size: the maximum number of commits per group
+ *
+ * Sets the "group-commit-size" property.  A value of 1 disables group commit.
+ *
+ * This method is not thread-safe.
+ */
+void
+catalina_storage_set_group_commit_size (CatalinaStorage *storage,
+                                        guint            group_commit_size)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (group_commit_size > 0);
+	storage->priv->txn_group_size = group_commit_size;
+	g_object_notify (G_OBJECT (storage), "group-commit-size");
+}
+
+/**
+ * catalina_storage_get_group_commit_stats:
+ * @storage: A #CatalinaStorage
+ * @n_groups: A location for the number of group flushes, or %NULL
+ * @n_commits: A location for the number of commits flushed in groups, or %NULL
+ * @largest_group: A location for the largest group flushed, or %NULL
+ *
+ * Retrieves counters describing the batches achieved by group commit.  The average
+ * group size is @n_commits divided by @n_groups.
+ */
+void
+catalina_storage_get_group_commit_stats (CatalinaStorage *storage,
+                                         gulong          *n_groups,
+                                         gulong          *n_commits,
+                                         guint           *largest_group)
+{
+	CatalinaStoragePrivate *priv;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+
+	priv = storage->priv;
+
+	if (n_groups)
+		*n_groups = priv->txn_group_count;
+	if (n_commits)
+		*n_commits = priv->txn_group_commits;
+	if (largest_group)
+		*largest_group = priv->txn_group_largest;
+}
+
+/**
+ * catalina_storage_get_compact_threshold:
+ * @storage: A #CatalinaStorage
+ *
+ * Retrieves the "compact-threshold" property.
+ *
+ * Return value: the fraction of free space starting a compaction, or 0
+ */
+gdouble
+catalina_storage_get_compact_threshold (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 0.0);
+	return storage->priv->compact_threshold;
+}
+
+/**
+ * catalina_storage_set_compact_threshold:
+ * @storage: A #CatalinaStorage
+ * @compact_threshold: the fraction of free space starting a compaction, or 0
+ *
+ * Sets the "compact-threshold" property.  A value of 0 disables automatic compaction.
+ *
+ * This method is not thread-safe.
+ */
+void
+catalina_storage_set_compact_threshold (CatalinaStorage *storage,
+                                        gdouble          compact_threshold)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (compact_threshold >= 0.0 && compact_threshold <= 1.0);
+	storage->priv->compact_threshold = compact_threshold;
+	g_object_notify (G_OBJECT (storage), "compact-threshold");
+}
+
+/**
+ * catalina_storage_get_durability:
+ * @storage: A #CatalinaStorage
+ *
+ * Retrieves the "durability" property.
+ *
+ * Return value: the default durability of transaction commits
+ */
+CatalinaDurability
+catalina_storage_get_durability (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), CATALINA_DURABILITY_COMMIT);
+	return storage->priv->durability;
+}
+
+/**
+ * catalina_storage_set_durability:
+ * @storage: A #CatalinaStorage
+ * @durability: the default durability of transaction commits
+ *
+ * Sets the "durability" property.
+ *
+ * This method is not thread-safe.
+ */
+void
+catalina_storage_set_durability (CatalinaStorage    *storage,
+                                 CatalinaDurability  durability)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (durability >= CATALINA_DURABILITY_NONE &&
+	                  durability <= CATALINA_DURABILITY_COMMIT);
+	storage->priv->durability = durability;
+	g_object_notify (G_OBJECT (storage), "durability");
+}
+
+/**
+ * catalina_storage_get_sync_interval:
+ * @storage: A #CatalinaStorage
+ *
+ * Retrieves the "sync-interval" property.
+ *
+ * Return value: the milliseconds between periodic syncs
+ */
+guint
+catalina_storage_get_sync_interval (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 0);
+	return storage->priv->sync_interval;
+}
+
+/**
+ * catalina_storage_set_sync_interval:
+ * @storage: A #CatalinaStorage
+ * @sync_interval: the milliseconds between periodic syncs
+ *
+ * Sets the "sync-interval" property.
+ */
+void
+catalina_storage_set_sync_interval (CatalinaStorage *storage,
+                                    guint            sync_interval)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (sync_interval > 0);
+
+	g_mutex_lock (storage->priv->sync_mutex);
+	storage->priv->sync_interval = sync_interval;
+	g_mutex_unlock (storage->priv->sync_mutex);
+
+	g_object_notify (G_OBJECT (storage), "sync-interval");
+}
+
+/**
+ * catalina_storage_get_sync_bytes:
+ * @storage: A #CatalinaStorage
+ *
+ * Retrieves the "sync-bytes" property.
+ *
+ * Return value: the bytes written starting a periodic sync, or 0
+ */
+guint64
+catalina_storage_get_sync_bytes (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 0);
+	return storage->priv->sync_bytes;
+}
+
+/**
+ * catalina_storage_set_sync_bytes:
+ * @storage: A #CatalinaStorage
+ * @sync_bytes: the bytes written starting a periodic sync, or 0 to only use the interval
+ *
+ * Sets the "sync-bytes" property.
+ */
+void
+catalina_storage_set_sync_bytes (CatalinaStorage *storage,
+                                 guint64          sync_bytes)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+
+	g_mutex_lock (storage->priv->sync_mutex);
+	storage->priv->sync_bytes = sync_bytes;
+	g_mutex_unlock (storage->priv->sync_mutex);
+
+	g_object_notify (G_OBJECT (storage), "sync-bytes");
+}
+
+/**
+ * catalina_storage_get_concurrent_writes:
+ * @storage: A #CatalinaStorage
+ *
+ * Retrieves the "concurrent-writes" property.
+ *
+ * Return value: %TRUE if writes run on the concurrent workers
+ */
+gboolean
+catalina_storage_get_concurrent_writes (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	return storage->priv->concurrent_writes;
+}
+
+/**
+ * catalina_storage_set_concurrent_writes:
+ * @storage: A #CatalinaStorage
+ * @concurrent_writes: if writes run on the concurrent workers
+ *
+ * Sets the "concurrent-writes" property.  Takes effect the next time the storage is
+ * opened.
+ */
+void
+catalina_storage_set_concurrent_writes (CatalinaStorage *storage,
+                                        gboolean         concurrent_writes)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	storage->priv->concurrent_writes = concurrent_writes;
+	g_object_notify (G_OBJECT (storage), "concurrent-writes");
+}
+
+/**
+ * catalina_storage_get_queue_limit:
+ * @storage: A #CatalinaStorage
+ *
+ * Retrieves the "queue-limit" property.
+ *
+ * Return value: the asynchronous requests outstanding per port, or 0
+ */
+guint
+catalina_storage_get_queue_limit (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 0);
+	return storage->priv->queue_limit;
+}
+
+/**
+ * catalina_storage_set_queue_limit:
+ * @storage: A #CatalinaStorage
+ * @queue_limit: the asynchronous requests outstanding per port, or 0 for no limit
+ *
+ * Sets the "queue-limit" property.
+ */
+void
+catalina_storage_set_queue_limit (CatalinaStorage *storage,
+                                  guint            queue_limit)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+
+	g_mutex_lock (storage->priv->queue_mutex);
+	storage->priv->queue_limit = queue_limit;
+	g_cond_broadcast (storage->priv->queue_cond);
+	g_mutex_unlock (storage->priv->queue_mutex);
+
+	g_object_notify (G_OBJECT (storage), "queue-limit");
+}
+
+/**
+ * catalina_storage_get_queue_limit_bytes:
+ * @storage: A #CatalinaStorage
+ *
+ * Retrieves the "queue-limit-bytes" property.
+ *
+ * Return value: the bytes of asynchronous requests outstanding per port, or 0
+ */
+guint64
+catalina_storage_get_queue_limit_bytes (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 0);
+	return storage->priv->queue_limit_bytes;
+}
+
+/**
+ * catalina_storage_set_queue_limit_bytes:
+ * @storage: A #CatalinaStorage
+ * @queue_limit_bytes: the bytes of asynchronous requests outstanding per port, or 0 for
+ *   no limit
+ *
+ * Sets the "queue-limit-bytes" property.
+ */
+void
+catalina_storage_set_queue_limit_bytes (CatalinaStorage *storage,
+                                        guint64          queue_limit_bytes)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+
+	g_mutex_lock (storage->priv->queue_mutex);
+	storage->priv->queue_limit_bytes = queue_limit_bytes;
+	g_cond_broadcast (storage->priv->queue_cond);
+	g_mutex_unlock (storage->priv->queue_mutex);
+
+	g_object_notify (G_OBJECT (storage), "queue-limit-bytes");
+}
+
+/**
+ * catalina_storage_get_queue_policy:
+ * @storage: A #CatalinaStorage
+ *
+ * Retrieves the "queue-policy" property.
+ *
+ * Return value: what happens to requests beyond the queue limits
+ */
+CatalinaQueuePolicy
+catalina_storage_get_queue_policy (CatalinaStorage *storage)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), CATALINA_QUEUE_FAIL);
+	return storage->priv->queue_policy;
+}
+
+/**
+ * catalina_storage_set_queue_policy:
+ * @storage: A #CatalinaStorage
+ * @queue_policy: what happens to requests beyond the queue limits
+ *
+ * Sets the "queue-policy" property.
+ */
+void
+catalina_storage_set_queue_policy (CatalinaStorage     *storage,
+                                   CatalinaQueuePolicy  queue_policy)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (queue_policy <= CATALINA_QUEUE_BLOCK);
+
+	g_mutex_lock (storage->priv->queue_mutex);
+	storage->priv->queue_policy = queue_policy;
+	g_cond_broadcast (storage->priv->queue_cond);
+	g_mutex_unlock (storage->priv->queue_mutex);
+
+	g_object_notify (G_OBJECT (storage), "queue-policy");
+}
+
+/**
+ * catalina_storage_remove_async:
+ * @storage: A #CatalinaStorage
+ * @txn_id: A transaction id or 0
+ * @key: the key to remove
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously removes @key from the data-store.
+ *
+ * Call catalina_storage_remove_finish() from within @callback to retrieve the result.
+ */
+void
+catalina_storage_remove_async (CatalinaStorage     *storage,
+                               gulong               txn_id,
+                               const gchar         *key,
+                               gssize               key_length,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (key != NULL);
+	g_return_if_fail (key_length == -1 || key_length > 0);
+
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_remove_async);
+
+	if (key_length == -1) {
+		task->key = g_strdup (key);
+		task->key_length = strlen (key) + 1;
+	}
+	else {
+		task->key = g_memdup (key, key_length);
+		task->key_length = key_length;
+	}
+
+	task->txn_id = txn_id;
+
+	message = iris_message_new_data (MESSAGE_REMOVE, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+}
+
+/**
+ * catalina_storage_remove_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_storage_remove_async().  If the key
+ * did not exist, %FALSE is returned and @error is set to
+ * %CATALINA_STORAGE_ERROR_NO_SUCH_KEY.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_remove_finish (CatalinaStorage  *storage,
+                                GAsyncResult     *result,
+                                GError          **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_remove_async),
+	                      FALSE);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return FALSE;
+	}
+
+	if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+
+	success = task->success;
+	storage_task_free (task, TRUE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_remove:
+ * @storage: A #CatalinaStorage
+ * @txn_id: A transaction id or 0
+ * @key: the key to remove
+ * @key_length: the length of @key in bytes or -1 if @key is %NULL terminated
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously removes @key from the data-store.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_remove (CatalinaStorage  *storage,
+                         gulong            txn_id,
+                         const gchar      *key,
+                         gssize            key_length,
+                         GError          **error)
+{
+	StorageTask *task;
+	IrisMessage *message;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
+
+	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
+	task->txn_id = txn_id;
+	task->key = (gchar*)key;
+	task->key_length = (key_length == -1) ? strlen (key) + 1 : key_length;
+
+	message = iris_message_new_data (MESSAGE_REMOVE, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+
+	success = storage_task_wait (task, error);
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+static StorageTask*
+storage_remove_many_task (CatalinaStorage      *storage,
+                          gboolean              is_async,
+                          const gchar         **keys,
+                          const gssize         *key_lengths,
+                          guint                 n_keys,
+                          GAsyncReadyCallback   callback,
+                          gpointer              user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	task = storage_task_new (storage, is_async, callback, user_data,
+	                         catalina_storage_remove_many_async);
+	task->entries = storage_entries_new (keys, key_lengths, n_keys);
+
+	message = iris_message_new_data (MESSAGE_REMOVE_MANY, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+
+	return task;
+}
+
+/**
+ * catalina_storage_remove_many_async:
+ * @storage: A #CatalinaStorage
+ * @keys: an array of keys
+ * @key_lengths: an array of key lengths, or %NULL if all keys are %NULL terminated
+ * @n_keys: the number of keys in @keys
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously removes @keys from the data-store.  All of the keys are removed within
+ * a single exclusive pass and a single transaction, after which a compaction is started
+ * in the background to reclaim the space they used.  Keys that do not exist are
+ * ignored.
+ *
+ * Call catalina_storage_remove_many_finish() from within @callback to retrieve the result.
+ */
+void
+catalina_storage_remove_many_async (CatalinaStorage      *storage,
+                                    const gchar         **keys,
+                                    const gssize         *key_lengths,
+                                    guint                 n_keys,
+                                    GAsyncReadyCallback   callback,
+                                    gpointer              user_data)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (keys != NULL || n_keys == 0);
+
+	storage_remove_many_task (storage, TRUE, keys, key_lengths, n_keys,
+	                          callback, user_data);
+}
+
+static gboolean
+storage_remove_finish (CatalinaStorage  *storage,
+                       GAsyncResult     *result,
+                       gpointer          source_tag,
+                       gulong           *n_removed,
+                       GError          **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      source_tag),
+	                      FALSE);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return FALSE;
+	}
+
+	if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+	if (n_removed)
+		*n_removed = task->size;
+
+	success = task->success;
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_remove_many_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @n_removed: A location for the number of keys removed, or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_storage_remove_many_async().
+ * Upon failure, no keys are removed.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_remove_many_finish (CatalinaStorage  *storage,
+                                     GAsyncResult     *result,
+                                     gulong           *n_removed,
+                                     GError          **error)
+{
+	return storage_remove_finish (storage, result,
+	                              catalina_storage_remove_many_async,
+	                              n_removed, error);
+}
+
+/**
+ * catalina_storage_remove_many:
+ * @storage: A #CatalinaStorage
+ * @keys: an array of keys
+ * @key_lengths: an array of key lengths, or %NULL if all keys are %NULL terminated
+ * @n_keys: the number of keys in @keys
+ * @n_removed: A location for the number of keys removed, or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously removes @keys from the data-store.
+ *
+ * See catalina_storage_remove_many_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_remove_many (CatalinaStorage  *storage,
+                              const gchar     **keys,
+                              const gssize     *key_lengths,
+                              guint             n_keys,
+                              gulong           *n_removed,
+                              GError          **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (keys != NULL || n_keys == 0, FALSE);
+
+	task = storage_remove_many_task (storage, FALSE, keys, key_lengths, n_keys,
+	                                 NULL, NULL);
+
+	success = storage_task_wait (task, error);
+	if (n_removed)
+		*n_removed = task->size;
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+static StorageTask*
+storage_remove_where_task (CatalinaStorage       *storage,
+                           gboolean               is_async,
+                           CatalinaPredicateFunc  predicate,
+                           gpointer               predicate_data,
+                           GAsyncReadyCallback    callback,
+                           gpointer               user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	task = storage_task_new (storage, is_async, callback, user_data,
+	                         catalina_storage_remove_where_async);
+	task->predicate = predicate;
+	task->record_data = predicate_data;
+
+	message = iris_message_new_data (MESSAGE_REMOVE_WHERE, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+
+	return task;
+}
+
+/**
+ * catalina_storage_remove_where_async:
+ * @storage: A #CatalinaStorage
+ * @predicate: A #CatalinaPredicateFunc
+ * @predicate_data: data for @predicate
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously removes every record for which @predicate returns %TRUE.  The
+ * data-store is traversed in a single exclusive pass within one transaction, after
+ * which a compaction is started in the background to reclaim the space used by the
+ * removed records.  @predicate is called from a worker thread.
+ *
+ * Call catalina_storage_remove_where_finish() from within @callback to retrieve the result.
+ */
+void
+catalina_storage_remove_where_async (CatalinaStorage       *storage,
+                                     CatalinaPredicateFunc  predicate,
+                                     gpointer               predicate_data,
+                                     GAsyncReadyCallback    callback,
+                                     gpointer               user_data)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (predicate != NULL);
+
+	storage_remove_where_task (storage, TRUE, predicate, predicate_data,
+	                           callback, user_data);
+}
+
+/**
+ * catalina_storage_remove_where_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @n_removed: A location for the number of keys removed, or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_storage_remove_where_async().
+ * Upon failure, no keys are removed.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_remove_where_finish (CatalinaStorage  *storage,
+                                      GAsyncResult     *result,
+                                      gulong           *n_removed,
+                                      GError          **error)
+{
+	return storage_remove_finish (storage, result,
+	                              catalina_storage_remove_where_async,
+	                              n_removed, error);
+}
+
+/**
+ * catalina_storage_remove_where:
+ * @storage: A #CatalinaStorage
+ * @predicate: A #CatalinaPredicateFunc
+ * @predicate_data: data for @predicate
+ * @n_removed: A location for the number of keys removed, or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously removes every record for which @predicate returns %TRUE.
+ *
+ * See catalina_storage_remove_where_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_remove_where (CatalinaStorage       *storage,
+                               CatalinaPredicateFunc  predicate,
+                               gpointer               predicate_data,
+                               gulong                *n_removed,
+                               GError               **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (predicate != NULL, FALSE);
+
+	task = storage_remove_where_task (storage, FALSE, predicate, predicate_data,
+	                                  NULL, NULL);
+
+	success = storage_task_wait (task, error);
+	if (n_removed)
+		*n_removed = task->size;
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_count_keys:
+ * @storage: A #CatalinaStorage
+ *
+ * Counts the number of keys that are currently in the database.  The count is
+ * maintained incrementally as records are written, so this does not traverse the
+ * data-store.
+ *
+ * Return value: the current number of keys
+ */
+gulong
+catalina_storage_count_keys (CatalinaStorage *storage)
+{
+	StorageTask *task;
+	IrisMessage *message;
+	gulong       count = 0;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 0);
+
+	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
+
+	message = iris_message_new_data (MESSAGE_COUNT_KEYS, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
+	iris_message_unref (message);
+
+	if (storage_task_wait (task, NULL))
+		count = g_value_get_ulong (&task->value);
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return count;
+}
+
+/**
+ * catalina_storage_count_keys_async:
+ * @storage: A #CatalinaStorage
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously requests the number of keys in the database along with the
+ * number of bytes stored for their values.
+ *
+ * Call catalina_storage_count_keys_finish() from within @callback to retrieve the result.
+ */
+void
+catalina_storage_count_keys_async (CatalinaStorage     *storage,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_count_keys_async);
+
+	message = iris_message_new_data (MESSAGE_COUNT_KEYS, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
+	iris_message_unref (message);
+}
+
+/**
+ * catalina_storage_count_keys_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @n_bytes: A location for the number of bytes stored for values, or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_storage_count_keys_async().
+ * @n_bytes is the size of the values as stored, after the "transform" is applied.
+ *
+ * Return value: the current number of keys
+ */
+gulong
+catalina_storage_count_keys_finish (CatalinaStorage  *storage,
+                                    GAsyncResult     *result,
+                                    guint64          *n_bytes,
+                                    GError          **error)
+{
+	StorageTask *task;
+	gulong       count = 0;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 0);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_count_keys_async),
+	                      0);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return 0;
+	}
+
+	if (task->success) {
+		count = g_value_get_ulong (&task->value);
+		if (n_bytes)
+			*n_bytes = task->size;
+	}
+	else if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return count;
+}
+
+/**
+ * catalina_storage_transaction_begin_async:
+ * @storage: A #CatalinaStorage
+ * @callback: a callback to execute when the transaction begins
+ * @user_data: data for @callback
+ *
+ * Begins a new transaction.  Catalina does not support recursive transactions currently, but it
+ * does support concurrent transactions using the resulting transaction id.  Consumers can implement
+ * recursive transactions by cancelling a secondary transaction if the child transaction fails.
+ */
+void
+catalina_storage_transaction_begin_async (CatalinaStorage     *storage,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data)
+{
+	catalina_storage_transaction_begin_full_async (storage, CATALINA_DURABILITY_DEFAULT,
+	                                               callback, user_data);
+}
+
+/**
+ * catalina_storage_transaction_begin_full_async:
+ * @storage: A #CatalinaStorage
+ * @durability: how far the commit of the transaction is persisted before it completes
+ * @callback: a callback to execute when the transaction begins
+ * @user_data: data for @callback
+ *
+ * Begins a new transaction like catalina_storage_transaction_begin_async(), overriding
+ * the "durability" of the storage for its commit.
+ *
+ * Call catalina_storage_transaction_begin_finish() from within @callback to retrieve
+ * the transaction id.
+ */
+void
+catalina_storage_transaction_begin_full_async (CatalinaStorage     *storage,
+                                               CatalinaDurability   durability,
+                                               GAsyncReadyCallback  callback,
+                                               gpointer             user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (durability <= CATALINA_DURABILITY_COMMIT);
+
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_transaction_begin_async);
+	task->durability = durability;
+
+	message = iris_message_new_data (MESSAGE_TXN_BEGIN, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+}
+
+/**
+ * catalina_storage_transaction_begin_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ *
+ * Completes an asynchronous request to create a new transaction.
+ *
+ * Return value: the transaction id
+ */
+gulong
+catalina_storage_transaction_begin_finish (CatalinaStorage *storage,
+                                           GAsyncResult    *result)
+{
+	StorageTask *task;
+	gulong       txn_id;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), 0);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_transaction_begin_async),
+	                      0);
+
+	task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result));
+
+	txn_id = task->txn_id;
+	storage_task_free (task, FALSE, FALSE);
+
+	return txn_id;
+}
+
+/**
+ * catalina_storage_transaction_commit_async:
+ * @storage: A #CatalinaStorage
+ * @txn_id: the transaction id from a call to catalina_storage_transaction_begin_async()
+ * @callback: A #GAsyncReadyCallback to call when the transaction is ready
+ * @user_data: data for @callback
+ *
+ * Asynchronously beings the process of committing a transaction.  The commit completes
+ * once it is as durable as the transaction was begun with, see #CatalinaDurability.
+ *
+ * Upon failure, %FALSE is returned and @error is set.  If you want to bring the storage back to a
+ * consistent state, call catalina_storage_transaction_rollback().
+ */
+void
+catalina_storage_transaction_commit_async (CatalinaStorage     *storage,
+                                           gulong               txn_id,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_transaction_commit_async);
+	task->txn_id = txn_id;
+
+	message = iris_message_new_data (MESSAGE_TXN_COMMIT, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+}
+
+/**
+ * catalina_storage_transaction_commit_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes and asynchronous request to commit a transaction.
+ *
+ * Upon failure, %FALSE is returned and @error is set.  If the commit failed, the state is
+ * automatically rolled back.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_transaction_commit_finish (CatalinaStorage  *storage,
+                                            GAsyncResult     *result,
+                                            GError          **error)
+{
+	StorageTask *task;
+	gboolean     success = FALSE;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_transaction_commit_async),
+	                      FALSE);
+
+	task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result));
+
+	success = task->success;
+	if (task->error && error && *error == NULL) {
+		*error = task->error;
+		task->error = NULL;
+	}
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_transaction_cancel_async:
+ * @storage: A #CatalinaStorage
+ * @txn_id: A transaction id retrieved from catalina_storage_transaction_begin_async()
+ * @callback: a callback to execute when the transaction is cancelled
+ * @user_data: data for @callback
+ *
+ * Asynchronously cancels transaction @txn_id.  There is no need to call
+ * catalina_storage_transaction_rollback_async() as the state will be rolled back automatically.
+ */
+void
+catalina_storage_transaction_cancel_async (CatalinaStorage     *storage,
+                                           gulong               txn_id,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_transaction_cancel_async);
+	task->txn_id = txn_id;
+
+	message = iris_message_new_data (MESSAGE_TXN_CANCEL, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+}
+
+/**
+ * catalina_storage_transaction_cancel_finish:
+ * @storage: A #CatalinaStorage
+ * @result: a #GAsyncResult
+ *
+ * Completes and asynchronous request to cancel the current transaction.
+ *
+ * The state is automatically rolled back to that of before the transaction.
+ */
+void
+catalina_storage_transaction_cancel_finish (CatalinaStorage *storage,
+                                            GAsyncResult    *result)
+{
+	StorageTask *task;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_transaction_cancel_async));
+
+	task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result));
+
+	storage_task_free (task, FALSE, FALSE);
+}
+
+static void
+storage_foreach_post (CatalinaStorage    *storage,
+                      StorageTask        *task,
+                      guint               n_partitions,
+                      CatalinaMapFunc     map_func,
+                      CatalinaReduceFunc  reduce_func,
+                      gpointer            func_data)
+{
+	ForeachJob  *job;
+	IrisMessage *message;
+
+	job = g_slice_new0 (ForeachJob);
+	job->task = task;
+	job->map_func = map_func;
+	job->reduce_func = reduce_func;
+	job->func_data = func_data;
+	job->n_parts = n_partitions;
+	job->mutex = g_mutex_new ();
+	task->foreach = job;
+
+	message = iris_message_new_data (MESSAGE_FOREACH, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
+	iris_message_unref (message);
+}
+
+/**
+ * catalina_storage_foreach_parallel_async:
+ * @storage: A #CatalinaStorage
+ * @n_partitions: the number of partitions to traverse concurrently, or 0 for the default
+ * @map_func: A #CatalinaMapFunc to run for each record
+ * @reduce_func: A #CatalinaReduceFunc to combine the partial results, or %NULL
+ * @func_data: data for @map_func and @reduce_func
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously traverses every record in @storage in parallel.  The hash chains of the
+ * data-store are split into @n_partitions ranges which are traversed concurrently on the
+ * Iris worker threads.  @map_func is called for each record with the partial result of its
+ * partition.  Once every partition has finished, the partial results are combined with
+ * @reduce_func.
+ *
+ * If @reduce_func is %NULL, @map_func should return %NULL and is only useful for its
+ * side effects, which must then be thread-safe.
+ *
+ * Call catalina_storage_foreach_parallel_finish() from within @callback to retrieve
+ * the reduced result.
+ */
+void
+catalina_storage_foreach_parallel_async (CatalinaStorage     *storage,
+                                         guint                n_partitions,
+                                         CatalinaMapFunc      map_func,
+                                         CatalinaReduceFunc   reduce_func,
+                                         gpointer             func_data,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data)
+{
+	StorageTask *task;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (map_func != NULL);
+
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_foreach_parallel_async);
+	storage_foreach_post (storage, task, n_partitions,
+	                      map_func, reduce_func, func_data);
+}
+
+/**
+ * catalina_storage_foreach_parallel_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @reduced: A location for the reduced result, or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_storage_foreach_parallel_async().
+ *
+ * Upon failure, %FALSE is returned and @error is set.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_foreach_parallel_finish (CatalinaStorage  *storage,
+                                          GAsyncResult     *result,
+                                          gpointer         *reduced,
+                                          GError          **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_foreach_parallel_async),
+	                      FALSE);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return FALSE;
+	}
+
+	success = task->success;
+	if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+	if (reduced)
+		*reduced = task->reduced;
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_foreach_parallel:
+ * @storage: A #CatalinaStorage
+ * @n_partitions: the number of partitions to traverse concurrently, or 0 for the default
+ * @map_func: A #CatalinaMapFunc to run for each record
+ * @reduce_func: A #CatalinaReduceFunc to combine the partial results, or %NULL
+ * @func_data: data for @map_func and @reduce_func
+ * @reduced: A location for the reduced result, or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously traverses every record in @storage in parallel.
+ *
+ * See catalina_storage_foreach_parallel_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_foreach_parallel (CatalinaStorage     *storage,
+                                   guint                n_partitions,
+                                   CatalinaMapFunc      map_func,
+                                   CatalinaReduceFunc   reduce_func,
+                                   gpointer             func_data,
+                                   gpointer            *reduced,
+                                   GError             **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (map_func != NULL, FALSE);
+
+	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
+	storage_foreach_post (storage, task, n_partitions,
+	                      map_func, reduce_func, func_data);
+
+	success = storage_task_wait (task, error);
+	if (reduced)
+		*reduced = task->reduced;
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_cursor_new:
+ * @storage: A #CatalinaStorage
+ * @flags: #CatalinaCursorFlags
+ *
+ * Creates a new cursor for traversing all of the key/value pairs in @storage.  Records
+ * are delivered in bounded batches using catalina_cursor_next_batch_async() so that very
+ * large stores can be scanned without loading everything into memory.
+ *
+ * The traversal order is unspecified.  Records stored or removed while the traversal is
+ * in progress may or may not be seen.  Only one batch may be requested at a time.
+ *
+ * Backends which are not ordered resume each batch from the last key read.  If that
+ * key is removed before the next batch, the traversal cannot continue and the batch
+ * fails with %CATALINA_STORAGE_ERROR_STATE rather than ending early.
+ *
+ * Return value: A new #CatalinaCursor which should be freed with catalina_cursor_free()
+ */
+CatalinaCursor*
+catalina_storage_cursor_new (CatalinaStorage     *storage,
+                             CatalinaCursorFlags  flags)
+{
+	CatalinaCursor *cursor;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), NULL);
+
+	if (flags & CATALINA_CURSOR_DESERIALIZE)
+		flags |= CATALINA_CURSOR_TRANSFORM;
+
+	cursor = g_slice_new0 (CatalinaCursor);
+	cursor->storage = g_object_ref (storage);
+	cursor->flags = flags;
+
+	return cursor;
+}
+
+/**
+ * catalina_cursor_next_batch_async:
+ * @cursor: A #CatalinaCursor
+ * @max_items: the maximum number of entries to deliver
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously retrieves up to @max_items records from the cursor.  Reading values,
+ * transforming and deserializing them is done on the worker thread.
+ *
+ * Call catalina_cursor_next_batch_finish() from within @callback.  The source object
+ * passed to @callback is the #CatalinaStorage of the cursor.
+ */
+void
+catalina_cursor_next_batch_async (CatalinaCursor      *cursor,
+                                  guint                max_items,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	g_return_if_fail (cursor != NULL);
+	g_return_if_fail (max_items > 0);
+
+	task = storage_task_new (cursor->storage, TRUE, callback, user_data,
+	                         catalina_cursor_next_batch_async);
+	task->cursor = cursor;
+	task->max_items = max_items;
+
+	message = iris_message_new_data (MESSAGE_CURSOR_NEXT, G_TYPE_POINTER, task);
+	storage_cn_post (cursor->storage, message);
+	iris_message_unref (message);
+}
+
+/**
+ * catalina_cursor_next_batch_finish:
+ * @cursor: A #CatalinaCursor
+ * @result: A #GAsyncResult
+ * @entries: A location for a #GArray of #CatalinaStorageEntry
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request for the next batch of records.  When the traversal
+ * is complete, @entries will be empty.  Free @entries with catalina_storage_entries_free().
+ *
+ * Upon failure, %FALSE is returned and @error is set.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_cursor_next_batch_finish (CatalinaCursor  *cursor,
+                                   GAsyncResult    *result,
+                                   GArray         **entries,
+                                   GError         **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (cursor != NULL, FALSE);
+	g_return_val_if_fail (entries != NULL, FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (cursor->storage),
+	                                                      catalina_cursor_next_batch_async),
+	                      FALSE);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return FALSE;
+	}
+
+	if ((success = task->success) == TRUE) {
+		*entries = task->entries;
+		task->entries = NULL;
+	}
+	else if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_cursor_next_batch:
+ * @cursor: A #CatalinaCursor
+ * @max_items: the maximum number of entries to deliver
+ * @entries: A location for a #GArray of #CatalinaStorageEntry
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously retrieves up to @max_items records from the cursor.
+ *
+ * See catalina_cursor_next_batch_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_cursor_next_batch (CatalinaCursor  *cursor,
+                            guint            max_items,
+                            GArray         **entries,
+                            GError         **error)
+{
+	StorageTask *task;
+	IrisMessage *message;
+	gboolean     success;
+
+	g_return_val_if_fail (cursor != NULL, FALSE);
+	g_return_val_if_fail (max_items > 0, FALSE);
+	g_return_val_if_fail (entries != NULL, FALSE);
+
+	task = storage_task_new (cursor->storage, FALSE, NULL, NULL, NULL);
+	task->cursor = cursor;
+	task->max_items = max_items;
+
+	message = iris_message_new_data (MESSAGE_CURSOR_NEXT, G_TYPE_POINTER, task);
+	storage_cn_post (cursor->storage, message);
+	iris_message_unref (message);
+
+	if ((success = storage_task_wait (task, error)) == TRUE) {
+		*entries = task->entries;
+		task->entries = NULL;
+	}
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_cursor_free:
+ * @cursor: A #CatalinaCursor
+ *
+ * Frees the cursor.  This must not be called while a batch is outstanding.
+ */
+void
+catalina_cursor_free (CatalinaCursor *cursor)
+{
+	g_return_if_fail (cursor != NULL);
+
+	if (cursor->backend) {
+		catalina_backend_release_partitions (cursor->backend);
+		g_object_unref (cursor->backend);
+	}
+	g_free (cursor->position);
+	g_object_unref (cursor->storage);
+	g_slice_free (CatalinaCursor, cursor);
+}
+
+/**
+ * catalina_storage_snapshot_new_async:
+ * @storage: A #CatalinaStorage
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously takes a point-in-time view of @storage.  The snapshot sees every write
+ * requested before it and none of those requested after it, so several records can be
+ * read consistently without a transaction.
+ *
+ * Reads through the snapshot do not wait for the writes and commits running meanwhile.
+ * Instead, the first write to a record after the snapshot was taken keeps a copy of
+ * the previous version in memory until the snapshot is freed, so snapshots should not
+ * be held longer than needed.  Shared data-stores do not support snapshots.
+ *
+ * Call catalina_storage_snapshot_new_finish() from within @callback.
+ */
+void
+catalina_storage_snapshot_new_async (CatalinaStorage     *storage,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_snapshot_new_async);
+
+	message = iris_message_new_data (MESSAGE_SNAPSHOT, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+}
+
+/**
+ * catalina_storage_snapshot_new_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to take a snapshot.
+ *
+ * Return value: A new #CatalinaSnapshot which should be freed with
+ *   catalina_snapshot_free(), or %NULL and @error is set
+ */
+CatalinaSnapshot*
+catalina_storage_snapshot_new_finish (CatalinaStorage  *storage,
+                                      GAsyncResult     *result,
+                                      GError          **error)
+{
+	CatalinaSnapshot *snapshot;
+	StorageTask      *task;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), NULL);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_snapshot_new_async),
+	                      NULL);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return NULL;
+	}
+
+	snapshot = task->snapshot;
+	if (!task->success && task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return snapshot;
+}
+
+/**
+ * catalina_storage_snapshot_new:
+ * @storage: A #CatalinaStorage
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously takes a point-in-time view of @storage.
+ *
+ * See catalina_storage_snapshot_new_async().
+ *
+ * Return value: A new #CatalinaSnapshot which should be freed with
+ *   catalina_snapshot_free(), or %NULL and @error is set
+ */
+CatalinaSnapshot*
+catalina_storage_snapshot_new (CatalinaStorage  *storage,
+                               GError          **error)
+{
+	CatalinaSnapshot *snapshot = NULL;
+	StorageTask      *task;
+	IrisMessage      *message;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), NULL);
+
+	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
+
+	message = iris_message_new_data (MESSAGE_SNAPSHOT, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+
+	if (storage_task_wait (task, error))
+		snapshot = task->snapshot;
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return snapshot;
+}
+
+static StorageTask*
+storage_snapshot_get_task (CatalinaSnapshot    *snapshot,
+                           guint                what,
+                           const gchar         *key,
+                           gssize               key_length,
+                           gboolean             is_async,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+	CatalinaStoragePrivate *priv = snapshot->storage->priv;
+	StorageTask            *task;
+	IrisMessage            *message;
+
+	task = storage_task_new (snapshot->storage, is_async, callback, user_data,
+	                         catalina_snapshot_get_async);
+	task->snapshot = snapshot;
+
+	if (key_length == -1) {
+		task->key = g_strdup (key);
+		task->key_length = strlen (key) + 1;
+	}
+	else {
+		task->key = g_memdup (key, key_length);
+		task->key_length = key_length;
+	}
+
+	/* backends which cannot read alongside the writers wait for the exclusive work */
+	message = iris_message_new_data (what, G_TYPE_POINTER, task);
+	if (!priv->snapshot_reads)
+		storage_cn_post (snapshot->storage, message);
+	else if (storage_queue_admit (snapshot->storage, message, &priv->cn_queue))
+		iris_port_post (priv->sn_port, message);
+	iris_message_unref (message);
+
+	return task;
+}
+
+/**
+ * catalina_snapshot_get_async:
+ * @snapshot: A #CatalinaSnapshot
+ * @key: the key
+ * @key_length: the length of @key or -1 if it is a string
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously retrieves the value of @key as of the snapshot.
+ *
+ * Call catalina_snapshot_get_finish() from within @callback.  The source object passed
+ * to @callback is the #CatalinaStorage of the snapshot.
+ */
+void
+catalina_snapshot_get_async (CatalinaSnapshot    *snapshot,
+                             const gchar         *key,
+                             gssize               key_length,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+	g_return_if_fail (snapshot != NULL);
+	g_return_if_fail (key != NULL);
+	g_return_if_fail (key_length == -1 || key_length > 0);
+
+	storage_snapshot_get_task (snapshot, MESSAGE_SNAPSHOT_GET, key, key_length,
+	                           TRUE, callback, user_data);
+}
+
+/**
+ * catalina_snapshot_get_finish:
+ * @snapshot: A #CatalinaSnapshot
+ * @result: A #GAsyncResult
+ * @value: A location for the value
+ * @value_length: A location for the value length or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to retrieve a value from the snapshot.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_snapshot_get_finish (CatalinaSnapshot  *snapshot,
+                              GAsyncResult      *result,
+                              gchar            **value,
+                              gsize             *value_length,
+                              GError           **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (snapshot != NULL, FALSE);
+	g_return_val_if_fail (value != NULL, FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (snapshot->storage),
+	                                                      catalina_snapshot_get_async),
+	                      FALSE);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return FALSE;
+	}
+
+	if ((success = task->success) == TRUE) {
+		*value = task->data;
+		if (value_length)
+			*value_length = task->data_length;
+	}
+	else if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+
+	storage_task_free (task, TRUE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_snapshot_get:
+ * @snapshot: A #CatalinaSnapshot
+ * @key: the key
+ * @key_length: the length of @key or -1 if it is a string
+ * @value: A location for the value
+ * @value_length: A location for the value length or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously retrieves the value of @key as of the snapshot.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_snapshot_get (CatalinaSnapshot  *snapshot,
+                       const gchar       *key,
+                       gssize             key_length,
+                       gchar            **value,
+                       gsize             *value_length,
+                       GError           **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (snapshot != NULL, FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
+	g_return_val_if_fail (value != NULL, FALSE);
+
+	task = storage_snapshot_get_task (snapshot, MESSAGE_SNAPSHOT_GET, key, key_length,
+	                                  FALSE, NULL, NULL);
+
+	if ((success = storage_task_wait (task, error)) == TRUE) {
+		*value = task->data;
+		if (value_length)
+			*value_length = task->data_length;
+	}
+
+	storage_task_free (task, TRUE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_snapshot_get_value:
+ * @snapshot: A #CatalinaSnapshot
+ * @key: the key
+ * @key_length: the length of @key or -1 if it is a string
+ * @value: A #GValue to store the resulting value
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously retrieves the value of @key as of the snapshot and deserializes it
+ * using the "formatter" of the storage.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_snapshot_get_value (CatalinaSnapshot  *snapshot,
+                             const gchar       *key,
+                             gssize             key_length,
+                             GValue            *value,
+                             GError           **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (snapshot != NULL, FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+	g_return_val_if_fail (key_length == -1 || key_length > 0, FALSE);
+	g_return_val_if_fail (value != NULL, FALSE);
+
+	task = storage_snapshot_get_task (snapshot, MESSAGE_SNAPSHOT_GET_VALUE, key, key_length,
+	                                  FALSE, NULL, NULL);
+
+	if ((success = storage_task_wait (task, error)) == TRUE) {
+		if (!G_VALUE_TYPE (value))
+			g_value_init (value, G_VALUE_TYPE (&task->value));
+		g_value_copy (&task->value, value);
+	}
+
+	storage_task_free (task, TRUE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_snapshot_free:
+ * @snapshot: A #CatalinaSnapshot
+ *
+ * Frees the snapshot along with the versions kept for it.  This must not be called
+ * while a read is outstanding.
+ */
+void
+catalina_snapshot_free (CatalinaSnapshot *snapshot)
+{
+	CatalinaStoragePrivate *priv;
+
+	g_return_if_fail (snapshot != NULL);
+
+	priv = snapshot->storage->priv;
+
+	g_static_rw_lock_writer_lock (&priv->snapshot_lock);
+	priv->snapshots = g_list_remove (priv->snapshots, snapshot);
+	if (snapshot->versions)
+		g_hash_table_destroy (snapshot->versions);
+	g_static_rw_lock_writer_unlock (&priv->snapshot_lock);
+
+	g_object_unref (snapshot->storage);
+	g_slice_free (CatalinaSnapshot, snapshot);
+}
+
+static gboolean
+storage_index_add (CatalinaStorage  *storage,
+                   StorageIndex     *index,
+                   GError          **error)
+{
+	StorageTask *task;
+	IrisMessage *message;
+	gboolean     success;
+
+	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
+	task->key = index->name;
+	task->record_data = index;
+
+	message = iris_message_new_data (MESSAGE_INDEX_ADD, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+
+	success = storage_task_wait (task, error);
+	storage_task_free (task, FALSE, FALSE);
+	storage_index_unref (index);
+
+	return success;
+}
+
+/**
+ * catalina_storage_add_index:
+ * @storage: A #CatalinaStorage
+ * @name: the name of the index
+ * @property_name: the name of the property to index
+ * @error: A location for a #GError or %NULL
+ *
+ * Adds a secondary index named @name over records stored with
+ * catalina_storage_set_value_async() whose value is a #GObject with the property
+ * @property_name.  Records holding other values are not indexed.
+ *
+ * Indexes are kept in memory and maintained as records are stored or removed.  The
+ * records already within the data-store are indexed in the background, a batch at a
+ * time, whenever an index is added to an open storage or the storage is opened.
+ * Lookups made while the build is running scan the data-store instead.
+ *
+ * Upon failure, such as an index named @name already existing, %FALSE is returned
+ * and @error is set.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_add_index (CatalinaStorage  *storage,
+                            const gchar      *name,
+                            const gchar      *property_name,
+                            GError          **error)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (name != NULL, FALSE);
+	g_return_val_if_fail (property_name != NULL, FALSE);
+
+	return storage_index_add (storage,
+	                          storage_index_new (name, property_name, NULL, NULL, NULL),
+	                          error);
+}
+
+/**
+ * catalina_storage_add_index_full:
+ * @storage: A #CatalinaStorage
+ * @name: the name of the index
+ * @func: A #CatalinaIndexFunc to extract the indexed value
+ * @func_data: user data for @func
+ * @notify: A #GDestroyNotify for @func_data or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Adds a secondary index named @name using @func to extract the value each record is
+ * indexed by.  @func is called from the threads storing values as well as from the
+ * storage's worker threads, so it must be thread-safe.
+ *
+ * See catalina_storage_add_index().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_add_index_full (CatalinaStorage    *storage,
+                                 const gchar        *name,
+                                 CatalinaIndexFunc   func,
+                                 gpointer            func_data,
+                                 GDestroyNotify      notify,
+                                 GError            **error)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (name != NULL, FALSE);
+	g_return_val_if_fail (func != NULL, FALSE);
+
+	return storage_index_add (storage,
+	                          storage_index_new (name, NULL, func, func_data, notify),
+	                          error);
+}
+
+/**
+ * catalina_storage_remove_index:
+ * @storage: A #CatalinaStorage
+ * @name: the name of the index
+ * @error: A location for a #GError or %NULL
+ *
+ * Removes the secondary index named @name, stopping its build if it is running.
+ *
+ * Upon failure, %FALSE is returned and @error is set.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_remove_index (CatalinaStorage  *storage,
+                               const gchar      *name,
+                               GError          **error)
+{
+	StorageTask *task;
+	IrisMessage *message;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (name != NULL, FALSE);
+
+	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
+	task->key = (gchar*)name;
+
+	message = iris_message_new_data (MESSAGE_INDEX_REMOVE, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+
+	success = storage_task_wait (task, error);
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/* Serializes the queried value the same way the indexed values are. */
+static gboolean
+storage_lookup_index_prepare (CatalinaStorage  *storage,
+                              StorageTask      *task,
+                              const gchar      *name,
+                              const GValue     *value,
+                              GError          **error)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
+
+	if (!priv->formatter) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage instance missing a CatalinaFormatter");
+		return FALSE;
+	}
+
+	if (!catalina_formatter_serialize (priv->formatter, value,
+	                                   &task->data, &task->data_length,
+	                                   error))
+		return FALSE;
+
+	task->key = g_strdup (name);
+
+	return TRUE;
+}
+
+/**
+ * catalina_storage_lookup_index_async:
+ * @storage: A #CatalinaStorage
+ * @name: the name of the index
+ * @value: the indexed value to look for
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously requests the records whose indexed value within the index named
+ * @name is equal to @value.  @value must hold the same type as the indexed property,
+ * or as the values returned from the index's #CatalinaIndexFunc.
+ *
+ * Call catalina_storage_lookup_index_finish() from within @callback to retrieve the
+ * entries.
+ */
+void
+catalina_storage_lookup_index_async (CatalinaStorage     *storage,
+                                     const gchar         *name,
+                                     const GValue        *value,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	g_return_if_fail (name != NULL);
+	g_return_if_fail (value != NULL);
+
+	task = storage_task_new (storage, TRUE, callback, user_data,
+	                         catalina_storage_lookup_index_async);
+
+	if (!storage_lookup_index_prepare (storage, task, name, value, &task->error)) {
+		storage_task_fail (task);
+		return;
+	}
+
+	message = iris_message_new_data (MESSAGE_INDEX_LOOKUP, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
+	iris_message_unref (message);
+}
+
+/**
+ * catalina_storage_lookup_index_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @entries: A location for a #GArray of #CatalinaStorageEntry
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_storage_lookup_index_async().
+ *
+ * @entries contains a #CatalinaStorageEntry for each matching record, in no particular
+ * order.  Free @entries with catalina_storage_entries_free().
+ *
+ * Upon failure, %FALSE is returned and @error is set.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_lookup_index_finish (CatalinaStorage  *storage,
+                                      GAsyncResult     *result,
+                                      GArray          **entries,
+                                      GError          **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (entries != NULL, FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_lookup_index_async),
+	                      FALSE);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return FALSE;
+	}
+
+	if ((success = task->success) == TRUE) {
+		*entries = task->entries;
+		task->entries = NULL;
+	}
+	else if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+
+	storage_task_free (task, TRUE, TRUE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_lookup_index:
+ * @storage: A #CatalinaStorage
+ * @name: the name of the index
+ * @value: the indexed value to look for
+ * @entries: A location for a #GArray of #CatalinaStorageEntry
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously retrieves the records whose indexed value is equal to @value.
+ *
+ * Upon failure, %FALSE is returned and @error is set.
+ *
+ * See catalina_storage_lookup_index_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_lookup_index (CatalinaStorage  *storage,
+                               const gchar      *name,
+                               const GValue     *value,
+                               GArray          **entries,
+                               GError          **error)
+{
+	StorageTask *task;
+	IrisMessage *message;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (name != NULL, FALSE);
+	g_return_val_if_fail (value != NULL, FALSE);
+	g_return_val_if_fail (entries != NULL, FALSE);
+
+	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
+
+	if (!storage_lookup_index_prepare (storage, task, name, value, error)) {
+		storage_task_free (task, FALSE, FALSE);
+		return FALSE;
+	}
+
+	message = iris_message_new_data (MESSAGE_INDEX_LOOKUP, G_TYPE_POINTER, task);
+	storage_cn_post (storage, message);
+	iris_message_unref (message);
+
+	if ((success = storage_task_wait (task, error)) == TRUE) {
+		*entries = task->entries;
+		task->entries = NULL;
+	}
+
+	storage_task_free (task, TRUE, TRUE);
+
+	return success;
+}
+
+static StorageTask*
+storage_compact_task (CatalinaStorage     *storage,
+                      gboolean             is_async,
+                      GAsyncReadyCallback  callback,
+                      gpointer             user_data)
+{
+	StorageTask *task;
+	IrisMessage *message;
+
+	task = storage_task_new (storage, is_async, callback, user_data,
+	                         catalina_storage_compact_async);
+
+	message = iris_message_new_data (MESSAGE_COMPACT, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+
+	return task;
+}
+
+/**
+ * catalina_storage_compact_async:
+ * @storage: A #CatalinaStorage
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously reclaims the space left behind by overwritten and removed records.
+ * The compaction runs in slices on the exclusive worker, each of which is queued behind
+ * the requests that arrived while the previous one ran, so reads and writes proceed
+ * while a large data-store is compacted.  Requests made while a compaction is already
+ * running complete along with it.
+ *
+ * Call catalina_storage_compact_finish() from within @callback to retrieve the result.
+ */
+void
+catalina_storage_compact_async (CatalinaStorage     *storage,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	storage_compact_task (storage, TRUE, callback, user_data);
+}
+
+/**
+ * catalina_storage_compact_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to catalina_storage_compact_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_compact_finish (CatalinaStorage  *storage,
+                                 GAsyncResult     *result,
+                                 GError          **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_compact_async),
+	                      FALSE);
+
+	if (!(task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result)))) {
+		g_critical ("GSimpleAsyncResult does not have a StorageTask");
+		return FALSE;
+	}
+
+	if (task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+
+	success = task->success;
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_compact:
+ * @storage: A #CatalinaStorage
+ * @error: A location for a #GError or %NULL
+ *
+ * Synchronously reclaims the space left behind by overwritten and removed records.
+ *
+ * See catalina_storage_compact_async().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_compact (CatalinaStorage  *storage,
+                          GError          **error)
+{
+	StorageTask *task;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+
+	task = storage_compact_task (storage, FALSE, NULL, NULL);
+	success = storage_task_wait (task, error);
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_get_space:
+ * @storage: A #CatalinaStorage
+ * @size: A location for the size of the data-store in bytes, or %NULL
+ * @free_size: A location for the bytes not held by any record, or %NULL
+ * @error: A location for a #GError or %NULL
+ *
+ * Retrieves how much of the data-store is free space left behind by overwritten and
+ * removed records, which catalina_storage_compact_async() reclaims.  The fragmentation
+ * of the data-store is @free_size divided by @size.
+ *
+ * Backends which cannot tell fail with %CATALINA_STORAGE_ERROR_NOT_SUPPORTED.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_get_space (CatalinaStorage  *storage,
+                            guint64          *size,
+                            guint64          *free_size,
+                            GError          **error)
+{
+	StorageTask *task;
+	IrisMessage *message;
+	gboolean     success;
+
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+
+	task = storage_task_new (storage, FALSE, NULL, NULL, NULL);
+
+	/* exclusive, since backends may count the space the first time it is asked for */
+	message = iris_message_new_data (MESSAGE_GET_SPACE, G_TYPE_POINTER, task);
+	storage_ex_post (storage, message);
+	iris_message_unref (message);
+
+	if ((success = storage_task_wait (task, error)) == TRUE) {
+		if (size)
+			*size = task->size;
+		if (free_size)
+			*free_size = g_value_get_uint64 (&task->value);
+	}
+
+	storage_task_free (task, FALSE, FALSE);
+
+	return success;
+}
+
+/**
+ * catalina_storage_wait_writable_async:
+ * @storage: A #CatalinaStorage
+ * @callback: A #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Asynchronously waits until another write fits within the "queue-limit" and
+ * "queue-limit-bytes" of the exclusive port.  Producers using %CATALINA_QUEUE_FAIL
+ * can wait with this instead of retrying their writes.  @callback is invoked right
+ * away, in the main loop when "use-idle" is set, if there is room already.
+ */
+void
+catalina_storage_wait_writable_async (CatalinaStorage     *storage,
+                                      GAsyncReadyCallback  callback,
+                                      gpointer             user_data)
+{
+	CatalinaStoragePrivate *priv;
+	GSimpleAsyncResult     *result;
+
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+
+	priv = storage->priv;
+	result = g_simple_async_result_new (G_OBJECT (storage), callback, user_data,
+	                                    catalina_storage_wait_writable_async);
+
+	g_mutex_lock (priv->queue_mutex);
+
+	if (!storage_queue_has_room (priv, &priv->ex_queue, 0, FALSE)) {
+		priv->queue_waiters = g_list_append (priv->queue_waiters, result);
+		g_mutex_unlock (priv->queue_mutex);
+		return;
+	}
+
+	g_mutex_unlock (priv->queue_mutex);
+
+	if (priv->use_idle)
+		g_simple_async_result_complete_in_idle (result);
+	else
+		g_simple_async_result_complete (result);
+	g_object_unref (result);
+}
+
+/**
+ * catalina_storage_wait_writable_finish:
+ * @storage: A #CatalinaStorage
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to wait until the exclusive port has room.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+catalina_storage_wait_writable_finish (CatalinaStorage  *storage,
+                                       GAsyncResult     *result,
+                                       GError          **error)
+{
+	g_return_val_if_fail (CATALINA_IS_STORAGE (storage), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
+	                                                      catalina_storage_wait_writable_async),
+	                      FALSE);
+
+	return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result), error);
+}
+
+GQuark
+catalina_storage_error_quark (void)
+{
+	return g_quark_from_static_string ("catalina-storage-error-quark");
+}
+
+/***************************************************************************
+ *               Asynchronous Message Handlers for Iris                    *
+ ***************************************************************************/
+
+static void
+handle_open (CatalinaStorage *storage,
+             IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	gchar                  *dir;
+	gboolean                success,
+	                        concurrent;
+
+	g_return_if_fail (storage != NULL);
+	g_return_if_fail (message != NULL && message->what == MESSAGE_OPEN);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (priv->opened) {
+		/* already open, throw error */
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage already opened");
+		storage_task_fail (task);
+		return;
+	}
+
+	/* make sure the containing directory exists */
+	dir = g_path_get_dirname (task->key);
+	if (!g_file_test (dir, G_FILE_TEST_IS_DIR))
+		g_mkdir_with_parents (dir, 0755);
+	g_free (dir);
+
+	/* clear any pending txn data */
+	priv->txn = 0;
+	if (priv->txn_commits) {
+		g_list_foreach (priv->txn_commits, (GFunc)txn_state_free, NULL);
+		g_list_free (priv->txn_commits);
+		priv->txn_commits = NULL;
+	}
+	g_hash_table_remove_all (priv->txn_state);
+
+	concurrent = catalina_backend_set_concurrent (priv->backend, priv->concurrent_writes);
+
+	if (!catalina_backend_open (priv->backend, task->key, &task->error)) {
+		storage_task_fail (task);
+		return;
+	}
+
+	priv->opened = TRUE;
+	priv->shared = catalina_backend_is_shared (priv->backend);
+
+	/* seeding the counters must not race the other processes */
+	if (priv->shared)
+		success = storage_write_begin (storage, &task->error) &&
+		          catalina_backend_transaction_commit (priv->backend, &task->error);
+	else {
+		/* until a clean close, a crash may leave the counters behind the records */
+		priv->meta_dirty = TRUE;
+		success = meta_load (storage, &task->error) &&
+		          meta_store (storage, &task->error);
+	}
+
+	if (!success) {
+		priv->meta_dirty = FALSE;
+		catalina_backend_close (priv->backend, NULL);
+		priv->opened = FALSE;
+		storage_task_fail (task);
+		return;
+	}
+
+	/* indexes live in memory and are built again for the data-store */
+	storage_indexes_reset (storage);
+
+	/* the following writes are routed to the lanes, see storage_stage_flush() */
+	g_mutex_lock (priv->stage_mutex);
+	priv->concurrent = priv->concurrent_writes && concurrent && !priv->shared;
+	g_mutex_unlock (priv->stage_mutex);
+
+	task->success = TRUE;
+	storage_task_succeed (task);
+}
+
+static void
+handle_close (CatalinaStorage *storage,
+              IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+
+	g_return_if_fail (message->what == MESSAGE_CLOSE);
+	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (priv->txn || g_hash_table_size (priv->txn_state) > 0) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage has pending transactions, please cancel or commit them "
+		             "before closing the storage");
+		storage_task_fail (task);
+		return;
+	}
+
+	/* commits awaiting a periodic sync are synced before the data-store goes away */
+	storage_sync_stop (storage);
+
+	/* waits for the snapshot reads running on sn_port */
+	storage_snapshots_release (storage);
+
+	/* the counters are trusted by the next open only after a clean close */
+	if (priv->meta_dirty) {
+		priv->meta_dirty = FALSE;
+		if (!meta_store (storage, &task->error)) {
+			priv->meta_dirty = TRUE;
+			storage_task_fail (task);
+			return;
+		}
+	}
+
+	if (!catalina_backend_close (priv->backend, &task->error)) {
+		storage_task_fail (task);
+		return;
+	}
+
+	priv->opened = FALSE;
+	priv->meta_keys = 0;
+	priv->meta_bytes = 0;
+	storage_indexes_clear (storage);
+
+	g_mutex_lock (priv->stage_mutex);
+	priv->concurrent = FALSE;
+	g_mutex_unlock (priv->stage_mutex);
+	priv->snapshot_reads = FALSE;
+
+	task->success = TRUE;
+	storage_task_succeed (task);
+}
+
+/* Fetches @key from storage and applies the read transform if needed.  Returns %FALSE
+ * only if the transform failed; a missing key is reported through @found so that batched
+ * lookups do not need to allocate a #GError for each miss.
+ */
+static gboolean
+storage_fetch (CatalinaStorage  *storage,
+               const gchar      *key,
+               gsize             key_length,
+               gchar           **data,
+               gsize            *data_length,
+               gboolean         *found,
+               GError          **error)
+{
+	CatalinaStoragePrivate *priv;
+	gchar                  *value        = NULL;
+	gsize                   value_length = 0;
+
+	priv = storage->priv;
+
+	if (IS_META_KEY (key, key_length) ||
+	    !catalina_backend_fetch (priv->backend, key, key_length,
+	                             &value, &value_length))
+	{
+		*found = FALSE;
+		return TRUE;
+	}
+
+	*found = TRUE;
+
+	return storage_untransform (storage, value, value_length, data, data_length, error);
+}
+
+/* Reads the stored buffer @value back through the "transform".  @value is consumed. */
+static gboolean
+storage_untransform (CatalinaStorage  *storage,
+                     gchar            *value,
+                     gsize             value_length,
+                     gchar           **data,
+                     gsize            *data_length,
+                     GError          **error)
+{
+	CatalinaStoragePrivate *priv          = storage->priv;
+	gchar                  *buffer        = NULL;
+	gsize                   buffer_length = 0;
+
+	if (priv->transform) {
+		if (!catalina_transform_read (priv->transform,
+		                              value, value_length,
+		                              &buffer, &buffer_length,
+		                              error))
+		{
+			g_free (value);
+			return FALSE;
+		}
+
+		if (buffer_length != 0) {
+			g_free (value);
+			*data = buffer;
+			*data_length = buffer_length;
+			return TRUE;
+		}
+	}
+
+	*data = value;
+	*data_length = value_length;
+
+	return TRUE;
+}
+
+static void
+handle_get (CatalinaStorage *storage,
+            IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	gboolean                found = FALSE;
+
+	g_return_if_fail (message->what == MESSAGE_GET);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (!storage_fetch (storage, task->key, task->key_length,
+	                    &task->data, &task->data_length,
+	                    &found, &task->error))
+	{
+		storage_task_fail (task);
+		return;
+	}
+
+	if (!found) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
+		             "No such key");
+		storage_task_fail (task);
+		return;
+	}
+
+	storage_task_succeed (task);
+}
+
+/* Fetches and deserializes in one step so that the caller is completed just once,
+ * with the value ready, rather than deserializing on the main thread. */
+static void
+handle_get_value (CatalinaStorage *storage,
+                  IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	gboolean                found = FALSE;
+
+	g_return_if_fail (message->what == MESSAGE_GET_VALUE);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (!priv->formatter) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "CatalinaStorage is missing a formatter for deserialization");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (!storage_fetch (storage, task->key, task->key_length,
+	                    &task->data, &task->data_length,
+	                    &found, &task->error))
+	{
+		storage_task_fail (task);
+		return;
+	}
+
+	if (!found) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
+		             "No such key");
+		storage_task_fail (task);
+		return;
+	}
+
+	/* the buffer is not needed once deserialized */
+	if (!catalina_formatter_deserialize (priv->formatter, &task->value,
+	                                     task->data, task->data_length,
+	                                     &task->error))
+	{
+		storage_task_fail (task);
+		return;
+	}
+
+	g_free (task->data);
+	task->data = NULL;
+	task->data_length = 0;
+
+	storage_task_succeed (task);
+}
+
+static void
+handle_get_many (CatalinaStorage *storage,
+                 IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	CatalinaStorageEntry   *entry;
+	guint                   i;
+
+	g_return_if_fail (message->what == MESSAGE_GET_MANY);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	for (i = 0; i < task->entries->len; i++) {
+		entry = &g_array_index (task->entries, CatalinaStorageEntry, i);
+
+		if (!storage_fetch (storage, entry->key, entry->key_length,
+		                    &entry->data, &entry->data_length,
+		                    &entry->found, &task->error))
+		{
+			storage_task_fail (task);
+			return;
+		}
+	}
+
+	storage_task_succeed (task);
+}
+
+static gboolean
+handle_get_with_func_parser (const gchar *key,
+                             gsize        key_length,
+                             const gchar *data,
+                             gsize        data_length,
+                             gpointer     user_data)
+{
+	StorageTask *task          = user_data;
+	gchar       *buffer        = NULL;
+	gsize        buffer_length = 0;
+
+	if (task->storage->priv->transform) {
+		if (!catalina_transform_read (task->storage->priv->transform,
+		                              data, data_length,
+		                              &buffer, &buffer_length,
+		                              &task->error))
+			return FALSE;
+
+		if (buffer_length != 0) {
+			task->record_func (task->key, task->key_length,
+			                   buffer, buffer_length,
+			                   task->record_data);
+			g_free (buffer);
+			return TRUE;
+		}
+	}
+
+	task->record_func (task->key, task->key_length,
+	                   data, data_length,
+	                   task->record_data);
+
+	return TRUE;
+}
+
+static void
+handle_get_with_func (CatalinaStorage *storage,
+                      IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+
+	g_return_if_fail (message->what == MESSAGE_GET_WITH_FUNC);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	/* the parser runs against the backend's copy of the record when possible */
+	if (IS_META_KEY (task->key, task->key_length) ||
+	    !catalina_backend_parse (priv->backend, task->key, task->key_length,
+	                             handle_get_with_func_parser, task))
+	{
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
+		             "No such key");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (task->error) {
+		storage_task_fail (task);
+		return;
+	}
+
+	storage_task_succeed (task);
+}
+
+static void
+handle_cursor_next (CatalinaStorage *storage,
+                    IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	CatalinaCursor         *cursor;
+	CatalinaStorageEntry    entry;
+	gchar                  *key;
+	gsize                   key_length;
+	gboolean                more;
+
+	g_return_if_fail (message->what == MESSAGE_CURSOR_NEXT);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+	cursor = task->cursor;
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	if ((cursor->flags & CATALINA_CURSOR_DESERIALIZE) && !priv->formatter) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "CatalinaStorage is missing a formatter for deserialization");
+		storage_task_fail (task);
+		return;
+	}
+
+	task->entries = g_array_sized_new (FALSE, TRUE, sizeof (CatalinaStorageEntry),
+	                                   MIN (task->max_items, 1024));
+
+	while (!cursor->done && task->entries->len < task->max_items) {
+		key = NULL;
+		key_length = 0;
+
+		if (!cursor->started) {
+			/* keeps the chains from being reordered under the traversal */
+			cursor->backend = g_object_ref (priv->backend);
+			catalina_backend_hold_partitions (cursor->backend);
+			more = catalina_backend_next_key (priv->backend, NULL, 0,
+			                                  &key, &key_length);
+			cursor->started = TRUE;
+		}
+		else
+			more = catalina_backend_next_key (priv->backend,
+			                                  cursor->position,
+			                                  cursor->position_length,
+			                                  &key, &key_length);
+
+		/* an unordered backend cannot tell the end from a removed position; the
+		 * entries read so far are delivered and the next batch fails */
+		if (!more && cursor->position &&
+		    !catalina_backend_is_ordered (priv->backend) &&
+		    !catalina_backend_size (priv->backend, cursor->position,
+		                            cursor->position_length, &key_length))
+		{
+			if (task->entries->len > 0)
+				break;
+			g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_STATE,
+			             "The cursor position was removed during the traversal");
+			storage_task_fail (task);
+			return;
+		}
+
+		g_free (cursor->position);
+		cursor->position = key;
+		cursor->position_length = key_length;
+
+		if (!more) {
+			cursor->done = TRUE;
+			catalina_backend_release_partitions (cursor->backend);
+			g_object_unref (cursor->backend);
+			cursor->backend = NULL;
+			break;
+		}
+
+		if (IS_META_KEY (key, key_length))
+			continue;
+
+		memset (&entry, 0, sizeof (entry));
+		entry.key = g_memdup (key, key_length);
+		entry.key_length = key_length;
+		entry.found = TRUE;
+
+		if (!(cursor->flags & CATALINA_CURSOR_KEYS_ONLY)) {
+			if (cursor->flags & CATALINA_CURSOR_TRANSFORM) {
+				if (!storage_fetch (storage, entry.key, entry.key_length,
+				                    &entry.data, &entry.data_length,
+				                    &entry.found, &task->error))
+					goto failure;
+			}
+			else
+				entry.found = catalina_backend_fetch (priv->backend,
+				                                      key, key_length,
+				                                      &entry.data,
+				                                      &entry.data_length);
+
+			/* removed since we read the key */
+			if (!entry.found) {
+				g_free (entry.key);
+				continue;
+			}
+
+			if (cursor->flags & CATALINA_CURSOR_DESERIALIZE) {
+				if (!catalina_formatter_deserialize (priv->formatter, &entry.value,
+				                                     entry.data, entry.data_length,
+				                                     &task->error))
+					goto failure;
+			}
+		}
+
+		g_array_append_val (task->entries, entry);
+	}
+
+	storage_task_succeed (task);
+	return;
+
+failure:
+	g_free (entry.key);
+	g_free (entry.data);
+	if (G_VALUE_TYPE (&entry.value))
+		g_value_unset (&entry.value);
+	storage_task_fail (task);
+}
+
+static gboolean
+handle_scan_func (const gchar *key,
+                  gsize        key_length,
+                  const gchar *data,
+                  gsize        data_length,
+                  gpointer     user_data)
+{
+	StorageTask            *task = user_data;
+	CatalinaStoragePrivate *priv = task->storage->priv;
+	CatalinaStorageEntry    entry;
+
+	if (IS_META_KEY (key, key_length))
+		return TRUE;
+
+	memset (&entry, 0, sizeof (entry));
+
+	if (priv->transform) {
+		if (!catalina_transform_read (priv->transform, data, data_length,
+		                              &entry.data, &entry.data_length,
+		                              &task->error))
+			return FALSE;
+	}
+
+	if (entry.data_length == 0) {
+		g_free (entry.data);
+		entry.data = g_memdup (data, data_length);
+		entry.data_length = data_length;
+	}
+
+	entry.key = g_memdup (key, key_length);
+	entry.key_length = key_length;
+	entry.found = TRUE;
+	g_array_append_val (task->entries, entry);
+
+	return task->max_items == 0 || task->entries->len < task->max_items;
+}
+
+static void
+handle_scan (CatalinaStorage *storage,
+             IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+
+	g_return_if_fail (message->what == MESSAGE_SCAN);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	task->entries = g_array_sized_new (FALSE, TRUE, sizeof (CatalinaStorageEntry),
+	                                   task->max_items ? MIN (task->max_items, 1024) : 64);
+
+	if (!catalina_backend_scan (priv->backend,
+	                            task->key, task->key_length,
+	                            task->data, task->data_length,
+	                            handle_scan_func, task,
+	                            &task->error) || task->error)
+	{
+		storage_task_fail (task);
+		return;
+	}
+
+	storage_task_succeed (task);
+}
+
+static void
+handle_foreach (CatalinaStorage *storage,
+                IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	ForeachJob             *job;
+	IrisMessage            *part_message;
+	guint                   n_partitions,
+	                        i;
+
+	g_return_if_fail (message->what == MESSAGE_FOREACH);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+	job = task->foreach;
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		foreach_job_free (job);
+		storage_task_fail (task);
+		return;
+	}
+
+	/* writes run alongside the parts, they must not rehash the partitions away */
+	catalina_backend_hold_partitions (priv->backend);
+	n_partitions = catalina_backend_get_n_partitions (priv->backend);
+
+	if (job->n_parts == 0)
+		job->n_parts = FOREACH_DEFAULT_PARTITIONS;
+	job->n_parts = CLAMP (job->n_parts, 1, n_partitions);
+	job->parts = g_new0 (ForeachPart, job->n_parts);
+	job->pending = job->n_parts;
+
+	/* each part covers a contiguous range of the backend's partitions */
+	for (i = 0; i < job->n_parts; i++) {
+		job->parts [i].job = job;
+		job->parts [i].first = (guint)(((guint64)n_partitions * i) / job->n_parts);
+		job->parts [i].last = (guint)(((guint64)n_partitions * (i + 1)) / job->n_parts);
+	}
+
+	/* each partition is its own concurrent message so the receiver can spread
+	 * them across the worker threads. */
+	for (i = 0; i < job->n_parts; i++) {
+		part_message = iris_message_new_data (MESSAGE_FOREACH_PART, G_TYPE_POINTER,
+		                                      &job->parts [i]);
+		iris_port_post (priv->cn_port, part_message);
+		iris_message_unref (part_message);
+	}
+}
+
+static gboolean
+handle_foreach_part_cb (const gchar *key,
+                        gsize        key_length,
+                        const gchar *value,
+                        gsize        value_length,
+                        gpointer     user_data)
+{
+	ForeachPart            *part = user_data;
+	ForeachJob             *job  = part->job;
+	CatalinaStoragePrivate *priv = job->task->storage->priv;
+	GError                 *error         = NULL;
+	gchar                  *buffer        = NULL;
+	gsize                   buffer_length = 0;
+
+	if (IS_META_KEY (key, key_length))
+		return TRUE;
+
+	if (priv->transform) {
+		if (!catalina_transform_read (priv->transform,
+		                              value, value_length,
+		                              &buffer, &buffer_length,
+		                              &error))
+		{
+			g_mutex_lock (job->mutex);
+			if (!job->error)
+				job->error = error;
+			else
+				g_error_free (error);
+			g_mutex_unlock (job->mutex);
+			return FALSE;
+		}
+	}
+
+	if (buffer_length != 0) {
+		part->partial = job->map_func (key, key_length,
+		                               buffer, buffer_length,
+		                               part->partial, job->func_data);
+		g_free (buffer);
+	}
+	else {
+		part->partial = job->map_func (key, key_length,
+		                               value, value_length,
+		                               part->partial, job->func_data);
+	}
+
+	return TRUE;
+}
+
+static void
+handle_foreach_part (CatalinaStorage *storage,
+                     IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	ForeachPart            *part;
+	ForeachJob             *job;
+	StorageTask            *task;
+	GError                 *error   = NULL;
+	gpointer                reduced = NULL;
+	guint                   partition,
+	                        i;
+
+	g_return_if_fail (message->what == MESSAGE_FOREACH_PART);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	part = g_value_get_pointer (iris_message_get_data (message));
+	job = part->job;
+
+	if (!priv->opened) {
+		g_mutex_lock (job->mutex);
+		if (!job->error)
+			g_set_error (&job->error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_STATE,
+			             "Storage was closed during traversal");
+		g_mutex_unlock (job->mutex);
+	}
+	else {
+		for (partition = part->first; partition < part->last; partition++) {
+			if (job->error)
+				break;
+			if (!catalina_backend_traverse_partition (priv->backend, partition,
+			                                          handle_foreach_part_cb,
+			                                          part, &error))
+			{
+				g_mutex_lock (job->mutex);
+				if (!job->error)
+					job->error = error;
+				else
+					g_error_free (error);
+				g_mutex_unlock (job->mutex);
+				break;
+			}
+		}
+	}
+
+	/* the last partition to finish reduces and completes the request */
+	if (!g_atomic_int_dec_and_test (&job->pending))
+		return;
+
+	catalina_backend_release_partitions (priv->backend);
+
+	task = job->task;
+
+	for (i = 0; i < job->n_parts; i++) {
+		if (job->reduce_func && job->parts [i].partial)
+			reduced = job->reduce_func (reduced, job->parts [i].partial,
+			                            job->func_data);
+	}
+
+	if (job->error) {
+		task->error = job->error;
+		job->error = NULL;
+	}
+
+	task->reduced = reduced;
+	foreach_job_free (job);
+
+	if (task->error)
+		storage_task_fail (task);
+	else
+		storage_task_succeed (task);
+}
+
+static void
+handle_set (CatalinaStorage *storage,
+            IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	gboolean                success       = FALSE,
+	                        autocommit;
+	gchar                  *buffer        = NULL;
+	gsize                   buffer_length = 0;
+
+	g_return_if_fail (message->what == MESSAGE_SET);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (IS_META_KEY (task->key, task->key_length)) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NOT_SUPPORTED,
+		             "The key is reserved for the storage metadata");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (task->txn_id != 0 && priv->txn != task->txn_id) {
+		TxnState *txn;
+		if (!(txn = g_hash_table_lookup (priv->txn_state, &task->txn_id))) {
+			g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_NO_SUCH_TXN,
+			             "No such transaction \"%lu\"", task->txn_id);
+			storage_task_fail (task);
+			return;
+		}
+
+		/* use prepend and reverse later */
+		txn->msgs = g_list_prepend (txn->msgs, iris_message_ref (message));
+		return;
+	}
+
+	g_return_if_fail (priv->txn == 0 || priv->txn == task->txn_id);
+
+	/* the transform stage failed, reported once the set is applied in order */
+	if (task->error) {
+		storage_task_fail (task);
+		return;
+	}
+
+	if (priv->transform && !task->transformed) {
+		if (!catalina_transform_write (priv->transform,
+		                               task->data, task->data_length,
+		                               &buffer, &buffer_length,
+		                               &task->error)) {
+			storage_task_fail (task);
+			return;
+		}
+	}
+
+	/* other processes write in between the messages, so each write is its own
+	 * transaction when the data-store is shared */
+	autocommit = priv->shared && priv->txn == 0;
+	if (autocommit && !storage_write_begin (storage, &task->error)) {
+		g_free (buffer);
+		storage_task_fail (task);
+		return;
+	}
+
+	{
+		const gchar *dbuf;
+		gsize        dbuf_length,
+		             old_size = 0;
+		gboolean     existed;
+
+		dbuf = buffer != NULL ? buffer : task->data;
+		dbuf_length = buffer != NULL ? buffer_length : task->data_length;
+
+		storage_snapshots_preserve (storage, task->key, task->key_length);
+		existed = meta_record_size (storage, task->key, task->key_length, &old_size);
+
+		if (catalina_backend_store (priv->backend,
+		                            task->key, task->key_length,
+		                            dbuf, dbuf_length,
+		                            &task->error))
+		{
+			/* writes on other keys may be running, see storage_lane_post() */
+			g_mutex_lock (priv->write_mutex);
+
+			if (existed)
+				priv->meta_bytes -= old_size;
+			else
+				priv->meta_keys++;
+			priv->meta_bytes += dbuf_length;
+			priv->sync_written += dbuf_length;
+
+			storage_indexes_update (storage, task);
+
+			/* transactions persist the metadata once, right before commit */
+			success = (priv->txn != 0) || meta_store (storage, &task->error);
+
+			g_mutex_unlock (priv->write_mutex);
+		}
+	}
+
+	g_free (buffer);
+
+	if (autocommit) {
+		if (!success)
+			catalina_backend_transaction_cancel (priv->backend, NULL);
+		else if (!catalina_backend_transaction_commit (priv->backend, &task->error))
+			success = FALSE;
+	}
+
+	if (success) {
+		storage_compact_check (storage);
+		storage_task_succeed (task);
+	}
+	else
+		storage_task_fail (task);
+}
+
+/* Deletes @key and updates the metadata counters.  A missing key is not an error,
+ * @found is set instead. */
+static gboolean
+storage_delete (CatalinaStorage  *storage,
+                const gchar      *key,
+                gsize             key_length,
+                gboolean         *found,
+                GError          **error)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
+	gsize                   size = 0;
+
+	if (IS_META_KEY (key, key_length) ||
+	    !(*found = meta_record_size (storage, key, key_length, &size)))
+		return TRUE;
+
+	storage_snapshots_preserve (storage, key, key_length);
+
+	if (!catalina_backend_remove (priv->backend, key, key_length, error))
+		return FALSE;
+
+	g_mutex_lock (priv->write_mutex);
+	priv->meta_keys--;
+	priv->meta_bytes -= size;
+	storage_indexes_remove (storage, key, key_length);
+	g_mutex_unlock (priv->write_mutex);
+
+	return TRUE;
+}
+
+static void
+handle_remove (CatalinaStorage *storage,
+               IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	gboolean                found   = FALSE,
+	                        success = TRUE,
+	                        autocommit;
+
+	g_return_if_fail (message->what == MESSAGE_REMOVE);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (task->txn_id != 0 && priv->txn != task->txn_id) {
+		TxnState *txn;
+		if (!(txn = g_hash_table_lookup (priv->txn_state, &task->txn_id))) {
+			g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_NO_SUCH_TXN,
+			             "No such transaction \"%lu\"", task->txn_id);
+			storage_task_fail (task);
+			return;
+		}
+
+		txn->msgs = g_list_prepend (txn->msgs, iris_message_ref (message));
+		return;
+	}
+
+	autocommit = priv->shared && priv->txn == 0;
+	if (autocommit && !storage_write_begin (storage, &task->error)) {
+		storage_task_fail (task);
+		return;
+	}
+
+	if (!storage_delete (storage, task->key, task->key_length, &found, &task->error)) {
+		if (autocommit)
+			catalina_backend_transaction_cancel (priv->backend, NULL);
+		storage_task_fail (task);
+		return;
+	}
+
+	if (!found) {
+		if (autocommit)
+			catalina_backend_transaction_cancel (priv->backend, NULL);
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
+		             "No such key");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (priv->txn == 0) {
+		g_mutex_lock (priv->write_mutex);
+		success = meta_store (storage, &task->error);
+		g_mutex_unlock (priv->write_mutex);
+	}
+
+	if (!success) {
+		if (autocommit)
+			catalina_backend_transaction_cancel (priv->backend, NULL);
+		storage_task_fail (task);
+		return;
+	}
+
+	if (autocommit && !catalina_backend_transaction_commit (priv->backend, &task->error)) {
+		storage_task_fail (task);
+		return;
+	}
+
+	storage_compact_check (storage);
+	storage_task_succeed (task);
+}
+
+typedef struct
+{
+	CatalinaStorage *storage;
+	StorageTask     *task;
+} RemoveWhere;
+
+static gboolean
+handle_remove_where_cb (const gchar *key,
+                        gsize        key_length,
+                        const gchar *value,
+                        gsize        value_length,
+                        gpointer     user_data)
+{
+	RemoveWhere            *state = user_data;
+	StorageTask            *task  = state->task;
+	CatalinaStoragePrivate *priv  = state->storage->priv;
+	CatalinaStorageEntry    entry;
+	gchar                  *buffer        = NULL;
+	gsize                   buffer_length = 0;
+	gboolean                matched;
+
+	if (IS_META_KEY (key, key_length))
+		return TRUE;
+
+	if (priv->transform) {
+		if (!catalina_transform_read (priv->transform,
+		                              value, value_length,
+		                              &buffer, &buffer_length,
+		                              &task->error))
+			return FALSE;
+	}
+
+	if (buffer_length != 0)
+		matched = task->predicate (key, key_length,
+		                           buffer, buffer_length, task->record_data);
+	else
+		matched = task->predicate (key, key_length,
+		                           value, value_length, task->record_data);
+
+	g_free (buffer);
+
+	if (matched) {
+		memset (&entry, 0, sizeof (entry));
+		entry.key = g_memdup (key, key_length);
+		entry.key_length = key_length;
+		g_array_append_val (task->entries, entry);
+	}
+
+	return TRUE;
+}
+
+static void
+handle_remove_bulk (CatalinaStorage *storage,
+                    IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	CatalinaStorageEntry   *entry;
+	RemoveWhere             state;
+	CatalinaDurability      durability;
+	gboolean                success = TRUE,
+	                        found;
+	gulong                  meta_keys;
+	guint64                 meta_bytes;
+	guint                   i;
+
+	g_return_if_fail (message->what == MESSAGE_REMOVE_MANY ||
+	                  message->what == MESSAGE_REMOVE_WHERE);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (G_UNLIKELY (!storage_write_begin (storage, &task->error))) {
+		storage_task_fail (task);
+		return;
+	}
+
+	meta_keys = priv->meta_keys;
+	meta_bytes = priv->meta_bytes;
+	task->size = 0;
+
+	/* the matches are removed once the traversal is done; a backend reading alongside
+	 * its writers cannot write from within its own traversal */
+	if (message->what == MESSAGE_REMOVE_WHERE) {
+		task->entries = g_array_new (FALSE, TRUE, sizeof (CatalinaStorageEntry));
+		state.storage = storage;
+		state.task = task;
+		if (!catalina_backend_traverse (priv->backend, handle_remove_where_cb,
+		                                &state, &task->error)
+		    || task->error)
+			success = FALSE;
+	}
+
+	for (i = 0; success && i < task->entries->len; i++) {
+		entry = &g_array_index (task->entries, CatalinaStorageEntry, i);
+
+		if (!(success = storage_delete (storage, entry->key, entry->key_length,
+		                                &found, &task->error)))
+			break;
+		if (found)
+			task->size++;
+	}
+
+	durability = storage_sync_prepare (storage, CATALINA_DURABILITY_DEFAULT);
+
+	if (!success || !meta_store (storage, &task->error)) {
+		catalina_backend_transaction_cancel (priv->backend, NULL);
+		success = FALSE;
+	}
+	else if (!catalina_backend_transaction_commit (priv->backend, &task->error))
+		success = FALSE;
+
+	if (!success) {
+		priv->meta_keys = meta_keys;
+		priv->meta_bytes = meta_bytes;
+		storage_indexes_reset (storage);
+		task->size = 0;
+		storage_task_fail (task);
+		return;
+	}
+
+	/* the space may have crossed "compact-threshold" all at once */
+	if (task->size > 0)
+		storage_compact_measure (storage);
+
+	storage_sync_succeed (storage, task, durability);
+}
+
+static void
+handle_count_keys (CatalinaStorage *storage,
+                   IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	gulong                  n_keys;
+	guint64                 n_bytes;
+
+	g_return_if_fail (message->what == MESSAGE_COUNT_KEYS);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+	g_value_init (&task->value, G_TYPE_ULONG);
+
+	/* the counters of a shared data-store are only current within a write */
+	if (priv->opened && priv->shared && meta_fetch (storage, &n_keys, &n_bytes)) {
+		g_value_set_ulong (&task->value, n_keys);
+		task->size = n_bytes;
+	}
+	else if (priv->opened) {
+		g_mutex_lock (priv->write_mutex);
+		g_value_set_ulong (&task->value, priv->meta_keys);
+		task->size = priv->meta_bytes;
+		g_mutex_unlock (priv->write_mutex);
+	}
+
+	storage_task_succeed (task);
+}
+
+static void
+handle_txn_begin (CatalinaStorage *storage,
+                  IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	TxnState               *txn;
+
+	g_return_if_fail (message->what == MESSAGE_TXN_BEGIN);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_warning ("Cannot begin transaction, storage not open");
+		storage_task_fail (task);
+	}
+	else {
+		/* use atomic to flush cache line */
+		g_atomic_int_inc ((gint*)&priv->txn_seq);
+		g_value_init (&task->value, G_TYPE_ULONG);
+		g_value_set_ulong (&task->value, priv->txn_seq);
+		txn = txn_state_new (storage, priv->txn_seq);
+		txn->durability = task->durability;
+		task->txn_id = txn->txn_id;
+		g_hash_table_insert (priv->txn_state, &txn->txn_id, txn);
+		storage_task_succeed (task);
+	}
+}
+
+static void
+handle_txn_commit (CatalinaStorage *storage,
+                   IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	TxnState               *txn;
+	CatalinaDurability      durability;
+	gboolean                success = TRUE;
+	gulong                  meta_keys;
+	guint64                 meta_bytes;
+
+	g_return_if_fail (message->what == MESSAGE_TXN_COMMIT);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage not opened");
+		storage_task_fail (task);
+		return;
+	}
+
+	/* coalesce with other commits when group commit is enabled */
+	if (priv->txn_group_size > 1) {
+		txn_group_queue (storage, message);
+		return;
+	}
+
+	/* queue if another transaction is pending */
+	if (priv->txn != 0 && priv->txn != task->txn_id) {
+		priv->txn_commits = g_list_append (priv->txn_commits, iris_message_ref (message));
+		return;
+	}
+
+	/* mark this as our current transaction */
+	priv->txn = task->txn_id;
+
+	/* fail if no txn state was found */
+	if (G_UNLIKELY (!(txn = g_hash_table_lookup (priv->txn_state, &task->txn_id)))) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "No such transaction");
+		storage_task_fail (task);
+		return;
+	}
+
+	/* begin backend transaction */
+	if (G_UNLIKELY (!storage_write_begin (storage, &task->error))) {
+		storage_task_fail (task);
+		return;
+	}
+
+	meta_keys = priv->meta_keys;
+	meta_bytes = priv->meta_bytes;
+
+	/* process all of the transaction operations */
+	if (!txn_state_run (txn, &task->error) || !meta_store (storage, &task->error)) {
+		catalina_backend_transaction_cancel (priv->backend, NULL);
+		success = FALSE;
+	}
+
+	/* commit the backend transaction */
+	durability = storage_sync_prepare (storage, txn->durability);
+	if (success && !catalina_backend_transaction_commit (priv->backend, &task->error))
+		success = FALSE;
+
+	/* roll back the metadata along with the data, the indexes are rebuilt */
+	if (!success) {
+		priv->meta_keys = meta_keys;
+		priv->meta_bytes = meta_bytes;
+		storage_indexes_reset (storage);
+	}
+
+	/* finished with transaction state */
+	g_hash_table_remove (priv->txn_state, &txn->txn_id);
+	priv->txn = 0;
+
+	if (!success) {
+		storage_task_fail (task);
+	}
+	else {
+		storage_sync_succeed (storage, task, durability);
+	}
+
+	/* unref our delivered message. this is done so we can share a code path with the
+	 * non-stored commit message (and the main handler refs it comming in). */
+	iris_message_unref (message);
+
+	/* begin the next pending transaction (tail-recursion) */
+	if (priv->txn_commits) {
+		if ((message = g_list_nth_data (priv->txn_commits, 0)) != NULL) {
+			priv->txn_commits = g_list_remove (priv->txn_commits, message);
+			handle_txn_commit (storage, message);
+		}
+	}
+}
+
+static void
+handle_txn_cancel (CatalinaStorage *storage,
+                   IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	TxnState               *txn;
+
+	g_return_if_fail (message->what == MESSAGE_TXN_CANCEL);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		storage_task_fail (task);
+		return;
+	}
+
+	/* This is an exclusive message.  When this code-path is reached, the transaction has
+	 * either already been completed, or it has not yet to begin being comitted.
+	 */
+
+	if ((txn = g_hash_table_lookup (priv->txn_state, &task->txn_id))) {
+		priv->txn_commits = g_list_remove (priv->txn_commits, txn);
+		g_hash_table_remove (priv->txn_state, &task->txn_id);
+	}
+
+	storage_task_succeed (task);
+}
+
+static void
+handle_txn_flush (CatalinaStorage *storage,
+                  IrisMessage     *message)
+{
+	g_return_if_fail (message->what == MESSAGE_TXN_FLUSH);
+	g_return_if_fail (storage != NULL);
+
+	storage->priv->txn_flush_pending = FALSE;
+	txn_group_flush (storage);
+}
+
+static void
+handle_index_change (CatalinaStorage *storage,
+                     IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	StorageIndex           *index;
+
+	g_return_if_fail (message->what == MESSAGE_INDEX_ADD ||
+	                  message->what == MESSAGE_INDEX_REMOVE);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+	index = storage_index_find (storage, task->key);
+
+	if (message->what == MESSAGE_INDEX_ADD) {
+		if (index) {
+			g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_STATE,
+			             "Index \"%s\" already exists", task->key);
+			storage_task_fail (task);
+			return;
+		}
+
+		index = task->record_data;
+		g_atomic_int_inc (&index->ref_count);
+
+		g_mutex_lock (priv->index_mutex);
+		priv->indexes = g_list_append (priv->indexes, index);
+		g_mutex_unlock (priv->index_mutex);
+
+		if (priv->opened)
+			storage_index_build (storage, index);
+	}
+	else {
+		if (!index) {
+			g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_STATE,
+			             "No such index \"%s\"", task->key);
+			storage_task_fail (task);
+			return;
+		}
+
+		/* a pending build notices this and stops */
+		index->removed = TRUE;
+
+		g_mutex_lock (priv->index_mutex);
+		priv->indexes = g_list_remove (priv->indexes, index);
+		g_mutex_unlock (priv->index_mutex);
+
+		storage_index_unref (index);
+	}
+
+	storage_task_succeed (task);
+}
+
+static gboolean
+handle_index_build_cb (const gchar *key,
+                       gsize        key_length,
+                       const gchar *data,
+                       gsize        data_length,
+                       gpointer     user_data)
+{
+	IndexBuild *build = user_data;
+	GValue      value = {0};
+
+	if (IS_META_KEY (key, key_length))
+		return TRUE;
+
+	build->n_records++;
+
+	if (storage_index_read (build->storage, data, data_length, &value)) {
+		storage_index_put (build->index, key, key_length,
+		                   storage_index_extract (build->storage, build->index, &value));
+		g_value_unset (&value);
+	}
+
+	return TRUE;
+}
+
+static void
+handle_index_build (CatalinaStorage *storage,
+                    IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	IndexBuild             *build;
+	StorageIndex           *index;
+	IrisMessage            *next;
+	GError                 *error = NULL;
+	guint                   n_parts;
+
+	g_return_if_fail (message->what == MESSAGE_INDEX_BUILD);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	build = g_value_get_pointer (iris_message_get_data (message));
+	index = build->index;
+
+	/* the index was dropped, or rebuilt since this build was started */
+	if (index->removed || index->generation != build->generation || !priv->opened)
+		goto finish;
+
+	build->storage = storage;
+	build->n_records = 0;
+	n_parts = catalina_backend_get_n_partitions (priv->backend);
+
+	/* the backend was reorganized, such as a rehash by #CatalinaTdbBackend, so the
+	 * partitions visited so far no longer cover the same records */
+	if (n_parts != build->n_partitions) {
+		build->n_partitions = n_parts;
+		index->partition = 0;
+	}
+
+	while (index->partition < n_parts && build->n_records < STORAGE_INDEX_BATCH) {
+		if (!catalina_backend_traverse_partition (priv->backend, index->partition++,
+		                                          handle_index_build_cb, build,
+		                                          &error))
+		{
+			/* lookups keep scanning until the next rebuild */
+			g_warning ("%s", error->message);
+			g_error_free (error);
+			goto finish;
+		}
+	}
+
+	if (index->partition >= n_parts) {
+		index->ready = TRUE;
+		goto finish;
+	}
+
+	/* requeue behind the requests which arrived while this batch was running so that
+	 * building an index over a large data-store does not stall writers. */
+	next = iris_message_new_data (MESSAGE_INDEX_BUILD, G_TYPE_POINTER, build);
+	iris_port_post (priv->ex_port, next);
+	iris_message_unref (next);
+	return;
+
+finish:
+	storage_index_unref (index);
+	g_slice_free (IndexBuild, build);
+}
+
+static gboolean
+handle_index_lookup_cb (const gchar *key,
+                        gsize        key_length,
+                        const gchar *data,
+                        gsize        data_length,
+                        gpointer     user_data)
+{
+	StorageTask            *task = user_data;
+	CatalinaStoragePrivate *priv = task->storage->priv;
+	CatalinaStorageEntry    entry;
+	IndexDatum             *datum,
+	                        query;
+	GValue                  value = {0};
+
+	if (IS_META_KEY (key, key_length))
+		return TRUE;
+
+	memset (&entry, 0, sizeof (entry));
+
+	if (priv->transform) {
+		if (!catalina_transform_read (priv->transform, data, data_length,
+		                              &entry.data, &entry.data_length,
+		                              &task->error))
+			return FALSE;
+	}
+
+	if (entry.data_length == 0) {
+		g_free (entry.data);
+		entry.data = g_memdup (data, data_length);
+		entry.data_length = data_length;
+	}
+
+	datum = NULL;
+	if (catalina_formatter_deserialize (priv->formatter, &value,
+	                                    entry.data, entry.data_length,
+	                                    NULL))
+	{
+		datum = storage_index_extract (task->storage, task->record_data, &value);
+		g_value_unset (&value);
+	}
+
+	query.data = task->data;
+	query.length = task->data_length;
+
+	if (datum && index_datum_equal (datum, &query)) {
+		entry.key = g_memdup (key, key_length);
+		entry.key_length = key_length;
+		entry.found = TRUE;
+		g_array_append_val (task->entries, entry);
+	}
+	else
+		g_free (entry.data);
+
+	if (datum)
+		index_datum_free (datum);
+
+	return TRUE;
+}
+
+static void
+handle_index_lookup (CatalinaStorage *storage,
+                     IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	StorageIndex           *index;
+	CatalinaStorageEntry    entry;
+	GHashTable             *keys;
+	GHashTableIter          iter;
+	GPtrArray              *matches;
+	IndexDatum             *key,
+	                        query;
+	guint                   i;
+
+	g_return_if_fail (message->what == MESSAGE_INDEX_LOOKUP);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	/* the index list only changes within exclusive handlers */
+	if (!(index = storage_index_find (storage, task->key))) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "No such index \"%s\"", task->key);
+		storage_task_fail (task);
+		return;
+	}
+
+	task->entries = g_array_new (FALSE, TRUE, sizeof (CatalinaStorageEntry));
+
+	/* answer with a scan until the background build has visited every record */
+	if (!index->ready) {
+		task->record_data = index;
+		if (!catalina_backend_traverse (priv->backend, handle_index_lookup_cb, task,
+		                                &task->error) || task->error)
+		{
+			storage_task_fail (task);
+			return;
+		}
+		storage_task_succeed (task);
+		return;
+	}
+
+	query.data = task->data;
+	query.length = task->data_length;
+
+	/* concurrent writers update the index, so the keys are copied out first */
+	matches = g_ptr_array_new ();
+	g_mutex_lock (priv->write_mutex);
+	if ((keys = g_hash_table_lookup (index->entries, &query)) != NULL) {
+		g_hash_table_iter_init (&iter, keys);
+		while (g_hash_table_iter_next (&iter, (gpointer*)&key, NULL))
+			g_ptr_array_add (matches, index_datum_new (g_memdup (key->data, key->length),
+			                                           key->length));
+	}
+	g_mutex_unlock (priv->write_mutex);
+
+	for (i = 0; i < matches->len && !task->error; i++) {
+		key = g_ptr_array_index (matches, i);
+		memset (&entry, 0, sizeof (entry));
+
+		if (!storage_fetch (storage, key->data, key->length,
+		                    &entry.data, &entry.data_length,
+		                    &entry.found, &task->error) || !entry.found)
+			continue;
+
+		entry.key = key->data;
+		entry.key_length = key->length;
+		key->data = NULL;
+		g_array_append_val (task->entries, entry);
+	}
+
+	g_ptr_array_foreach (matches, (GFunc)index_datum_free, NULL);
+	g_ptr_array_free (matches, TRUE);
+
+	if (task->error)
+		storage_task_fail (task);
+	else
+		storage_task_succeed (task);
+}
+
+static void
+handle_compact (CatalinaStorage *storage,
+                IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+
+	g_return_if_fail (message->what == MESSAGE_COMPACT);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	/* completes with the compaction already running, if any */
+	priv->compact_waiters = g_list_prepend (priv->compact_waiters, task);
+
+	if (!priv->compact_running) {
+		priv->compact_running = TRUE;
+		storage_compact_step (storage);
+	}
+}
+
+static void
+handle_compact_step (CatalinaStorage *storage,
+                     IrisMessage     *message)
+{
+	g_return_if_fail (message->what == MESSAGE_COMPACT_STEP);
+	g_return_if_fail (storage != NULL);
+
+	storage_compact_step (storage);
+}
+
+static void
+handle_get_space (CatalinaStorage *storage,
+                  IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	guint64                 free_size = 0;
+
+	g_return_if_fail (message->what == MESSAGE_GET_SPACE);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (!catalina_backend_get_space (priv->backend, &task->size, &free_size)) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NOT_SUPPORTED,
+		             "The backend does not measure its free space");
+		storage_task_fail (task);
+		return;
+	}
+
+	g_value_init (&task->value, G_TYPE_UINT64);
+	g_value_set_uint64 (&task->value, free_size);
+	storage_task_succeed (task);
+}
+
+static void
+handle_snapshot (CatalinaStorage *storage,
+                 IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+
+	g_return_if_fail (message->what == MESSAGE_SNAPSHOT);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (!priv->opened) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage is not currently open");
+		storage_task_fail (task);
+		return;
+	}
+
+	/* the writes of the other processes do not keep versions for the snapshots */
+	if (priv->shared) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NOT_SUPPORTED,
+		             "Snapshots are not supported on a shared data-store");
+		storage_task_fail (task);
+		return;
+	}
+
+	/* lets the snapshot reads run alongside the exclusive handlers from now on;
+	 * nothing else uses the backend while this handler runs */
+	if (!priv->snapshot_reads)
+		priv->snapshot_reads = catalina_backend_set_concurrent (priv->backend, TRUE);
+
+	task->snapshot = storage_snapshot_new (storage);
+	storage_task_succeed (task);
+}
+
+/* Reads a record as of the snapshot.  The writers keep the version of a record for the
+ * snapshot before they first change it, so records without a version kept are still
+ * the same in the data-store. */
+static void
+handle_snapshot_get (CatalinaStorage *storage,
+                     IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	CatalinaSnapshot       *snapshot;
+	StorageTask            *task;
+	IndexDatum              query,
+	                       *version      = NULL;
+	gchar                  *value        = NULL;
+	gsize                   value_length = 0;
+	gboolean                found        = FALSE,
+	                        closed;
+
+	g_return_if_fail (message->what == MESSAGE_SNAPSHOT_GET ||
+	                  message->what == MESSAGE_SNAPSHOT_GET_VALUE);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+	snapshot = task->snapshot;
+
+	if (message->what == MESSAGE_SNAPSHOT_GET_VALUE && !priv->formatter) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "CatalinaStorage is missing a formatter for deserialization");
+		storage_task_fail (task);
+		return;
+	}
+
+	query.data = task->key;
+	query.length = task->key_length;
+
+	g_static_rw_lock_reader_lock (&priv->snapshot_lock);
+	if (!(closed = (snapshot->versions == NULL))) {
+		if (g_hash_table_lookup_extended (snapshot->versions, &query,
+		                                  NULL, (gpointer*)&version))
+		{
+			if ((found = (version != NULL)) == TRUE) {
+				value = g_memdup (version->data, version->length);
+				value_length = version->length;
+			}
+		}
+		else if (!IS_META_KEY (task->key, task->key_length))
+			found = catalina_backend_fetch (priv->backend,
+			                                task->key, task->key_length,
+			                                &value, &value_length);
+	}
+	g_static_rw_lock_reader_unlock (&priv->snapshot_lock);
+
+	if (closed) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Storage was closed since the snapshot was taken");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (!found) {
+		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
+		             "No such key");
+		storage_task_fail (task);
+		return;
+	}
+
+	if (!storage_untransform (storage, value, value_length,
+	                          &task->data, &task->data_length,
+	                          &task->error))
+	{
+		storage_task_fail (task);
+		return;
+	}
+
+	if (message->what == MESSAGE_SNAPSHOT_GET_VALUE) {
+		if (!catalina_formatter_deserialize (priv->formatter, &task->value,
+		                                     task->data, task->data_length,
+		                                     &task->error))
+		{
+			storage_task_fail (task);
+			return;
+		}
+
+		g_free (task->data);
+		task->data = NULL;
+		task->data_length = 0;
+	}
+
+	storage_task_succeed (task);
+}
+
+static void
+handle_compact_check (CatalinaStorage *storage,
+                      IrisMessage     *message)
+{
+	g_return_if_fail (message->what == MESSAGE_COMPACT_CHECK);
+	g_return_if_fail (storage != NULL);
+
+	if (storage->priv->opened)
+		storage_compact_measure (storage);
+}
+
+/* Serializes the value of catalina_storage_set_value_async() and transforms the buffer
+ * of a set on a concurrent worker, then lets the set through to the exclusive port in
+ * the order it was submitted. */
+static void
+handle_set_stage (CatalinaStorage *storage,
+                  IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	CatalinaTransform      *transform;
+	StorageTask            *task;
+	gchar                  *buffer        = NULL;
+	gsize                   buffer_length = 0;
+
+	g_return_if_fail (message->what == MESSAGE_SET);
+	g_return_if_fail (storage != NULL);
+
+	priv = storage->priv;
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (G_VALUE_TYPE (&task->value)) {
+		if (catalina_formatter_serialize (priv->formatter, &task->value,
+		                                  &task->data, &task->data_length,
+		                                  &task->error))
+			task->index_values = storage_indexes_extract (storage, &task->value);
+		g_value_unset (&task->value);
+	}
+
+	if (!task->error && (transform = priv->transform) != NULL &&
+	    catalina_transform_write (transform, task->data, task->data_length,
+	                              &buffer, &buffer_length, &task->error))
+	{
+		g_free (task->data);
+		task->data = buffer;
+		task->data_length = buffer_length;
+		task->transformed = TRUE;
+	}
+
+	if (task->queue)
+		storage_queue_resize (storage, task);
+
+	storage_stage_done (storage, task);
+}
+
+/* Applies a set or remove within its write lane, then starts the next write of the
+ * lane.  Sets pass through here for the transform stage first. */
+static void
+handle_write_concurrent (CatalinaStorage *storage,
+                         IrisMessage     *message)
+{
+	StorageTask *task;
+	guint        lane;
+
+	task = g_value_get_pointer (iris_message_get_data (message));
+
+	if (task->staging) {
+		handle_set_stage (storage, message);
+		return;
+	}
+
+	/* the task is gone once it completes */
+	lane = storage_lane_of (task);
+
+	if (message->what == MESSAGE_SET)
+		handle_set (storage, message);
+	else
+		handle_remove (storage, message);
+
+	storage_lane_done (storage, lane);
+}
+
+static void
+catalina_storage_cn_handle_message (IrisMessage     *message,
+                                    CatalinaStorage *storage)
+{
+	switch (message->what) {
+	case MESSAGE_GET:
+		handle_get (storage, message);
+		break;
+	case MESSAGE_GET_VALUE:
+		handle_get_value (storage, message);
+		break;
+	case MESSAGE_GET_MANY:
+		handle_get_many (storage, message);
+		break;
+	case MESSAGE_GET_WITH_FUNC:
+		handle_get_with_func (storage, message);
+		break;
+	case MESSAGE_CURSOR_NEXT:
+		handle_cursor_next (storage, message);
+		break;
+	case MESSAGE_FOREACH:
+		handle_foreach (storage, message);
+		break;
+	case MESSAGE_FOREACH_PART:
+		handle_foreach_part (storage, message);
+		break;
+	case MESSAGE_SCAN:
+		handle_scan (storage, message);
+		break;
+	case MESSAGE_COUNT_KEYS:
+		handle_count_keys (storage, message);
+		break;
+	case MESSAGE_INDEX_LOOKUP:
+		handle_index_lookup (storage, message);
+		break;
+	case MESSAGE_SET:
+	case MESSAGE_REMOVE:
+		handle_write_concurrent (storage, message);
+		break;
+	case MESSAGE_SNAPSHOT_GET:
+	case MESSAGE_SNAPSHOT_GET_VALUE:
+		handle_snapshot_get (storage, message);
+		break;
+	default:
+		g_warning ("Invalid message sent to storage: %d", message->what);
+	}
+}
+
+static void
+catalina_storage_sn_handle_message (IrisMessage     *message,
+                                    CatalinaStorage *storage)
+{
+	switch (message->what) {
+	case MESSAGE_SNAPSHOT_GET:
+	case MESSAGE_SNAPSHOT_GET_VALUE:
+		handle_snapshot_get (storage, message);
+		break;
+	default:
+		g_warning ("Invalid snapshot message: %d", message->what);
+	}
+}
+
+static void
+catalina_storage_ex_handle_message (IrisMessage     *message,
+                                    CatalinaStorage *storage)
+{
+	/* the commits waiting for a group flush were made before this message */
+	if (storage->priv->txn_group &&
+	    message->what != MESSAGE_TXN_COMMIT &&
+	    message->what != MESSAGE_TXN_FLUSH)
+		txn_group_flush (storage);
+
+	switch (message->what) {
+	case MESSAGE_SET:
+		handle_set (storage, message);
+		break;
+	case MESSAGE_REMOVE:
+		handle_remove (storage, message);
+		break;
+	case MESSAGE_REMOVE_MANY:
+	case MESSAGE_REMOVE_WHERE:
+		handle_remove_bulk (storage, message);
+		break;
+	case MESSAGE_OPEN:
+		handle_open (storage, message);
+		break;
+	case MESSAGE_CLOSE:
+		handle_close (storage, message);
+		break;
+	case MESSAGE_TXN_BEGIN:
+		handle_txn_begin (storage, message);
+		break;
+	case MESSAGE_TXN_COMMIT:
+		handle_txn_commit (storage, iris_message_ref (message));
+		break;
+	case MESSAGE_TXN_CANCEL:
+		handle_txn_cancel (storage, message);
+		break;
+	case MESSAGE_TXN_FLUSH:
+		handle_txn_flush (storage, message);
+		break;
+	case MESSAGE_INDEX_ADD:
+	case MESSAGE_INDEX_REMOVE:
+		handle_index_change (storage, message);
+		break;
+	case MESSAGE_INDEX_BUILD:
+		handle_index_build (storage, message);
+		break;
+	case MESSAGE_COMPACT:
+		handle_compact (storage, message);
+		break;
+	case MESSAGE_COMPACT_STEP:
+		handle_compact_step (storage, message);
+		break;
+	case MESSAGE_GET_SPACE:
+		handle_get_space (storage, message);
+		break;
+	case MESSAGE_COMPACT_CHECK:
+		handle_compact_check (storage, message);
+		break;
+	case MESSAGE_SNAPSHOT:
+		handle_snapshot (storage, message);
+		break;
+	default:
+		g_warning ("Invalid exclusive message: %d", message->what);
+	}
+}
+
+/***************************************************************************
+ *     Storage Tasks - Asynchronous and Synchronous Task Encapsulation     *
+ ***************************************************************************/
+
+StorageTask*
+storage_task_new (CatalinaStorage     *storage,
+                  gboolean             is_async,
+                  GAsyncReadyCallback  callback,
+                  gpointer             user_data,
+                  gpointer             source_tag)
+{
+	StorageTask *task;
+
+	task = g_slice_new0 (StorageTask);
+	task->storage = storage;
+
+	if (!is_async) {
+		/* FIXME: Use IrisFreeList to re-use mutex and cond */
+		task->mutex = g_mutex_new ();
+		task->cond = g_cond_new ();
+		g_mutex_lock (task->mutex);
+	}
+	else {
+		task->result = g_simple_async_result_new (G_OBJECT (storage),
+		                                          callback, user_data,
+		                                          source_tag);
+		g_simple_async_result_set_op_res_gpointer (task->result, task, NULL);
+	}
+
+	return task;
+}
+
+static void
+storage_task_free (StorageTask *task,
+                   gboolean     free_key,
+                   gboolean     free_data)
+{
+	/* FIXME: Use IrisFreeList to re-use mutex and cond */
+	if (task->mutex) {
+		g_mutex_unlock (task->mutex);
+		g_mutex_free (task->mutex);
+	}
+
+	if (task->cond)
+		g_cond_free (task->cond);
+
+	if (G_VALUE_TYPE (&task->value))
+		g_value_unset (&task->value);
+
+	if (task->error)
+		g_error_free (task->error);
+
+	if (free_key)
+		g_free (task->key);
+
+	if (free_data)
+		g_free (task->data);
+
+	if (task->entries)
+		catalina_storage_entries_free (task->entries);
+
+	if (task->index_values)
+		storage_index_updates_free (task->index_values);
+
+	if (task->result)
+		g_object_unref (task->result);
+
+	g_slice_free (StorageTask, task);
+}
+
+static gboolean
+storage_task_wait (StorageTask  *task,
+                   GError      **error)
+{
+	g_cond_wait (task->cond, task->mutex);
+	if (!task->success && task->error && error && *error == NULL)
+		*error = g_error_copy (task->error);
+	return task->success;
+}
+
+static void
+storage_task_complete (StorageTask *task,
+                       gboolean     success)
+{
+	CatalinaStoragePrivate *priv = task->storage->priv;
+
+	task->success = success;
+
+	/* held back until the group commit knows whether the replay is kept */
+	if (task->txn_id != 0 && priv->txn_replay) {
+		priv->txn_replayed = g_list_prepend (priv->txn_replayed, task);
+		return;
+	}
+
+	if (task->mutex) {
+		g_mutex_lock (task->mutex);
+		g_cond_signal (task->cond);
+		g_mutex_unlock (task->mutex);
+	}
+	else if (task->queue)
+		storage_queue_complete (task->storage, task);
+	else {
+		if (task->storage->priv->use_idle)
+			g_simple_async_result_complete_in_idle (task->result);
+		else
+			g_simple_async_result_complete (task->result);
+	}
+}
+
+static void
+storage_task_succeed (StorageTask *task)
+{
+	storage_task_complete (task, TRUE);
+}
+
+static void
+storage_task_fail (StorageTask *task)
+{
+	/* propagate error to transaction if needed */
+	if (task->txn_id != 0 && task->error) {
+		TxnState *txn;
+		if ((txn = g_hash_table_lookup (task->storage->priv->txn_state, &task->txn_id)))
+			txn->error = g_error_copy (task->error);
+	}
+
+	storage_task_complete (task, FALSE);
+}
+
+/***************************************************************************
+ *                           Transaction State                             *
+ ***************************************************************************/
+
+static TxnState*
+txn_state_new (CatalinaStorage *storage,
+               gulong           txn_id)
+{
+	TxnState *state = g_slice_new0 (TxnState);
+	state->txn_id = txn_id;
+	state->storage = storage;
+	state->msgs = NULL;
+	state->error = NULL;
+	return state;
+}
+
+static gboolean
+txn_state_run (TxnState  *txn,
+               GError   **error)
+{
+	GList *iter;
+
+	/* reverse the list as additions were prepends for O(1), a group commit may
+	 * replay it more than once */
+	if (!txn->ordered) {
+		txn->msgs = g_list_reverse (txn->msgs);
+		txn->ordered = TRUE;
+	}
+
+	for (iter = txn->msgs; iter; iter = iter->next) {
+		catalina_storage_ex_handle_message (iter->data, txn->storage);
+		if (txn->error) {
+			if (error && *error == NULL) {
+				*error = txn->error;
+				txn->error = NULL;
+			}
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void
+txn_state_free (TxnState *txn)
+{
+	GList *iter;
+
+	for (iter = txn->msgs; iter; iter = iter->next)
+		iris_message_unref (iter->data);
+	/*if (txn->error)
+		g_error_free (txn->error);*/
+	g_list_free (txn->msgs);
+	g_slice_free (TxnState, txn);
+}
+
+/***************************************************************************
+ *                             Group Commit                                *
+ ***************************************************************************/
+
+static void
+txn_group_queue (CatalinaStorage *storage,
+                 IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv;
+	IrisMessage            *flush;
+
+	priv = storage->priv;
+
+	/* the message was ref'd by the exclusive handler and is released once the
+	 * group containing it has been flushed. */
+	priv->txn_group = g_list_prepend (priv->txn_group, message);
+	priv->txn_group_length++;
+
+	if (priv->txn_group_length >= priv->txn_group_size) {
+		txn_group_flush (storage);
+		return;
+	}
+
+	/* Commits already waiting on the exclusive port are delivered before the flush
+	 * message, so everything that arrived while we were busy lands in one group. */
+	if (!priv->txn_flush_pending) {
+		priv->txn_flush_pending = TRUE;
+		flush = iris_message_new_data (MESSAGE_TXN_FLUSH, G_TYPE_POINTER, NULL);
+		iris_port_post (priv->ex_port, flush);
+		iris_message_unref (flush);
+	}
+}
 
-	g_return_if_fail (CATALINA_IS_STORAGE (storage));
-	g_return_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (storage),
-	                                                      catalina_storage_transaction_cancel_async));
+static void
+txn_group_flush (CatalinaStorage *storage)
+{
+	CatalinaStoragePrivate *priv;
+	GList                  *pending,
+	                       *group,
+	                       *iter;
+	guint                   n;
 
 	priv = storage->priv;
-	task = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result));
 
-	storage_task_free (task, FALSE, FALSE);
+	/* additions were prepends for O(1) */
+	pending = g_list_reverse (priv->txn_group);
+	priv->txn_group = NULL;
+	priv->txn_group_length = 0;
+
+	while (pending) {
+		group = NULL;
+
+		for (n = 0; pending && n < priv->txn_group_size; n++) {
+			iter = pending;
+			pending = g_list_remove_link (pending, iter);
+			group = g_list_concat (iter, group);
+		}
+
+		group = g_list_reverse (group);
+		txn_group_commit (storage, group);
+		g_list_free (group);
+	}
 }
 
-GQuark
-catalina_storage_error_quark (void)
+/* Completes the tasks held back during a replay.  With @txn_id, only those of that
+ * transaction are completed and the others are dropped to be replayed again. */
+static void
+txn_group_complete_replayed (CatalinaStorage *storage,
+                             gulong           txn_id)
 {
-	return g_quark_from_static_string ("catalina-storage-error-quark");
+	CatalinaStoragePrivate *priv = storage->priv;
+	StorageTask            *task;
+	GList                  *replayed,
+	                       *iter;
+
+	replayed = g_list_reverse (priv->txn_replayed);
+	priv->txn_replayed = NULL;
+
+	for (iter = replayed; iter; iter = iter->next) {
+		task = iter->data;
+		if (txn_id == 0 || task->txn_id == txn_id)
+			storage_task_complete (task, task->success);
+	}
+
+	g_list_free (replayed);
+}
+
+static void
+txn_group_commit (CatalinaStorage *storage,
+                  GList           *messages)
+{
+	CatalinaStoragePrivate *priv;
+	StorageTask            *task;
+	TxnState               *txn;
+	GList                  *members = NULL,
+	                       *failed,
+	                       *iter;
+	GError                 *error   = NULL;
+	gboolean                success = FALSE;
+	guint                   n_members;
+	gulong                  meta_keys;
+	guint64                 meta_bytes;
+	CatalinaDurability      durability = CATALINA_DURABILITY_NONE,
+	                        reached;
+
+	priv = storage->priv;
+
+	/* fail commits for unknown transactions up front so they do not
+	 * abort the rest of the group. */
+	for (iter = messages; iter; iter = iter->next) {
+		task = g_value_get_pointer (iris_message_get_data (iter->data));
+
+		if (G_UNLIKELY (!g_hash_table_lookup (priv->txn_state, &task->txn_id))) {
+			g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_STATE,
+			             "No such transaction");
+			storage_task_fail (task);
+			iris_message_unref (iter->data);
+			continue;
+		}
+
+		members = g_list_prepend (members, iter->data);
+	}
+
+	if (!members)
+		return;
+
+	members = g_list_reverse (members);
+	n_members = g_list_length (members);
+
+	/* the group is committed as durably as its most demanding member asks for */
+	for (iter = members; iter; iter = iter->next) {
+		task = g_value_get_pointer (iris_message_get_data (iter->data));
+		txn = g_hash_table_lookup (priv->txn_state, &task->txn_id);
+		task->durability = storage_durability (storage, txn->durability);
+		durability = MAX (durability, task->durability);
+	}
+	reached = storage_sync_prepare (storage, durability);
+
+	/* A member which fails to replay is failed on its own and the others are replayed
+	 * again in a fresh backend transaction, so that one bad transaction does not fail
+	 * commits which would have succeeded.  The writes within the replay complete once
+	 * it is known to be kept. */
+	while (members) {
+		meta_keys = priv->meta_keys;
+		meta_bytes = priv->meta_bytes;
+		failed = NULL;
+
+		if (G_UNLIKELY (!storage_write_begin (storage, &error)))
+			break;
+
+		priv->txn_replay = TRUE;
+
+		/* replay each transaction in commit order */
+		for (iter = members; iter; iter = iter->next) {
+			task = g_value_get_pointer (iris_message_get_data (iter->data));
+			txn = g_hash_table_lookup (priv->txn_state, &task->txn_id);
+			priv->txn = task->txn_id;
+
+			if (!txn_state_run (txn, &task->error)) {
+				failed = iter;
+				break;
+			}
+		}
+
+		priv->txn = 0;
+		priv->txn_replay = FALSE;
+
+		if (!failed && meta_store (storage, &error))
+			success = catalina_backend_transaction_commit (priv->backend, &error);
+		else
+			catalina_backend_transaction_cancel (priv->backend, NULL);
+
+		if (success)
+			break;
+
+		/* roll back the metadata along with the data, the indexes are rebuilt */
+		priv->meta_keys = meta_keys;
+		priv->meta_bytes = meta_bytes;
+		storage_indexes_reset (storage);
+
+		if (!failed)
+			break;
+
+		/* drop the failed member and replay the rest without it */
+		task = g_value_get_pointer (iris_message_get_data (failed->data));
+		txn_group_complete_replayed (storage, task->txn_id);
+		g_hash_table_remove (priv->txn_state, &task->txn_id);
+		storage_task_fail (task);
+		iris_message_unref (failed->data);
+		members = g_list_delete_link (members, failed);
+	}
+
+	txn_group_complete_replayed (storage, 0);
+
+	/* fan the result back out to each committer */
+	for (iter = members; iter; iter = iter->next) {
+		task = g_value_get_pointer (iris_message_get_data (iter->data));
+		g_hash_table_remove (priv->txn_state, &task->txn_id);
+
+		if (success)
+			storage_sync_succeed (storage, task,
+			                      reached == CATALINA_DURABILITY_COMMIT ?
+			                          reached : task->durability);
+		else {
+			if (!task->error)
+				task->error = g_error_copy (error);
+			storage_task_fail (task);
+		}
+
+		iris_message_unref (iter->data);
+	}
+
+	priv->txn_group_count++;
+	priv->txn_group_commits += n_members;
+	if (n_members > priv->txn_group_largest)
+		priv->txn_group_largest = n_members;
+
+	if (error)
+		g_error_free (error);
+	g_list_free (members);
 }
 
 /***************************************************************************
- *               Asynchronous Message Handlers for Iris                    *
+ *                          Parallel Traversal                             *
  ***************************************************************************/
 
 static void
-handle_open (CatalinaStorage *storage,
-             IrisMessage     *message)
+foreach_job_free (ForeachJob *job)
+{
+	job->task->foreach = NULL;
+	if (job->error)
+		g_error_free (job->error);
+	g_mutex_free (job->mutex);
+	g_free (job->parts);
+	g_slice_free (ForeachJob, job);
+}
+
+/***************************************************************************
+ *                               Metadata                                  *
+ ***************************************************************************/
+
+/* Looks up the stored size of @key without copying the record.  Returns %TRUE
+ * if the record exists. */
+static gboolean
+meta_record_size (CatalinaStorage *storage,
+                  const gchar     *key,
+                  gsize            key_length,
+                  gsize           *size)
+{
+	return catalina_backend_size (storage->priv->backend, key, key_length, size);
+}
+
+static gboolean
+meta_load_cb (const gchar *key,
+              gsize        key_length,
+              const gchar *value,
+              gsize        value_length,
+              gpointer     user_data)
+{
+	CatalinaStoragePrivate *priv = user_data;
+
+	if (!IS_META_KEY (key, key_length)) {
+		priv->meta_keys++;
+		priv->meta_bytes += value_length;
+	}
+
+	return TRUE;
+}
+
+/* Reads the counters from the metadata record, without touching the cached ones.
+ * Counters left by a data-store that was not closed cleanly are not returned. */
+static gboolean
+meta_fetch (CatalinaStorage *storage,
+            gulong          *n_keys,
+            guint64         *n_bytes)
+{
+	gchar    *value        = NULL;
+	gsize     value_length = 0;
+	guint64   record [4];
+	gboolean  found        = FALSE;
+
+	if (catalina_backend_fetch (storage->priv->backend, META_KEY, META_KEY_LENGTH,
+	                            &value, &value_length)
+	    && value_length == sizeof (record))
+	{
+		memcpy (record, value, sizeof (record));
+		if (GUINT64_FROM_BE (record [0]) == META_VERSION &&
+		    !(GUINT64_FROM_BE (record [3]) & META_DIRTY))
+		{
+			*n_keys = GUINT64_FROM_BE (record [1]);
+			*n_bytes = GUINT64_FROM_BE (record [2]);
+			found = TRUE;
+		}
+	}
+
+	g_free (value);
+
+	return found;
+}
+
+static gboolean
+meta_load (CatalinaStorage  *storage,
+           GError          **error)
 {
 	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	TDB_CONTEXT            *db_ctx;
-	gchar                  *dir;
-	gint                    tdb_flags,
-				o_flags;
 
-	g_return_if_fail (storage != NULL);
-	g_return_if_fail (message != NULL && message->what == MESSAGE_OPEN);
+	priv = storage->priv;
+	priv->meta_keys = 0;
+	priv->meta_bytes = 0;
+
+	if (meta_fetch (storage, &priv->meta_keys, &priv->meta_bytes))
+		return TRUE;
+
+	/* data-stores created before the metadata record existed, or not closed
+	 * cleanly, need a single traversal to seed the counters. */
+	priv->meta_keys = 0;
+	priv->meta_bytes = 0;
+	if (!catalina_backend_traverse (priv->backend, meta_load_cb, priv, error))
+		return FALSE;
+
+	return meta_store (storage, error);
+}
+
+static gboolean
+meta_store (CatalinaStorage  *storage,
+            GError          **error)
+{
+	CatalinaStoragePrivate *priv;
+	guint64                 record [4];
 
 	priv = storage->priv;
-	task = g_value_get_pointer (iris_message_get_data (message));
 
-	if (priv->db_ctx) {
-		/* already open, throw error */
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "Storage already opened");
-		storage_task_fail (task);
+	record [0] = GUINT64_TO_BE (META_VERSION);
+	record [1] = GUINT64_TO_BE ((guint64)priv->meta_keys);
+	record [2] = GUINT64_TO_BE (priv->meta_bytes);
+	record [3] = GUINT64_TO_BE (priv->meta_dirty ? META_DIRTY : 0);
+
+	return catalina_backend_store (priv->backend, META_KEY, META_KEY_LENGTH,
+	                               (gchar*)record, sizeof (record), error);
+}
+
+/* Starts the backend transaction of a write.  When the data-store is shared, it also
+ * keeps out the writers of other processes until the commit, and the counters they
+ * may have changed since the last write are reloaded within it. */
+static gboolean
+storage_write_begin (CatalinaStorage  *storage,
+                     GError          **error)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
+
+	if (!catalina_backend_transaction_begin (priv->backend, error))
+		return FALSE;
+
+	if (priv->shared && !meta_load (storage, error)) {
+		catalina_backend_transaction_cancel (priv->backend, NULL);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/***************************************************************************
+ *                           Secondary Indexes                             *
+ ***************************************************************************/
+
+static guint
+index_datum_hash (gconstpointer data)
+{
+	const IndexDatum *datum = data;
+	guint             hash  = 5381;
+	gsize             i;
+
+	for (i = 0; i < datum->length; i++)
+		hash = (hash << 5) + hash + (guchar)datum->data [i];
+
+	return hash;
+}
+
+static gboolean
+index_datum_equal (gconstpointer a,
+                   gconstpointer b)
+{
+	const IndexDatum *da = a,
+	                 *db = b;
+
+	return da->length == db->length && memcmp (da->data, db->data, da->length) == 0;
+}
+
+static IndexDatum*
+index_datum_new (gchar *data,
+                 gsize  length)
+{
+	IndexDatum *datum = g_slice_new (IndexDatum);
+	datum->data = data;
+	datum->length = length;
+	return datum;
+}
+
+static void
+index_datum_free (IndexDatum *datum)
+{
+	g_free (datum->data);
+	g_slice_free (IndexDatum, datum);
+}
+
+static StorageIndex*
+storage_index_new (const gchar       *name,
+                   const gchar       *property,
+                   CatalinaIndexFunc  func,
+                   gpointer           func_data,
+                   GDestroyNotify     func_notify)
+{
+	StorageIndex *index;
+
+	index = g_slice_new0 (StorageIndex);
+	index->ref_count = 1;
+	index->name = g_strdup (name);
+	index->property = g_strdup (property);
+	index->func = func;
+	index->func_data = func_data;
+	index->func_notify = func_notify;
+
+	/* the key sets borrow their keys from the reverse table */
+	index->entries = g_hash_table_new_full (index_datum_hash, index_datum_equal,
+	                                        (GDestroyNotify)index_datum_free,
+	                                        (GDestroyNotify)g_hash_table_destroy);
+	index->reverse = g_hash_table_new_full (index_datum_hash, index_datum_equal,
+	                                        (GDestroyNotify)index_datum_free,
+	                                        (GDestroyNotify)index_datum_free);
+
+	return index;
+}
+
+static void
+storage_index_unref (StorageIndex *index)
+{
+	if (!g_atomic_int_dec_and_test (&index->ref_count))
 		return;
+
+	if (index->func_notify)
+		index->func_notify (index->func_data);
+
+	g_hash_table_destroy (index->entries);
+	g_hash_table_destroy (index->reverse);
+	g_free (index->name);
+	g_free (index->property);
+	g_slice_free (StorageIndex, index);
+}
+
+static StorageIndex*
+storage_index_find (CatalinaStorage *storage,
+                    const gchar     *name)
+{
+	GList *iter;
+
+	for (iter = storage->priv->indexes; iter; iter = iter->next)
+		if (g_str_equal (((StorageIndex*)iter->data)->name, name))
+			return iter->data;
+
+	return NULL;
+}
+
+/* Reads the indexed value out of @value and serializes it with the storage's
+ * formatter so that it can be compared bytewise.  Returns %NULL if the record is
+ * not indexed. */
+static IndexDatum*
+storage_index_extract (CatalinaStorage *storage,
+                       StorageIndex    *index,
+                       const GValue    *value)
+{
+	CatalinaFormatter *formatter;
+	GParamSpec        *pspec;
+	GObject           *object;
+	GValue             index_value   = {0};
+	gchar             *buffer        = NULL;
+	gsize              buffer_length = 0;
+	gboolean           success;
+
+	if (!(formatter = storage->priv->formatter))
+		return NULL;
+
+	if (index->property) {
+		if (!G_VALUE_HOLDS_OBJECT (value) || !(object = g_value_get_object (value)))
+			return NULL;
+
+		pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (object),
+		                                      index->property);
+		if (!pspec || !(pspec->flags & G_PARAM_READABLE))
+			return NULL;
+
+		g_value_init (&index_value, pspec->value_type);
+		g_object_get_property (object, index->property, &index_value);
+	}
+	else if (!index->func (value, &index_value, index->func_data)) {
+		if (G_VALUE_TYPE (&index_value))
+			g_value_unset (&index_value);
+		return NULL;
 	}
 
-	/* make sure the containing directory exists */
-	dir = g_path_get_dirname (task->key);
-	if (!g_file_test (dir, G_FILE_TEST_IS_DIR))
-		g_mkdir_with_parents (dir, 0755);
-	g_free (dir);
+	if (!G_VALUE_TYPE (&index_value))
+		return NULL;
 
-	/* clear any pending txn data */
-	priv->txn = 0;
-	if (priv->txn_commits) {
-		g_list_foreach (priv->txn_commits, (GFunc)txn_state_free, NULL);
-		g_list_free (priv->txn_commits);
-		priv->txn_commits = NULL;
+	success = catalina_formatter_serialize (formatter, &index_value,
+	                                        &buffer, &buffer_length,
+	                                        NULL);
+	g_value_unset (&index_value);
+
+	return success ? index_datum_new (buffer, buffer_length) : NULL;
+}
+
+/* Points @key at @value within @index, replacing the previous value.  A %NULL
+ * @value drops @key from the index.  Takes ownership of @value. */
+static void
+storage_index_put (StorageIndex *index,
+                   const gchar  *key,
+                   gsize         key_length,
+                   IndexDatum   *value)
+{
+	IndexDatum  lookup,
+	           *old_key,
+	           *old_value,
+	           *new_key;
+	GHashTable *keys;
+
+	lookup.data = (gchar*)key;
+	lookup.length = key_length;
+
+	if (g_hash_table_lookup_extended (index->reverse, &lookup,
+	                                  (gpointer*)&old_key, (gpointer*)&old_value))
+	{
+		if (value && index_datum_equal (value, old_value)) {
+			index_datum_free (value);
+			return;
+		}
+
+		if ((keys = g_hash_table_lookup (index->entries, old_value)) != NULL) {
+			g_hash_table_remove (keys, old_key);
+			if (g_hash_table_size (keys) == 0)
+				g_hash_table_remove (index->entries, old_value);
+		}
+
+		g_hash_table_remove (index->reverse, &lookup);
+	}
+
+	if (!value)
+		return;
+
+	new_key = index_datum_new (g_memdup (key, key_length), key_length);
+
+	if (!(keys = g_hash_table_lookup (index->entries, value))) {
+		keys = g_hash_table_new (index_datum_hash, index_datum_equal);
+		g_hash_table_insert (index->entries,
+		                     index_datum_new (g_memdup (value->data, value->length),
+		                                      value->length),
+		                     keys);
+	}
+
+	g_hash_table_insert (keys, new_key, new_key);
+	g_hash_table_insert (index->reverse, new_key, value);
+}
+
+/* Deserializes a record as stored by the backend. */
+static gboolean
+storage_index_read (CatalinaStorage *storage,
+                    const gchar     *data,
+                    gsize            data_length,
+                    GValue          *value)
+{
+	CatalinaStoragePrivate *priv          = storage->priv;
+	gchar                  *buffer        = NULL;
+	gsize                   buffer_length = 0;
+	gboolean                success;
+
+	if (!priv->formatter)
+		return FALSE;
+
+	if (priv->transform) {
+		if (!catalina_transform_read (priv->transform, data, data_length,
+		                              &buffer, &buffer_length, NULL))
+			return FALSE;
+	}
+
+	if (buffer_length != 0)
+		success = catalina_formatter_deserialize (priv->formatter, value,
+		                                          buffer, buffer_length, NULL);
+	else
+		success = catalina_formatter_deserialize (priv->formatter, value,
+		                                          (gchar*)data, data_length, NULL);
+
+	g_free (buffer);
+
+	return success;
+}
+
+static void
+storage_index_clear (StorageIndex *index)
+{
+	g_hash_table_remove_all (index->entries);
+	g_hash_table_remove_all (index->reverse);
+	index->ready = FALSE;
+	index->generation++;
+	index->partition = 0;
+}
+
+/* Starts a background build of @index, abandoning any build in progress.  The
+ * build runs a batch of partitions at a time on the exclusive port. */
+static void
+storage_index_build (CatalinaStorage *storage,
+                     StorageIndex    *index)
+{
+	IndexBuild  *build;
+	IrisMessage *message;
+
+	storage_index_clear (index);
+
+	/* the writes of other processes never reach the index, lookups traverse instead */
+	if (storage->priv->shared)
+		return;
+
+	build = g_slice_new0 (IndexBuild);
+	build->index = index;
+	build->generation = index->generation;
+	g_atomic_int_inc (&index->ref_count);
+
+	message = iris_message_new_data (MESSAGE_INDEX_BUILD, G_TYPE_POINTER, build);
+	iris_port_post (storage->priv->ex_port, message);
+	iris_message_unref (message);
+}
+
+/* Extracts the value of each index from @value within the calling thread, before
+ * the request is queued, so that the exclusive handler does not need to deserialize
+ * the record again. */
+static GSList*
+storage_indexes_extract (CatalinaStorage *storage,
+                         const GValue    *value)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
+	IndexUpdate            *update;
+	GSList                 *updates = NULL;
+	GList                  *indexes = NULL,
+	                       *iter;
+
+	g_mutex_lock (priv->index_mutex);
+	for (iter = priv->indexes; iter; iter = iter->next) {
+		g_atomic_int_inc (&((StorageIndex*)iter->data)->ref_count);
+		indexes = g_list_prepend (indexes, iter->data);
+	}
+	g_mutex_unlock (priv->index_mutex);
+
+	for (iter = indexes; iter; iter = iter->next) {
+		update = g_slice_new (IndexUpdate);
+		update->index = iter->data;
+		update->value = storage_index_extract (storage, update->index, value);
+		updates = g_slist_prepend (updates, update);
+	}
+
+	g_list_free (indexes);
+
+	return updates;
+}
+
+static void
+storage_index_updates_free (GSList *updates)
+{
+	IndexUpdate *update;
+	GSList      *iter;
+
+	for (iter = updates; iter; iter = iter->next) {
+		update = iter->data;
+		if (update->value)
+			index_datum_free (update->value);
+		storage_index_unref (update->index);
+		g_slice_free (IndexUpdate, update);
+	}
+
+	g_slist_free (updates);
+}
+
+/* Applies a stored record to each index.  Indexes without a value extracted by
+ * set_value, such as those added after the request was queued or records stored as
+ * raw buffers, deserialize the record instead. */
+static void
+storage_indexes_update (CatalinaStorage *storage,
+                        StorageTask     *task)
+{
+	CatalinaStoragePrivate *priv   = storage->priv;
+	StorageIndex           *index;
+	IndexUpdate            *update;
+	GList                  *iter;
+	GSList                 *liter;
+	GValue                  value  = {0};
+	gboolean                failed = FALSE;
+
+	if (priv->shared)
+		return;
+
+	for (iter = priv->indexes; iter; iter = iter->next) {
+		index = iter->data;
+
+		for (liter = task->index_values; liter; liter = liter->next)
+			if (((IndexUpdate*)liter->data)->index == index)
+				break;
+
+		if (liter) {
+			update = liter->data;
+			storage_index_put (index, task->key, task->key_length, update->value);
+			update->value = NULL;
+			continue;
+		}
+
+		if (!G_VALUE_TYPE (&value) && !failed)
+			failed = !priv->formatter ||
+			         !catalina_formatter_deserialize (priv->formatter, &value,
+			                                          task->data, task->data_length,
+			                                          NULL);
+
+		storage_index_put (index, task->key, task->key_length,
+		                   failed ? NULL : storage_index_extract (storage, index, &value));
 	}
-	g_hash_table_remove_all (priv->txn_state);
 
-	/* always store in big-endian */
-	tdb_flags  = (G_BYTE_ORDER == G_LITTLE_ENDIAN) ? TDB_CONVERT : 0;
-	tdb_flags |= TDB_NOLOCK;
+	if (G_VALUE_TYPE (&value))
+		g_value_unset (&value);
+}
 
-	if (!g_file_test (task->key, G_FILE_TEST_IS_REGULAR))
-		o_flags = O_CREAT;
+static void
+storage_indexes_remove (CatalinaStorage *storage,
+                        const gchar     *key,
+                        gsize            key_length)
+{
+	GList *iter;
 
-	if (!(db_ctx = tdb_open (task->key, 0, tdb_flags, o_flags | O_RDWR, 0755))) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_DB,
-		             "Could not open the database");
-		storage_task_fail (task);
+	if (storage->priv->shared)
 		return;
-	}
 
-	priv->db_ctx = db_ctx;
-	task->success = TRUE;
-	storage_task_succeed (task);
+	for (iter = storage->priv->indexes; iter; iter = iter->next)
+		storage_index_put (iter->data, key, key_length, NULL);
 }
 
+/* Rebuilds every index from the data-store, used after opening it and when a
+ * failed commit leaves the indexes ahead of the data. */
 static void
-handle_close (CatalinaStorage *storage,
-              IrisMessage     *message)
+storage_indexes_reset (CatalinaStorage *storage)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gint                    ret;
+	GList *iter;
 
-	g_return_if_fail (message->what == MESSAGE_CLOSE);
-	g_return_if_fail (CATALINA_IS_STORAGE (storage));
+	for (iter = storage->priv->indexes; iter; iter = iter->next)
+		storage_index_build (storage, iter->data);
+}
 
-	priv = storage->priv;
-	task = g_value_get_pointer (iris_message_get_data (message));
+static void
+storage_indexes_clear (CatalinaStorage *storage)
+{
+	GList *iter;
 
-	if (!priv->db_ctx) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "Storage is not currently open");
-		storage_task_fail (task);
-		return;
-	}
+	for (iter = storage->priv->indexes; iter; iter = iter->next)
+		storage_index_clear (iter->data);
+}
 
-	if (priv->txn || g_hash_table_size (priv->txn_state) > 0) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "Storage has pending transactions, please cancel or commit them "
-		             "before closing the storage");
-		storage_task_fail (task);
-		return;
-	}
+/***************************************************************************
+ *                               Compaction                                *
+ ***************************************************************************/
 
-	if ((ret = tdb_close (priv->db_ctx)) != 0) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "There was an error closing the storage: (%d)",
-		             ret);
-		storage_task_fail (task);
+#define COMPACT_MIN_SIZE       (1 << 20)
+#define COMPACT_CHECK_INTERVAL 256
+
+/* Starts a compaction in the background unless one is running already. */
+static void
+storage_compact_start (CatalinaStorage *storage)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
+	IrisMessage            *message;
+
+	if (priv->compact_running)
 		return;
-	}
 
-	priv->db_ctx = NULL;
-	task->success = TRUE;
-	storage_task_succeed (task);
+	priv->compact_running = TRUE;
+
+	message = iris_message_new_data (MESSAGE_COMPACT_STEP, G_TYPE_POINTER, NULL);
+	iris_port_post (priv->ex_port, message);
+	iris_message_unref (message);
 }
 
+/* Starts a compaction once the free space crosses "compact-threshold".  The space is
+ * only measured every few writes so that measuring it does not cost every write. */
 static void
-handle_get (CatalinaStorage *storage,
-            IrisMessage     *message)
+storage_compact_check (CatalinaStorage *storage)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	gboolean                success       = FALSE;
-	gchar                  *buffer        = NULL;
-	gsize                   buffer_length = 0;
+	CatalinaStoragePrivate *priv = storage->priv;
+	IrisMessage            *message;
 
-	g_return_if_fail (message->what == MESSAGE_GET);
-	g_return_if_fail (storage != NULL);
+	if (priv->compact_threshold <= 0.0 || priv->compact_running)
+		return;
 
-	priv = storage->priv;
-	task = g_value_get_pointer (iris_message_get_data (message));
+	if (g_atomic_int_exchange_and_add (&priv->compact_writes, 1) != COMPACT_CHECK_INTERVAL - 1)
+		return;
 
-	if (!priv->db_ctx) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "Storage is not currently open");
-		storage_task_fail (task);
+	g_atomic_int_set (&priv->compact_writes, 0);
+
+	/* the space is not measured alongside concurrent writes */
+	if (priv->concurrent) {
+		message = iris_message_new_data (MESSAGE_COMPACT_CHECK, G_TYPE_POINTER, NULL);
+		storage_ex_post (storage, message);
+		iris_message_unref (message);
 		return;
 	}
 
-	{
-		TDB_DATA db_key,
-		         db_value;
-
-		bzero (&db_key, sizeof (db_key));
-		bzero (&db_value, sizeof (db_value));
+	storage_compact_measure (storage);
+}
 
-		db_key.dptr = (guchar*)task->key;
-		db_key.dsize = task->key_length;
+static void
+storage_compact_measure (CatalinaStorage *storage)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
+	guint64                 size,
+	                        free_size;
 
-		db_value = tdb_fetch (priv->db_ctx, db_key);
+	if (priv->compact_threshold <= 0.0 || priv->compact_running)
+		return;
 
-		if (!db_value.dptr) {
-			g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-			             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
-			             "%s", tdb_errorstr (priv->db_ctx));
-		}
-		else {
-			if (priv->transform) {
-				if (catalina_transform_read (priv->transform,
-				                             (gchar*)db_value.dptr, db_value.dsize,
-				                             &buffer, &buffer_length,
-				                             &task->error))
-				{
-					if (buffer_length == 0)
-						goto copy;
-					success = TRUE;
-					task->data = buffer;
-					task->data_length = buffer_length;
-					g_free (db_value.dptr);
-				}
-			}
-			else {
-			copy:
-				success = TRUE;
-				task->data = (gchar*)db_value.dptr;
-				task->data_length = db_value.dsize;
-			}
-		}
-	}
+	if (!catalina_backend_get_space (priv->backend, &size, &free_size))
+		return;
 
-	if (success)
-		storage_task_succeed (task);
-	else
-		storage_task_fail (task);
+	if (size >= COMPACT_MIN_SIZE && free_size >= size * priv->compact_threshold)
+		storage_compact_start (storage);
 }
 
+/* Runs one slice of the compaction, queuing the next one behind the requests which
+ * arrived meanwhile, and completes the waiting requests once it is done. */
 static void
-handle_set (CatalinaStorage *storage,
-            IrisMessage     *message)
+storage_compact_step (CatalinaStorage *storage)
 {
-	CatalinaStoragePrivate *priv;
+	CatalinaStoragePrivate *priv = storage->priv;
+	IrisMessage            *message;
 	StorageTask            *task;
-	gboolean                success       = FALSE;
-	gchar                  *buffer        = NULL;
-	gsize                   buffer_length = 0;
-
-	g_return_if_fail (message->what == MESSAGE_SET);
-	g_return_if_fail (storage != NULL);
-
-	priv = storage->priv;
-	task = g_value_get_pointer (iris_message_get_data (message));
+	GError                 *error = NULL;
+	GList                  *iter;
+	gboolean                success,
+	                        done = FALSE;
 
-	if (!priv->db_ctx) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+	if (!priv->opened) {
+		g_set_error (&error, CATALINA_STORAGE_ERROR,
 		             CATALINA_STORAGE_ERROR_STATE,
-		             "Storage is not currently open");
-		storage_task_fail (task);
-		return;
+		             "Storage was closed during compaction");
+		success = FALSE;
 	}
+	else
+		success = catalina_backend_compact_step (priv->backend, &done, &error);
 
-	if (task->txn_id != 0 && priv->txn != task->txn_id) {
-		TxnState *txn;
-		if (!(txn = g_hash_table_lookup (priv->txn_state, &task->txn_id))) {
-			g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-			             CATALINA_STORAGE_ERROR_NO_SUCH_TXN,
-			             "No such transaction \"%lu\"", task->txn_id);
-			storage_task_fail (task);
-			return;
-		}
-
-		/* use prepend and reverse later */
-		txn->msgs = g_list_prepend (txn->msgs, iris_message_ref (message));
+	if (success && !done) {
+		message = iris_message_new_data (MESSAGE_COMPACT_STEP, G_TYPE_POINTER, NULL);
+		iris_port_post (priv->ex_port, message);
+		iris_message_unref (message);
 		return;
 	}
 
-	g_return_if_fail (priv->txn == 0 || priv->txn == task->txn_id);
+	priv->compact_running = FALSE;
+	g_atomic_int_set (&priv->compact_writes, 0);
 
-	if (priv->transform) {
-		if (!catalina_transform_write (priv->transform,
-		                               task->data, task->data_length,
-		                               &buffer, &buffer_length,
-		                               &task->error)) {
+	if (!success && !priv->compact_waiters)
+		g_warning ("%s", error->message);
+
+	for (iter = priv->compact_waiters; iter; iter = iter->next) {
+		task = iter->data;
+		if (success)
+			storage_task_succeed (task);
+		else {
+			task->error = g_error_copy (error);
 			storage_task_fail (task);
-			return;
 		}
 	}
 
-	{
-		TDB_DATA key,
-			 dbuf;
-		gint     flags = 0,
-		         ret;
-
-		bzero (&key, sizeof (key));
-		bzero (&dbuf, sizeof (dbuf));
-
-		key.dptr = (guchar*)task->key;
-		key.dsize = task->key_length;
-		dbuf.dptr = (guchar*)(buffer != NULL ? buffer : task->data);
-		dbuf.dsize = buffer != NULL ? buffer_length : task->data_length;
-
-		flags = TDB_REPLACE;
+	g_list_free (priv->compact_waiters);
+	priv->compact_waiters = NULL;
 
-		if ((ret = tdb_store (priv->db_ctx, key, dbuf, flags)) != 0) {
-			g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-			             CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
-			             "tdb_store: %s",
-			             tdb_errorstr (priv->db_ctx));
-		}
-		else {
-			success = TRUE;
-		}
-	}
+	if (error)
+		g_error_free (error);
+}
 
-	g_free (buffer);
+/***************************************************************************
+ *                               Durability                                *
+ ***************************************************************************/
 
-	if (success)
-		storage_task_succeed (task);
-	else
-		storage_task_fail (task);
+/* Resolves %CATALINA_DURABILITY_DEFAULT to the "durability" of the storage. */
+static CatalinaDurability
+storage_durability (CatalinaStorage    *storage,
+                    CatalinaDurability  durability)
+{
+	if (durability == CATALINA_DURABILITY_DEFAULT)
+		return storage->priv->durability;
+	return durability;
 }
 
-static gint
-handle_count_keys_cb (TDB_CONTEXT *context,
-                      TDB_DATA     key,
-                      TDB_DATA     value,
-                      gpointer     user_data)
+/* Sets up the backend for the next commit to reach @durability, returning the
+ * durability the commit itself provides. */
+static CatalinaDurability
+storage_sync_prepare (CatalinaStorage    *storage,
+                      CatalinaDurability  durability)
 {
-	gulong *count = user_data;
-	(*count)++;
-	return 0;
+	durability = storage_durability (storage, durability);
+
+	if (!catalina_backend_set_sync (storage->priv->backend,
+	                                durability == CATALINA_DURABILITY_COMMIT))
+		return CATALINA_DURABILITY_COMMIT;
+
+	return durability;
 }
 
 static void
-handle_count_keys (CatalinaStorage *storage,
-                   IrisMessage     *message)
+storage_sync_complete (CatalinaStorage *storage,
+                       GList           *waiters)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-
-	g_return_if_fail (message->what == MESSAGE_COUNT_KEYS);
-	g_return_if_fail (storage != NULL);
+	StorageTask *task;
+	GError      *error = NULL;
+	GList       *iter;
+	gboolean     success;
 
-	priv = storage->priv;
-	task = g_value_get_pointer (iris_message_get_data (message));
-	g_value_init (&task->value, G_TYPE_ULONG);
+	success = catalina_backend_sync (storage->priv->backend, &error);
 
-	if (priv->db_ctx) {
-		gulong count = 0;
-		tdb_traverse (priv->db_ctx, handle_count_keys_cb, &count);
-		g_value_set_ulong (&task->value, count);
+	for (iter = waiters; iter; iter = iter->next) {
+		task = iter->data;
+		if (success)
+			storage_task_succeed (task);
+		else {
+			task->error = g_error_copy (error);
+			storage_task_fail (task);
+		}
 	}
 
-	storage_task_succeed (task);
+	if (error)
+		g_error_free (error);
 }
 
-static void
-handle_txn_begin (CatalinaStorage *storage,
-                  IrisMessage     *message)
+/* Syncs the commits waiting on it once per "sync-interval", or sooner if "sync-bytes"
+ * are waiting.  The sync runs outside of the exclusive worker, which keeps committing
+ * meanwhile; the commits made during a sync wait for the next one. */
+static gpointer
+storage_sync_thread (gpointer data)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	TxnState               *txn;
-
-	g_return_if_fail (message->what == MESSAGE_TXN_BEGIN);
-	g_return_if_fail (storage != NULL);
+	CatalinaStorage        *storage = data;
+	CatalinaStoragePrivate *priv = storage->priv;
+	GTimeVal                deadline;
+	GList                  *waiters;
+	gboolean                stop;
+
+	g_mutex_lock (priv->sync_mutex);
+
+	for (;;) {
+		while (!priv->sync_waiters && !priv->sync_stop)
+			g_cond_wait (priv->sync_cond, priv->sync_mutex);
+
+		/* gather the commits arriving within the interval into this sync */
+		g_get_current_time (&deadline);
+		g_time_val_add (&deadline, (glong)priv->sync_interval * 1000);
+		while (!priv->sync_stop && !priv->sync_wake)
+			if (!g_cond_timed_wait (priv->sync_cond, priv->sync_mutex, &deadline))
+				break;
+
+		waiters = g_list_reverse (priv->sync_waiters);
+		priv->sync_waiters = NULL;
+		priv->sync_pending = 0;
+		priv->sync_wake = FALSE;
+		stop = priv->sync_stop;
+
+		g_mutex_unlock (priv->sync_mutex);
+
+		if (waiters) {
+			storage_sync_complete (storage, waiters);
+			g_list_free (waiters);
+		}
 
-	priv = storage->priv;
-	task = g_value_get_pointer (iris_message_get_data (message));
+		g_mutex_lock (priv->sync_mutex);
 
-	if (!priv->db_ctx) {
-		g_warning ("Cannot begin transaction, storage not open");
-		storage_task_fail (task);
-	}
-	else {
-		/* use atomic to flush cache line */
-		g_atomic_int_inc ((gint*)&priv->txn_seq);
-		g_value_init (&task->value, G_TYPE_ULONG);
-		g_value_set_ulong (&task->value, priv->txn_seq);
-		txn = txn_state_new (storage, priv->txn_seq);
-		task->txn_id = txn->txn_id;
-		g_hash_table_insert (priv->txn_state, &txn->txn_id, txn);
-		storage_task_succeed (task);
+		if (stop && !priv->sync_waiters)
+			break;
 	}
+
+	g_mutex_unlock (priv->sync_mutex);
+
+	return NULL;
 }
 
+/* Completes a successful commit once it is as durable as @durability. */
 static void
-handle_txn_commit (CatalinaStorage *storage,
-                   IrisMessage     *message)
+storage_sync_succeed (CatalinaStorage    *storage,
+                      StorageTask        *task,
+                      CatalinaDurability  durability)
 {
-	CatalinaStoragePrivate *priv;
-	StorageTask            *task;
-	TxnState               *txn;
-	gboolean                success = TRUE;
-
-	g_return_if_fail (message->what == MESSAGE_TXN_COMMIT);
-	g_return_if_fail (storage != NULL);
-
-	priv = storage->priv;
-	task = g_value_get_pointer (iris_message_get_data (message));
-
-	if (!priv->db_ctx) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "Storage not opened");
-		storage_task_fail (task);
-		return;
-	}
+	CatalinaStoragePrivate *priv = storage->priv;
+	GError                 *error = NULL;
+	GList                  *waiters;
 
-	/* queue if another transaction is pending */
-	if (priv->txn != 0 && priv->txn != task->txn_id) {
-		priv->txn_commits = g_list_append (priv->txn_commits, iris_message_ref (message));
+	if (durability != CATALINA_DURABILITY_PERIODIC) {
+		storage_task_succeed (task);
 		return;
 	}
 
-	/* mark this as our current transaction */
-	priv->txn = task->txn_id;
+	g_mutex_lock (priv->sync_mutex);
 
-	/* fail if no txn state was found */
-	if (G_UNLIKELY (!(txn = g_hash_table_lookup (priv->txn_state, &task->txn_id)))) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_STATE,
-		             "No such transaction");
-		storage_task_fail (task);
+	if (!priv->sync_thread &&
+	    !(priv->sync_thread = g_thread_create (storage_sync_thread, storage,
+	                                           TRUE, &error)))
+	{
+		g_mutex_unlock (priv->sync_mutex);
+		g_warning ("%s", error->message);
+		g_error_free (error);
+
+		/* sync here rather than leave the commit hanging */
+		waiters = g_list_prepend (NULL, task);
+		storage_sync_complete (storage, waiters);
+		g_list_free (waiters);
 		return;
 	}
 
-	/* begin tdb transaction */
-	if (G_UNLIKELY (tdb_transaction_start (priv->db_ctx) != 0)) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_DB,
-		             "Tdb could not start a new transaction");
-		storage_task_fail (task);
-		return;
-	}
+	priv->sync_waiters = g_list_prepend (priv->sync_waiters, task);
+	priv->sync_pending += priv->sync_written;
+	priv->sync_written = 0;
+	if (priv->sync_bytes && priv->sync_pending >= priv->sync_bytes)
+		priv->sync_wake = TRUE;
 
-	/* process all of the transaction operations */
-	if (!txn_state_run (txn, &task->error))
-		success = FALSE;
+	g_cond_signal (priv->sync_cond);
+	g_mutex_unlock (priv->sync_mutex);
+}
 
-	/* commit the tdb transaction */
-	if (success && tdb_transaction_commit (priv->db_ctx) != 0) {
-		g_set_error (&task->error, CATALINA_STORAGE_ERROR,
-		             CATALINA_STORAGE_ERROR_DB,
-		             "Cannot commit txn: %s",
-		             tdb_errorstr (priv->db_ctx));
-		success = FALSE;
-	}
+/* Syncs the waiting commits and stops the sync thread. */
+static void
+storage_sync_stop (CatalinaStorage *storage)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
 
-	/* finished with transaction state */
-	g_hash_table_remove (priv->txn_state, &txn->txn_id);
-	priv->txn = 0;
+	if (!priv->sync_thread)
+		return;
 
-	if (!success) {
-		tdb_transaction_recover (priv->db_ctx);
-		storage_task_fail (task);
-	}
-	else {
-		storage_task_succeed (task);
-	}
+	g_mutex_lock (priv->sync_mutex);
+	priv->sync_stop = TRUE;
+	g_cond_signal (priv->sync_cond);
+	g_mutex_unlock (priv->sync_mutex);
 
-	/* unref our delivered message. this is done so we can share a code path with the
-	 * non-stored commit message (and the main handler refs it comming in). */
-	iris_message_unref (message);
+	g_thread_join (priv->sync_thread);
 
-	/* begin the next pending transaction (tail-recursion) */
-	if (priv->txn_commits) {
-		if ((message = g_list_nth_data (priv->txn_commits, 0)) != NULL) {
-			priv->txn_commits = g_list_remove (priv->txn_commits, message);
-			handle_txn_commit (storage, message);
-		}
-	}
+	priv->sync_thread = NULL;
+	priv->sync_stop = FALSE;
 }
 
+/***************************************************************************
+ *                            Transform Stage                              *
+ ***************************************************************************/
+
+/* Posts the messages at the head of the stage queue which are done with the
+ * transform stage.  Called with stage_mutex held. */
 static void
-handle_txn_cancel (CatalinaStorage *storage,
-                   IrisMessage     *message)
+storage_stage_flush (CatalinaStorage *storage)
 {
-	CatalinaStoragePrivate *priv;
+	CatalinaStoragePrivate *priv = storage->priv;
+	IrisMessage            *message;
 	StorageTask            *task;
-	TxnState               *txn;
 
-	g_return_if_fail (message->what == MESSAGE_TXN_CANCEL);
-	g_return_if_fail (storage != NULL);
+	while ((message = g_queue_peek_head (priv->stage_queue)) != NULL) {
+		task = NULL;
+		if (message->what == MESSAGE_SET || message->what == MESSAGE_REMOVE) {
+			task = g_value_get_pointer (iris_message_get_data (message));
+			if (task->staging)
+				break;
+		}
 
-	priv = storage->priv;
-	task = g_value_get_pointer (iris_message_get_data (message));
+		/* writes outside of transactions go to their lane, the exclusive messages
+		 * wait for the lanes to drain */
+		if (priv->concurrent && task && task->txn_id == 0)
+			storage_lane_post (storage, message);
+		else if (priv->writes_inflight > 0)
+			break;
+		else
+			iris_port_post (priv->ex_port, message);
 
-	if (!priv->db_ctx) {
-		storage_task_fail (task);
-		return;
+		g_queue_pop_head (priv->stage_queue);
+		iris_message_unref (message);
 	}
+}
 
-	/* This is an exclusive message.  When this code-path is reached, the transaction has
-	 * either already been completed, or it has not yet to begin being comitted.
-	 */
+/* Posts @message to the exclusive port, or holds it behind the sets still in the
+ * transform stage so that requests are applied in the order they were made.  A
+ * commit must not overtake the sets of its transaction, for one.  With
+ * "concurrent-writes", sets and removes go to their write lane instead. */
+static void
+storage_ex_post (CatalinaStorage *storage,
+                 IrisMessage     *message)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
 
-	if ((txn = g_hash_table_lookup (priv->txn_state, &task->txn_id))) {
-		priv->txn_commits = g_list_remove (priv->txn_commits, txn);
-		g_hash_table_remove (priv->txn_state, &task->txn_id);
-	}
+	if (!storage_queue_admit (storage, message, &priv->ex_queue))
+		return;
 
-	storage_task_succeed (task);
+	g_mutex_lock (priv->stage_mutex);
+	g_queue_push_tail (priv->stage_queue, iris_message_ref (message));
+	storage_stage_flush (storage);
+	g_mutex_unlock (priv->stage_mutex);
 }
 
+/* Posts @message to the concurrent port once its request fits within the queue limits. */
 static void
-catalina_storage_cn_handle_message (IrisMessage     *message,
-                                    CatalinaStorage *storage)
+storage_cn_post (CatalinaStorage *storage,
+                 IrisMessage     *message)
 {
-	switch (message->what) {
-	case MESSAGE_GET:
-		handle_get (storage, message);
-		break;
-	case MESSAGE_COUNT_KEYS:
-		handle_count_keys (storage, message);
-		break;
-	default:
-		g_warning ("Invalid message sent to storage: %d", message->what);
-	}
+	if (storage_queue_admit (storage, message, &storage->priv->cn_queue))
+		iris_port_post (storage->priv->cn_port, message);
 }
 
+/* Hands a set to the concurrent workers to transform its value.  The message holds its
+ * place in the stage queue until storage_stage_done() is called for it. */
 static void
-catalina_storage_ex_handle_message (IrisMessage     *message,
-                                    CatalinaStorage *storage)
+storage_stage_set (CatalinaStorage *storage,
+                   IrisMessage     *message)
 {
-	switch (message->what) {
-	case MESSAGE_SET:
-		handle_set (storage, message);
-		break;
-	case MESSAGE_OPEN:
-		handle_open (storage, message);
-		break;
-	case MESSAGE_CLOSE:
-		handle_close (storage, message);
-		break;
-	case MESSAGE_TXN_BEGIN:
-		handle_txn_begin (storage, message);
-		break;
-	case MESSAGE_TXN_COMMIT:
-		handle_txn_commit (storage, iris_message_ref (message));
-		break;
-	case MESSAGE_TXN_CANCEL:
-		handle_txn_cancel (storage, message);
-		break;
-	default:
-		g_warning ("Invalid exclusive message: %d", message->what);
-	}
+	CatalinaStoragePrivate *priv = storage->priv;
+	StorageTask            *task;
+
+	if (!storage_queue_admit (storage, message, &priv->ex_queue))
+		return;
+
+	task = g_value_get_pointer (iris_message_get_data (message));
+	task->staging = TRUE;
+
+	g_mutex_lock (priv->stage_mutex);
+	g_queue_push_tail (priv->stage_queue, iris_message_ref (message));
+	g_mutex_unlock (priv->stage_mutex);
+
+	iris_port_post (priv->cn_port, message);
+}
+
+static void
+storage_stage_done (CatalinaStorage *storage,
+                    StorageTask     *task)
+{
+	g_mutex_lock (storage->priv->stage_mutex);
+	task->staging = FALSE;
+	storage_stage_flush (storage);
+	g_mutex_unlock (storage->priv->stage_mutex);
 }
 
 /***************************************************************************
- *     Storage Tasks - Asynchronous and Synchronous Task Encapsulation     *
+ *                              Write Lanes                                *
  ***************************************************************************/
 
-StorageTask*
-storage_task_new (CatalinaStorage     *storage,
-                  gboolean             is_async,
-                  GAsyncReadyCallback  callback,
-                  gpointer             user_data,
-                  gpointer             source_tag)
-{
-	StorageTask *task;
+/* The backends do not order the writes made from several threads, so the lanes do:
+ * writes to a key always hash to the same lane, which runs a single write at a time,
+ * while the lanes run alongside each other and the readers on the concurrent workers.
+ * The backend may still serialize the stores themselves, see
+ * catalina_backend_set_concurrent().  The lanes are protected by stage_mutex. */
 
-	task = g_slice_new0 (StorageTask);
-	task->storage = storage;
+static guint
+storage_lane_of (StorageTask *task)
+{
+	guint hash = 5381;
+	gsize i;
 
-	if (!is_async) {
-		/* FIXME: Use IrisFreeList to re-use mutex and cond */
-		task->mutex = g_mutex_new ();
-		task->cond = g_cond_new ();
-		g_mutex_lock (task->mutex);
-	}
-	else {
-		task->result = g_simple_async_result_new (G_OBJECT (storage),
-		                                          callback, user_data,
-		                                          source_tag);
-		g_simple_async_result_set_op_res_gpointer (task->result, task, NULL);
-	}
+	for (i = 0; i < task->key_length; i++)
+		hash = (hash << 5) + hash + (guchar)task->key [i];
 
-	return task;
+	return hash % STORAGE_WRITE_LANES;
 }
 
+/* Queues the write of @message in its lane, starting it if the lane is idle.  Called
+ * with stage_mutex held. */
 static void
-storage_task_free (StorageTask *task,
-                   gboolean     free_key,
-                   gboolean     free_data)
+storage_lane_post (CatalinaStorage *storage,
+                   IrisMessage     *message)
 {
-	/* FIXME: Use IrisFreeList to re-use mutex and cond */
-	if (task->mutex) {
-		g_mutex_unlock (task->mutex);
-		g_mutex_free (task->mutex);
-	}
+	CatalinaStoragePrivate *priv = storage->priv;
+	StorageTask            *task;
+	GQueue                 *lane;
 
-	if (task->cond)
-		g_cond_free (task->cond);
+	task = g_value_get_pointer (iris_message_get_data (message));
+	lane = &priv->write_lanes [storage_lane_of (task)];
+	g_queue_push_tail (lane, iris_message_ref (message));
+	priv->writes_inflight++;
 
-	if (G_VALUE_TYPE (&task->value))
-		g_value_unset (&task->value);
+	if (lane->length == 1)
+		iris_port_post (priv->cn_port, message);
+}
 
-	if (task->error)
-		g_error_free (task->error);
+/* Retires the running write of @lane and starts the next one.  The exclusive messages
+ * held in the stage queue are let through once the last write is done. */
+static void
+storage_lane_done (CatalinaStorage *storage,
+                   guint            lane)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
+	IrisMessage            *message;
 
-	if (free_key)
-		g_free (task->key);
+	g_mutex_lock (priv->stage_mutex);
 
-	if (free_data)
-		g_free (task->data);
+	message = g_queue_pop_head (&priv->write_lanes [lane]);
+	iris_message_unref (message);
 
-	if (task->result)
-		g_object_unref (task->result);
+	if ((message = g_queue_peek_head (&priv->write_lanes [lane])) != NULL)
+		iris_port_post (priv->cn_port, message);
 
-	g_slice_free (StorageTask, task);
+	if (--priv->writes_inflight == 0)
+		storage_stage_flush (storage);
+
+	g_mutex_unlock (priv->stage_mutex);
 }
 
-static gboolean
-storage_task_wait (StorageTask  *task,
-                   GError      **error)
+/***************************************************************************
+ *                               Snapshots                                 *
+ ***************************************************************************/
+
+static void
+snapshot_version_free (IndexDatum *version)
 {
-	g_cond_wait (task->cond, task->mutex);
-	if (!task->success && task->error && error && *error == NULL)
-		*error = g_error_copy (task->error);
-	return task->success;
+	if (version)
+		index_datum_free (version);
 }
 
-static void
-storage_task_complete (StorageTask *task,
-                       gboolean     success)
+/* Registers a new snapshot.  Called by an exclusive handler, in between two writes. */
+static CatalinaSnapshot*
+storage_snapshot_new (CatalinaStorage *storage)
 {
-	task->success = success;
+	CatalinaStoragePrivate *priv = storage->priv;
+	CatalinaSnapshot       *snapshot;
 
-	if (task->mutex) {
-		g_mutex_lock (task->mutex);
-		g_cond_signal (task->cond);
-		g_mutex_unlock (task->mutex);
-	}
-	else {
-		if (task->storage->priv->use_idle)
-			g_simple_async_result_complete_in_idle (task->result);
-		else
-			g_simple_async_result_complete (task->result);
-	}
+	snapshot = g_slice_new0 (CatalinaSnapshot);
+	snapshot->storage = g_object_ref (storage);
+	snapshot->versions = g_hash_table_new_full (index_datum_hash, index_datum_equal,
+	                                            (GDestroyNotify)index_datum_free,
+	                                            (GDestroyNotify)snapshot_version_free);
+
+	g_static_rw_lock_writer_lock (&priv->snapshot_lock);
+	priv->snapshots = g_list_prepend (priv->snapshots, snapshot);
+	g_static_rw_lock_writer_unlock (&priv->snapshot_lock);
+
+	return snapshot;
 }
 
+/* Keeps the current version of @key for each snapshot which has not seen it change yet.
+ * Called by the writers before they change the record, which is also read under the
+ * lock by handle_snapshot_get() so that it never sees the change without the version. */
 static void
-storage_task_succeed (StorageTask *task)
+storage_snapshots_preserve (CatalinaStorage *storage,
+                            const gchar     *key,
+                            gsize            key_length)
 {
-	storage_task_complete (task, TRUE);
+	CatalinaStoragePrivate *priv         = storage->priv;
+	CatalinaSnapshot       *snapshot;
+	IndexDatum              query;
+	GList                  *iter;
+	gchar                  *value        = NULL;
+	gsize                   value_length = 0;
+	gboolean                fetched      = FALSE,
+	                        found        = FALSE;
+
+	/* snapshots are only added by exclusive handlers, never alongside a writer */
+	if (!priv->snapshots)
+		return;
+
+	query.data = (gchar*)key;
+	query.length = key_length;
+
+	g_static_rw_lock_writer_lock (&priv->snapshot_lock);
+
+	for (iter = priv->snapshots; iter; iter = iter->next) {
+		snapshot = iter->data;
+		if (g_hash_table_lookup_extended (snapshot->versions, &query, NULL, NULL))
+			continue;
+
+		if (!fetched) {
+			found = catalina_backend_fetch (priv->backend, key, key_length,
+			                                &value, &value_length);
+			fetched = TRUE;
+		}
+
+		g_hash_table_insert (snapshot->versions,
+		                     index_datum_new (g_memdup (key, key_length), key_length),
+		                     found ? index_datum_new (g_memdup (value, value_length),
+		                                              value_length)
+		                           : NULL);
+	}
+
+	g_static_rw_lock_writer_unlock (&priv->snapshot_lock);
+
+	g_free (value);
 }
 
+/* Drops the versions of every snapshot as the data-store goes away; reading them fails
+ * from then on. */
 static void
-storage_task_fail (StorageTask *task)
+storage_snapshots_release (CatalinaStorage *storage)
 {
-	/* propagate error to transaction if needed */
-	if (task->txn_id != 0 && task->error) {
-		TxnState *txn;
-		if ((txn = g_hash_table_lookup (task->storage->priv->txn_state, &task->txn_id)))
-			txn->error = g_error_copy (task->error);
+	CatalinaStoragePrivate *priv = storage->priv;
+	CatalinaSnapshot       *snapshot;
+	GList                  *iter;
+
+	g_static_rw_lock_writer_lock (&priv->snapshot_lock);
+
+	for (iter = priv->snapshots; iter; iter = iter->next) {
+		snapshot = iter->data;
+		g_hash_table_destroy (snapshot->versions);
+		snapshot->versions = NULL;
 	}
 
-	storage_task_complete (task, FALSE);
+	g_list_free (priv->snapshots);
+	priv->snapshots = NULL;
+
+	g_static_rw_lock_writer_unlock (&priv->snapshot_lock);
 }
 
 /***************************************************************************
- *                           Transaction State                             *
+ *                           Submission Queues                             *
  ***************************************************************************/
 
-static TxnState*
-txn_state_new (CatalinaStorage *storage,
-               gulong           txn_id)
+/* Asynchronous requests are counted in the queue of the port they are posted to from
+ * submission until their callback has run, which bounds both the messages waiting on
+ * the port and the callbacks waiting to run in the main loop.  Synchronous requests
+ * wait for themselves, and requests within a transaction only complete with its
+ * commit, so neither is counted.  A producer blocking under %CATALINA_QUEUE_BLOCK
+ * does not wait for callbacks waiting in the main loop, which it may be holding up.
+ * The queues are protected by queue_mutex. */
+
+static gboolean
+storage_queue_has_room (CatalinaStoragePrivate *priv,
+                        StorageQueue           *queue,
+                        gsize                   bytes,
+                        gboolean                blocking)
 {
-	TxnState *state = g_slice_new0 (TxnState);
-	state->txn_id = txn_id;
-	state->storage = storage;
-	state->msgs = NULL;
-	state->error = NULL;
-	return state;
+	guint   length = queue->length;
+	guint64 queued = queue->bytes;
+
+	if (blocking) {
+		length -= queue->idle;
+		queued -= queue->idle_bytes;
+	}
+
+	if (priv->queue_limit > 0 && length >= priv->queue_limit)
+		return FALSE;
+
+	/* a request larger than the limit still goes through on its own */
+	if (priv->queue_limit_bytes > 0 && length > 0 &&
+	    queued + bytes > priv->queue_limit_bytes)
+		return FALSE;
+
+	return TRUE;
 }
 
 static gboolean
-txn_state_run (TxnState  *txn,
-               GError   **error)
+storage_queue_admit (CatalinaStorage *storage,
+                     IrisMessage     *message,
+                     StorageQueue    *queue)
 {
-	GList *iter;
+	CatalinaStoragePrivate *priv = storage->priv;
+	StorageTask            *task;
+	gsize                   bytes;
 
-	/* reverse the list as additions were prepends for O(1) */
-	txn->msgs = g_list_reverse (txn->msgs);
+	task = g_value_get_pointer (iris_message_get_data (message));
 
-	for (iter = txn->msgs; iter; iter = iter->next) {
-		catalina_storage_ex_handle_message (iter->data, txn->storage);
-		if (txn->error) {
-			if (error && *error == NULL) {
-				*error = txn->error;
-				txn->error = NULL;
-			}
+	if (!task || !task->result || task->txn_id != 0)
+		return TRUE;
+
+	bytes = task->key_length + task->data_length;
+
+	g_mutex_lock (priv->queue_mutex);
+
+	while (!storage_queue_has_room (priv, queue, bytes,
+	                                priv->queue_policy == CATALINA_QUEUE_BLOCK)) {
+		if (priv->queue_policy == CATALINA_QUEUE_FAIL) {
+			g_mutex_unlock (priv->queue_mutex);
+			g_set_error (&task->error, CATALINA_STORAGE_ERROR,
+			             CATALINA_STORAGE_ERROR_QUEUE_FULL,
+			             "Too many requests are outstanding");
+			storage_task_fail (task);
 			return FALSE;
 		}
+		g_cond_wait (priv->queue_cond, priv->queue_mutex);
 	}
 
+	queue->length++;
+	queue->bytes += bytes;
+	task->queue = queue;
+	task->queue_bytes = bytes;
+
+	g_mutex_unlock (priv->queue_mutex);
+
 	return TRUE;
 }
 
 static void
-txn_state_free (TxnState *txn)
+storage_queue_release (CatalinaStorage *storage,
+                       StorageQueue    *queue,
+                       gsize            bytes,
+                       gboolean         idle)
 {
-	GList *iter;
+	CatalinaStoragePrivate *priv = storage->priv;
+	GList                  *waiters = NULL,
+	                       *iter;
 
-	for (iter = txn->msgs; iter; iter = iter->next)
-		iris_message_unref (iter->data);
-	/*if (txn->error)
-		g_error_free (txn->error);*/
-	g_list_free (txn->msgs);
-	g_slice_free (TxnState, txn);
+	g_mutex_lock (priv->queue_mutex);
+
+	queue->length--;
+	queue->bytes -= bytes;
+	if (idle) {
+		queue->idle--;
+		queue->idle_bytes -= bytes;
+	}
+	g_cond_broadcast (priv->queue_cond);
+
+	if (priv->queue_waiters && storage_queue_has_room (priv, &priv->ex_queue, 0, FALSE)) {
+		waiters = priv->queue_waiters;
+		priv->queue_waiters = NULL;
+	}
+
+	g_mutex_unlock (priv->queue_mutex);
+
+	for (iter = waiters; iter; iter = iter->next) {
+		if (priv->use_idle)
+			g_simple_async_result_complete_in_idle (iter->data);
+		else
+			g_simple_async_result_complete (iter->data);
+		g_object_unref (iter->data);
+	}
+
+	g_list_free (waiters);
+}
+
+/* Counts a set by the size of the buffer it stores once its value is serialized and
+ * transformed, since only the key and the raw buffer are known when it is admitted. */
+static void
+storage_queue_resize (CatalinaStorage *storage,
+                      StorageTask     *task)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
+	gsize                   bytes = task->key_length + task->data_length;
+
+	g_mutex_lock (priv->queue_mutex);
+	if (bytes < task->queue_bytes)
+		g_cond_broadcast (priv->queue_cond);
+	task->queue->bytes = task->queue->bytes - task->queue_bytes + bytes;
+	task->queue_bytes = bytes;
+	g_mutex_unlock (priv->queue_mutex);
+}
+
+static gboolean
+storage_queue_complete_idle (gpointer data)
+{
+	QueueCompletion *completion = data;
+
+	g_simple_async_result_complete (completion->result);
+	storage_queue_release (completion->storage, completion->queue, completion->bytes, TRUE);
+
+	g_object_unref (completion->result);
+	g_object_unref (completion->storage);
+	g_slice_free (QueueCompletion, completion);
+
+	return FALSE;
+}
+
+/* Completes a counted task and gives back its place in the queue once the callback
+ * has run.  The task may be freed by the callback, so its queue is taken first. */
+static void
+storage_queue_complete (CatalinaStorage *storage,
+                        StorageTask     *task)
+{
+	CatalinaStoragePrivate *priv = storage->priv;
+	QueueCompletion        *completion;
+	StorageQueue           *queue = task->queue;
+	gsize                   bytes = task->queue_bytes;
+
+	task->queue = NULL;
+
+	if (priv->use_idle) {
+		g_mutex_lock (priv->queue_mutex);
+		queue->idle++;
+		queue->idle_bytes += bytes;
+		g_cond_broadcast (priv->queue_cond);
+		g_mutex_unlock (priv->queue_mutex);
+
+		completion = g_slice_new (QueueCompletion);
+		completion->storage = g_object_ref (storage);
+		completion->result = g_object_ref (task->result);
+		completion->queue = queue;
+		completion->bytes = bytes;
+		g_idle_add (storage_queue_complete_idle, completion);
+	}
+	else {
+		g_object_ref (storage);
+		g_simple_async_result_complete (task->result);
+		storage_queue_release (storage, queue, bytes, FALSE);
+		g_object_unref (storage);
+	}
 }
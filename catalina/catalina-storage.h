@@ -24,6 +24,7 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 
+#include "catalina-backend.h"
 #include "catalina-formatter.h"
 #include "catalina-transform.h"
 
@@ -49,6 +50,9 @@ G_BEGIN_DECLS
  * @CATALINA_STORAGE_ERROR_DB: An error occurred with BDB.
  * @CATALINA_STORAGE_ERROR_NO_SUCH_KEY: The key requested was not found
  * @CATALINA_STORAGE_ERROR_NO_SUCH_TXN: The transaction provided is invalid
+ * @CATALINA_STORAGE_ERROR_NOT_SUPPORTED: The backend does not support the operation
+ * @CATALINA_STORAGE_ERROR_QUEUE_FULL: Too many requests are outstanding, see
+ *   #CatalinaQueuePolicy
  *
  * #CatalinaStorage error enumeration.
  */
@@ -57,11 +61,157 @@ typedef enum {
 	CATALINA_STORAGE_ERROR_DB,
 	CATALINA_STORAGE_ERROR_NO_SUCH_KEY,
 	CATALINA_STORAGE_ERROR_NO_SUCH_TXN,
+	CATALINA_STORAGE_ERROR_NOT_SUPPORTED,
+	CATALINA_STORAGE_ERROR_QUEUE_FULL,
 } CatalinaStorageError;
 
+/**
+ * CatalinaDurability:
+ * @CATALINA_DURABILITY_DEFAULT: use the "durability" of the storage
+ * @CATALINA_DURABILITY_NONE: commits are not synced to disk and may be lost on a crash,
+ *   which suits caches and data derived from elsewhere
+ * @CATALINA_DURABILITY_PERIODIC: commits are synced to disk by a background thread
+ *   every "sync-interval" milliseconds, or once "sync-bytes" have been written, and
+ *   complete once synced
+ * @CATALINA_DURABILITY_COMMIT: each commit is synced to disk before it completes
+ *
+ * How far a transaction commit is persisted before it completes.
+ */
+typedef enum {
+	CATALINA_DURABILITY_DEFAULT,
+	CATALINA_DURABILITY_NONE,
+	CATALINA_DURABILITY_PERIODIC,
+	CATALINA_DURABILITY_COMMIT,
+} CatalinaDurability;
+
+/**
+ * CatalinaQueuePolicy:
+ * @CATALINA_QUEUE_FAIL: requests beyond the limits fail right away with
+ *   %CATALINA_STORAGE_ERROR_QUEUE_FULL
+ * @CATALINA_QUEUE_BLOCK: the asynchronous call blocks until the request fits within the
+ *   limits
+ *
+ * What happens to an asynchronous request made while "queue-limit" or
+ * "queue-limit-bytes" are reached.
+ */
+typedef enum {
+	CATALINA_QUEUE_FAIL,
+	CATALINA_QUEUE_BLOCK,
+} CatalinaQueuePolicy;
+
 typedef struct _CatalinaStorage        CatalinaStorage;
 typedef struct _CatalinaStorageClass   CatalinaStorageClass;
 typedef struct _CatalinaStoragePrivate CatalinaStoragePrivate;
+typedef struct _CatalinaStorageEntry   CatalinaStorageEntry;
+typedef struct _CatalinaCursor         CatalinaCursor;
+typedef struct _CatalinaSnapshot       CatalinaSnapshot;
+
+/**
+ * CatalinaCursorFlags:
+ * @CATALINA_CURSOR_DEFAULT: deliver keys and the buffers as they are stored
+ * @CATALINA_CURSOR_KEYS_ONLY: deliver only keys; values are not read
+ * @CATALINA_CURSOR_TRANSFORM: apply the storage's "transform" to each buffer
+ * @CATALINA_CURSOR_DESERIALIZE: deserialize each buffer into the entry's value using the
+ *   storage's "formatter".  Implies %CATALINA_CURSOR_TRANSFORM.
+ *
+ * Flags controlling what a #CatalinaCursor delivers for each record.
+ */
+typedef enum {
+	CATALINA_CURSOR_DEFAULT     = 0,
+	CATALINA_CURSOR_KEYS_ONLY   = 1 << 0,
+	CATALINA_CURSOR_TRANSFORM   = 1 << 1,
+	CATALINA_CURSOR_DESERIALIZE = 1 << 2,
+} CatalinaCursorFlags;
+
+/**
+ * CatalinaRecordFunc:
+ * @key: the key of the record
+ * @key_length: the length of @key in bytes
+ * @data: the record's buffer
+ * @data_length: the length of @data in bytes
+ * @user_data: user data provided with the function
+ *
+ * Callback used to inspect a record in place.  @data is only valid for the duration
+ * of the callback and must not be modified or freed.
+ *
+ * See catalina_storage_get_with_func_async().
+ */
+typedef void (*CatalinaRecordFunc) (const gchar *key,
+                                    gsize        key_length,
+                                    const gchar *data,
+                                    gsize        data_length,
+                                    gpointer     user_data);
+
+/**
+ * CatalinaMapFunc:
+ * @key: the key of the record
+ * @key_length: the length of @key in bytes
+ * @data: the record's buffer, after the storage's "transform" is applied
+ * @data_length: the length of @data in bytes
+ * @partial: the partial result of the current partition, initially %NULL
+ * @user_data: user data provided with the function
+ *
+ * Callback run for each record during catalina_storage_foreach_parallel_async().  Calls
+ * for a single partition are serialized, but partitions run concurrently.
+ *
+ * Return value: the new partial result for the partition
+ */
+typedef gpointer (*CatalinaMapFunc) (const gchar *key,
+                                     gsize        key_length,
+                                     const gchar *data,
+                                     gsize        data_length,
+                                     gpointer     partial,
+                                     gpointer     user_data);
+
+/**
+ * CatalinaReduceFunc:
+ * @result: the result reduced so far, initially %NULL
+ * @partial: the partial result of a partition
+ * @user_data: user data provided with the function
+ *
+ * Callback used to combine the partial results of each partition into a single result.
+ * Calls are serialized.
+ *
+ * Return value: the new reduced result
+ */
+typedef gpointer (*CatalinaReduceFunc) (gpointer result,
+                                        gpointer partial,
+                                        gpointer user_data);
+
+/**
+ * CatalinaPredicateFunc:
+ * @key: the key of the record
+ * @key_length: the length of @key in bytes
+ * @data: the record's buffer, after the storage's "transform" is applied
+ * @data_length: the length of @data in bytes
+ * @user_data: user data provided with the function
+ *
+ * Callback used to select records, such as with catalina_storage_remove_where_async().
+ *
+ * Return value: %TRUE if the record matches
+ */
+typedef gboolean (*CatalinaPredicateFunc) (const gchar *key,
+                                           gsize        key_length,
+                                           const gchar *data,
+                                           gsize        data_length,
+                                           gpointer     user_data);
+
+/**
+ * CatalinaIndexFunc:
+ * @value: the value of the record, as passed to catalina_storage_set_value_async()
+ *   or deserialized by the storage's "formatter"
+ * @index_value: an uninitialized #GValue to store the indexed value in
+ * @user_data: user data provided with the function
+ *
+ * Callback used by catalina_storage_add_index_full() to extract the value a record
+ * is indexed by.  @index_value is serialized with the storage's "formatter", so it
+ * must hold a type the formatter supports.
+ *
+ * Return value: %TRUE if @index_value was set, %FALSE if the record is not indexed
+ */
+typedef gboolean (*CatalinaIndexFunc) (const GValue *value,
+                                       GValue       *index_value,
+                                       gpointer      user_data);
 
 struct _CatalinaStorage
 {
@@ -76,6 +226,29 @@ struct _CatalinaStorageClass
 	GObjectClass parent_class;
 };
 
+/**
+ * CatalinaStorageEntry:
+ * @key: the key of the entry
+ * @key_length: the length of @key in bytes
+ * @data: the buffer found for @key or %NULL
+ * @data_length: the length of @data in bytes
+ * @found: if @key was found in the data-store
+ * @value: the deserialized value, if requested with %CATALINA_CURSOR_DESERIALIZE
+ *
+ * A key/value pair as returned from batched requests such as
+ * catalina_storage_get_many_async().  Entries are stored in a #GArray and should
+ * be freed with catalina_storage_entries_free().
+ */
+struct _CatalinaStorageEntry
+{
+	gchar    *key;
+	gsize     key_length;
+	gchar    *data;
+	gsize     data_length;
+	gboolean  found;
+	GValue    value;
+};
+
 GType            catalina_storage_get_type         (void);
 CatalinaStorage* catalina_storage_new              (void);
 void             catalina_storage_open_async       (CatalinaStorage      *storage,
@@ -114,6 +287,75 @@ gboolean         catalina_storage_get              (CatalinaStorage      *storag
                                                     gchar               **value,
                                                     gsize                *value_length,
                                                     GError              **error);
+void             catalina_storage_get_many_async   (CatalinaStorage      *storage,
+                                                    const gchar         **keys,
+                                                    const gssize         *key_lengths,
+                                                    guint                 n_keys,
+                                                    GAsyncReadyCallback   callback,
+                                                    gpointer              user_data);
+gboolean         catalina_storage_get_many_finish  (CatalinaStorage      *storage,
+                                                    GAsyncResult         *result,
+                                                    GArray              **entries,
+                                                    GError              **error);
+gboolean         catalina_storage_get_many         (CatalinaStorage      *storage,
+                                                    const gchar         **keys,
+                                                    const gssize         *key_lengths,
+                                                    guint                 n_keys,
+                                                    GArray              **entries,
+                                                    GError              **error);
+void             catalina_storage_entries_free     (GArray               *entries);
+void             catalina_storage_scan_range_async   (CatalinaStorage      *storage,
+                                                      const gchar          *start,
+                                                      gssize                start_length,
+                                                      const gchar          *end,
+                                                      gssize                end_length,
+                                                      guint                 limit,
+                                                      GAsyncReadyCallback   callback,
+                                                      gpointer              user_data);
+gboolean         catalina_storage_scan_range_finish  (CatalinaStorage      *storage,
+                                                      GAsyncResult         *result,
+                                                      GArray              **entries,
+                                                      GError              **error);
+gboolean         catalina_storage_scan_range         (CatalinaStorage      *storage,
+                                                      const gchar          *start,
+                                                      gssize                start_length,
+                                                      const gchar          *end,
+                                                      gssize                end_length,
+                                                      guint                 limit,
+                                                      GArray              **entries,
+                                                      GError              **error);
+void             catalina_storage_scan_prefix_async  (CatalinaStorage      *storage,
+                                                      const gchar          *prefix,
+                                                      gssize                prefix_length,
+                                                      guint                 limit,
+                                                      GAsyncReadyCallback   callback,
+                                                      gpointer              user_data);
+gboolean         catalina_storage_scan_prefix_finish (CatalinaStorage      *storage,
+                                                      GAsyncResult         *result,
+                                                      GArray              **entries,
+                                                      GError              **error);
+gboolean         catalina_storage_scan_prefix        (CatalinaStorage      *storage,
+                                                      const gchar          *prefix,
+                                                      gssize                prefix_length,
+                                                      guint                 limit,
+                                                      GArray              **entries,
+                                                      GError              **error);
+void             catalina_storage_get_with_func_async  (CatalinaStorage      *storage,
+                                                        const gchar          *key,
+                                                        gssize                key_length,
+                                                        CatalinaRecordFunc    func,
+                                                        gpointer              func_data,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
+gboolean         catalina_storage_get_with_func_finish (CatalinaStorage      *storage,
+                                                        GAsyncResult         *result,
+                                                        GError              **error);
+gboolean         catalina_storage_get_with_func        (CatalinaStorage      *storage,
+                                                        const gchar          *key,
+                                                        gssize                key_length,
+                                                        CatalinaRecordFunc    func,
+                                                        gpointer              func_data,
+                                                        GError              **error);
 void             catalina_storage_set_async        (CatalinaStorage      *storage,
                                                     gulong                txn_id,
                                                     const gchar          *key,
@@ -122,6 +364,14 @@ void             catalina_storage_set_async        (CatalinaStorage      *storag
                                                     gssize                value_length,
                                                     GAsyncReadyCallback   callback,
                                                     gpointer              user_data);
+void             catalina_storage_set_take_async   (CatalinaStorage      *storage,
+                                                    gulong                txn_id,
+                                                    const gchar          *key,
+                                                    gssize                key_length,
+                                                    gchar                *value,
+                                                    gsize                 value_length,
+                                                    GAsyncReadyCallback   callback,
+                                                    gpointer              user_data);
 gboolean         catalina_storage_set_finish       (CatalinaStorage      *storage,
                                                     GAsyncResult         *result,
                                                     GError              **error);
@@ -174,14 +424,106 @@ CatalinaTransform*
                  catalina_storage_get_transform    (CatalinaStorage   *storage);
 void             catalina_storage_set_transform    (CatalinaStorage   *storage,
                                                     CatalinaTransform *transform);
+CatalinaBackend*
+                 catalina_storage_get_backend      (CatalinaStorage   *storage);
+void             catalina_storage_set_backend      (CatalinaStorage   *storage,
+                                                    CatalinaBackend   *backend);
+guint            catalina_storage_get_group_commit_size  (CatalinaStorage   *storage);
+void             catalina_storage_set_group_commit_size  (CatalinaStorage   *storage,
+                                                          guint              group_commit_size);
+void             catalina_storage_get_group_commit_stats (CatalinaStorage   *storage,
+                                                          gulong            *n_groups,
+                                                          gulong            *n_commits,
+                                                          guint             *largest_group);
+gdouble          catalina_storage_get_compact_threshold  (CatalinaStorage   *storage);
+void             catalina_storage_set_compact_threshold  (CatalinaStorage   *storage,
+                                                          gdouble            compact_threshold);
+CatalinaDurability
+                 catalina_storage_get_durability         (CatalinaStorage   *storage);
+void             catalina_storage_set_durability         (CatalinaStorage   *storage,
+                                                          CatalinaDurability durability);
+guint            catalina_storage_get_sync_interval      (CatalinaStorage   *storage);
+void             catalina_storage_set_sync_interval      (CatalinaStorage   *storage,
+                                                          guint              sync_interval);
+guint64          catalina_storage_get_sync_bytes         (CatalinaStorage   *storage);
+void             catalina_storage_set_sync_bytes         (CatalinaStorage   *storage,
+                                                          guint64            sync_bytes);
+gboolean         catalina_storage_get_concurrent_writes  (CatalinaStorage   *storage);
+void             catalina_storage_set_concurrent_writes  (CatalinaStorage   *storage,
+                                                          gboolean           concurrent_writes);
+guint            catalina_storage_get_queue_limit        (CatalinaStorage   *storage);
+void             catalina_storage_set_queue_limit        (CatalinaStorage   *storage,
+                                                          guint              queue_limit);
+guint64          catalina_storage_get_queue_limit_bytes  (CatalinaStorage   *storage);
+void             catalina_storage_set_queue_limit_bytes  (CatalinaStorage   *storage,
+                                                          guint64            queue_limit_bytes);
+CatalinaQueuePolicy
+                 catalina_storage_get_queue_policy       (CatalinaStorage   *storage);
+void             catalina_storage_set_queue_policy       (CatalinaStorage   *storage,
+                                                          CatalinaQueuePolicy queue_policy);
 
 GQuark           catalina_storage_error_quark      (void);
 
+void             catalina_storage_remove_async     (CatalinaStorage      *storage,
+                                                    gulong                txn_id,
+                                                    const gchar          *key,
+                                                    gssize                key_length,
+                                                    GAsyncReadyCallback   callback,
+                                                    gpointer              user_data);
+gboolean         catalina_storage_remove_finish    (CatalinaStorage      *storage,
+                                                    GAsyncResult         *result,
+                                                    GError              **error);
+gboolean         catalina_storage_remove           (CatalinaStorage      *storage,
+                                                    gulong                txn_id,
+                                                    const gchar          *key,
+                                                    gssize                key_length,
+                                                    GError              **error);
+void             catalina_storage_remove_many_async  (CatalinaStorage      *storage,
+                                                      const gchar         **keys,
+                                                      const gssize         *key_lengths,
+                                                      guint                 n_keys,
+                                                      GAsyncReadyCallback   callback,
+                                                      gpointer              user_data);
+gboolean         catalina_storage_remove_many_finish (CatalinaStorage      *storage,
+                                                      GAsyncResult         *result,
+                                                      gulong               *n_removed,
+                                                      GError              **error);
+gboolean         catalina_storage_remove_many        (CatalinaStorage      *storage,
+                                                      const gchar         **keys,
+                                                      const gssize         *key_lengths,
+                                                      guint                 n_keys,
+                                                      gulong               *n_removed,
+                                                      GError              **error);
+void             catalina_storage_remove_where_async  (CatalinaStorage       *storage,
+                                                       CatalinaPredicateFunc  predicate,
+                                                       gpointer               predicate_data,
+                                                       GAsyncReadyCallback    callback,
+                                                       gpointer               user_data);
+gboolean         catalina_storage_remove_where_finish (CatalinaStorage       *storage,
+                                                       GAsyncResult          *result,
+                                                       gulong                *n_removed,
+                                                       GError               **error);
+gboolean         catalina_storage_remove_where        (CatalinaStorage       *storage,
+                                                       CatalinaPredicateFunc  predicate,
+                                                       gpointer               predicate_data,
+                                                       gulong                *n_removed,
+                                                       GError               **error);
 gulong           catalina_storage_count_keys       (CatalinaStorage   *storage);
+void             catalina_storage_count_keys_async  (CatalinaStorage     *storage,
+                                                     GAsyncReadyCallback  callback,
+                                                     gpointer             user_data);
+gulong           catalina_storage_count_keys_finish (CatalinaStorage     *storage,
+                                                     GAsyncResult        *result,
+                                                     guint64             *n_bytes,
+                                                     GError             **error);
 
 void             catalina_storage_transaction_begin_async     (CatalinaStorage      *storage,
                                                                GAsyncReadyCallback   callback,
                                                                gpointer              user_data);
+void             catalina_storage_transaction_begin_full_async (CatalinaStorage     *storage,
+                                                               CatalinaDurability    durability,
+                                                               GAsyncReadyCallback   callback,
+                                                               gpointer              user_data);
 gulong           catalina_storage_transaction_begin_finish    (CatalinaStorage      *storage,
                                                                GAsyncResult         *result);
 void             catalina_storage_transaction_commit_async    (CatalinaStorage      *storage,
@@ -198,6 +540,121 @@ void             catalina_storage_transaction_cancel_async    (CatalinaStorage
 void             catalina_storage_transaction_cancel_finish   (CatalinaStorage      *storage,
                                                                GAsyncResult         *result);
 
+void             catalina_storage_foreach_parallel_async  (CatalinaStorage      *storage,
+                                                           guint                 n_partitions,
+                                                           CatalinaMapFunc       map_func,
+                                                           CatalinaReduceFunc    reduce_func,
+                                                           gpointer              func_data,
+                                                           GAsyncReadyCallback   callback,
+                                                           gpointer              user_data);
+gboolean         catalina_storage_foreach_parallel_finish (CatalinaStorage      *storage,
+                                                           GAsyncResult         *result,
+                                                           gpointer             *reduced,
+                                                           GError              **error);
+gboolean         catalina_storage_foreach_parallel        (CatalinaStorage      *storage,
+                                                           guint                 n_partitions,
+                                                           CatalinaMapFunc       map_func,
+                                                           CatalinaReduceFunc    reduce_func,
+                                                           gpointer              func_data,
+                                                           gpointer             *reduced,
+                                                           GError              **error);
+
+CatalinaCursor*  catalina_storage_cursor_new       (CatalinaStorage      *storage,
+                                                    CatalinaCursorFlags   flags);
+void             catalina_cursor_next_batch_async  (CatalinaCursor       *cursor,
+                                                    guint                 max_items,
+                                                    GAsyncReadyCallback   callback,
+                                                    gpointer              user_data);
+gboolean         catalina_cursor_next_batch_finish (CatalinaCursor       *cursor,
+                                                    GAsyncResult         *result,
+                                                    GArray              **entries,
+                                                    GError              **error);
+gboolean         catalina_cursor_next_batch        (CatalinaCursor       *cursor,
+                                                    guint                 max_items,
+                                                    GArray              **entries,
+                                                    GError              **error);
+void             catalina_cursor_free              (CatalinaCursor       *cursor);
+
+void             catalina_storage_snapshot_new_async  (CatalinaStorage      *storage,
+                                                       GAsyncReadyCallback   callback,
+                                                       gpointer              user_data);
+CatalinaSnapshot*
+                 catalina_storage_snapshot_new_finish (CatalinaStorage      *storage,
+                                                       GAsyncResult         *result,
+                                                       GError              **error);
+CatalinaSnapshot*
+                 catalina_storage_snapshot_new        (CatalinaStorage      *storage,
+                                                       GError              **error);
+void             catalina_snapshot_get_async          (CatalinaSnapshot     *snapshot,
+                                                       const gchar          *key,
+                                                       gssize                key_length,
+                                                       GAsyncReadyCallback   callback,
+                                                       gpointer              user_data);
+gboolean         catalina_snapshot_get_finish         (CatalinaSnapshot     *snapshot,
+                                                       GAsyncResult         *result,
+                                                       gchar               **value,
+                                                       gsize                *value_length,
+                                                       GError              **error);
+gboolean         catalina_snapshot_get                (CatalinaSnapshot     *snapshot,
+                                                       const gchar          *key,
+                                                       gssize                key_length,
+                                                       gchar               **value,
+                                                       gsize                *value_length,
+                                                       GError              **error);
+gboolean         catalina_snapshot_get_value          (CatalinaSnapshot     *snapshot,
+                                                       const gchar          *key,
+                                                       gssize                key_length,
+                                                       GValue               *value,
+                                                       GError              **error);
+void             catalina_snapshot_free               (CatalinaSnapshot     *snapshot);
+
+gboolean         catalina_storage_add_index           (CatalinaStorage      *storage,
+                                                       const gchar          *name,
+                                                       const gchar          *property_name,
+                                                       GError              **error);
+gboolean         catalina_storage_add_index_full      (CatalinaStorage      *storage,
+                                                       const gchar          *name,
+                                                       CatalinaIndexFunc     func,
+                                                       gpointer              func_data,
+                                                       GDestroyNotify        notify,
+                                                       GError              **error);
+gboolean         catalina_storage_remove_index        (CatalinaStorage      *storage,
+                                                       const gchar          *name,
+                                                       GError              **error);
+void             catalina_storage_lookup_index_async  (CatalinaStorage      *storage,
+                                                       const gchar          *name,
+                                                       const GValue         *value,
+                                                       GAsyncReadyCallback   callback,
+                                                       gpointer              user_data);
+gboolean         catalina_storage_lookup_index_finish (CatalinaStorage      *storage,
+                                                       GAsyncResult         *result,
+                                                       GArray              **entries,
+                                                       GError              **error);
+gboolean         catalina_storage_lookup_index        (CatalinaStorage      *storage,
+                                                       const gchar          *name,
+                                                       const GValue         *value,
+                                                       GArray              **entries,
+                                                       GError              **error);
+
+void             catalina_storage_compact_async  (CatalinaStorage      *storage,
+                                                  GAsyncReadyCallback   callback,
+                                                  gpointer              user_data);
+gboolean         catalina_storage_compact_finish (CatalinaStorage      *storage,
+                                                  GAsyncResult         *result,
+                                                  GError              **error);
+gboolean         catalina_storage_compact        (CatalinaStorage      *storage,
+                                                  GError              **error);
+void             catalina_storage_wait_writable_async  (CatalinaStorage      *storage,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
+gboolean         catalina_storage_wait_writable_finish (CatalinaStorage      *storage,
+                                                        GAsyncResult         *result,
+                                                        GError              **error);
+gboolean         catalina_storage_get_space      (CatalinaStorage      *storage,
+                                                  guint64              *size,
+                                                  guint64              *free_size,
+                                                  GError              **error);
+
 G_END_DECLS
 
 #endif /* __CATALINA_STORAGE_H__ */
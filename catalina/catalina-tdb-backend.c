@@ -0,0 +1,1928 @@
+/* catalina-tdb-backend.c
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <tdb.h>
+#include <unistd.h>
+
+#include "catalina-storage.h"
+#include "catalina-tdb-backend.h"
+
+/**
+ * SECTION:catalina-tdb-backend
+ * @title: CatalinaTdbBackend
+ * @short_description: TDB storage engine
+ *
+ * #CatalinaTdbBackend stores records in a TDB data-store.  It is the default backend
+ * of #CatalinaStorage.
+ *
+ * The records are spread over the hash chains of the data-store, which are used as
+ * the partitions for parallel traversal.
+ *
+ * TDB does not order its keys, so a sorted index of them is kept alongside the
+ * data-store to support catalina_backend_scan().  The index is a sorted array loaded
+ * from "<path>.keys" plus an in-memory delta of the keys changed since, which is
+ * folded into the array once it grows.  The key file is written when the backend is
+ * closed and removed while it is open; if it is missing or does not match the
+ * data-store, the index is rebuilt with a single traversal on open.
+ *
+ * The number of hash chains of a TDB data-store is fixed when it is created, so a
+ * data-store that outgrows it walks ever longer chains.  Once the average chain holds
+ * more than #CatalinaTdbBackend:max-chain-length records, the records are copied into
+ * a larger table in "<path>.rehash", a few chains with each write.  Writes are applied
+ * to both tables while the copy runs and reads use the original.  When every chain
+ * has been copied the larger table replaces the data-store.
+ *
+ * The space of deleted records is kept on the free list of the data-store rather
+ * than returned to the file-system.  The bytes held by live records are counted so
+ * that catalina_backend_get_space() can tell how much of the file is free, and
+ * catalina_backend_compact_step() reclaims it with the same copy, into a table of the
+ * same size, a few chains at a time.
+ *
+ * Commits are synced to disk unless catalina_backend_set_sync() turned that off, in
+ * which case catalina_backend_sync() syncs a duplicate of the file descriptor from
+ * another thread.  On Linux this also writes back the pages changed through the
+ * memory map.
+ *
+ * The data-store is opened without locking by default and must then only be used by
+ * a single process.  With #CatalinaTdbBackend:shared set, it is opened with the
+ * fcntl() locks of TDB instead, so that several processes can use it at once.  The
+ * writes of other processes never reach the key index, so it is not kept; scans sort
+ * the keys within their range on each call.  Nor is the data-store rehashed, since
+ * the other processes would keep using the replaced file.
+ *
+ * TDB is not safe to use from several threads at once within a process; its chain
+ * locks are fcntl() locks, which only exclude other processes.  When
+ * catalina_backend_set_concurrent() allows writes alongside readers, each store and
+ * remove holds a lock which excludes the readers and the other writes for the
+ * duration of the write instead, since it may reuse space from the free list or
+ * remap the file as it grows, both of which are shared by every chain.  The stores
+ * themselves are therefore applied one at a time.
+ * Beginning and ending a transaction and each compaction step hold it as well, so
+ * the readers only ever see the data-store in between two calls.  A rehash is not
+ * swapped in while catalina_backend_hold_partitions() is in effect, since it changes
+ * the number of chains.
+ */
+
+static void catalina_tdb_backend_base_init (CatalinaBackendIface *iface);
+
+G_DEFINE_TYPE_EXTENDED (CatalinaTdbBackend,
+                        catalina_tdb_backend,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (CATALINA_TYPE_BACKEND,
+                                               catalina_tdb_backend_base_init))
+
+#define INDEX_MAGIC       0x43544B49U /* "CTKI" */
+#define INDEX_HEADER_SIZE 24
+#define INDEX_DELTA_MIN   4096
+
+#define TDB_DEFAULT_MAX_CHAIN_LENGTH 32
+#define REHASH_CHAINS_PER_STEP       8
+#define REHASH_MAX_HASH_SIZE         (1 << 24)
+#define COMPACT_RECORDS_PER_STEP     4096
+
+/* sizes of the TDB file header, the record header and tailer, and their alignment */
+#define TDB_HEADER_SIZE       168
+#define TDB_RECORD_OVERHEAD   28
+#define TDB_RECORD_SIZE(k,d)  (((TDB_RECORD_OVERHEAD + (k) + (d)) + 3) & ~(guint64)3)
+
+enum
+{
+	PROP_0,
+	PROP_HASH_SIZE,
+	PROP_USE_MMAP,
+	PROP_MAX_CHAIN_LENGTH,
+	PROP_SHARED,
+};
+
+struct _CatalinaTdbBackendPrivate
+{
+	TDB_CONTEXT *db_ctx;
+	gchar       *path;
+
+	gchar       *index_path;   /* sorted key file */
+	gchar       *index_buffer; /* storage of the keys in @index */
+	GArray      *index;        /* sorted IndexKey array */
+	GSequence   *delta;        /* IndexKey changed since @index was built */
+	GSequence   *txn_delta;    /* IndexKey changed by the active transaction */
+	guint        txn_depth;
+
+	guint        hash_size;        /* hash chains of new data-stores */
+	gboolean     use_mmap;
+	guint        max_chain_length; /* average chain length starting a rehash */
+	gint         tdb_flags;        /* flags the data-store was opened with */
+	gboolean     shared;           /* lock for other processes on open */
+	gboolean     locking;          /* @shared when the data-store was opened */
+	GStaticRecMutex read_lock;     /* serializes readers while @locking */
+	gboolean     concurrent;       /* allow concurrent writes on open */
+	gboolean     concurrency;      /* @concurrent when the data-store was opened */
+	GStaticRWLock access_lock;     /* excludes readers from writes while @concurrency */
+
+	TDB_CONTEXT *rehash_ctx;       /* larger table being filled, or NULL */
+	gchar       *rehash_path;
+	guint        rehash_chain;     /* next chain of @db_ctx to copy */
+	guint        rehash_copied;    /* records copied by the current step */
+	gboolean     rehash_failed;
+	volatile gint partitions_held; /* traversals keeping the hash size */
+
+	gboolean     no_sync;          /* commits are not synced to disk */
+	GMutex      *sync_mutex;       /* protects sync_fd */
+	gint         sync_fd;          /* duplicate of the data-store's descriptor */
+
+	guint64      used_size;        /* bytes held by live records */
+	guint64      txn_used_size;    /* @used_size when the transaction began */
+	gboolean     used_valid;       /* if @used_size has been counted */
+};
+
+typedef struct
+{
+	gchar    *key;
+	gsize     key_length;
+	gboolean  removed;
+} IndexKey;
+
+typedef struct
+{
+	CatalinaBackendFunc func;
+	gpointer            user_data;
+} TraverseClosure;
+
+typedef struct
+{
+	CatalinaBackendFunc func;
+	gpointer            user_data;
+	gboolean            proceed;
+} ScanClosure;
+
+#define TDB_DATA_INIT(d,p,l) G_STMT_START { \
+	(d).dptr = (guchar*)(p);                \
+	(d).dsize = (l);                        \
+} G_STMT_END
+
+/* TDB keeps track of the locks it holds within the context, which concurrent readers
+ * would corrupt, so they take turns once locking.  Otherwise the storage excludes the
+ * writers from the readers, unless writes are concurrent; they then hold the access
+ * lock, since a store may move records of any chain through the free list or remap
+ * the file as it grows. */
+#define READ_LOCK(p) G_STMT_START {                          \
+	if ((p)->locking)                                        \
+		g_static_rec_mutex_lock (&(p)->read_lock);           \
+	else if ((p)->concurrency)                               \
+		g_static_rw_lock_reader_lock (&(p)->access_lock);    \
+} G_STMT_END
+
+#define READ_UNLOCK(p) G_STMT_START {                        \
+	if ((p)->locking)                                        \
+		g_static_rec_mutex_unlock (&(p)->read_lock);         \
+	else if ((p)->concurrency)                               \
+		g_static_rw_lock_reader_unlock (&(p)->access_lock);  \
+} G_STMT_END
+
+#define WRITE_LOCK(p) G_STMT_START {                         \
+	if ((p)->concurrency)                                    \
+		g_static_rw_lock_writer_lock (&(p)->access_lock);    \
+} G_STMT_END
+
+#define WRITE_UNLOCK(p) G_STMT_START {                       \
+	if ((p)->concurrency)                                    \
+		g_static_rw_lock_writer_unlock (&(p)->access_lock);  \
+} G_STMT_END
+
+/***************************************************************************
+ *                               Key Index                                 *
+ ***************************************************************************/
+
+static gint
+index_key_compare (gconstpointer a,
+                   gconstpointer b)
+{
+	const IndexKey *ka = a,
+	               *kb = b;
+	gint            ret;
+
+	ret = memcmp (ka->key, kb->key, MIN (ka->key_length, kb->key_length));
+	if (ret == 0)
+		ret = (ka->key_length > kb->key_length) - (ka->key_length < kb->key_length);
+
+	return ret;
+}
+
+static gint
+index_key_compare_data (gconstpointer a,
+                        gconstpointer b,
+                        gpointer      user_data)
+{
+	return index_key_compare (a, b);
+}
+
+static void
+index_key_free (gpointer data)
+{
+	IndexKey *key = data;
+
+	g_free (key->key);
+	g_slice_free (IndexKey, key);
+}
+
+/* The position of the first key in @index not less than @probe. */
+static guint
+index_lower_bound (GArray         *index,
+                   const IndexKey *probe)
+{
+	guint lo = 0,
+	      hi = index->len,
+	      mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (index_key_compare (&g_array_index (index, IndexKey, mid), probe) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* The position of the first key in @delta not less than @probe. */
+static GSequenceIter*
+index_delta_lower_bound (GSequence      *delta,
+                         const IndexKey *probe)
+{
+	GSequenceIter *iter,
+	              *prev;
+
+	/* g_sequence_search() places @iter after an equal item */
+	iter = g_sequence_search (delta, (gpointer)probe, index_key_compare_data, NULL);
+	if (!g_sequence_iter_is_begin (iter)) {
+		prev = g_sequence_iter_prev (iter);
+		if (index_key_compare (g_sequence_get (prev), probe) == 0)
+			return prev;
+	}
+
+	return iter;
+}
+
+static void
+index_delta_put (GSequence   *delta,
+                 const gchar *key,
+                 gsize        key_length,
+                 gboolean     removed)
+{
+	GSequenceIter *iter;
+	IndexKey       probe = { (gchar*)key, key_length, FALSE },
+	              *item;
+
+	iter = index_delta_lower_bound (delta, &probe);
+	if (!g_sequence_iter_is_end (iter)) {
+		item = g_sequence_get (iter);
+		if (index_key_compare (item, &probe) == 0) {
+			item->removed = removed;
+			return;
+		}
+	}
+
+	item = g_slice_new (IndexKey);
+	item->key = g_memdup (key, key_length);
+	item->key_length = key_length;
+	item->removed = removed;
+	g_sequence_insert_before (iter, item);
+}
+
+/* Builds the sorted array over a buffer of length-prefixed keys, which it takes. */
+static void
+index_set_buffer (CatalinaTdbBackendPrivate *priv,
+                  gchar                     *buffer,
+                  gsize                      offset,
+                  gsize                      length)
+{
+	IndexKey key = { NULL, 0, FALSE };
+	guint32  key_length;
+
+	g_free (priv->index_buffer);
+	priv->index_buffer = buffer;
+	g_array_set_size (priv->index, 0);
+
+	while (offset + 4 <= length) {
+		memcpy (&key_length, buffer + offset, 4);
+		key.key_length = GUINT32_FROM_BE (key_length);
+		key.key = buffer + offset + 4;
+		offset += 4 + key.key_length;
+		if (offset > length)
+			break;
+		g_array_append_val (priv->index, key);
+	}
+}
+
+static void
+index_append_key (GByteArray  *buffer,
+                  const gchar *key,
+                  gsize        key_length)
+{
+	guint32 be_length = GUINT32_TO_BE (key_length);
+
+	g_byte_array_append (buffer, (guint8*)&be_length, 4);
+	g_byte_array_append (buffer, (guint8*)key, key_length);
+}
+
+/* Merges the delta into the sorted array. */
+static void
+index_fold (CatalinaTdbBackendPrivate *priv)
+{
+	GSequenceIter *iter;
+	GByteArray    *buffer;
+	IndexKey      *base,
+	              *item;
+	guint          i = 0;
+	gint           cmp;
+
+	buffer = g_byte_array_new ();
+	iter = g_sequence_get_begin_iter (priv->delta);
+
+	while (i < priv->index->len || !g_sequence_iter_is_end (iter)) {
+		base = i < priv->index->len ? &g_array_index (priv->index, IndexKey, i) : NULL;
+		item = g_sequence_iter_is_end (iter) ? NULL : g_sequence_get (iter);
+
+		if (!item)
+			cmp = -1;
+		else if (!base)
+			cmp = 1;
+		else
+			cmp = index_key_compare (base, item);
+
+		if (cmp < 0) {
+			index_append_key (buffer, base->key, base->key_length);
+			i++;
+			continue;
+		}
+
+		if (!item->removed)
+			index_append_key (buffer, item->key, item->key_length);
+		if (cmp == 0)
+			i++;
+		iter = g_sequence_iter_next (iter);
+	}
+
+	g_sequence_remove_range (g_sequence_get_begin_iter (priv->delta),
+	                         g_sequence_get_end_iter (priv->delta));
+
+	i = buffer->len;
+	index_set_buffer (priv, (gchar*)g_byte_array_free (buffer, FALSE), 0, i);
+}
+
+static void
+index_changed (CatalinaTdbBackendPrivate *priv,
+               const gchar               *key,
+               gsize                      key_length,
+               gboolean                   removed)
+{
+	if (!priv->index)
+		return;
+
+	if (priv->txn_depth > 0) {
+		index_delta_put (priv->txn_delta, key, key_length, removed);
+		return;
+	}
+
+	index_delta_put (priv->delta, key, key_length, removed);
+
+	/* fold once the delta is a fraction of the index, keeping it amortized */
+	if ((guint)g_sequence_get_length (priv->delta) >= MAX (INDEX_DELTA_MIN, priv->index->len / 8))
+		index_fold (priv);
+}
+
+static gint
+index_build_cb (TDB_CONTEXT *context,
+                TDB_DATA     key,
+                TDB_DATA     value,
+                gpointer     user_data)
+{
+	index_append_key (user_data, (gchar*)key.dptr, key.dsize);
+	return 0;
+}
+
+static gboolean
+index_stat (const gchar *path,
+            guint64     *size,
+            guint64     *mtime)
+{
+	struct stat st;
+
+	if (stat (path, &st) != 0)
+		return FALSE;
+
+	*size = st.st_size;
+	*mtime = st.st_mtime;
+
+	return TRUE;
+}
+
+/* Loads the key file if it matches the data-store, otherwise rebuilds the index. */
+static void
+index_open (CatalinaTdbBackendPrivate *priv,
+            const gchar               *path)
+{
+	GByteArray *buffer;
+	gchar      *contents = NULL;
+	gsize       length = 0;
+	guint64     size = 0,
+	            mtime = 0,
+	            header [2];
+	guint32     magic;
+
+	priv->path = g_strdup (path);
+	priv->index_path = g_strconcat (path, ".keys", NULL);
+
+	/* the writes of other processes would leave any key file stale */
+	if (priv->locking) {
+		unlink (priv->index_path);
+		return;
+	}
+
+	priv->index = g_array_new (FALSE, FALSE, sizeof (IndexKey));
+	priv->delta = g_sequence_new (index_key_free);
+
+	if (index_stat (path, &size, &mtime) &&
+	    g_file_get_contents (priv->index_path, &contents, &length, NULL) &&
+	    length >= INDEX_HEADER_SIZE)
+	{
+		memcpy (&magic, contents, 4);
+		memcpy (header, contents + 8, 16);
+		if (GUINT32_FROM_BE (magic) == INDEX_MAGIC &&
+		    GUINT64_FROM_BE (header [0]) == size &&
+		    GUINT64_FROM_BE (header [1]) == mtime)
+		{
+			index_set_buffer (priv, contents, INDEX_HEADER_SIZE, length);
+			contents = NULL;
+		}
+	}
+
+	if (contents || !priv->index_buffer) {
+		g_free (contents);
+		buffer = g_byte_array_new ();
+		tdb_traverse (priv->db_ctx, index_build_cb, buffer);
+		length = buffer->len;
+		index_set_buffer (priv, (gchar*)g_byte_array_free (buffer, FALSE), 0, length);
+		g_array_sort (priv->index, index_key_compare);
+	}
+
+	/* a crash while open must not leave a stale key file behind */
+	unlink (priv->index_path);
+}
+
+/* Writes the key file once the data-store is closed, if @save, and frees the index. */
+static void
+index_close (CatalinaTdbBackendPrivate *priv,
+             gboolean                   save)
+{
+	GByteArray *buffer;
+	IndexKey   *key;
+	guint64     size,
+	            mtime,
+	            header [2];
+	guint32     magic = GUINT32_TO_BE (INDEX_MAGIC),
+	            reserved = 0;
+	guint       i;
+
+	if (save && priv->index && priv->txn_depth == 0 &&
+	    index_stat (priv->path, &size, &mtime)) {
+		index_fold (priv);
+
+		header [0] = GUINT64_TO_BE (size);
+		header [1] = GUINT64_TO_BE (mtime);
+
+		buffer = g_byte_array_new ();
+		g_byte_array_append (buffer, (guint8*)&magic, 4);
+		g_byte_array_append (buffer, (guint8*)&reserved, 4);
+		g_byte_array_append (buffer, (guint8*)header, 16);
+		for (i = 0; i < priv->index->len; i++) {
+			key = &g_array_index (priv->index, IndexKey, i);
+			index_append_key (buffer, key->key, key->key_length);
+		}
+
+		g_file_set_contents (priv->index_path, (gchar*)buffer->data, buffer->len, NULL);
+		g_byte_array_free (buffer, TRUE);
+	}
+
+	if (priv->txn_delta) {
+		g_sequence_free (priv->txn_delta);
+		priv->txn_delta = NULL;
+	}
+	priv->txn_depth = 0;
+
+	if (priv->index) {
+		g_sequence_free (priv->delta);
+		priv->delta = NULL;
+		g_array_free (priv->index, TRUE);
+		priv->index = NULL;
+	}
+	g_free (priv->index_buffer);
+	priv->index_buffer = NULL;
+	g_free (priv->index_path);
+	priv->index_path = NULL;
+	g_free (priv->path);
+	priv->path = NULL;
+}
+
+/***************************************************************************
+ *                                  Sync                                   *
+ ***************************************************************************/
+
+/* Keeps a duplicate of the descriptor of @context for catalina_backend_sync(), which
+ * stays valid while the context is replaced or closed by the exclusive worker. */
+static void
+sync_set_context (CatalinaTdbBackendPrivate *priv,
+                  TDB_CONTEXT               *context)
+{
+	g_mutex_lock (priv->sync_mutex);
+
+	if (priv->sync_fd >= 0)
+		close (priv->sync_fd);
+	priv->sync_fd = context ? dup (tdb_fd (context)) : -1;
+
+	g_mutex_unlock (priv->sync_mutex);
+}
+
+/***************************************************************************
+ *                                 Rehash                                  *
+ ***************************************************************************/
+
+/* TDB hashes keys modulo the number of chains, which spreads better over a prime. */
+static guint
+rehash_prime (guint n)
+{
+	guint i;
+
+	for (n |= 1; ; n += 2) {
+		for (i = 3; i * i <= n; i += 2)
+			if (n % i == 0)
+				break;
+		if (i * i > n)
+			return n;
+	}
+}
+
+static void
+rehash_abandon (CatalinaTdbBackendPrivate *priv)
+{
+	if (!priv->rehash_ctx)
+		return;
+
+	tdb_close (priv->rehash_ctx);
+	priv->rehash_ctx = NULL;
+	unlink (priv->rehash_path);
+	g_free (priv->rehash_path);
+	priv->rehash_path = NULL;
+}
+
+static void
+rehash_warn (CatalinaTdbBackendPrivate *priv,
+             const gchar               *reason)
+{
+	g_warning ("Abandoning rehash of %s: %s", priv->path, reason);
+	rehash_abandon (priv);
+}
+
+/* Starts copying the data-store into a table of @hash_size chains. */
+static gboolean
+rehash_start (CatalinaTdbBackendPrivate *priv,
+              guint                      hash_size)
+{
+	priv->rehash_path = g_strconcat (priv->path, ".rehash", NULL);
+	priv->rehash_ctx = tdb_open (priv->rehash_path, hash_size,
+	                             priv->tdb_flags, O_CREAT | O_TRUNC | O_RDWR, 0755);
+	priv->rehash_chain = 0;
+
+	if (!priv->rehash_ctx) {
+		g_warning ("Could not create %s", priv->rehash_path);
+		g_free (priv->rehash_path);
+		priv->rehash_path = NULL;
+		return FALSE;
+	}
+
+	if (priv->no_sync)
+		tdb_add_flags (priv->rehash_ctx, TDB_NOSYNC);
+
+	return TRUE;
+}
+
+/* Starts copying the data-store into a larger table if its chains have grown past
+ * "max-chain-length", or if "hash-size" asks for more chains than it has. */
+static void
+rehash_check (CatalinaTdbBackendPrivate *priv)
+{
+	guint64 n_records,
+	        target = 0;
+	guint   n_chains;
+
+	if (priv->locking || priv->rehash_ctx || priv->txn_depth > 0)
+		return;
+
+	/* the delta may count keys twice, which is close enough to decide */
+	n_chains = tdb_hash_size (priv->db_ctx);
+	n_records = priv->index->len + g_sequence_get_length (priv->delta);
+
+	if (priv->hash_size > n_chains)
+		target = priv->hash_size;
+
+	/* grow to a quarter of the limit so the rehash is not repeated soon after */
+	if (priv->max_chain_length && n_records / n_chains >= priv->max_chain_length)
+		target = MAX (target, n_records * 4 / priv->max_chain_length);
+
+	if (target <= n_chains || n_chains >= REHASH_MAX_HASH_SIZE)
+		return;
+
+	rehash_start (priv, rehash_prime (MIN (target, REHASH_MAX_HASH_SIZE)));
+}
+
+static gint
+rehash_copy_cb (TDB_CONTEXT *context,
+                TDB_DATA     key,
+                TDB_DATA     value,
+                gpointer     user_data)
+{
+	CatalinaTdbBackendPrivate *priv = user_data;
+
+	/* keys written since the copy started are already current */
+	if (tdb_store (priv->rehash_ctx, key, value, TDB_INSERT) != 0 &&
+	    tdb_error (priv->rehash_ctx) != TDB_ERR_EXISTS)
+	{
+		priv->rehash_failed = TRUE;
+		return -1;
+	}
+
+	priv->rehash_copied++;
+
+	return 0;
+}
+
+/* Copies up to @max_chains chains, stopping early once @max_records records have been
+ * copied, and replaces the data-store with the new table once every chain is copied.
+ * Readers are excluded while writing, so swapping the context here is not observed
+ * half-way.  Returns %FALSE if the copy had to be abandoned. */
+static gboolean
+rehash_step (CatalinaTdbBackendPrivate *priv,
+             guint                      max_chains,
+             guint                      max_records)
+{
+	guint n_chains,
+	      i;
+
+	if (!priv->rehash_ctx || priv->txn_depth > 0)
+		return TRUE;
+
+	n_chains = tdb_hash_size (priv->db_ctx);
+	priv->rehash_failed = FALSE;
+	priv->rehash_copied = 0;
+
+	for (i = 0; i < max_chains && priv->rehash_chain < n_chains &&
+	            priv->rehash_copied < max_records; i++) {
+		tdb_traverse_chain (priv->db_ctx, priv->rehash_chain++, rehash_copy_cb, priv);
+		if (priv->rehash_failed) {
+			rehash_warn (priv, tdb_errorstr (priv->rehash_ctx));
+			return FALSE;
+		}
+	}
+
+	if (priv->rehash_chain < n_chains)
+		return TRUE;
+
+	/* a traversal of the partitions is running, the writes keep the copy current
+	 * until a later step can swap it in */
+	if (tdb_hash_size (priv->rehash_ctx) != n_chains &&
+	    g_atomic_int_get (&priv->partitions_held) > 0)
+		return TRUE;
+
+	/* the new table must be on disk before it replaces the data-store */
+	if (fsync (tdb_fd (priv->rehash_ctx)) != 0 ||
+	    rename (priv->rehash_path, priv->path) != 0) {
+		rehash_warn (priv, g_strerror (errno));
+		return FALSE;
+	}
+
+	tdb_close (priv->db_ctx);
+	priv->db_ctx = priv->rehash_ctx;
+	priv->rehash_ctx = NULL;
+	sync_set_context (priv, priv->db_ctx);
+	g_free (priv->rehash_path);
+	priv->rehash_path = NULL;
+
+	return TRUE;
+}
+
+/***************************************************************************
+ *                               Space Usage                               *
+ ***************************************************************************/
+
+static gint
+used_size_cb (TDB_CONTEXT *context,
+              TDB_DATA     key,
+              TDB_DATA     value,
+              gpointer     user_data)
+{
+	*(guint64*)user_data += TDB_RECORD_SIZE (key.dsize, value.dsize);
+	return 0;
+}
+
+static gint
+used_size_parser (TDB_DATA  key,
+                  TDB_DATA  data,
+                  gpointer  user_data)
+{
+	*(guint64*)user_data = TDB_RECORD_SIZE (key.dsize, data.dsize);
+	return 0;
+}
+
+/* The bytes held by the record of @db_key, or 0 if there is none. */
+static guint64
+used_size_of (CatalinaTdbBackendPrivate *priv,
+              TDB_DATA                   db_key)
+{
+	guint64 size = 0;
+
+	tdb_parse_record (priv->db_ctx, db_key, used_size_parser, &size);
+	return size;
+}
+
+/***************************************************************************
+ *                                 Object                                  *
+ ***************************************************************************/
+
+static void
+catalina_tdb_backend_get_property (GObject    *object,
+                                   guint       property_id,
+                                   GValue     *value,
+                                   GParamSpec *pspec)
+{
+	switch (property_id) {
+	case PROP_HASH_SIZE:
+		g_value_set_uint (value, catalina_tdb_backend_get_hash_size ((gpointer)object));
+		break;
+	case PROP_USE_MMAP:
+		g_value_set_boolean (value, catalina_tdb_backend_get_use_mmap ((gpointer)object));
+		break;
+	case PROP_MAX_CHAIN_LENGTH:
+		g_value_set_uint (value, catalina_tdb_backend_get_max_chain_length ((gpointer)object));
+		break;
+	case PROP_SHARED:
+		g_value_set_boolean (value, catalina_tdb_backend_get_shared ((gpointer)object));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+	}
+}
+
+static void
+catalina_tdb_backend_set_property (GObject      *object,
+                                   guint         property_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+	switch (property_id) {
+	case PROP_HASH_SIZE:
+		catalina_tdb_backend_set_hash_size ((gpointer)object, g_value_get_uint (value));
+		break;
+	case PROP_USE_MMAP:
+		catalina_tdb_backend_set_use_mmap ((gpointer)object, g_value_get_boolean (value));
+		break;
+	case PROP_MAX_CHAIN_LENGTH:
+		catalina_tdb_backend_set_max_chain_length ((gpointer)object, g_value_get_uint (value));
+		break;
+	case PROP_SHARED:
+		catalina_tdb_backend_set_shared ((gpointer)object, g_value_get_boolean (value));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+	}
+}
+
+static void
+catalina_tdb_backend_finalize (GObject *object)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (object)->priv;
+
+	if (priv->db_ctx)
+		catalina_backend_close (CATALINA_BACKEND (object), NULL);
+
+	g_mutex_free (priv->sync_mutex);
+	g_static_rec_mutex_free (&priv->read_lock);
+	g_static_rw_lock_free (&priv->access_lock);
+
+	G_OBJECT_CLASS (catalina_tdb_backend_parent_class)->finalize (object);
+}
+
+static void
+catalina_tdb_backend_class_init (CatalinaTdbBackendClass *klass)
+{
+	GObjectClass *object_class;
+
+	g_type_class_add_private (klass, sizeof (CatalinaTdbBackendPrivate));
+
+	object_class = G_OBJECT_CLASS (klass);
+	object_class->set_property = catalina_tdb_backend_set_property;
+	object_class->get_property = catalina_tdb_backend_get_property;
+	object_class->finalize     = catalina_tdb_backend_finalize;
+
+	/**
+	 * CatalinaTdbBackend:hash-size:
+	 *
+	 * The "hash-size" property.  The number of hash chains of newly created
+	 * data-stores, or 0 for the TDB default of 131.  Opening an existing data-store
+	 * with fewer chains copies it into a table of this size in the background.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_HASH_SIZE,
+	                                 g_param_spec_uint ("hash-size",
+	                                                    "HashSize",
+	                                                    "Number of hash chains.",
+	                                                    0,
+	                                                    REHASH_MAX_HASH_SIZE,
+	                                                    0,
+	                                                    G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaTdbBackend:use-mmap:
+	 *
+	 * The "use-mmap" property.  If the data-store is mapped into memory rather than
+	 * accessed with read() and write().  Takes effect when the data-store is opened.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_USE_MMAP,
+	                                 g_param_spec_boolean ("use-mmap",
+	                                                       "UseMmap",
+	                                                       "Map the data-store into "
+	                                                       "memory.",
+	                                                       TRUE,
+	                                                       G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaTdbBackend:max-chain-length:
+	 *
+	 * The "max-chain-length" property.  Once the average hash chain holds this many
+	 * records, the data-store is copied into a table with enough chains to bring the
+	 * average down to a quarter of it.  Zero disables the rehash.
+	 *
+	 * See catalina_tdb_backend_get_chain_stats().
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_MAX_CHAIN_LENGTH,
+	                                 g_param_spec_uint ("max-chain-length",
+	                                                    "MaxChainLength",
+	                                                    "Average chain length "
+	                                                    "starting a rehash.",
+	                                                    0,
+	                                                    G_MAXUINT,
+	                                                    TDB_DEFAULT_MAX_CHAIN_LENGTH,
+	                                                    G_PARAM_READWRITE));
+
+	/**
+	 * CatalinaTdbBackend:shared:
+	 *
+	 * The "shared" property.  If the data-store is opened with locking, so that other
+	 * processes may use it at the same time.  Every process using the data-store must
+	 * set it.  Takes effect when the data-store is opened.
+	 */
+	g_object_class_install_property (object_class,
+	                                 PROP_SHARED,
+	                                 g_param_spec_boolean ("shared",
+	                                                       "Shared",
+	                                                       "Share the data-store with "
+	                                                       "other processes.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE));
+}
+
+static void
+catalina_tdb_backend_init (CatalinaTdbBackend *backend)
+{
+	backend->priv = G_TYPE_INSTANCE_GET_PRIVATE (backend,
+	                                             CATALINA_TYPE_TDB_BACKEND,
+	                                             CatalinaTdbBackendPrivate);
+	backend->priv->use_mmap = TRUE;
+	backend->priv->max_chain_length = TDB_DEFAULT_MAX_CHAIN_LENGTH;
+	backend->priv->sync_mutex = g_mutex_new ();
+	backend->priv->sync_fd = -1;
+	g_static_rec_mutex_init (&backend->priv->read_lock);
+	g_static_rw_lock_init (&backend->priv->access_lock);
+}
+
+/**
+ * catalina_tdb_backend_new:
+ *
+ * Creates a new instance of #CatalinaTdbBackend.
+ *
+ * Return value: the newly created #CatalinaTdbBackend instance
+ */
+CatalinaBackend*
+catalina_tdb_backend_new (void)
+{
+	return g_object_new (CATALINA_TYPE_TDB_BACKEND, NULL);
+}
+
+/**
+ * catalina_tdb_backend_get_hash_size:
+ * @backend: A #CatalinaTdbBackend
+ *
+ * Retrieves the "hash-size" property.
+ *
+ * Return value: the number of hash chains of new data-stores, or 0 for the default
+ */
+guint
+catalina_tdb_backend_get_hash_size (CatalinaTdbBackend *backend)
+{
+	g_return_val_if_fail (CATALINA_IS_TDB_BACKEND (backend), 0);
+	return backend->priv->hash_size;
+}
+
+/**
+ * catalina_tdb_backend_set_hash_size:
+ * @backend: A #CatalinaTdbBackend
+ * @hash_size: the number of hash chains, or 0 for the default
+ *
+ * Sets the "hash-size" property.  This should be set before the data-store is opened.
+ */
+void
+catalina_tdb_backend_set_hash_size (CatalinaTdbBackend *backend,
+                                    guint               hash_size)
+{
+	g_return_if_fail (CATALINA_IS_TDB_BACKEND (backend));
+	backend->priv->hash_size = hash_size;
+	g_object_notify (G_OBJECT (backend), "hash-size");
+}
+
+/**
+ * catalina_tdb_backend_get_use_mmap:
+ * @backend: A #CatalinaTdbBackend
+ *
+ * Retrieves the "use-mmap" property.
+ *
+ * Return value: %TRUE if the data-store is mapped into memory
+ */
+gboolean
+catalina_tdb_backend_get_use_mmap (CatalinaTdbBackend *backend)
+{
+	g_return_val_if_fail (CATALINA_IS_TDB_BACKEND (backend), FALSE);
+	return backend->priv->use_mmap;
+}
+
+/**
+ * catalina_tdb_backend_set_use_mmap:
+ * @backend: A #CatalinaTdbBackend
+ * @use_mmap: if the data-store should be mapped into memory
+ *
+ * Sets the "use-mmap" property.  This should be set before the data-store is opened.
+ */
+void
+catalina_tdb_backend_set_use_mmap (CatalinaTdbBackend *backend,
+                                   gboolean            use_mmap)
+{
+	g_return_if_fail (CATALINA_IS_TDB_BACKEND (backend));
+	backend->priv->use_mmap = use_mmap;
+	g_object_notify (G_OBJECT (backend), "use-mmap");
+}
+
+/**
+ * catalina_tdb_backend_get_max_chain_length:
+ * @backend: A #CatalinaTdbBackend
+ *
+ * Retrieves the "max-chain-length" property.
+ *
+ * Return value: the average chain length starting a rehash, or 0
+ */
+guint
+catalina_tdb_backend_get_max_chain_length (CatalinaTdbBackend *backend)
+{
+	g_return_val_if_fail (CATALINA_IS_TDB_BACKEND (backend), 0);
+	return backend->priv->max_chain_length;
+}
+
+/**
+ * catalina_tdb_backend_set_max_chain_length:
+ * @backend: A #CatalinaTdbBackend
+ * @max_chain_length: the average chain length starting a rehash, or 0 to disable it
+ *
+ * Sets the "max-chain-length" property.
+ */
+void
+catalina_tdb_backend_set_max_chain_length (CatalinaTdbBackend *backend,
+                                           guint               max_chain_length)
+{
+	g_return_if_fail (CATALINA_IS_TDB_BACKEND (backend));
+	backend->priv->max_chain_length = max_chain_length;
+	g_object_notify (G_OBJECT (backend), "max-chain-length");
+}
+
+/**
+ * catalina_tdb_backend_get_shared:
+ * @backend: A #CatalinaTdbBackend
+ *
+ * Retrieves the "shared" property.
+ *
+ * Return value: %TRUE if the data-store is opened for use by several processes
+ */
+gboolean
+catalina_tdb_backend_get_shared (CatalinaTdbBackend *backend)
+{
+	g_return_val_if_fail (CATALINA_IS_TDB_BACKEND (backend), FALSE);
+	return backend->priv->shared;
+}
+
+/**
+ * catalina_tdb_backend_set_shared:
+ * @backend: A #CatalinaTdbBackend
+ * @shared: if the data-store is opened for use by several processes
+ *
+ * Sets the "shared" property.  This must be set before the data-store is opened.
+ */
+void
+catalina_tdb_backend_set_shared (CatalinaTdbBackend *backend,
+                                 gboolean            shared)
+{
+	g_return_if_fail (CATALINA_IS_TDB_BACKEND (backend));
+	backend->priv->shared = shared;
+	g_object_notify (G_OBJECT (backend), "shared");
+}
+
+static gint
+chain_stats_cb (TDB_CONTEXT *context,
+                TDB_DATA     key,
+                TDB_DATA     value,
+                gpointer     user_data)
+{
+	(*(guint*)user_data)++;
+	return 0;
+}
+
+/**
+ * catalina_tdb_backend_get_chain_stats:
+ * @backend: A #CatalinaTdbBackend
+ * @n_chains: A location for the number of hash chains, or %NULL
+ * @n_records: A location for the number of records, or %NULL
+ * @longest_chain: A location for the length of the longest chain, or %NULL
+ *
+ * Walks every hash chain of the open data-store to describe how the records are
+ * spread over them.  The average number of records a lookup walks is @n_records
+ * divided by @n_chains.  This reads the whole data-store and must not run while it is
+ * being written to.
+ */
+void
+catalina_tdb_backend_get_chain_stats (CatalinaTdbBackend *backend,
+                                      guint              *n_chains,
+                                      guint              *n_records,
+                                      guint              *longest_chain)
+{
+	CatalinaTdbBackendPrivate *priv;
+	guint                      n_hash,
+	                           total = 0,
+	                           longest = 0,
+	                           length,
+	                           i;
+
+	g_return_if_fail (CATALINA_IS_TDB_BACKEND (backend));
+	g_return_if_fail (backend->priv->db_ctx != NULL);
+
+	priv = backend->priv;
+	n_hash = tdb_hash_size (priv->db_ctx);
+
+	READ_LOCK (priv);
+	for (i = 0; i < n_hash; i++) {
+		length = 0;
+		tdb_traverse_chain (priv->db_ctx, i, chain_stats_cb, &length);
+		total += length;
+		longest = MAX (longest, length);
+	}
+	READ_UNLOCK (priv);
+
+	if (n_chains)
+		*n_chains = n_hash;
+	if (n_records)
+		*n_records = total;
+	if (longest_chain)
+		*longest_chain = longest;
+}
+
+static gboolean
+catalina_tdb_backend_real_open (CatalinaBackend  *backend,
+                                const gchar      *path,
+                                GError          **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	gint                       tdb_flags;
+
+	/* always store in big-endian */
+	tdb_flags  = (G_BYTE_ORDER == G_LITTLE_ENDIAN) ? TDB_CONVERT : 0;
+	if (!priv->shared)
+		tdb_flags |= TDB_NOLOCK;
+	if (!priv->use_mmap)
+		tdb_flags |= TDB_NOMMAP;
+
+	/* the hash size is ignored for existing data-stores */
+	if (!(priv->db_ctx = tdb_open (path, priv->hash_size, tdb_flags, O_CREAT | O_RDWR, 0755))) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not open the database");
+		return FALSE;
+	}
+
+	priv->tdb_flags = tdb_flags;
+	priv->locking = priv->shared;
+	priv->concurrency = priv->concurrent && !priv->locking;
+	if (priv->no_sync)
+		tdb_add_flags (priv->db_ctx, TDB_NOSYNC);
+	sync_set_context (priv, priv->db_ctx);
+	index_open (priv, path);
+	rehash_check (priv);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_tdb_backend_real_close (CatalinaBackend  *backend,
+                                 GError          **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	gint                       ret;
+
+	/* an unfinished copy is started over once the data-store is opened again */
+	rehash_abandon (priv);
+	sync_set_context (priv, NULL);
+
+	ret = tdb_close (priv->db_ctx);
+	priv->db_ctx = NULL;
+
+	index_close (priv, ret == 0);
+	priv->used_size = 0;
+	priv->used_valid = FALSE;
+
+	if (ret != 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "There was an error closing the storage: (%d)",
+		             ret);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+catalina_tdb_backend_real_fetch (CatalinaBackend  *backend,
+                                 const gchar      *key,
+                                 gsize             key_length,
+                                 gchar           **data,
+                                 gsize            *data_length)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	TDB_DATA                   db_key,
+	                           db_value;
+
+	TDB_DATA_INIT (db_key, key, key_length);
+	READ_LOCK (priv);
+	db_value = tdb_fetch (priv->db_ctx, db_key);
+	READ_UNLOCK (priv);
+
+	*data = (gchar*)db_value.dptr;
+	*data_length = db_value.dsize;
+
+	return (db_value.dptr != NULL);
+}
+
+static gint
+catalina_tdb_backend_parser (TDB_DATA  key,
+                             TDB_DATA  data,
+                             gpointer  user_data)
+{
+	TraverseClosure *closure = user_data;
+
+	closure->func ((gchar*)key.dptr, key.dsize,
+	               (gchar*)data.dptr, data.dsize,
+	               closure->user_data);
+
+	return 0;
+}
+
+static gboolean
+catalina_tdb_backend_real_parse (CatalinaBackend     *backend,
+                                 const gchar         *key,
+                                 gsize                key_length,
+                                 CatalinaBackendFunc  func,
+                                 gpointer             user_data)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	TraverseClosure            closure = { func, user_data };
+	TDB_DATA                   db_key;
+	gint                       ret;
+
+	TDB_DATA_INIT (db_key, key, key_length);
+
+	READ_LOCK (priv);
+	ret = tdb_parse_record (priv->db_ctx, db_key, catalina_tdb_backend_parser, &closure);
+	READ_UNLOCK (priv);
+
+	return ret == 0;
+}
+
+static gboolean
+catalina_tdb_backend_real_store (CatalinaBackend  *backend,
+                                 const gchar      *key,
+                                 gsize             key_length,
+                                 const gchar      *data,
+                                 gsize             data_length,
+                                 GError          **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	TDB_DATA                   db_key,
+	                           db_value;
+	guint64                    old_size = 0;
+
+	TDB_DATA_INIT (db_key, key, key_length);
+	TDB_DATA_INIT (db_value, data, data_length);
+
+	WRITE_LOCK (priv);
+
+	/* the space is only counted once it has been asked for */
+	if (priv->used_valid)
+		old_size = used_size_of (priv, db_key);
+
+	if (tdb_store (priv->db_ctx, db_key, db_value, TDB_REPLACE) != 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "tdb_store: %s",
+		             tdb_errorstr (priv->db_ctx));
+		WRITE_UNLOCK (priv);
+		return FALSE;
+	}
+
+	index_changed (priv, key, key_length, FALSE);
+	priv->used_size += TDB_RECORD_SIZE (key_length, data_length) - old_size;
+
+	if (priv->rehash_ctx &&
+	    tdb_store (priv->rehash_ctx, db_key, db_value, TDB_REPLACE) != 0)
+		rehash_warn (priv, tdb_errorstr (priv->rehash_ctx));
+
+	rehash_check (priv);
+	rehash_step (priv, REHASH_CHAINS_PER_STEP, G_MAXUINT);
+
+	WRITE_UNLOCK (priv);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_tdb_backend_real_remove (CatalinaBackend  *backend,
+                                  const gchar      *key,
+                                  gsize             key_length,
+                                  GError          **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	TDB_DATA                   db_key;
+	guint64                    old_size = 0;
+
+	TDB_DATA_INIT (db_key, key, key_length);
+
+	WRITE_LOCK (priv);
+
+	if (priv->used_valid)
+		old_size = used_size_of (priv, db_key);
+
+	if (tdb_delete (priv->db_ctx, db_key) != 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             tdb_error (priv->db_ctx) == TDB_ERR_NOEXIST ?
+		                 CATALINA_STORAGE_ERROR_NO_SUCH_KEY :
+		                 CATALINA_STORAGE_ERROR_DB,
+		             "tdb_delete: %s",
+		             tdb_errorstr (priv->db_ctx));
+		WRITE_UNLOCK (priv);
+		return FALSE;
+	}
+
+	index_changed (priv, key, key_length, TRUE);
+	priv->used_size -= MIN (old_size, priv->used_size);
+
+	if (priv->rehash_ctx && tdb_delete (priv->rehash_ctx, db_key) != 0 &&
+	    tdb_error (priv->rehash_ctx) != TDB_ERR_NOEXIST)
+		rehash_warn (priv, tdb_errorstr (priv->rehash_ctx));
+
+	rehash_step (priv, REHASH_CHAINS_PER_STEP, G_MAXUINT);
+
+	WRITE_UNLOCK (priv);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_tdb_backend_real_next_key (CatalinaBackend  *backend,
+                                    const gchar      *key,
+                                    gsize             key_length,
+                                    gchar           **next_key,
+                                    gsize            *next_key_length)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	TDB_DATA                   db_key,
+	                           db_next;
+
+	READ_LOCK (priv);
+	if (key) {
+		TDB_DATA_INIT (db_key, key, key_length);
+		db_next = tdb_nextkey (priv->db_ctx, db_key);
+	}
+	else
+		db_next = tdb_firstkey (priv->db_ctx);
+	READ_UNLOCK (priv);
+
+	*next_key = (gchar*)db_next.dptr;
+	*next_key_length = db_next.dsize;
+
+	return (db_next.dptr != NULL);
+}
+
+static gint
+catalina_tdb_backend_traverse_cb (TDB_CONTEXT *context,
+                                  TDB_DATA     key,
+                                  TDB_DATA     value,
+                                  gpointer     user_data)
+{
+	TraverseClosure *closure = user_data;
+
+	return closure->func ((gchar*)key.dptr, key.dsize,
+	                      (gchar*)value.dptr, value.dsize,
+	                      closure->user_data) ? 0 : -1;
+}
+
+static gboolean
+catalina_tdb_backend_real_traverse (CatalinaBackend      *backend,
+                                    CatalinaBackendFunc   func,
+                                    gpointer              user_data,
+                                    GError              **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	TraverseClosure            closure = { func, user_data };
+	gint                       ret;
+
+	READ_LOCK (priv);
+	ret = tdb_traverse (priv->db_ctx, catalina_tdb_backend_traverse_cb, &closure);
+	READ_UNLOCK (priv);
+
+	if (ret < 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "tdb_traverse: %s",
+		             tdb_errorstr (priv->db_ctx));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static guint
+catalina_tdb_backend_real_get_n_partitions (CatalinaBackend *backend)
+{
+	return tdb_hash_size (CATALINA_TDB_BACKEND (backend)->priv->db_ctx);
+}
+
+static gboolean
+catalina_tdb_backend_real_traverse_partition (CatalinaBackend      *backend,
+                                              guint                 partition,
+                                              CatalinaBackendFunc   func,
+                                              gpointer              user_data,
+                                              GError              **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	TraverseClosure            closure = { func, user_data };
+	gboolean                   success = TRUE;
+
+	/* each partition is a single hash chain */
+	READ_LOCK (priv);
+	if (tdb_traverse_chain (priv->db_ctx, partition,
+	                        catalina_tdb_backend_traverse_cb, &closure) < 0
+	    && tdb_error (priv->db_ctx) != TDB_SUCCESS) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "tdb_traverse_chain: %s",
+		             tdb_errorstr (priv->db_ctx));
+		success = FALSE;
+	}
+	READ_UNLOCK (priv);
+
+	return success;
+}
+
+static gboolean
+catalina_tdb_backend_real_transaction_begin (CatalinaBackend  *backend,
+                                             GError          **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+
+	WRITE_LOCK (priv);
+
+	if (G_UNLIKELY (tdb_transaction_start (priv->db_ctx) != 0)) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Tdb could not start a new transaction");
+		WRITE_UNLOCK (priv);
+		return FALSE;
+	}
+
+	if (priv->txn_depth++ == 0) {
+		priv->txn_delta = g_sequence_new (index_key_free);
+		priv->txn_used_size = priv->used_size;
+	}
+
+	/* the larger table follows the transaction so that both agree once it ends */
+	if (priv->rehash_ctx && tdb_transaction_start (priv->rehash_ctx) != 0)
+		rehash_warn (priv, tdb_errorstr (priv->rehash_ctx));
+
+	WRITE_UNLOCK (priv);
+
+	return TRUE;
+}
+
+/* Ends a transaction in the index, applying its changes if @commit. */
+static void
+index_transaction_end (CatalinaTdbBackendPrivate *priv,
+                       gboolean                   commit)
+{
+	GSequenceIter *iter;
+	GSequence     *txn_delta;
+	IndexKey      *item;
+
+	if (priv->txn_depth == 0 || --priv->txn_depth > 0)
+		return;
+
+	txn_delta = priv->txn_delta;
+	priv->txn_delta = NULL;
+
+	if (commit) {
+		for (iter = g_sequence_get_begin_iter (txn_delta);
+		     !g_sequence_iter_is_end (iter);
+		     iter = g_sequence_iter_next (iter))
+		{
+			item = g_sequence_get (iter);
+			index_changed (priv, item->key, item->key_length, item->removed);
+		}
+	}
+	else
+		priv->used_size = priv->txn_used_size;
+
+	g_sequence_free (txn_delta);
+}
+
+static gboolean
+catalina_tdb_backend_real_transaction_commit (CatalinaBackend  *backend,
+                                              GError          **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+
+	WRITE_LOCK (priv);
+
+	if (tdb_transaction_commit (priv->db_ctx) != 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Cannot commit txn: %s",
+		             tdb_errorstr (priv->db_ctx));
+		tdb_transaction_recover (priv->db_ctx);
+		priv->txn_depth = MIN (priv->txn_depth, 1);
+		index_transaction_end (priv, FALSE);
+		rehash_abandon (priv);
+		WRITE_UNLOCK (priv);
+		return FALSE;
+	}
+
+	if (priv->rehash_ctx && tdb_transaction_commit (priv->rehash_ctx) != 0)
+		rehash_warn (priv, tdb_errorstr (priv->rehash_ctx));
+
+	index_transaction_end (priv, TRUE);
+
+	WRITE_UNLOCK (priv);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_tdb_backend_real_transaction_cancel (CatalinaBackend  *backend,
+                                              GError          **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+
+	WRITE_LOCK (priv);
+
+	if (tdb_transaction_cancel (priv->db_ctx) != 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Cannot cancel txn: %s",
+		             tdb_errorstr (priv->db_ctx));
+		WRITE_UNLOCK (priv);
+		return FALSE;
+	}
+
+	if (priv->rehash_ctx && tdb_transaction_cancel (priv->rehash_ctx) != 0)
+		rehash_warn (priv, tdb_errorstr (priv->rehash_ctx));
+
+	index_transaction_end (priv, FALSE);
+
+	WRITE_UNLOCK (priv);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_tdb_backend_real_compact (CatalinaBackend  *backend,
+                                   GError          **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+
+	/* rewrites the data-store so the space of deleted records is returned to the
+	 * file-system rather than the free list. */
+	WRITE_LOCK (priv);
+	if (tdb_repack (priv->db_ctx) != 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not reclaim free space: %s",
+		             tdb_errorstr (priv->db_ctx));
+		WRITE_UNLOCK (priv);
+		return FALSE;
+	}
+	WRITE_UNLOCK (priv);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_tdb_backend_real_get_space (CatalinaBackend *backend,
+                                     guint64         *size,
+                                     guint64         *free_size)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	guint64                    file_size,
+	                           mtime,
+	                           overhead;
+
+	/* the live bytes cannot be followed across the writes of other processes */
+	if (priv->locking || !index_stat (priv->path, &file_size, &mtime))
+		return FALSE;
+
+	/* counted with a single traversal, then kept up to date by every write */
+	if (!priv->used_valid) {
+		priv->used_size = 0;
+		tdb_traverse (priv->db_ctx, used_size_cb, &priv->used_size);
+		priv->txn_used_size = priv->used_size;
+		priv->used_valid = TRUE;
+	}
+
+	overhead = TDB_HEADER_SIZE + 4 * ((guint64)tdb_hash_size (priv->db_ctx) + 1);
+
+	*size = file_size;
+	*free_size = file_size > priv->used_size + overhead ?
+	             file_size - priv->used_size - overhead : 0;
+
+	return TRUE;
+}
+
+/* Copies the data-store into a table of the same size, which leaves the free list
+ * behind.  Each step copies whole chains until a few thousand records are copied, so a
+ * large data-store is not held up for the whole copy.  A rehash already under way is
+ * continued instead, since it compacts just as well. */
+static gboolean
+catalina_tdb_backend_real_compact_step (CatalinaBackend  *backend,
+                                        gboolean         *done,
+                                        GError          **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+
+	if (priv->txn_depth > 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_STATE,
+		             "Cannot compact during a transaction");
+		return FALSE;
+	}
+
+	/* other processes would keep using a copy swapped in, tdb_repack() locks them out */
+	if (priv->locking) {
+		*done = TRUE;
+		return catalina_tdb_backend_real_compact (backend, error);
+	}
+
+	WRITE_LOCK (priv);
+
+	if (!priv->rehash_ctx && !rehash_start (priv, tdb_hash_size (priv->db_ctx))) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not create the compacted copy");
+		WRITE_UNLOCK (priv);
+		return FALSE;
+	}
+
+	if (!rehash_step (priv, G_MAXUINT, COMPACT_RECORDS_PER_STEP)) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not copy the records into the compacted copy");
+		WRITE_UNLOCK (priv);
+		return FALSE;
+	}
+
+	*done = (priv->rehash_ctx == NULL);
+
+	WRITE_UNLOCK (priv);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_tdb_backend_real_set_sync (CatalinaBackend *backend,
+                                    gboolean         sync)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	TDB_CONTEXT               *contexts [2] = { priv->db_ctx, priv->rehash_ctx };
+	guint                      i;
+
+	priv->no_sync = !sync;
+
+	for (i = 0; i < G_N_ELEMENTS (contexts); i++) {
+		if (!contexts [i])
+			continue;
+		if (sync)
+			tdb_remove_flags (contexts [i], TDB_NOSYNC);
+		else
+			tdb_add_flags (contexts [i], TDB_NOSYNC);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+catalina_tdb_backend_real_sync (CatalinaBackend  *backend,
+                                GError          **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	gint                       fd,
+	                           ret;
+
+	g_mutex_lock (priv->sync_mutex);
+	fd = priv->sync_fd >= 0 ? dup (priv->sync_fd) : -1;
+	g_mutex_unlock (priv->sync_mutex);
+
+	/* not open, so there is nothing to sync */
+	if (fd < 0)
+		return TRUE;
+
+	ret = fsync (fd);
+	close (fd);
+
+	if (ret != 0) {
+		g_set_error (error, CATALINA_STORAGE_ERROR,
+		             CATALINA_STORAGE_ERROR_DB,
+		             "Could not sync the data-store: %s",
+		             g_strerror (errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gint
+catalina_tdb_backend_scan_parser (TDB_DATA  key,
+                                  TDB_DATA  data,
+                                  gpointer  user_data)
+{
+	ScanClosure *closure = user_data;
+
+	closure->proceed = closure->func ((gchar*)key.dptr, key.dsize,
+	                                  (gchar*)data.dptr, data.dsize,
+	                                  closure->user_data);
+
+	return 0;
+}
+
+typedef struct
+{
+	GArray         *keys;
+	const IndexKey *start;
+	const IndexKey *end;
+} ScanCollect;
+
+static gint
+scan_collect_cb (TDB_CONTEXT *context,
+                 TDB_DATA     key,
+                 TDB_DATA     value,
+                 gpointer     user_data)
+{
+	ScanCollect *collect = user_data;
+	IndexKey     item = { (gchar*)key.dptr, key.dsize, FALSE };
+
+	if ((collect->start && index_key_compare (&item, collect->start) < 0) ||
+	    (collect->end && index_key_compare (&item, collect->end) >= 0))
+		return 0;
+
+	item.key = g_memdup (key.dptr, key.dsize);
+	g_array_append_val (collect->keys, item);
+
+	return 0;
+}
+
+/* Scans without the key index, collecting and sorting the keys within the range
+ * first.  Records removed by another process meanwhile are skipped by the parse. */
+static gboolean
+scan_unindexed (CatalinaTdbBackendPrivate *priv,
+                ScanClosure               *closure,
+                const IndexKey            *start,
+                const IndexKey            *end)
+{
+	ScanCollect  collect = { NULL, start, end };
+	IndexKey    *key;
+	TDB_DATA     db_key;
+	guint        i;
+
+	collect.keys = g_array_new (FALSE, FALSE, sizeof (IndexKey));
+
+	READ_LOCK (priv);
+	tdb_traverse_read (priv->db_ctx, scan_collect_cb, &collect);
+	g_array_sort (collect.keys, index_key_compare);
+
+	for (i = 0; i < collect.keys->len && closure->proceed; i++) {
+		key = &g_array_index (collect.keys, IndexKey, i);
+		TDB_DATA_INIT (db_key, key->key, key->key_length);
+		tdb_parse_record (priv->db_ctx, db_key,
+		                  catalina_tdb_backend_scan_parser, closure);
+	}
+	READ_UNLOCK (priv);
+
+	for (i = 0; i < collect.keys->len; i++)
+		g_free (g_array_index (collect.keys, IndexKey, i).key);
+	g_array_free (collect.keys, TRUE);
+
+	return TRUE;
+}
+
+/* Walks the key index in order, merging the sorted array with the deltas, and
+ * parses each record in place rather than copying it out of the data-store.  Writers
+ * are excluded while scanning, so the index does not change underneath. */
+static gboolean
+catalina_tdb_backend_real_scan (CatalinaBackend      *backend,
+                                const gchar          *start,
+                                gsize                 start_length,
+                                const gchar          *end,
+                                gsize                 end_length,
+                                CatalinaBackendFunc   func,
+                                gpointer              user_data,
+                                GError              **error)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+	ScanClosure                closure = { func, user_data, TRUE };
+	GSequenceIter             *iters [2] = { NULL, NULL };
+	GSequence                 *deltas [2];
+	IndexKey                   probe = { (gchar*)start, start_length, FALSE },
+	                           limit = { (gchar*)end, end_length, FALSE },
+	                          *key,
+	                          *item;
+	TDB_DATA                   db_key;
+	gboolean                   removed;
+	guint                      i = 0,
+	                           j;
+
+	if (!priv->index)
+		return scan_unindexed (priv, &closure, start ? &probe : NULL, end ? &limit : NULL);
+
+	/* concurrent writes fold the delta into a new index, see index_changed() */
+	READ_LOCK (priv);
+
+	deltas [0] = priv->delta;
+	deltas [1] = priv->txn_delta;
+
+	if (start) {
+		i = index_lower_bound (priv->index, &probe);
+		for (j = 0; j < 2; j++)
+			if (deltas [j])
+				iters [j] = index_delta_lower_bound (deltas [j], &probe);
+	}
+	else {
+		for (j = 0; j < 2; j++)
+			if (deltas [j])
+				iters [j] = g_sequence_get_begin_iter (deltas [j]);
+	}
+
+	while (closure.proceed) {
+		/* the smallest key of the sources, later sources taking precedence */
+		key = i < priv->index->len ? &g_array_index (priv->index, IndexKey, i) : NULL;
+		removed = FALSE;
+		for (j = 0; j < 2; j++) {
+			if (!iters [j] || g_sequence_iter_is_end (iters [j]))
+				continue;
+			item = g_sequence_get (iters [j]);
+			if (!key || index_key_compare (item, key) <= 0) {
+				key = item;
+				removed = item->removed;
+			}
+		}
+
+		if (!key || (end && index_key_compare (key, &limit) >= 0))
+			break;
+
+		if (!removed) {
+			TDB_DATA_INIT (db_key, key->key, key->key_length);
+			tdb_parse_record (priv->db_ctx, db_key,
+			                  catalina_tdb_backend_scan_parser, &closure);
+		}
+
+		/* step every source past the key */
+		probe = *key;
+		if (i < priv->index->len &&
+		    index_key_compare (&g_array_index (priv->index, IndexKey, i), &probe) == 0)
+			i++;
+		for (j = 0; j < 2; j++)
+			if (iters [j] && !g_sequence_iter_is_end (iters [j]) &&
+			    index_key_compare (g_sequence_get (iters [j]), &probe) == 0)
+				iters [j] = g_sequence_iter_next (iters [j]);
+	}
+	READ_UNLOCK (priv);
+
+	return TRUE;
+}
+
+static gboolean
+catalina_tdb_backend_real_is_shared (CatalinaBackend *backend)
+{
+	return CATALINA_TDB_BACKEND (backend)->priv->locking;
+}
+
+static gboolean
+catalina_tdb_backend_real_set_concurrent (CatalinaBackend *backend,
+                                          gboolean         concurrent)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+
+	priv->concurrent = concurrent;
+	if (priv->db_ctx)
+		priv->concurrency = concurrent && !priv->locking;
+
+	return TRUE;
+}
+
+static void
+catalina_tdb_backend_real_hold_partitions (CatalinaBackend *backend)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+
+	/* waits for a swap in progress, so the hash size read next is the one kept */
+	WRITE_LOCK (priv);
+	g_atomic_int_inc (&priv->partitions_held);
+	WRITE_UNLOCK (priv);
+}
+
+static void
+catalina_tdb_backend_real_release_partitions (CatalinaBackend *backend)
+{
+	CatalinaTdbBackendPrivate *priv = CATALINA_TDB_BACKEND (backend)->priv;
+
+	g_atomic_int_add (&priv->partitions_held, -1);
+}
+
+static void
+catalina_tdb_backend_base_init (CatalinaBackendIface *iface)
+{
+	iface->open               = catalina_tdb_backend_real_open;
+	iface->close              = catalina_tdb_backend_real_close;
+	iface->fetch              = catalina_tdb_backend_real_fetch;
+	iface->parse              = catalina_tdb_backend_real_parse;
+	iface->store              = catalina_tdb_backend_real_store;
+	iface->remove             = catalina_tdb_backend_real_remove;
+	iface->next_key           = catalina_tdb_backend_real_next_key;
+	iface->traverse           = catalina_tdb_backend_real_traverse;
+	iface->get_n_partitions   = catalina_tdb_backend_real_get_n_partitions;
+	iface->traverse_partition = catalina_tdb_backend_real_traverse_partition;
+	iface->transaction_begin  = catalina_tdb_backend_real_transaction_begin;
+	iface->transaction_commit = catalina_tdb_backend_real_transaction_commit;
+	iface->transaction_cancel = catalina_tdb_backend_real_transaction_cancel;
+	iface->compact            = catalina_tdb_backend_real_compact;
+	iface->scan               = catalina_tdb_backend_real_scan;
+	iface->get_space          = catalina_tdb_backend_real_get_space;
+	iface->compact_step       = catalina_tdb_backend_real_compact_step;
+	iface->set_sync           = catalina_tdb_backend_real_set_sync;
+	iface->sync               = catalina_tdb_backend_real_sync;
+	iface->is_shared          = catalina_tdb_backend_real_is_shared;
+	iface->set_concurrent     = catalina_tdb_backend_real_set_concurrent;
+	iface->hold_partitions    = catalina_tdb_backend_real_hold_partitions;
+	iface->release_partitions = catalina_tdb_backend_real_release_partitions;
+}
@@ -0,0 +1,75 @@
+/* catalina-tdb-backend.h
+ *
+ * Copyright (C) 2009 Christian Hergert <chris@dronelabs.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __CATALINA_TDB_BACKEND_H__
+#define __CATALINA_TDB_BACKEND_H__
+
+#include <glib-object.h>
+
+#include "catalina-backend.h"
+
+G_BEGIN_DECLS
+
+#define CATALINA_TYPE_TDB_BACKEND            (catalina_tdb_backend_get_type())
+#define CATALINA_TDB_BACKEND(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj),  CATALINA_TYPE_TDB_BACKEND, CatalinaTdbBackend))
+#define CATALINA_TDB_BACKEND_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),   CATALINA_TYPE_TDB_BACKEND, CatalinaTdbBackendClass))
+#define CATALINA_IS_TDB_BACKEND(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj),  CATALINA_TYPE_TDB_BACKEND))
+#define CATALINA_IS_TDB_BACKEND_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),   CATALINA_TYPE_TDB_BACKEND))
+#define CATALINA_TDB_BACKEND_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),   CATALINA_TYPE_TDB_BACKEND, CatalinaTdbBackendClass))
+
+typedef struct _CatalinaTdbBackend        CatalinaTdbBackend;
+typedef struct _CatalinaTdbBackendClass   CatalinaTdbBackendClass;
+typedef struct _CatalinaTdbBackendPrivate CatalinaTdbBackendPrivate;
+
+struct _CatalinaTdbBackend
+{
+	GObject parent;
+
+	/*< private >*/
+	CatalinaTdbBackendPrivate *priv;
+};
+
+struct _CatalinaTdbBackendClass
+{
+	GObjectClass parent_class;
+};
+
+GType            catalina_tdb_backend_get_type             (void);
+CatalinaBackend* catalina_tdb_backend_new                  (void);
+guint            catalina_tdb_backend_get_hash_size        (CatalinaTdbBackend *backend);
+void             catalina_tdb_backend_set_hash_size        (CatalinaTdbBackend *backend,
+                                                            guint               hash_size);
+gboolean         catalina_tdb_backend_get_use_mmap         (CatalinaTdbBackend *backend);
+void             catalina_tdb_backend_set_use_mmap         (CatalinaTdbBackend *backend,
+                                                            gboolean            use_mmap);
+guint            catalina_tdb_backend_get_max_chain_length (CatalinaTdbBackend *backend);
+void             catalina_tdb_backend_set_max_chain_length (CatalinaTdbBackend *backend,
+                                                            guint               max_chain_length);
+gboolean         catalina_tdb_backend_get_shared           (CatalinaTdbBackend *backend);
+void             catalina_tdb_backend_set_shared           (CatalinaTdbBackend *backend,
+                                                            gboolean            shared);
+void             catalina_tdb_backend_get_chain_stats      (CatalinaTdbBackend *backend,
+                                                            guint              *n_chains,
+                                                            guint              *n_records,
+                                                            guint              *longest_chain);
+
+G_END_DECLS
+
+#endif /* __CATALINA_TDB_BACKEND_H__ */
@@ -22,6 +22,13 @@
 #define __CATALINA_H__
 
 #include "catalina-storage.h"
+#include "catalina-sharded-storage.h"
+#include "catalina-backend.h"
+#include "catalina-tdb-backend.h"
+#include "catalina-memory-backend.h"
+#include "catalina-log-backend.h"
+#include "catalina-btree-backend.h"
+#include "catalina-lsm-backend.h"
 #include "catalina-formatter.h"
 #include "catalina-binary-formatter.h"
 #include "catalina-transform.h"
@@ -34,6 +34,8 @@ typedef struct
 	gulong    txn2;
 	gulong    txn3;
 	gulong    txn4;
+
+	gpointer  data;
 } AsyncTest;
 
 static void
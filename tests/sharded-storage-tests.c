@@ -0,0 +1,182 @@
+#include <catalina/catalina.h>
+#include <iris/iris.h>
+#include <string.h>
+
+#include "async-test.h"
+
+#define N_SHARDS  4
+#define N_KEYS    32
+#define TEST_DATA "this is some sharded test data"
+
+static void
+test1 (void)
+{
+	CatalinaShardedStorage *storage = catalina_sharded_storage_new (N_SHARDS);
+	guint n_shards = 0;
+	g_assert (storage);
+	g_assert_cmpint (catalina_sharded_storage_get_n_shards (storage),==,N_SHARDS);
+	g_object_get (storage, "n-shards", &n_shards, NULL);
+	g_assert_cmpint (n_shards,==,N_SHARDS);
+	g_assert (catalina_sharded_storage_get_shard (storage, 0) != catalina_sharded_storage_get_shard (storage, 1));
+	g_object_unref (storage);
+}
+
+static void
+test2 (void)
+{
+	CatalinaShardedStorage *storage = catalina_sharded_storage_new (N_SHARDS);
+	gchar  *key, *buffer = NULL;
+	gsize   length = 0;
+	gulong  used = 0;
+	guint   i;
+	g_assert (catalina_sharded_storage_open (storage, ".", "sharded-tests.db", NULL));
+	for (i = 0; i < N_KEYS; i++) {
+		key = g_strdup_printf ("sharded-key-%u", i);
+		g_assert (catalina_sharded_storage_set (storage, 0, key, -1, TEST_DATA, -1, NULL));
+		g_free (key);
+	}
+	for (i = 0; i < N_KEYS; i++) {
+		key = g_strdup_printf ("sharded-key-%u", i);
+		g_assert (catalina_sharded_storage_get (storage, key, -1, &buffer, &length, NULL));
+		g_assert_cmpstr (buffer,==,TEST_DATA);
+		g_assert_cmpint (length,==,strlen (TEST_DATA) + 1);
+		g_free (buffer);
+		g_free (key);
+	}
+	g_assert_cmpint (catalina_sharded_storage_count_keys (storage),>=,N_KEYS);
+	/* keys should be spread over more than a single shard */
+	for (i = 0; i < N_SHARDS; i++)
+		if (catalina_storage_count_keys (catalina_sharded_storage_get_shard (storage, i)) > 0)
+			used++;
+	g_assert_cmpint (used,>,1);
+	g_assert (catalina_sharded_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test3_get_cb (GObject      *object,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	gchar *buffer = NULL;
+	if (!catalina_sharded_storage_get_finish (CATALINA_SHARDED_STORAGE (object), result,
+	                                          &buffer, NULL, &test->error))
+		async_test_error (test);
+	g_assert_cmpstr (buffer,==,TEST_DATA);
+	g_free (buffer);
+	async_test_complete (test);
+}
+
+static void
+test3_set_cb (GObject      *object,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	if (!catalina_sharded_storage_set_finish (CATALINA_SHARDED_STORAGE (object), result, &test->error))
+		async_test_error (test);
+	catalina_sharded_storage_get_async (CATALINA_SHARDED_STORAGE (object), "sharded-async", -1,
+	                                    test3_get_cb, test);
+}
+
+static void
+test3 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaShardedStorage *storage = catalina_sharded_storage_new (N_SHARDS);
+	g_assert (catalina_sharded_storage_open (storage, ".", "sharded-tests.db", NULL));
+	catalina_sharded_storage_set_async (storage, 0, "sharded-async", -1, TEST_DATA, -1,
+	                                    test3_set_cb, test);
+	async_test_wait (test);
+	g_assert (catalina_sharded_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test4_commit_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	if (!catalina_sharded_storage_transaction_commit_finish (CATALINA_SHARDED_STORAGE (object),
+	                                                         result, &test->error))
+		async_test_error (test);
+	async_test_complete (test);
+}
+
+static void
+test4_set_cb (GObject      *object,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+	GError *error = NULL;
+	if (!catalina_sharded_storage_set_finish (CATALINA_SHARDED_STORAGE (object), result, &error))
+		g_error ("%s", error->message);
+}
+
+static void
+test4_begin_cb (GObject      *object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	CatalinaShardedStorage *storage = CATALINA_SHARDED_STORAGE (object);
+	CatalinaStorage *shard = catalina_sharded_storage_get_shard_for_key (storage, "sharded-txn", -1);
+	GError *error = NULL;
+	gchar  *key;
+	guint   i;
+
+	test->txn1 = catalina_sharded_storage_transaction_begin_finish (storage, result);
+	g_assert_cmpint (test->txn1,>,0);
+	catalina_sharded_storage_set_async (storage, test->txn1, "sharded-txn", -1,
+	                                    TEST_DATA, -1, test4_set_cb, test);
+
+	/* writing a key from another shard is rejected before it is queued */
+	for (i = 0; ; i++) {
+		key = g_strdup_printf ("sharded-txn-%u", i);
+		if (catalina_sharded_storage_get_shard_for_key (storage, key, -1) != shard)
+			break;
+		g_free (key);
+	}
+	g_assert (!catalina_sharded_storage_set (storage, test->txn1, key, -1, TEST_DATA, -1, &error));
+	g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_NO_SUCH_TXN);
+	g_error_free (error);
+	g_free (key);
+
+	catalina_sharded_storage_transaction_commit_async (storage, test->txn1,
+	                                                   test4_commit_cb, test);
+}
+
+static void
+test4 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaShardedStorage *storage = catalina_sharded_storage_new (N_SHARDS);
+	gchar *buffer = NULL;
+	g_assert (catalina_sharded_storage_open (storage, ".", "sharded-tests.db", NULL));
+	catalina_sharded_storage_transaction_begin_async (storage, "sharded-txn", -1,
+	                                                  test4_begin_cb, test);
+	async_test_wait (test);
+	g_assert (catalina_sharded_storage_get (storage, "sharded-txn", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA);
+	g_free (buffer);
+	g_assert (catalina_sharded_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	iris_init ();
+
+	g_test_add_func ("/CatalinaShardedStorage/new(1)", test1);
+	g_test_add_func ("/CatalinaShardedStorage/set_get(1)", test2);
+	g_test_add_func ("/CatalinaShardedStorage/set_get_async(1)", test3);
+	g_test_add_func ("/CatalinaShardedStorage/transaction(1)", test4);
+
+	return g_test_run ();
+}
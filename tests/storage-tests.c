@@ -493,6 +493,1421 @@ test24 (void)
 	g_assert (catalina_storage_close (storage, NULL));
 }
 
+static void
+test25 (void)
+{
+	const gchar *keys[] = { TEST_KEY, "test25-missing", TEST_KEY };
+	GArray      *entries = NULL;
+	GError      *error = NULL;
+	CatalinaStorage *storage = catalina_storage_new ();
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	g_assert (catalina_storage_set (storage, 0, TEST_KEY, -1, TEST_DATA, -1, NULL));
+	if (!catalina_storage_get_many (storage, keys, NULL, 3, &entries, &error))
+		g_error ("%s", error->message);
+	g_assert_cmpint (entries->len,==,3);
+	g_assert (g_array_index (entries, CatalinaStorageEntry, 0).found);
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 0).data,==,TEST_DATA);
+	g_assert (!g_array_index (entries, CatalinaStorageEntry, 1).found);
+	g_assert (g_array_index (entries, CatalinaStorageEntry, 1).data == NULL);
+	g_assert (g_array_index (entries, CatalinaStorageEntry, 2).found);
+	catalina_storage_entries_free (entries);
+	g_assert (catalina_storage_close (storage, NULL));
+}
+
+static void
+test26_cb (GObject      *object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	GArray *entries = NULL;
+	if (!catalina_storage_get_many_finish ((void*)object, result, &entries, &test->error))
+		async_test_error (test);
+	g_assert_cmpint (entries->len,==,2);
+	g_assert (g_array_index (entries, CatalinaStorageEntry, 0).found);
+	g_assert (!g_array_index (entries, CatalinaStorageEntry, 1).found);
+	catalina_storage_entries_free (entries);
+	async_test_complete (test);
+}
+
+static void
+test26 (void)
+{
+	const gchar *keys[] = { TEST_KEY, "test26-missing" };
+	gssize       lengths[] = { -1, 14 };
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	catalina_storage_get_many_async (storage, keys, lengths, 2, test26_cb, test);
+	async_test_wait (test);
+	g_assert (catalina_storage_close (storage, NULL));
+}
+
+static gint test27_count = 0;
+
+static void
+test27_commit_cb (GObject      *obj,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+	CatalinaStorage *storage = (void*)obj;
+	AsyncTest *test = user_data;
+	GError *error = NULL;
+	gulong n_groups = 0, n_commits = 0;
+	if (!catalina_storage_transaction_commit_finish (storage, result, &error))
+		g_error ("%s", error->message);
+	if (g_atomic_int_dec_and_test (&test27_count)) {
+		catalina_storage_get_group_commit_stats (storage, &n_groups, &n_commits, NULL);
+		g_assert_cmpint (n_commits,==,3);
+		g_assert_cmpint (n_groups,>=,1);
+		async_test_complete (test);
+	}
+}
+
+static void
+test27_set_cb (GObject      *obj,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+	GError *error = NULL;
+	if (!catalina_storage_set_finish ((void*)obj, result, &error))
+		g_error ("%s", error->message);
+}
+
+static void
+test27_begin_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	CatalinaStorage *storage = (void*)obj;
+	gulong txn_id = catalina_storage_transaction_begin_finish (storage, result);
+	gchar *key = g_strdup_printf ("test27-%lu", txn_id);
+	catalina_storage_set_async (storage, txn_id, key, -1, TEST_DATA, -1, test27_set_cb, user_data);
+	catalina_storage_transaction_commit_async (storage, txn_id, test27_commit_cb, user_data);
+	g_free (key);
+}
+
+static void
+test27 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	catalina_storage_set_use_idle (storage, FALSE);
+	catalina_storage_set_group_commit_size (storage, 8);
+	g_assert_cmpint (catalina_storage_get_group_commit_size (storage),==,8);
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	test27_count = 3;
+	catalina_storage_transaction_begin_async (storage, test27_begin_cb, test);
+	catalina_storage_transaction_begin_async (storage, test27_begin_cb, test);
+	catalina_storage_transaction_begin_async (storage, test27_begin_cb, test);
+	async_test_wait (test);
+	g_assert (catalina_storage_close (storage, NULL));
+}
+
+static void
+test28_func (const gchar *key,
+             gsize        key_length,
+             const gchar *data,
+             gsize        data_length,
+             gpointer     user_data)
+{
+	gsize *length = user_data;
+	g_assert_cmpstr (key,==,TEST_KEY);
+	g_assert_cmpstr (data,==,TEST_DATA);
+	*length = data_length;
+}
+
+static void
+test28 (void)
+{
+	gsize length = 0;
+	CatalinaStorage *storage = catalina_storage_new ();
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	g_assert (catalina_storage_set (storage, 0, TEST_KEY, -1, TEST_DATA, -1, NULL));
+	g_assert (catalina_storage_get_with_func (storage, TEST_KEY, -1, test28_func, &length, NULL));
+	g_assert_cmpint (length,==,strlen (TEST_DATA) + 1);
+	g_assert (!catalina_storage_get_with_func (storage, "test28-missing", -1, test28_func, &length, NULL));
+	g_assert (catalina_storage_close (storage, NULL));
+}
+
+static void
+test29 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	gchar *buffer = NULL;
+	gsize  length = 0;
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	catalina_storage_set_take_async (storage, 0, "test29", -1, g_strdup (TEST_DATA),
+	                                 strlen (TEST_DATA) + 1, test10_cb, test);
+	async_test_wait (test);
+	g_assert (catalina_storage_get (storage, "test29", -1, &buffer, &length, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA);
+	g_free (buffer);
+	g_assert (catalina_storage_close (storage, NULL));
+}
+
+static void
+test30 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	CatalinaCursor  *cursor;
+	GArray          *entries = NULL;
+	GError          *error = NULL;
+	gulong           n_keys, seen = 0;
+	guint            len;
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	n_keys = catalina_storage_count_keys (storage);
+	cursor = catalina_storage_cursor_new (storage, CATALINA_CURSOR_KEYS_ONLY);
+	do {
+		if (!catalina_cursor_next_batch (cursor, 2, &entries, &error))
+			g_error ("%s", error->message);
+		g_assert_cmpint (entries->len,<=,2);
+		if (entries->len)
+			g_assert (g_array_index (entries, CatalinaStorageEntry, 0).data == NULL);
+		len = entries->len;
+		seen += len;
+		catalina_storage_entries_free (entries);
+	} while (len > 0);
+	g_assert_cmpint (seen,==,n_keys);
+	catalina_cursor_free (cursor);
+	g_assert (catalina_storage_close (storage, NULL));
+}
+
+static void
+test31_cb (GObject      *object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	CatalinaCursor *cursor = test->data;
+	CatalinaStorageEntry *entry;
+	GArray *entries = NULL;
+	guint i;
+	if (!catalina_cursor_next_batch_finish (cursor, result, &entries, &test->error))
+		async_test_error (test);
+	if (entries->len == 0) {
+		catalina_storage_entries_free (entries);
+		g_assert_cmpint (test->txn1,==,1);
+		async_test_complete (test);
+		return;
+	}
+	for (i = 0; i < entries->len; i++) {
+		entry = &g_array_index (entries, CatalinaStorageEntry, i);
+		g_assert (entry->found);
+		g_assert (entry->data != NULL);
+		if (g_str_equal (entry->key, TEST_KEY_ZLIB)) {
+			g_assert_cmpstr (entry->data,==,TEST_DATA_ZLIB);
+			test->txn1++;
+		}
+	}
+	catalina_storage_entries_free (entries);
+	catalina_cursor_next_batch_async (cursor, 16, test31_cb, test);
+}
+
+static void
+test31 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	CatalinaCursor  *cursor;
+	g_object_set (storage, "transform", catalina_zlib_transform_new (), NULL);
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	cursor = catalina_storage_cursor_new (storage, CATALINA_CURSOR_TRANSFORM);
+	test->data = cursor;
+	catalina_cursor_next_batch_async (cursor, 16, test31_cb, test);
+	async_test_wait (test);
+	catalina_cursor_free (cursor);
+	g_assert (catalina_storage_close (storage, NULL));
+}
+
+static gpointer
+test32_map (const gchar *key,
+            gsize        key_length,
+            const gchar *data,
+            gsize        data_length,
+            gpointer     partial,
+            gpointer     user_data)
+{
+	return GUINT_TO_POINTER (GPOINTER_TO_UINT (partial) + 1);
+}
+
+static gpointer
+test32_reduce (gpointer result,
+               gpointer partial,
+               gpointer user_data)
+{
+	return GUINT_TO_POINTER (GPOINTER_TO_UINT (result) + GPOINTER_TO_UINT (partial));
+}
+
+static void
+test32 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	GError          *error = NULL;
+	gpointer         reduced = NULL;
+	gulong           n_keys;
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	n_keys = catalina_storage_count_keys (storage);
+	if (!catalina_storage_foreach_parallel (storage, 4, test32_map, test32_reduce,
+	                                        NULL, &reduced, &error))
+		g_error ("%s", error->message);
+	g_assert_cmpint (GPOINTER_TO_UINT (reduced),==,n_keys);
+	g_assert (catalina_storage_close (storage, NULL));
+}
+
+static void
+test33_cb (GObject      *object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	guint64    n_bytes = 0;
+	test->txn1 = catalina_storage_count_keys_finish (CATALINA_STORAGE (object), result,
+	                                                 &n_bytes, &test->error);
+	if (test->error)
+		async_test_error (test);
+	g_assert_cmpint (n_bytes,>=,strlen (TEST_DATA) + 1);
+	async_test_complete (test);
+}
+
+static void
+test33 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	gchar           *key = g_strdup_printf ("test33-%u", g_random_int ());
+	gulong           n_keys;
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	n_keys = catalina_storage_count_keys (storage);
+	g_assert (catalina_storage_set (storage, 0, key, -1, TEST_DATA, strlen (TEST_DATA) + 1, NULL));
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,n_keys + 1);
+	g_assert (catalina_storage_set (storage, 0, key, -1, TEST_DATA, strlen (TEST_DATA) + 1, NULL));
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,n_keys + 1);
+	catalina_storage_count_keys_async (storage, test33_cb, test);
+	async_test_wait (test);
+	g_assert_cmpint (test->txn1,==,n_keys + 1);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,n_keys + 1);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_free (key);
+}
+
+static gboolean
+test34_predicate (const gchar *key,
+                  gsize        key_length,
+                  const gchar *data,
+                  gsize        data_length,
+                  gpointer     user_data)
+{
+	return g_str_has_prefix (key, "test34-where-");
+}
+
+static void
+test34 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	const gchar     *keys[] = { "test34-many-1", "test34-many-2", "test34-missing" };
+	GError          *error = NULL;
+	gulong           n_keys, n_removed = 0;
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	g_assert (catalina_storage_set (storage, 0, "test34", -1, TEST_DATA, -1, NULL));
+	g_assert (catalina_storage_set (storage, 0, keys [0], -1, TEST_DATA, -1, NULL));
+	g_assert (catalina_storage_set (storage, 0, keys [1], -1, TEST_DATA, -1, NULL));
+	g_assert (catalina_storage_set (storage, 0, "test34-where-1", -1, TEST_DATA, -1, NULL));
+	g_assert (catalina_storage_set (storage, 0, "test34-where-2", -1, TEST_DATA, -1, NULL));
+	n_keys = catalina_storage_count_keys (storage);
+
+	g_assert (catalina_storage_remove (storage, 0, "test34", -1, NULL));
+	g_assert (!catalina_storage_remove (storage, 0, "test34", -1, &error));
+	g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_NO_SUCH_KEY);
+	g_clear_error (&error);
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,n_keys - 1);
+
+	g_assert (catalina_storage_remove_many (storage, keys, NULL, 3, &n_removed, NULL));
+	g_assert_cmpint (n_removed,==,2);
+	g_assert (catalina_storage_remove_where (storage, test34_predicate, NULL, &n_removed, NULL));
+	g_assert_cmpint (n_removed,==,2);
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,n_keys - 5);
+	g_assert (!catalina_storage_get (storage, "test34-where-1", -1, NULL, NULL, NULL));
+	g_assert (catalina_storage_close (storage, NULL));
+}
+
+static void
+test35 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	CatalinaBackend *backend = catalina_memory_backend_new ();
+	const gchar     *keys[] = { "test35-1", "test35-2" };
+	gchar           *buffer = NULL;
+	gsize            length = 0;
+	gulong           n_removed = 0;
+	catalina_storage_set_backend (storage, backend);
+	g_assert (catalina_storage_get_backend (storage) == backend);
+	g_object_unref (backend);
+	g_assert (catalina_storage_open (storage, ".", "memory-tests.db", NULL));
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,0);
+	g_assert (catalina_storage_set (storage, 0, keys [0], -1, TEST_DATA, -1, NULL));
+	g_assert (catalina_storage_set (storage, 0, keys [1], -1, TEST_DATA, -1, NULL));
+	g_assert (catalina_storage_get (storage, keys [0], -1, &buffer, &length, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA);
+	g_assert_cmpint (length,==,strlen (TEST_DATA) + 1);
+	g_free (buffer);
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,2);
+	g_assert (catalina_storage_remove_many (storage, keys, NULL, 1, &n_removed, NULL));
+	g_assert_cmpint (n_removed,==,1);
+	g_assert (!catalina_storage_get (storage, keys [0], -1, NULL, NULL, NULL));
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,1);
+	/* nothing survives closing the storage */
+	g_assert (catalina_storage_close (storage, NULL));
+	g_assert (catalina_storage_open (storage, ".", "memory-tests.db", NULL));
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,0);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test36 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	CatalinaBackend *backend = catalina_log_backend_new ();
+	const gchar     *keys [] = { "test36-2", "test36-3" };
+	/* a frame header of two records, followed by less than it claims */
+	const guchar     torn [] = { 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 2, 0, 0, 0, 64,
+	                             0, 0, 0, 8, 0, 0, 0, 4 };
+	GDir            *dir;
+	const gchar     *name;
+	gchar           *key, *buffer = NULL, *newest = NULL;
+	gsize            length = 0;
+	gulong           n_keys;
+	guint            i, j;
+	/* small segments so the writes below span several of them */
+	g_object_set (backend, "segment-size", 4096, NULL);
+	g_object_set (storage, "backend", backend, NULL);
+	g_object_unref (backend);
+	g_assert (catalina_storage_open (storage, ".", "log-tests.db", NULL));
+	for (j = 0; j < 4; j++) {
+		for (i = 0; i < 64; i++) {
+			key = g_strdup_printf ("test36-%u", i);
+			buffer = g_strdup_printf ("%s-%u", TEST_DATA, j);
+			g_assert (catalina_storage_set (storage, 0, key, -1, buffer, -1, NULL));
+			g_free (buffer);
+			g_free (key);
+		}
+	}
+	g_assert (catalina_storage_remove (storage, 0, "test36-0", -1, NULL));
+	/* removes many in a single commit frame */
+	g_assert (catalina_storage_remove_many (storage, keys, NULL, 2, NULL, NULL));
+	g_assert (catalina_storage_close (storage, NULL));
+	/* the index is rebuilt from the segments and their hints */
+	g_assert (catalina_storage_open (storage, ".", "log-tests.db", NULL));
+	g_assert (!catalina_storage_get (storage, "test36-0", -1, NULL, NULL, NULL));
+	g_assert (!catalina_storage_get (storage, "test36-2", -1, NULL, NULL, NULL));
+	g_assert (catalina_storage_get (storage, "test36-1", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA "-3");
+	g_free (buffer);
+	g_assert (catalina_storage_set (storage, 0, "test36-0", -1, TEST_DATA, -1, NULL));
+	n_keys = catalina_storage_count_keys (storage);
+	g_assert_cmpint (n_keys,>=,62);
+	g_assert (catalina_storage_close (storage, NULL));
+	/* a commit torn by a crash is discarded as a whole */
+	dir = g_dir_open ("log-tests.db", 0, NULL);
+	while ((name = g_dir_read_name (dir)) != NULL)
+		if (g_str_has_suffix (name, ".data") && (!newest || strcmp (name, newest) > 0)) {
+			g_free (newest);
+			newest = g_strdup (name);
+		}
+	g_dir_close (dir);
+	key = g_build_filename ("log-tests.db", newest, NULL);
+	g_assert (g_file_get_contents (key, &buffer, &length, NULL));
+	buffer = g_realloc (buffer, length + sizeof (torn));
+	memcpy (buffer + length, torn, sizeof (torn));
+	g_assert (g_file_set_contents (key, buffer, length + sizeof (torn), NULL));
+	g_free (buffer);
+	g_free (newest);
+	g_free (key);
+	g_assert (catalina_storage_open (storage, ".", "log-tests.db", NULL));
+	g_assert (catalina_storage_get (storage, "test36-0", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA);
+	g_free (buffer);
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,n_keys);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test37_scan_cb (GObject      *object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	GArray    *entries = NULL;
+	if (!catalina_storage_scan_prefix_finish (CATALINA_STORAGE (object), result,
+	                                          &entries, &test->error))
+		async_test_error (test);
+	g_assert_cmpint (entries->len,==,10);
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 0).key,==,"test37-b-00");
+	catalina_storage_entries_free (entries);
+	async_test_complete (test);
+}
+
+static void
+test37 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	CatalinaBackend *backend = catalina_memory_backend_new ();
+	AsyncTest       *test = async_test_new ();
+	GArray          *entries = NULL;
+	GError          *error = NULL;
+	gchar           *key;
+	guint            i;
+	/* hash ordered backends can not scan */
+	g_object_set (storage, "backend", backend, NULL);
+	g_object_unref (backend);
+	g_assert (catalina_storage_open (storage, ".", "memory-tests.db", NULL));
+	g_assert (!catalina_storage_scan_prefix (storage, "test37", -1, 0, &entries, &error));
+	g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_NOT_SUPPORTED);
+	g_clear_error (&error);
+	g_assert (catalina_storage_close (storage, NULL));
+	backend = catalina_btree_backend_new ();
+	g_object_set (storage, "backend", backend, NULL);
+	g_object_unref (backend);
+	g_assert (catalina_storage_open (storage, ".", "btree-tests.db", NULL));
+	/* insert in reverse so the scans must sort */
+	for (i = 30; i-- > 0;) {
+		key = g_strdup_printf ("test37-%c-%02u", 'a' + i / 10, i % 10);
+		g_assert (catalina_storage_set (storage, 0, key, -1, TEST_DATA, -1, NULL));
+		g_free (key);
+	}
+	g_assert (catalina_storage_scan_range (storage, "test37-a-05", -1, "test37-b-02", -1,
+	                                       0, &entries, NULL));
+	g_assert_cmpint (entries->len,==,7);
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 0).key,==,"test37-a-05");
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 6).key,==,"test37-b-01");
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 6).data,==,TEST_DATA);
+	catalina_storage_entries_free (entries);
+	g_assert (catalina_storage_scan_prefix (storage, "test37-c", -1, 4, &entries, NULL));
+	g_assert_cmpint (entries->len,==,4);
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 3).key,==,"test37-c-03");
+	catalina_storage_entries_free (entries);
+	catalina_storage_scan_prefix_async (storage, "test37-b", -1, 0, test37_scan_cb, test);
+	async_test_wait (test);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test38 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	CatalinaBackend *backend = catalina_lsm_backend_new ();
+	const gchar     *keys [] = { "test38-001", "test38-002" };
+	GArray          *entries = NULL;
+	GDir            *dir;
+	const gchar     *name;
+	gchar           *key, *buffer = NULL, *newest = NULL;
+	gsize            length = 0;
+	guint            i, j;
+	/* a small memtable so the writes below are flushed and merged */
+	g_object_set (backend, "memtable-size", 4096, NULL);
+	g_object_set (storage, "backend", backend, NULL);
+	g_object_unref (backend);
+	g_assert (catalina_storage_open (storage, ".", "lsm-tests.db", NULL));
+	for (j = 0; j < 8; j++) {
+		for (i = 0; i < 128; i++) {
+			key = g_strdup_printf ("test38-%03u", i);
+			buffer = g_strdup_printf ("%s-%u", TEST_DATA, j);
+			g_assert (catalina_storage_set (storage, 0, key, -1, buffer, -1, NULL));
+			g_free (buffer);
+			g_free (key);
+		}
+	}
+	g_assert (catalina_storage_remove (storage, 0, "test38-000", -1, NULL));
+	g_assert (catalina_storage_close (storage, NULL));
+	/* unflushed writes are replayed from the log */
+	g_assert (catalina_storage_open (storage, ".", "lsm-tests.db", NULL));
+	g_assert (!catalina_storage_get (storage, "test38-000", -1, NULL, NULL, NULL));
+	g_assert (catalina_storage_get (storage, "test38-001", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA "-7");
+	g_free (buffer);
+	g_assert (catalina_storage_scan_prefix (storage, "test38-01", -1, 0, &entries, NULL));
+	g_assert_cmpint (entries->len,==,10);
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 0).key,==,"test38-010");
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 9).data,==,TEST_DATA "-7");
+	catalina_storage_entries_free (entries);
+	g_assert_cmpint (catalina_storage_count_keys (storage),>=,127);
+	/* removes many in a single commit frame */
+	g_assert (catalina_storage_remove_many (storage, keys, NULL, 2, NULL, NULL));
+	g_assert (catalina_storage_close (storage, NULL));
+	/* a commit torn by a crash is discarded as a whole */
+	dir = g_dir_open ("lsm-tests.db", 0, NULL);
+	while ((name = g_dir_read_name (dir)) != NULL)
+		if (g_str_has_suffix (name, ".wal") && (!newest || strcmp (name, newest) > 0)) {
+			g_free (newest);
+			newest = g_strdup (name);
+		}
+	g_dir_close (dir);
+	key = g_build_filename ("lsm-tests.db", newest, NULL);
+	g_assert (g_file_get_contents (key, &buffer, &length, NULL));
+	g_assert_cmpint (length,>,4);
+	g_assert (g_file_set_contents (key, buffer, length - 4, NULL));
+	g_free (buffer);
+	g_free (newest);
+	g_free (key);
+	g_assert (catalina_storage_open (storage, ".", "lsm-tests.db", NULL));
+	g_assert (catalina_storage_get (storage, "test38-001", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA "-7");
+	g_free (buffer);
+	g_assert (catalina_storage_get (storage, "test38-002", -1, NULL, NULL, NULL));
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test39 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	GArray          *entries = NULL;
+	gchar           *key;
+	guint            i;
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	for (i = 20; i-- > 0;) {
+		key = g_strdup_printf ("test39-%02u", i);
+		g_assert (catalina_storage_set (storage, 0, key, -1, TEST_DATA, -1, NULL));
+		g_free (key);
+	}
+	g_assert (catalina_storage_remove (storage, 0, "test39-11", -1, NULL));
+	g_assert (catalina_storage_scan_prefix (storage, "test39-1", -1, 0, &entries, NULL));
+	g_assert_cmpint (entries->len,==,9);
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 1).key,==,"test39-12");
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 1).data,==,TEST_DATA);
+	catalina_storage_entries_free (entries);
+	g_assert (catalina_storage_close (storage, NULL));
+	/* the key index is loaded back from its file */
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	g_assert (catalina_storage_scan_range (storage, "test39-05", -1, "test39-12", -1,
+	                                       0, &entries, NULL));
+	g_assert_cmpint (entries->len,==,6);
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 0).key,==,"test39-05");
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 5).key,==,"test39-10");
+	catalina_storage_entries_free (entries);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test40_set (CatalinaStorage *storage,
+            const gchar     *key,
+            const gchar     *first_name,
+            const gchar     *last_name)
+{
+	MockPerson *person = mock_person_new ();
+	GValue      v      = {0,};
+	g_object_set (person, "first-name", first_name, "last-name", last_name, NULL);
+	g_value_init (&v, MOCK_TYPE_PERSON);
+	g_value_take_object (&v, person);
+	g_assert (catalina_storage_set_value (storage, 0, key, -1, &v, NULL));
+	g_value_unset (&v);
+}
+
+static guint
+test40_lookup (CatalinaStorage *storage,
+               const gchar     *last_name)
+{
+	GArray *entries = NULL;
+	GValue  v       = {0,};
+	guint   n;
+	g_value_init (&v, G_TYPE_STRING);
+	g_value_set_string (&v, last_name);
+	g_assert (catalina_storage_lookup_index (storage, "last-name", &v, &entries, NULL));
+	n = entries->len;
+	catalina_storage_entries_free (entries);
+	g_value_unset (&v);
+	return n;
+}
+
+static void
+test40 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	GError          *error   = NULL;
+	g_object_set (storage, "formatter", catalina_binary_formatter_new (), NULL);
+	g_assert (catalina_storage_open (storage, ".", "index-tests.db", NULL));
+	test40_set (storage, "test40-0", "Christian", "Hergert");
+	test40_set (storage, "test40-1", "John", "Smith");
+	test40_set (storage, "test40-2", "Jane", "Hergert");
+	/* existing records are picked up by the background build */
+	g_assert (catalina_storage_add_index (storage, "last-name", "last-name", NULL));
+	g_assert (!catalina_storage_add_index (storage, "last-name", "first-name", &error));
+	g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_STATE);
+	g_clear_error (&error);
+	g_assert_cmpint (test40_lookup (storage, "Hergert"),==,2);
+	test40_set (storage, "test40-1", "John", "Hergert");
+	g_assert_cmpint (test40_lookup (storage, "Hergert"),==,3);
+	g_assert_cmpint (test40_lookup (storage, "Smith"),==,0);
+	g_assert (catalina_storage_remove (storage, 0, "test40-0", -1, NULL));
+	g_assert_cmpint (test40_lookup (storage, "Hergert"),==,2);
+	/* the index is rebuilt when the data-store is opened again */
+	g_assert (catalina_storage_close (storage, NULL));
+	g_assert (catalina_storage_open (storage, ".", "index-tests.db", NULL));
+	g_assert_cmpint (test40_lookup (storage, "Hergert"),==,2);
+	g_assert (catalina_storage_remove_index (storage, "last-name", NULL));
+	g_assert (!catalina_storage_remove_index (storage, "last-name", &error));
+	g_clear_error (&error);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static gboolean
+test41_index (const GValue *value,
+              GValue       *index_value,
+              gpointer      user_data)
+{
+	MockPerson *person = g_value_get_object (value);
+	g_value_init (index_value, G_TYPE_STRING);
+	g_value_set_string (index_value, mock_person_get_first_name (person));
+	return TRUE;
+}
+
+static void
+test41_cb (GObject      *object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+	AsyncTest *test    = user_data;
+	GArray    *entries = NULL;
+	if (!catalina_storage_lookup_index_finish (CATALINA_STORAGE (object), result,
+	                                           &entries, &test->error))
+		async_test_error (test);
+	g_assert_cmpint (entries->len,==,1);
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 0).key,==,"test40-2");
+	catalina_storage_entries_free (entries);
+	async_test_complete (test);
+}
+
+static void
+test41 (void)
+{
+	AsyncTest       *test    = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	GValue           v       = {0,};
+	g_object_set (storage, "formatter", catalina_binary_formatter_new (), NULL);
+	g_assert (catalina_storage_add_index_full (storage, "first-name", test41_index,
+	                                           NULL, NULL, NULL));
+	g_assert (catalina_storage_open (storage, ".", "index-tests.db", NULL));
+	g_value_init (&v, G_TYPE_STRING);
+	g_value_set_string (&v, "Jane");
+	catalina_storage_lookup_index_async (storage, "first-name", &v, test41_cb, test);
+	async_test_wait (test);
+	g_value_unset (&v);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test42 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	CatalinaBackend *backend = catalina_tdb_backend_new ();
+	gchar           *key, *buffer = NULL;
+	guint            n_chains = 0, n_records = 0, longest = 0, i;
+	/* a tiny table so that the writes below outgrow it */
+	g_object_set (backend, "hash-size", 7, "max-chain-length", 4, NULL);
+	g_object_set (storage, "backend", backend, NULL);
+	g_assert (catalina_storage_open (storage, ".", "rehash-tests.db", NULL));
+	for (i = 0; i < 64; i++) {
+		key = g_strdup_printf ("test42-%02u", i);
+		g_assert (catalina_storage_set (storage, 0, key, -1, TEST_DATA, -1, NULL));
+		g_free (key);
+	}
+	catalina_tdb_backend_get_chain_stats (CATALINA_TDB_BACKEND (backend),
+	                                      &n_chains, &n_records, &longest);
+	g_assert_cmpint (n_chains,>,7);
+	g_assert_cmpint (n_records,==,65); /* including the metadata record */
+	g_assert_cmpint (longest,<,n_records);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (backend);
+	g_object_unref (storage);
+	/* the larger table replaced the data-store */
+	storage = catalina_storage_new ();
+	g_assert (catalina_storage_open (storage, ".", "rehash-tests.db", NULL));
+	for (i = 0; i < 64; i++) {
+		key = g_strdup_printf ("test42-%02u", i);
+		g_assert (catalina_storage_get (storage, key, -1, &buffer, NULL, NULL));
+		g_assert_cmpstr (buffer,==,TEST_DATA);
+		g_free (buffer);
+		g_free (key);
+	}
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,64);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test43 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	gchar           *key, *large, *buffer = NULL;
+	guint64          size = 0, free_size = 0, compacted = 0;
+	guint            i;
+	g_assert (catalina_storage_open (storage, ".", "compact-tests.db", NULL));
+	large = g_strnfill (4096, 'x');
+	for (i = 0; i < 64; i++) {
+		key = g_strdup_printf ("test43-%02u", i);
+		g_assert (catalina_storage_set (storage, 0, key, -1, large, -1, NULL));
+		g_free (key);
+	}
+	/* overwriting with smaller values leaves the large records on the free list */
+	for (i = 0; i < 64; i++) {
+		key = g_strdup_printf ("test43-%02u", i);
+		g_assert (catalina_storage_set (storage, 0, key, -1, TEST_DATA, -1, NULL));
+		g_free (key);
+	}
+	g_free (large);
+	g_assert (catalina_storage_get_space (storage, &size, &free_size, NULL));
+	g_assert_cmpint (free_size,>,64 * 2048);
+	g_assert_cmpint (free_size,<,size);
+	g_assert (catalina_storage_compact (storage, NULL));
+	g_assert (catalina_storage_get_space (storage, &size, &compacted, NULL));
+	g_assert_cmpint (compacted,<,free_size / 4);
+	for (i = 0; i < 64; i++) {
+		key = g_strdup_printf ("test43-%02u", i);
+		g_assert (catalina_storage_get (storage, key, -1, &buffer, NULL, NULL));
+		g_assert_cmpstr (buffer,==,TEST_DATA);
+		g_free (buffer);
+		g_free (key);
+	}
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,64);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test44_set_cb (GObject      *obj,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+	GError *error = NULL;
+	if (!catalina_storage_set_finish (CATALINA_STORAGE (obj), result, &error))
+		g_error ("%s", error->message);
+}
+
+static void
+test44_commit2_cb (GObject      *obj,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	CatalinaStorage *storage = (void*)obj;
+	gchar *buffer = NULL;
+	if (!catalina_storage_transaction_commit_finish (storage, result, &test->error))
+		async_test_error (test);
+	g_assert (catalina_storage_get (storage, "test44-none", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA);
+	g_free (buffer);
+	async_test_complete (test);
+}
+
+static void
+test44_begin2_cb (GObject      *obj,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	CatalinaStorage *storage = (void*)obj;
+	test->txn2 = catalina_storage_transaction_begin_finish (storage, result);
+	catalina_storage_set_async (storage, test->txn2, "test44-none", -1, TEST_DATA, -1,
+	                            test44_set_cb, test);
+	catalina_storage_transaction_commit_async (storage, test->txn2, test44_commit2_cb, test);
+}
+
+static void
+test44_commit_cb (GObject      *obj,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	CatalinaStorage *storage = (void*)obj;
+	gchar *buffer = NULL;
+	/* completes only once the background sync ran */
+	if (!catalina_storage_transaction_commit_finish (storage, result, &test->error))
+		async_test_error (test);
+	g_assert (catalina_storage_get (storage, "test44", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA);
+	g_free (buffer);
+	catalina_storage_transaction_begin_full_async (storage, CATALINA_DURABILITY_NONE,
+	                                               test44_begin2_cb, test);
+}
+
+static void
+test44_begin_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	CatalinaStorage *storage = (void*)obj;
+	test->txn1 = catalina_storage_transaction_begin_finish (storage, result);
+	catalina_storage_set_async (storage, test->txn1, "test44", -1, TEST_DATA, -1,
+	                            test44_set_cb, test);
+	catalina_storage_transaction_commit_async (storage, test->txn1, test44_commit_cb, test);
+}
+
+static void
+test44 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	g_object_set (storage,
+	              "durability", CATALINA_DURABILITY_PERIODIC,
+	              "sync-interval", 20,
+	              NULL);
+	g_assert_cmpint (catalina_storage_get_durability (storage),==,CATALINA_DURABILITY_PERIODIC);
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	catalina_storage_transaction_begin_async (storage, test44_begin_cb, test);
+	async_test_wait (test);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test45 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	CatalinaBackend *backend = catalina_tdb_backend_new ();
+	GArray          *entries = NULL;
+	gchar           *key;
+	guint            i;
+	g_object_set (backend, "shared", TRUE, NULL);
+	g_object_set (storage, "backend", backend, NULL);
+	g_assert (catalina_storage_open (storage, ".", "shared-tests.db", NULL));
+	for (i = 0; i < 16; i++) {
+		key = g_strdup_printf ("test45-%02u", i);
+		g_assert (catalina_storage_set (storage, 0, key, -1, TEST_DATA, -1, NULL));
+		g_free (key);
+	}
+	g_assert (catalina_storage_remove (storage, 0, "test45-04", -1, NULL));
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,15);
+	/* sorted without the key index */
+	g_assert (catalina_storage_scan_range (storage, "test45-03", -1, "test45-07", -1,
+	                                       0, &entries, NULL));
+	g_assert_cmpint (entries->len,==,3);
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 0).key,==,"test45-03");
+	g_assert_cmpstr (g_array_index (entries, CatalinaStorageEntry, 2).key,==,"test45-06");
+	catalina_storage_entries_free (entries);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_assert (!g_file_test ("shared-tests.db.keys", G_FILE_TEST_EXISTS));
+	/* the counters are kept in the data-store for the other processes */
+	g_assert (catalina_storage_open (storage, ".", "shared-tests.db", NULL));
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,15);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (backend);
+	g_object_unref (storage);
+}
+
+static void
+test46_commit_cb (GObject      *obj,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	CatalinaStorage *storage = (void*)obj;
+	gchar *buffer = NULL;
+	if (!catalina_storage_transaction_commit_finish (storage, result, &test->error))
+		async_test_error (test);
+	g_assert (catalina_storage_get (storage, "test46-txn", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA);
+	g_free (buffer);
+	/* the later of the two sets won */
+	g_assert (catalina_storage_get (storage, "test46", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,TEST_DATA_ZLIB);
+	g_free (buffer);
+	async_test_complete (test);
+}
+
+static void
+test46_begin_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	CatalinaStorage *storage = (void*)obj;
+	test->txn1 = catalina_storage_transaction_begin_finish (storage, result);
+	catalina_storage_set_async (storage, 0, "test46", -1, TEST_DATA, -1,
+	                            test44_set_cb, test);
+	catalina_storage_set_async (storage, 0, "test46", -1, TEST_DATA_ZLIB, -1,
+	                            test44_set_cb, test);
+	/* the commit is held until the set before it has been transformed */
+	catalina_storage_set_async (storage, test->txn1, "test46-txn", -1, TEST_DATA, -1,
+	                            test44_set_cb, test);
+	catalina_storage_transaction_commit_async (storage, test->txn1, test46_commit_cb, test);
+}
+
+static void
+test46 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	g_object_set (storage, "transform", catalina_zlib_transform_new (), NULL);
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	catalina_storage_transaction_begin_async (storage, test46_begin_cb, test);
+	async_test_wait (test);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test47_cb (GObject      *object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+	AsyncTest *test  = user_data;
+	GValue     value = {0,};
+	GError    *error = NULL;
+
+	/* the missing key fails within the single completion */
+	g_assert (!catalina_storage_get_value_finish (CATALINA_STORAGE (object), result,
+	                                              &value, &error));
+	g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_NO_SUCH_KEY);
+	g_error_free (error);
+	async_test_complete (test);
+}
+
+static void
+test47 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	g_object_set (storage, "formatter", catalina_binary_formatter_new (), NULL);
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	catalina_storage_get_value_async (storage, "test47-missing", -1, test47_cb, test);
+	async_test_wait (test);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+#define TEST48_N_VALUES 100
+
+static gint test48_completed = 0;
+
+static void
+test48_cb (GObject      *object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	GValue     v = {0,};
+	if (!catalina_storage_set_value_finish (CATALINA_STORAGE (object), result, &test->error))
+		async_test_error (test);
+	/* the sets complete in the order they were made, so the last one wrote last */
+	if (++test48_completed < TEST48_N_VALUES)
+		return;
+	g_assert (catalina_storage_get_value (CATALINA_STORAGE (object), "test48", -1, &v, NULL));
+	g_assert_cmpint (g_value_get_int (&v),==,TEST48_N_VALUES - 1);
+	async_test_complete (test);
+}
+
+static void
+test48 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	GValue v = {0,};
+	gint i;
+	g_object_set (storage, "formatter", catalina_binary_formatter_new (), NULL);
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	g_value_init (&v, G_TYPE_INT);
+	for (i = 0; i < TEST48_N_VALUES; i++) {
+		g_value_set_int (&v, i);
+		catalina_storage_set_value_async (storage, 0, "test48", -1, &v, test48_cb, test);
+	}
+	async_test_wait (test);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+#define TEST49_N_KEYS   64
+#define TEST49_N_ROUNDS 4
+
+static gint test49_completed = 0;
+
+static void
+test49_cb (GObject      *object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+	AsyncTest       *test = user_data;
+	CatalinaStorage *storage = CATALINA_STORAGE (object);
+	gchar           *key, *expected, *buffer = NULL;
+	gint             i;
+	if (!catalina_storage_set_finish (storage, result, &test->error))
+		async_test_error (test);
+	if (++test49_completed < TEST49_N_KEYS * TEST49_N_ROUNDS)
+		return;
+	/* the writes to each key were applied in the order they were made */
+	for (i = 0; i < TEST49_N_KEYS; i++) {
+		key = g_strdup_printf ("test49-%d", i);
+		expected = g_strdup_printf ("round %d", TEST49_N_ROUNDS - 1);
+		g_assert (catalina_storage_get (storage, key, -1, &buffer, NULL, NULL));
+		g_assert_cmpstr (buffer,==,expected);
+		g_free (buffer);
+		if (i % 2 == 0)
+			g_assert (catalina_storage_remove (storage, 0, key, -1, NULL));
+		g_free (expected);
+		g_free (key);
+	}
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,TEST49_N_KEYS / 2);
+	async_test_complete (test);
+}
+
+static void
+test49 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	gboolean concurrent = FALSE;
+	gchar *key, *data;
+	gint i, j;
+	g_object_set (storage, "concurrent-writes", TRUE, NULL);
+	g_object_get (storage, "concurrent-writes", &concurrent, NULL);
+	g_assert (concurrent);
+	g_assert (catalina_storage_open (storage, ".", "concurrent-tests.db", NULL));
+	for (j = 0; j < TEST49_N_ROUNDS; j++) {
+		for (i = 0; i < TEST49_N_KEYS; i++) {
+			key = g_strdup_printf ("test49-%d", i);
+			data = g_strdup_printf ("round %d", j);
+			catalina_storage_set_async (storage, 0, key, -1, data, -1, test49_cb, test);
+			g_free (data);
+			g_free (key);
+		}
+	}
+	async_test_wait (test);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test50 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	CatalinaSnapshot *snapshot;
+	GError *error = NULL;
+	gchar *buffer = NULL;
+	g_assert (catalina_storage_open (storage, ".", "snapshot-tests.db", NULL));
+	g_assert (catalina_storage_set (storage, 0, "test50-a", -1, "before", -1, NULL));
+	g_assert (catalina_storage_set (storage, 0, "test50-b", -1, "before", -1, NULL));
+	snapshot = catalina_storage_snapshot_new (storage, NULL);
+	g_assert (snapshot);
+	/* the writes made after the snapshot are not seen through it */
+	g_assert (catalina_storage_set (storage, 0, "test50-a", -1, "after", -1, NULL));
+	g_assert (catalina_storage_set (storage, 0, "test50-a", -1, "again", -1, NULL));
+	g_assert (catalina_storage_remove (storage, 0, "test50-b", -1, NULL));
+	g_assert (catalina_storage_set (storage, 0, "test50-c", -1, "after", -1, NULL));
+	g_assert (catalina_snapshot_get (snapshot, "test50-a", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,"before");
+	g_free (buffer);
+	g_assert (catalina_snapshot_get (snapshot, "test50-b", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,"before");
+	g_free (buffer);
+	g_assert (!catalina_snapshot_get (snapshot, "test50-c", -1, &buffer, NULL, &error));
+	g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_NO_SUCH_KEY);
+	g_clear_error (&error);
+	g_assert (catalina_storage_get (storage, "test50-a", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,"again");
+	g_free (buffer);
+	catalina_snapshot_free (snapshot);
+	/* a new snapshot sees the latest writes */
+	snapshot = catalina_storage_snapshot_new (storage, NULL);
+	g_assert (catalina_snapshot_get (snapshot, "test50-c", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,"after");
+	g_free (buffer);
+	g_assert (catalina_storage_close (storage, NULL));
+	/* the snapshot does not outlive the data-store */
+	g_assert (!catalina_snapshot_get (snapshot, "test50-a", -1, &buffer, NULL, &error));
+	g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_STATE);
+	g_clear_error (&error);
+	catalina_snapshot_free (snapshot);
+	g_object_unref (storage);
+}
+
+#define TEST51_N_KEYS 64
+
+static gint test51_succeeded = 0;
+static gint test51_failed = 0;
+
+static void
+test51_writable_cb (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	if (!catalina_storage_wait_writable_finish (CATALINA_STORAGE (object), result, &test->error))
+		async_test_error (test);
+	async_test_complete (test);
+}
+
+static void
+test51_cb (GObject      *object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	GError    *error = NULL;
+	if (catalina_storage_set_finish (CATALINA_STORAGE (object), result, &error))
+		g_atomic_int_inc (&test51_succeeded);
+	else {
+		/* requests beyond the limit fail right away instead of queueing */
+		g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_QUEUE_FULL);
+		g_error_free (error);
+		g_atomic_int_inc (&test51_failed);
+	}
+	if (g_atomic_int_get (&test51_succeeded) + g_atomic_int_get (&test51_failed) == TEST51_N_KEYS)
+		catalina_storage_wait_writable_async (CATALINA_STORAGE (object), test51_writable_cb, test);
+}
+
+static void
+test51 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	guint limit = 0, policy = CATALINA_QUEUE_BLOCK;
+	gchar *key;
+	gint i;
+	g_object_set (storage, "use-idle", FALSE, "queue-limit", 1, NULL);
+	g_object_get (storage, "queue-limit", &limit, "queue-policy", &policy, NULL);
+	g_assert_cmpint (limit,==,1);
+	g_assert_cmpint (policy,==,CATALINA_QUEUE_FAIL);
+	g_assert (catalina_storage_open (storage, ".", "queue-tests.db", NULL));
+	for (i = 0; i < TEST51_N_KEYS; i++) {
+		key = g_strdup_printf ("test51-%d", i);
+		catalina_storage_set_async (storage, 0, key, -1, TEST_DATA, -1, test51_cb, test);
+		g_free (key);
+	}
+	async_test_wait (test);
+	g_assert_cmpint (test51_succeeded,>,0);
+	g_assert_cmpint (test51_succeeded + test51_failed,==,TEST51_N_KEYS);
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,test51_succeeded);
+	/* blocking callers wait for room instead */
+	test = async_test_new ();
+	test51_succeeded = test51_failed = 0;
+	catalina_storage_set_queue_policy (storage, CATALINA_QUEUE_BLOCK);
+	for (i = 0; i < TEST51_N_KEYS; i++) {
+		key = g_strdup_printf ("test51-%d", i);
+		catalina_storage_set_async (storage, 0, key, -1, TEST_DATA, -1, test51_cb, test);
+		g_free (key);
+	}
+	async_test_wait (test);
+	g_assert_cmpint (test51_succeeded,==,TEST51_N_KEYS);
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,TEST51_N_KEYS);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test52_close_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	/* the queued commit is flushed before the close */
+	if (!catalina_storage_close_finish (CATALINA_STORAGE (object), result, &test->error))
+		async_test_error (test);
+	async_test_complete (test);
+}
+
+static void
+test52_set_cb (GObject      *object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	if (!catalina_storage_set_finish (CATALINA_STORAGE (object), result, &test->error))
+		async_test_error (test);
+}
+
+static void
+test52_commit_cb (GObject      *object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	if (!catalina_storage_transaction_commit_finish (CATALINA_STORAGE (object), result, &test->error))
+		async_test_error (test);
+}
+
+static void
+test52_begin_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	CatalinaStorage *storage = CATALINA_STORAGE (object);
+	gulong txn_id = catalina_storage_transaction_begin_finish (storage, result);
+	catalina_storage_set_async (storage, txn_id, "test52", -1, "1", -1, test52_set_cb, user_data);
+	catalina_storage_transaction_commit_async (storage, txn_id, test52_commit_cb, user_data);
+	/* a write made after the commit is applied after it */
+	catalina_storage_set_async (storage, 0, "test52", -1, "2", -1, test52_set_cb, user_data);
+	catalina_storage_close_async (storage, test52_close_cb, user_data);
+}
+
+static void
+test52 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	gchar *buffer = NULL;
+	catalina_storage_set_use_idle (storage, FALSE);
+	catalina_storage_set_group_commit_size (storage, 8);
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	catalina_storage_transaction_begin_async (storage, test52_begin_cb, test);
+	async_test_wait (test);
+	g_object_unref (storage);
+	storage = catalina_storage_new ();
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	g_assert (catalina_storage_get (storage, "test52", -1, &buffer, NULL, NULL));
+	g_assert_cmpstr (buffer,==,"2");
+	g_free (buffer);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test53 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	CatalinaBackend *backend = catalina_memory_backend_new ();
+	CatalinaCursor  *cursor;
+	GArray          *entries = NULL;
+	GError          *error = NULL;
+	catalina_storage_set_backend (storage, backend);
+	g_object_unref (backend);
+	g_assert (catalina_storage_open (storage, ".", "memory-tests.db", NULL));
+	g_assert (catalina_storage_set (storage, 0, "test53-1", -1, TEST_DATA, -1, NULL));
+	g_assert (catalina_storage_set (storage, 0, "test53-2", -1, TEST_DATA, -1, NULL));
+	cursor = catalina_storage_cursor_new (storage, CATALINA_CURSOR_KEYS_ONLY);
+	g_assert (catalina_cursor_next_batch (cursor, 1, &entries, NULL));
+	g_assert_cmpint (entries->len,==,1);
+	/* removing the position does not end the traversal silently */
+	g_assert (catalina_storage_remove (storage, 0,
+	                                   g_array_index (entries, CatalinaStorageEntry, 0).key,
+	                                   -1, NULL));
+	catalina_storage_entries_free (entries);
+	entries = NULL;
+	g_assert (!catalina_cursor_next_batch (cursor, 1, &entries, &error));
+	g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_STATE);
+	g_error_free (error);
+	catalina_cursor_free (cursor);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static gint test54_succeeded = 0;
+static gint test54_failed = 0;
+
+static void
+test54_cb (GObject      *object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	GError    *error = NULL;
+	if (catalina_storage_set_finish (CATALINA_STORAGE (object), result, &error))
+		test54_succeeded++;
+	else {
+		g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_QUEUE_FULL);
+		g_error_free (error);
+		test54_failed++;
+	}
+	if (test54_succeeded + test54_failed == 2)
+		async_test_complete (test);
+}
+
+static void
+test54 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	g_object_set (storage, "use-idle", TRUE, "queue-limit", 1, NULL);
+	g_assert (catalina_storage_open (storage, ".", "queue-tests.db", NULL));
+	catalina_storage_set_async (storage, 0, "test54", -1, TEST_DATA, -1, test54_cb, test);
+	/* written after the request above, whose callback has not run yet */
+	g_assert (catalina_storage_set (storage, 0, "test54", -1, TEST_DATA, -1, NULL));
+	catalina_storage_set_async (storage, 0, "test54-2", -1, TEST_DATA, -1, test54_cb, test);
+	async_test_wait (test);
+	g_assert_cmpint (test54_succeeded,==,1);
+	g_assert_cmpint (test54_failed,==,1);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static gint test55_succeeded = 0;
+static gint test55_failed = 0;
+
+static void
+test55_cb (GObject      *object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+	AsyncTest *test = user_data;
+	GError    *error = NULL;
+	if (catalina_storage_set_value_finish (CATALINA_STORAGE (object), result, &error))
+		test55_succeeded++;
+	else {
+		g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_QUEUE_FULL);
+		g_error_free (error);
+		test55_failed++;
+	}
+	if (test55_succeeded + test55_failed == 2)
+		async_test_complete (test);
+}
+
+static void
+test55 (void)
+{
+	AsyncTest *test = async_test_new ();
+	CatalinaStorage *storage = catalina_storage_new ();
+	gchar *buffer = g_strnfill (256, 'x');
+	GValue v = {0,};
+	g_object_set (storage, "formatter", catalina_binary_formatter_new (),
+	              "use-idle", TRUE, "queue-limit-bytes", (guint64)64, NULL);
+	g_assert (catalina_storage_open (storage, ".", "queue-tests.db", NULL));
+	g_value_init (&v, G_TYPE_STRING);
+	g_value_set_string (&v, buffer);
+	g_free (buffer);
+	catalina_storage_set_value_async (storage, 0, "test55", -1, &v, test55_cb, test);
+	/* written after the request above, which is counted by its serialized size */
+	g_assert (catalina_storage_set (storage, 0, "test55", -1, TEST_DATA, -1, NULL));
+	catalina_storage_set_value_async (storage, 0, "test55-2", -1, &v, test55_cb, test);
+	async_test_wait (test);
+	g_assert_cmpint (test55_succeeded,==,1);
+	g_assert_cmpint (test55_failed,==,1);
+	g_value_unset (&v);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
+static void
+test56 (void)
+{
+	CatalinaStorage *storage = catalina_storage_new ();
+	GError          *error = NULL;
+	gulong           n_keys;
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	n_keys = catalina_storage_count_keys (storage);
+	/* the metadata record is out of reach of binary keys too */
+	g_assert (!catalina_storage_set (storage, 0, "\0catalina-meta", 14, TEST_DATA, -1, &error));
+	g_assert_cmpint (error->code,==,CATALINA_STORAGE_ERROR_NOT_SUPPORTED);
+	g_error_free (error);
+	g_assert (!catalina_storage_get (storage, "\0catalina-meta", 14, NULL, NULL, NULL));
+	g_assert (!catalina_storage_remove (storage, 0, "\0catalina-meta", 14, NULL));
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,n_keys);
+	g_assert (catalina_storage_close (storage, NULL));
+	/* the counters of a cleanly closed data-store are kept */
+	g_assert (catalina_storage_open (storage, ".", "storage-tests.db", NULL));
+	g_assert_cmpint (catalina_storage_count_keys (storage),==,n_keys);
+	g_assert (catalina_storage_close (storage, NULL));
+	g_object_unref (storage);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
@@ -517,9 +1932,13 @@ main (gint   argc,
 	g_test_add_func ("/CatalinaStorage/set_async(1)", test10);
 	g_test_add_func ("/CatalinaStorage/set(1)", test11);
 	g_test_add_func ("/CatalinaStorage/set(2)", test14);
+	g_test_add_func ("/CatalinaStorage/set_take_async(1)", test29);
 	g_test_add_func ("/CatalinaStorage/get_async(1)", test9);
 	g_test_add_func ("/CatalinaStorage/get(1)", test12);
 	g_test_add_func ("/CatalinaStorage/get(2)", test13);
+	g_test_add_func ("/CatalinaStorage/get_many(1)", test25);
+	g_test_add_func ("/CatalinaStorage/get_many_async(1)", test26);
+	g_test_add_func ("/CatalinaStorage/get_with_func(1)", test28);
 	g_test_add_func ("/CatalinaStorage/set_value_async(1)", test16);
 	g_test_add_func ("/CatalinaStorage/get_value_async(1)", test15);
 	g_test_add_func ("/CatalinaStorage/set_value(1)", test17);
@@ -527,9 +1946,37 @@ main (gint   argc,
 	g_test_add_func ("/CatalinaStorage/get_value(1)", test18);
 	g_test_add_func ("/CatalinaStorage/get_value(2)", test20);
 	g_test_add_func ("/CatalinaStorage/count_keys(1)", test21);
+	g_test_add_func ("/CatalinaStorage/count_keys_async(1)", test33);
+	g_test_add_func ("/CatalinaStorage/remove(1)", test34);
+	g_test_add_func ("/CatalinaStorage/cursor(1)", test30);
+	g_test_add_func ("/CatalinaStorage/cursor_async(1)", test31);
+	g_test_add_func ("/CatalinaStorage/foreach_parallel(1)", test32);
 	g_test_add_func ("/CatalinaStorage/transaction_begin(1)", test22);
 	g_test_add_func ("/CatalinaStorage/transaction_commit(1)", test23);
 	g_test_add_func ("/CatalinaStorage/transaction_cancel(1)", test24);
+	g_test_add_func ("/CatalinaStorage/group_commit(1)", test27);
+	g_test_add_func ("/CatalinaStorage/:backend(1)", test35);
+	g_test_add_func ("/CatalinaStorage/:backend(2)", test36);
+	g_test_add_func ("/CatalinaStorage/scan(1)", test37);
+	g_test_add_func ("/CatalinaStorage/:backend(3)", test38);
+	g_test_add_func ("/CatalinaStorage/scan(2)", test39);
+	g_test_add_func ("/CatalinaStorage/index(1)", test40);
+	g_test_add_func ("/CatalinaStorage/lookup_index_async(1)", test41);
+	g_test_add_func ("/CatalinaStorage/:backend(4)", test42);
+	g_test_add_func ("/CatalinaStorage/compact(1)", test43);
+	g_test_add_func ("/CatalinaStorage/durability(1)", test44);
+	g_test_add_func ("/CatalinaStorage/shared(1)", test45);
+	g_test_add_func ("/CatalinaStorage/:transform(2)", test46);
+	g_test_add_func ("/CatalinaStorage/get_value_async(2)", test47);
+	g_test_add_func ("/CatalinaStorage/set_value_async(2)", test48);
+	g_test_add_func ("/CatalinaStorage/concurrent_writes(1)", test49);
+	g_test_add_func ("/CatalinaStorage/snapshot(1)", test50);
+	g_test_add_func ("/CatalinaStorage/queue_limit(1)", test51);
+	g_test_add_func ("/CatalinaStorage/group_commit(2)", test52);
+	g_test_add_func ("/CatalinaStorage/cursor(3)", test53);
+	g_test_add_func ("/CatalinaStorage/queue_limit(2)", test54);
+	g_test_add_func ("/CatalinaStorage/queue_limit(3)", test55);
+	g_test_add_func ("/CatalinaStorage/count_keys(2)", test56);
 
 	return g_test_run ();
 }